@@ -0,0 +1,894 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Thomas Fischer <thomas.fischer@his.se>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "benchmark.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/thread.hpp>
+
+#include "globalobjects.h"
+#include "blockstream.h"
+#include "config.h"
+#include "error.h"
+#include "helper.h"
+#include "shardedloader.h"
+#include "timer.h"
+
+/// Minimum number of lookups per measurement to get stable numbers
+static const size_t minimumLookups = 10000000;
+/// Minimum number of elements to import per measurement
+static const size_t minimumImports = 5000000;
+
+/**
+ * Load a tree mapping node ids to coordinates from the .n2c file
+ * written by GlobalObjectManager and measure how long loading takes
+ * and how much memory the tree occupies. If map data is kept in a
+ * snapshot instead, node2Coord's serialization is loaded from memory.
+ * The returned tree has to be deleted by the caller; it is kept
+ * alive so that memory measurements of subsequently loaded trees
+ * are not distorted by reused heap memory.
+ */
+template <class Tree>
+static Tree *loadCoordTree(const char *label) {
+    const std::string filename = tempdir + "/" + mapname + ".n2c";
+    std::ifstream node2CoordFile(filename);
+    std::stringstream serialized;
+    if (!node2CoordFile.good()) {
+        if (node2Coord == nullptr) {
+            Error::warn("Cannot read '%s' for benchmarking", filename.c_str());
+            return nullptr;
+        }
+        node2Coord->write(serialized);
+    }
+
+    const size_t residentBefore = residentMemory();
+    Timer timer;
+    boost::iostreams::filtering_istream in;
+    if (node2CoordFile.good())
+        BlockStream::pushDecompressor(in, node2CoordFile);
+    else
+        in.push(serialized);
+    Tree *tree = new Tree(in);
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    const size_t residentAfter = residentMemory();
+    Error::info("%s: Spent CPU time to load %d elements: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", label, tree->size(), cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("%s: Resident memory grew by %.1f MiB (%.1f bytes per element)", label, (residentAfter - residentBefore) / 1048576.0, tree->size() > 0 ? (double)(residentAfter - residentBefore) / tree->size() : 0.0);
+
+    return tree;
+}
+
+/**
+ * Measure how fast looking up the given node ids in a tree mapping
+ * node ids to coordinates is, both one by one and batched per way.
+ */
+template <class Tree>
+static void measureCoordLookups(const char *label, const Tree *tree, const std::vector<uint64_t> &nodeIds, const std::vector<size_t> &wayOffsets, int64_t &checksum) {
+    Timer timer;
+    int64_t cputime, walltime;
+    const size_t rounds = (minimumLookups + nodeIds.size() - 1) / nodeIds.size();
+    checksum = 0;
+    size_t misses = 0;
+    timer.start();
+    for (size_t r = 0; r < rounds; ++r)
+        for (const uint64_t id : nodeIds) {
+            Coord coord;
+            if (tree->retrieve(id, coord))
+                checksum += coord.x ^ coord.y;
+            else
+                ++misses;
+        }
+    timer.elapsed(&cputime, &walltime);
+    const size_t lookups = rounds * nodeIds.size();
+    Error::info("%s: Spent CPU time for %d lookups: %.1fms == %.1fs  (wall time: %.1fms == %.1fs), %.1fns per lookup, %d misses", label, lookups, cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0, cputime * 1000.0 / lookups, misses);
+
+    size_t longestWay = 0;
+    for (size_t w = 0; w + 1 < wayOffsets.size(); ++w)
+        longestWay = std::max(longestWay, wayOffsets[w + 1] - wayOffsets[w]);
+    std::vector<Coord> coords(longestWay);
+    bool *found = (bool *)calloc(longestWay, sizeof(bool));
+    int64_t batchedChecksum = 0;
+    timer.start();
+    for (size_t r = 0; r < rounds; ++r)
+        for (size_t w = 0; w + 1 < wayOffsets.size(); ++w) {
+            const size_t count = wayOffsets[w + 1] - wayOffsets[w];
+            tree->retrieveMany(nodeIds.data() + wayOffsets[w], count, coords.data(), found);
+            for (size_t i = 0; i < count; ++i)
+                if (found[i])
+                    batchedChecksum += coords[i].x ^ coords[i].y;
+        }
+    timer.elapsed(&cputime, &walltime);
+    free(found);
+    Error::info("%s: Spent CPU time for %d lookups batched per way: %.1fms == %.1fs  (wall time: %.1fms == %.1fs), %.1fns per lookup", label, lookups, cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0, cputime * 1000.0 / lookups);
+    if (batchedChecksum != checksum)
+        Error::warn("%s: Batched lookups disagree with single lookups: checksum %lld != %lld", label, batchedChecksum, checksum);
+}
+
+/**
+ * Build trees mapping node ids to coordinates from elements given in
+ * ascending id order, as when importing an .osm.pbf file, once by
+ * inserting element by element and once using the tree's BulkLoader,
+ * and compare the time taken.
+ */
+template <class Tree>
+static void measureCoordImport(const char *label, const std::vector<uint64_t> &nodeIds, const std::vector<Coord> &coords) {
+    const size_t rounds = (minimumImports + nodeIds.size() - 1) / nodeIds.size();
+    int64_t insertCputime = 0, bulkCputime = 0;
+    for (size_t r = 0; r < rounds; ++r) {
+        int64_t cputime;
+        Tree *tree = new Tree();
+        Timer timer;
+        for (size_t i = 0; i < nodeIds.size(); ++i)
+            tree->insert(nodeIds[i], coords[i]);
+        timer.elapsed(&cputime);
+        insertCputime += cputime;
+        delete tree;
+
+        tree = new Tree();
+        timer.start();
+        {
+            typename Tree::BulkLoader loader(*tree);
+            for (size_t i = 0; i < nodeIds.size(); ++i)
+                loader.append(nodeIds[i], coords[i]);
+        }
+        timer.elapsed(&cputime);
+        bulkCputime += cputime;
+        if (tree->size() != nodeIds.size())
+            Error::warn("%s: Bulk loading resulted in %d instead of %d elements", label, tree->size(), nodeIds.size());
+        delete tree;
+    }
+
+    const size_t elements = rounds * nodeIds.size();
+    Error::info("%s: Spent CPU time to insert %d elements: %.1fms == %.1fs, %.1fns per element", label, elements, insertCputime / 1000.0, insertCputime / 1000000.0, insertCputime * 1000.0 / elements);
+    Error::info("%s: Spent CPU time to bulk load %d elements: %.1fms == %.1fs, %.1fns per element", label, elements, bulkCputime / 1000.0, bulkCputime / 1000000.0, bulkCputime * 1000.0 / elements);
+}
+
+/**
+ * Build a tree from the given elements, once with a single thread
+ * using the tree's BulkLoader and then with an increasing number of
+ * threads using a ShardedLoader, and compare the wall time taken.
+ * Elements are handed out to threads in blocks of consecutive ids.
+ */
+template <class Tree, class T>
+static void measureShardedImport(const char *label, const std::vector<uint64_t> &ids, const std::vector<const T *> &values) {
+    static const size_t blockSize = 8000; ///< typical number of elements in an .osm.pbf block
+    const size_t numBlocks = (ids.size() + blockSize - 1) / blockSize;
+    const unsigned int maxThreads = std::max(2u, boost::thread::hardware_concurrency());
+
+    int64_t cputime, walltime;
+    Tree *tree = new Tree();
+    Timer timer;
+    {
+        typename Tree::BulkLoader loader(*tree);
+        for (size_t i = 0; i < ids.size(); ++i)
+            loader.append(ids[i], *values[i]);
+    }
+    timer.elapsed(&cputime, &walltime);
+    Error::info("%s: Single thread with BulkLoader: %d elements in wall time %.1fms == %.1fs", label, tree->size(), walltime / 1000.0, walltime / 1000000.0);
+    delete tree;
+
+    for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+        tree = new Tree();
+        timer.start();
+        int64_t mergeWalltime;
+        {
+            ShardedLoader<Tree, T> loader(*tree, numThreads);
+            boost::thread_group threads;
+            for (unsigned int t = 0; t < numThreads; ++t)
+                threads.create_thread([&, t]() {
+                    for (size_t b = t; b < numBlocks; b += numThreads)
+                        for (size_t i = b * blockSize; i < ids.size() && i < (b + 1) * blockSize; ++i)
+                            loader.insert(t, ids[i], *values[i]);
+                });
+            threads.join_all();
+            Timer mergeTimer;
+            loader.finish();
+            mergeTimer.elapsed(&cputime, &mergeWalltime);
+        }
+        timer.elapsed(&cputime, &walltime);
+        Error::info("%s: %d thread(s) with ShardedLoader: %d elements in wall time %.1fms == %.1fs, of which %.1fms merging shards", label, numThreads, tree->size(), walltime / 1000.0, walltime / 1000000.0, mergeWalltime / 1000.0);
+        if (tree->size() != ids.size())
+            Error::warn("%s: Sharded loading resulted in %d instead of %d elements", label, tree->size(), ids.size());
+        delete tree;
+    }
+}
+
+/**
+ * Retrieve the given ids from a tree with different sizes of its
+ * lookup cache and report time per lookup and hit rate for each size.
+ * Afterwards, the tree's cache has its original size again.
+ */
+template <class Tree, class T>
+static void measureCacheSizes(const char *label, Tree *tree, const std::vector<uint64_t> &ids) {
+    if (tree == nullptr || ids.empty()) return;
+
+    const size_t originalSize = tree->cacheStatistics().capacity;
+    const size_t rounds = (minimumLookups + ids.size() - 1) / ids.size();
+    for (const size_t cacheSize : {0, 256, 1024, 4096, 16384, 65536}) {
+        tree->setCacheSize(cacheSize);
+        const LookupCacheStatistics before = tree->cacheStatistics();
+        size_t found = 0;
+        Timer timer;
+        for (size_t r = 0; r < rounds; ++r)
+            for (const uint64_t id : ids) {
+                T data;
+                if (tree->retrieve(id, data))
+                    ++found;
+            }
+        int64_t cputime;
+        timer.elapsed(&cputime);
+        const LookupCacheStatistics after = tree->cacheStatistics();
+        const size_t hits = after.hits - before.hits, misses = after.misses - before.misses;
+        const size_t lookups = rounds * ids.size();
+        Error::info("%s: Cache with %d entries: %.1fns per lookup, hit rate %.1f%%, %d of %d found", label, tree->cacheStatistics().capacity, cputime * 1000.0 / lookups, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0, found, lookups);
+    }
+    tree->setCacheSize(originalSize);
+}
+
+/**
+ * Retrieve the given ids from a tree and report the time per lookup.
+ * @return number of lookups where the id was found
+ */
+template <class Tree, class T>
+static size_t measureLookups(const std::string &label, const Tree *tree, const std::vector<uint64_t> &ids) {
+    if (tree == nullptr || ids.empty()) return 0;
+
+    const size_t rounds = (minimumLookups + ids.size() - 1) / ids.size();
+    size_t found = 0;
+    Timer timer;
+    for (size_t r = 0; r < rounds; ++r)
+        for (const uint64_t id : ids) {
+            T data;
+            if (tree->retrieve(id, data))
+                ++found;
+        }
+    int64_t cputime;
+    timer.elapsed(&cputime);
+    const size_t lookups = rounds * ids.size();
+    Error::info("%s: %.1fns per lookup, %d of %d found", label.c_str(), cputime * 1000.0 / lookups, found, lookups);
+    return found;
+}
+
+/**
+ * Copy a tree as loaded from file, then measure memory consumption
+ * and lookup speed of the copy before and after freezing it.
+ */
+template <class Tree, class T>
+static void measureFrozen(const char *label, Tree *tree, const std::vector<uint64_t> &ids) {
+    if (tree == nullptr || ids.empty()) return;
+
+    std::stringstream serialized;
+    tree->write(serialized);
+    Tree copy(serialized);
+    const std::string trieLabel = std::string(label) + ", trie";
+    Error::info("%s: Memory in use: %.1f MiB (%.1f bytes per element)", trieLabel.c_str(), copy.memoryUsage() / 1048576.0, copy.size() > 0 ? (double)copy.memoryUsage() / copy.size() : 0.0);
+    const size_t foundTrie = measureLookups<Tree, T>(trieLabel, &copy, ids);
+
+    Timer timer;
+    copy.freeze();
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    const std::string frozenLabel = std::string(label) + ", frozen";
+    Error::info("%s: Spent CPU time to freeze: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", frozenLabel.c_str(), cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("%s: Memory in use: %.1f MiB (%.1f bytes per element)", frozenLabel.c_str(), copy.memoryUsage() / 1048576.0, copy.size() > 0 ? (double)copy.memoryUsage() / copy.size() : 0.0);
+    const size_t foundFrozen = measureLookups<Tree, T>(frozenLabel, &copy, ids);
+    if (foundTrie != foundFrozen)
+        Error::warn("%s: Frozen tree found %d instead of %d elements", label, foundFrozen, foundTrie);
+}
+
+/**
+ * Look up each given way's nodes and name as well as each given node's
+ * coordinates and combine all results into a single checksum.
+ */
+static uint64_t lookupChecksum(const IdTree<WayNodes, IdTreeLeanPolicy> &ways, const NameTree &names, const PagedIdTree<Coord> &coords, const std::vector<uint64_t> &wayIds, const std::vector<uint64_t> &nodeIds) {
+    uint64_t checksum = 0;
+    for (const uint64_t wayId : wayIds) {
+        WayNodes wn;
+        if (ways.retrieve(wayId, wn))
+            for (uint32_t i = 0; i < wn.num_nodes; ++i)
+                checksum = checksum * 31 + wn.nodes[i];
+        const char *name = names.retrieve(wayId);
+        if (name != nullptr)
+            for (const char *c = name; *c != '\0'; ++c)
+                checksum = checksum * 131 + (unsigned char)*c;
+    }
+    for (const uint64_t nodeId : nodeIds) {
+        Coord coord;
+        if (coords.retrieve(nodeId, coord))
+            checksum = checksum * 17 + ((uint64_t)coord.x << 32) + coord.y;
+    }
+    return checksum;
+}
+
+/**
+ * Let several threads repeat the same lookups concurrently, see
+ * lookupChecksum(..), and count the rounds giving a different
+ * result than a single thread did before.
+ * @return number of rounds with a wrong checksum over all threads
+ */
+static size_t concurrentMismatches(const IdTree<WayNodes, IdTreeLeanPolicy> &ways, const NameTree &names, const PagedIdTree<Coord> &coords, const std::vector<uint64_t> &wayIds, const std::vector<uint64_t> &nodeIds, const unsigned int numThreads, const size_t rounds) {
+    const uint64_t expectedChecksum = lookupChecksum(ways, names, coords, wayIds, nodeIds);
+    boost::atomic<size_t> mismatches(0);
+    boost::thread_group threads;
+    for (unsigned int t = 0; t < numThreads; ++t)
+        threads.create_thread([&]() {
+            for (size_t r = 0; r < rounds; ++r)
+                if (lookupChecksum(ways, names, coords, wayIds, nodeIds) != expectedChecksum)
+                    mismatches.fetch_add(1, boost::memory_order_relaxed);
+        });
+    threads.join_all();
+    return mismatches.load();
+}
+
+void Benchmark::run() {
+    Error::info("Running benchmarks");
+    node2CoordBackends();
+    node2CoordImport();
+    shardedImport();
+    nameStorage();
+    frozenTrees();
+    lookupCacheSizes();
+    concurrentReaders();
+    versionedUpdates();
+    fileCodecs();
+}
+
+void Benchmark::node2CoordBackends() {
+    std::vector<size_t> wayOffsets;
+    const std::vector<uint64_t> nodeIds = roadNodeIds(&wayOffsets);
+    if (nodeIds.empty()) {
+        Error::warn("No road nodes found, skipping benchmark for node2Coord");
+        return;
+    }
+    Error::info("Benchmarking node2Coord backends with %d road nodes", nodeIds.size());
+
+    int64_t checksumPaged = 0, checksumCompressed = 0, checksumTrie = 0;
+    PagedIdTree<Coord> *paged = loadCoordTree<PagedIdTree<Coord> >("PagedIdTree<Coord>");
+    if (paged != nullptr) {
+        Error::info("PagedIdTree<Coord>: Memory in use: %.1f MiB (%.1f bytes per element)", paged->memoryUsage() / 1048576.0, paged->size() > 0 ? (double)paged->memoryUsage() / paged->size() : 0.0);
+        measureCoordLookups("PagedIdTree<Coord>", paged, nodeIds, wayOffsets, checksumPaged);
+    }
+    PagedIdTree<Coord> *compressed = loadCoordTree<PagedIdTree<Coord> >("PagedIdTree<Coord>, compressed");
+    if (compressed != nullptr) {
+        Timer timer;
+        compressed->compress();
+        int64_t cputime, walltime;
+        timer.elapsed(&cputime, &walltime);
+        Error::info("PagedIdTree<Coord>, compressed: Spent CPU time to compress: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+        Error::info("PagedIdTree<Coord>, compressed: Memory in use: %.1f MiB (%.1f bytes per element)", compressed->memoryUsage() / 1048576.0, compressed->size() > 0 ? (double)compressed->memoryUsage() / compressed->size() : 0.0);
+        measureCoordLookups("PagedIdTree<Coord>, compressed", compressed, nodeIds, wayOffsets, checksumCompressed);
+    }
+    IdTree<Coord> *trie = loadCoordTree<IdTree<Coord> >("IdTree<Coord>");
+    if (trie != nullptr)
+        measureCoordLookups("IdTree<Coord>", trie, nodeIds, wayOffsets, checksumTrie);
+    if (paged != nullptr && trie != nullptr && checksumPaged != checksumTrie)
+        Error::warn("Backends disagree on looked up coordinates: checksum %lld != %lld", checksumPaged, checksumTrie);
+    if (paged != nullptr && compressed != nullptr && checksumPaged != checksumCompressed)
+        Error::warn("Compressed backend disagrees on looked up coordinates: checksum %lld != %lld", checksumPaged, checksumCompressed);
+
+    if (paged != nullptr) delete paged;
+    if (compressed != nullptr) delete compressed;
+    if (trie != nullptr) delete trie;
+}
+
+void Benchmark::node2CoordImport() {
+    std::vector<uint64_t> nodeIds = roadNodeIds();
+    std::sort(nodeIds.begin(), nodeIds.end());
+    nodeIds.erase(std::unique(nodeIds.begin(), nodeIds.end()), nodeIds.end());
+    std::vector<Coord> coords;
+    coords.reserve(nodeIds.size());
+    for (const uint64_t id : nodeIds) {
+        Coord coord;
+        node2Coord->retrieve(id, coord);
+        coords.push_back(coord);
+    }
+    if (nodeIds.empty()) {
+        Error::warn("No road nodes found, skipping benchmark for importing node2Coord");
+        return;
+    }
+    Error::info("Benchmarking import of node2Coord with %d road nodes in ascending order", nodeIds.size());
+
+    measureCoordImport<PagedIdTree<Coord> >("PagedIdTree<Coord>", nodeIds, coords);
+    measureCoordImport<IdTree<Coord> >("IdTree<Coord>", nodeIds, coords);
+}
+
+void Benchmark::shardedImport() {
+    std::vector<uint64_t> ids;
+    std::vector<Coord> coords;
+    node2Coord->forEach([&ids, &coords](const uint64_t id, const Coord &coord) {
+        ids.push_back(id);
+        coords.push_back(coord);
+    });
+    if (!ids.empty()) {
+        Error::info("Benchmarking sharded import of %d nodes' coordinates", ids.size());
+        std::vector<const Coord *> values;
+        values.reserve(coords.size());
+        for (const Coord &coord : coords)
+            values.push_back(&coord);
+        measureShardedImport<PagedIdTree<Coord>, Coord>("PagedIdTree<Coord>", ids, values);
+    }
+
+    ids.clear();
+    std::vector<const WayNodes *> ways;
+    wayNodes->forEach([&ids, &ways](const uint64_t id, const WayNodes &wn) {
+        ids.push_back(id);
+        ways.push_back(&wn);
+    });
+    if (!ids.empty()) {
+        Error::info("Benchmarking sharded import of %d ways' nodes", ids.size());
+        measureShardedImport<IdTree<WayNodes, IdTreeLeanPolicy>, WayNodes>("IdTree<WayNodes>", ids, ways);
+    }
+}
+
+/**
+ * Load names from a serialized tree and report the time needed
+ * and how much memory the loaded tree occupies.
+ * The returned tree has to be deleted by the caller.
+ */
+template <class Tree>
+static Tree *loadNameTree(const char *label, const std::string &serialized) {
+    std::istringstream input(serialized);
+    const size_t residentBefore = residentMemory();
+    Timer timer;
+    Tree *tree = new Tree(input);
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    const size_t residentAfter = residentMemory();
+    Error::info("%s: Spent CPU time to load %d names: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", label, tree->size(), cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("%s: Resident memory grew by %.1f MiB (%.1f bytes per name)", label, (residentAfter - residentBefore) / 1048576.0, tree->size() > 0 ? (double)(residentAfter - residentBefore) / tree->size() : 0.0);
+
+    return tree;
+}
+
+void Benchmark::nameStorage() {
+    for (const auto &names : {std::make_pair("wayNames", wayNames), std::make_pair("nodeNames", nodeNames)}) {
+        if (names.second == nullptr || names.second->size() == 0) continue;
+        Error::info("Benchmarking storage of %s with %d names", names.first, names.second->size());
+
+        /// Serialize names both as NameTree and in the
+        /// format of IdTree<WriteableString> as used before
+        std::ostringstream pooled, legacy;
+        names.second->write(pooled);
+        {
+            IdTree<WriteableString, IdTreeLeanPolicy> legacyTree;
+            names.second->forEach([&legacyTree](const uint64_t id, const char *name) {
+                legacyTree.insert(id, WriteableString(name));
+            });
+            legacyTree.write(legacy);
+        }
+
+        IdTree<WriteableString, IdTreeLeanPolicy> *stringTree = loadNameTree<IdTree<WriteableString, IdTreeLeanPolicy> >("IdTree<WriteableString>", legacy.str());
+        NameTree *convertedTree = loadNameTree<NameTree>("NameTree from IdTree<WriteableString> format", legacy.str());
+        NameTree *nameTree = loadNameTree<NameTree>("NameTree", pooled.str());
+        Error::info("NameTree: Pool and offsets occupy %.1f MiB (%.1f bytes per name)", nameTree->memoryUsage() / 1048576.0, nameTree->size() > 0 ? (double)nameTree->memoryUsage() / nameTree->size() : 0.0);
+        delete stringTree;
+        delete convertedTree;
+        delete nameTree;
+    }
+}
+
+void Benchmark::frozenTrees() {
+    const std::vector<uint64_t> wayIds = roadWayIds();
+    if (wayIds.empty()) {
+        Error::warn("No roads found, skipping benchmark for frozen trees");
+        return;
+    }
+    std::vector<uint64_t> relationIds;
+    if (relMembers != nullptr)
+        relMembers->forEach([&relationIds](const uint64_t id, const RelationMem &) {
+            relationIds.push_back(id);
+        });
+    Error::info("Benchmarking frozen trees with %d road ways and %d relations", wayIds.size(), relationIds.size());
+
+    measureFrozen<IdTree<WayNodes, IdTreeLeanPolicy>, WayNodes>("wayNodes", wayNodes, wayIds);
+    measureFrozen<IdTree<RelationMem, IdTreeLeanPolicy>, RelationMem>("relMembers", relMembers, relationIds);
+    measureFrozen<NameTree, std::string>("wayNames", wayNames, wayIds);
+    measureFrozen<NameTree, std::string>("relationNames", relationNames, relationIds);
+}
+
+void Benchmark::lookupCacheSizes() {
+    const std::vector<uint64_t> wayIds = roadWayIds();
+    const std::vector<uint64_t> nodeIds = roadNodeIds();
+    if (wayIds.empty()) {
+        Error::warn("No roads found, skipping benchmark for lookup caches");
+        return;
+    }
+    Error::info("Benchmarking lookup cache sizes with %d road ways and %d road nodes", wayIds.size(), nodeIds.size());
+
+    measureCacheSizes<PagedIdTree<Coord>, Coord>("node2Coord", node2Coord, nodeIds);
+    measureCacheSizes<IdTree<WayNodes, IdTreeLeanPolicy>, WayNodes>("wayNodes", wayNodes, wayIds);
+    measureCacheSizes<NameTree, std::string>("wayNames", wayNames, wayIds);
+}
+
+void Benchmark::concurrentReaders() {
+    const std::vector<uint64_t> wayIds = roadWayIds();
+    const std::vector<uint64_t> nodeIds = roadNodeIds();
+    if (wayIds.empty()) {
+        Error::warn("No roads found, skipping benchmark for concurrent readers");
+        return;
+    }
+
+    const size_t lookupsPerRound = 2 * wayIds.size() + nodeIds.size();
+    const size_t rounds = (minimumLookups + lookupsPerRound - 1) / lookupsPerRound;
+    const unsigned int maxThreads = std::max(2u, boost::thread::hardware_concurrency());
+
+    for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+        Timer timer;
+        const size_t mismatches = concurrentMismatches(*wayNodes, *wayNames, *node2Coord, wayIds, nodeIds, numThreads, rounds);
+        int64_t cputime, walltime;
+        timer.elapsed(&cputime, &walltime);
+        const size_t lookups = numThreads * rounds * lookupsPerRound;
+        Error::info("%d reader thread(s): %d lookups in wall time %.1fms == %.1fs, %.1f million lookups per second", numThreads, lookups, walltime / 1000.0, walltime / 1000000.0, walltime > 0 ? (double)lookups / walltime : 0.0);
+        if (mismatches > 0)
+            Error::err("%d reader thread(s): %d of %d rounds returned wrong results", numThreads, mismatches, numThreads * rounds);
+    }
+}
+
+bool Benchmark::checkConcurrentReaders() {
+    /// Synthetic data resembling map data: ascending node ids with
+    /// gaps, each way referring to a few of them, and most ways named
+    static const size_t numNodes = 200000, numWays = 20000;
+    PagedIdTree<Coord> coords;
+    std::vector<uint64_t> nodeIds;
+    nodeIds.reserve(numNodes);
+    uint64_t id = 0;
+    for (size_t i = 0; i < numNodes; ++i) {
+        id += 1 + i % 7;
+        coords.insert(id, Coord((int)(i * 13 % 100003), (int)(i * 29 % 100019)));
+        nodeIds.push_back(id);
+    }
+    IdTree<WayNodes, IdTreeLeanPolicy> ways;
+    NameTree names;
+    std::vector<uint64_t> wayIds;
+    wayIds.reserve(numWays * 2);
+    for (size_t w = 0; w < numWays; ++w) {
+        const uint64_t wayId = 1000 + w * 3;
+        WayNodes wn(2 + w % 9);
+        for (uint32_t i = 0; i < wn.num_nodes; ++i)
+            wn.nodes[i] = nodeIds[(w * 7 + i * 101) % numNodes];
+        ways.insert(wayId, wn);
+        if (w % 4 != 0)
+            names.insert(wayId, "Way " + std::to_string(w % 5000));
+        wayIds.push_back(wayId);
+        if (w % 3 == 0)
+            /// Looking up an id again right away hits the caches
+            wayIds.push_back(wayId);
+    }
+    coords.setCacheSize(1024);
+    ways.setCacheSize(1024);
+    names.setCacheSize(1024);
+
+    const unsigned int numThreads = std::max(4u, boost::thread::hardware_concurrency());
+    static const size_t rounds = 20;
+    bool result = true;
+    for (const bool frozen : {false, true}) {
+        if (frozen) {
+            ways.freeze();
+            names.freeze();
+        }
+        const size_t mismatches = concurrentMismatches(ways, names, coords, wayIds, nodeIds, numThreads, rounds);
+        if (mismatches > 0) {
+            Error::warn("%d reader threads on %s trees: %d of %d rounds returned wrong results", numThreads, frozen ? "frozen" : "modifiable", mismatches, numThreads * rounds);
+            result = false;
+        } else
+            Error::info("%d reader threads on %s trees: all %d rounds returned correct results", numThreads, frozen ? "frozen" : "modifiable", numThreads * rounds);
+    }
+    return result;
+}
+
+typedef IdTree<Coord, IdTreeLeanPolicy> VersionedTree;
+
+/**
+ * Compare a tree with the elements it is expected to hold, see
+ * checkVersionedUpdates(). Ids in 'absent' must not be found.
+ * @return true if size, lookups, and visited elements all match
+ */
+static bool expectElements(const VersionedTree &tree, const std::map<uint64_t, Coord> &expected, const std::vector<uint64_t> &absent, const char *step) {
+    bool result = true;
+    if (tree.size() != expected.size()) {
+        Error::warn("%s: Tree has %d elements, expected %d", step, tree.size(), expected.size());
+        result = false;
+    }
+    for (const auto &element : expected) {
+        Coord c;
+        if (!tree.retrieve(element.first, c) || !(c == element.second)) {
+            Error::warn("%s: Element %llu missing or with wrong data", step, element.first);
+            result = false;
+        }
+    }
+    for (const uint64_t id : absent) {
+        Coord c;
+        if (tree.retrieve(id, c) || tree.view(id) != nullptr) {
+            Error::warn("%s: Element %llu found, expected it to be absent", step, id);
+            result = false;
+        }
+    }
+    std::map<uint64_t, Coord> visited;
+    size_t visits = 0;
+    tree.forEach([&visited, &visits](const uint64_t id, const Coord &c) {
+        visited[id] = c;
+        ++visits;
+    });
+    if (visits != expected.size() || visited != expected) {
+        Error::warn("%s: Visited %d elements, expected %d elements", step, visits, expected.size());
+        result = false;
+    }
+    return result;
+}
+
+/**
+ * Apply the same sequence of updates to a trie or a frozen tree,
+ * see checkVersionedUpdates().
+ * @return true if all checks passed
+ */
+static bool checkUpdates(const bool frozen) {
+    const char *kind = frozen ? "frozen tree" : "trie";
+    bool result = true;
+    VersionedTree tree;
+    std::map<uint64_t, Coord> expected;
+    for (uint64_t id = 10; id <= 10000; id += 10) {
+        tree.insert(id, Coord((int)id, -(int)id));
+        expected[id] = Coord((int)id, -(int)id);
+    }
+    if (frozen)
+        tree.freeze();
+    result &= expectElements(tree, expected, {5, 10005}, kind);
+
+    /// Nothing is visible before commit(), everything after it
+    {
+        VersionedTree::Update update(tree);
+        update.insert(15, Coord(15, 15)); ///< new
+        update.insert(20, Coord(20, 20)); ///< overwritten
+        update.remove(30);
+        if (update.remove(35)) {
+            Error::warn("%s: Removed element that never existed", kind);
+            result = false;
+        }
+        result &= expectElements(tree, expected, {15}, frozen ? "Uncommitted update of frozen tree" : "Uncommitted update of trie");
+        update.commit();
+        expected[15] = Coord(15, 15);
+        expected[20] = Coord(20, 20);
+        expected.erase(30);
+        result &= expectElements(tree, expected, {30, 35}, frozen ? "Committed update of frozen tree" : "Committed update of trie");
+
+        /// Modifications after a commit() get committed when deleting the update
+        update.insert(30, Coord(3, 3)); ///< re-inserting removed id
+        update.remove(15); ///< inserted by this update
+        update.remove(40);
+    }
+    expected[30] = Coord(3, 3);
+    expected.erase(15);
+    expected.erase(40);
+    result &= expectElements(tree, expected, {15, 40}, frozen ? "Second update of frozen tree" : "Second update of trie");
+
+    /// Removing an element again, then inserting it anew
+    {
+        VersionedTree::Update update(tree);
+        update.remove(30);
+        update.remove(50);
+        update.commit();
+        update.insert(50, Coord(5, 5));
+    }
+    expected.erase(30);
+    expected[50] = Coord(5, 5);
+    result &= expectElements(tree, expected, {30}, frozen ? "Third update of frozen tree" : "Third update of trie");
+
+    /// Versions read under a guard must not be reclaimed
+    {
+        const VersionedTree::ReadGuard guard(tree);
+        const Coord *before = tree.view(20);
+        {
+            VersionedTree::Update update(tree);
+            update.insert(20, Coord(2, 2));
+            update.remove(60);
+        }
+        expected[20] = Coord(2, 2);
+        expected.erase(60);
+        if (tree.reclaimVersions() != 0) {
+            Error::warn("%s: Reclaimed old versions while a reader held a guard", kind);
+            result = false;
+        }
+        if (before == nullptr || !(*before == Coord(20, 20))) {
+            Error::warn("%s: Element of old version changed while a reader held a guard", kind);
+            result = false;
+        }
+        result &= expectElements(tree, expected, {60}, frozen ? "Update of frozen tree under guard" : "Update of trie under guard");
+    }
+    if (tree.reclaimVersions() == 0) {
+        Error::warn("%s: Nothing reclaimed after readers finished", kind);
+        result = false;
+    }
+
+    /// Freezing merges all updates, after which updates work as before
+    tree.freeze();
+    result &= expectElements(tree, expected, {15, 30, 40, 60}, frozen ? "Frozen tree frozen again" : "Updated trie frozen");
+    {
+        VersionedTree::Update update(tree);
+        update.insert(60, Coord(6, 6));
+        update.remove(70);
+    }
+    expected[60] = Coord(6, 6);
+    expected.erase(70);
+    result &= expectElements(tree, expected, {70}, frozen ? "Update of frozen tree frozen again" : "Update of updated trie frozen");
+
+    if (result)
+        Error::info("Updates of %s returned correct results", kind);
+    return result;
+}
+
+bool Benchmark::checkVersionedUpdates() {
+    bool result = true;
+    for (const bool frozen : {false, true})
+        result &= checkUpdates(frozen);
+    return result;
+}
+
+void Benchmark::versionedUpdates() {
+    const std::vector<uint64_t> wayIds = roadWayIds();
+    if (wayIds.empty()) {
+        Error::warn("No roads found, skipping benchmark for versioned updates");
+        return;
+    }
+
+    /// Work on a copy as a trie, as wayNodes may be frozen
+    std::stringstream serialized;
+    wayNodes->write(serialized);
+    IdTree<WayNodes, IdTreeLeanPolicy> tree(serialized);
+    /// Updates write back unchanged data, so readers
+    /// can check what they get against this
+    std::vector<uint64_t> expectedFirstNode(wayIds.size(), 0);
+    for (size_t i = 0; i < wayIds.size(); ++i) {
+        const WayNodes *wn = tree.view(wayIds[i]);
+        if (wn != nullptr) expectedFirstNode[i] = wn->nodes[0];
+    }
+    Error::info("Benchmarking versioned updates of %d ways with %d road ways", tree.size(), wayIds.size());
+
+    static const size_t waysPerUpdate = 100;
+    const unsigned int numReaders = std::max(2u, boost::thread::hardware_concurrency());
+    const size_t rounds = (minimumLookups + numReaders * wayIds.size() - 1) / (numReaders * wayIds.size());
+    const size_t memoryBefore = tree.memoryUsage();
+    for (const bool withWriter : {false, true}) {
+        boost::atomic<size_t> readersDone(0), mismatches(0);
+        Timer timer;
+        boost::thread_group threads;
+        for (unsigned int t = 0; t < numReaders; ++t)
+            threads.create_thread([&]() {
+                for (size_t r = 0; r < rounds; ++r)
+                    for (size_t i = 0; i < wayIds.size(); ++i) {
+                        const IdTree<WayNodes, IdTreeLeanPolicy>::ReadGuard guard(tree);
+                        WayNodes wn;
+                        if (tree.retrieve(wayIds[i], wn) ? wn.nodes[0] != expectedFirstNode[i] : expectedFirstNode[i] != 0)
+                            mismatches.fetch_add(1, boost::memory_order_relaxed);
+                    }
+                readersDone.fetch_add(1, boost::memory_order_relaxed);
+            });
+
+        size_t updates = 0;
+        int64_t updateCputime = 0;
+        if (withWriter) {
+            size_t next = 0;
+            while (readersDone.load(boost::memory_order_relaxed) < numReaders) {
+                Timer updateTimer;
+                {
+                    IdTree<WayNodes, IdTreeLeanPolicy>::Update update(tree);
+                    for (size_t k = 0; k < waysPerUpdate; ++k, next = (next + 1) % wayIds.size()) {
+                        const WayNodes *wn = tree.view(wayIds[next]);
+                        if (wn != nullptr)
+                            update.insert(wayIds[next], WayNodes(*wn));
+                    }
+                }
+                int64_t cputime;
+                updateTimer.elapsed(&cputime);
+                updateCputime += cputime;
+                ++updates;
+            }
+        }
+        threads.join_all();
+        int64_t cputime, walltime;
+        timer.elapsed(&cputime, &walltime);
+        const size_t lookups = numReaders * rounds * wayIds.size();
+        const char *label = withWriter ? "with writer" : "without writer";
+        Error::info("%d reader thread(s) %s: %d lookups in wall time %.1fms == %.1fs, %.1f million lookups per second", numReaders, label, lookups, walltime / 1000.0, walltime / 1000000.0, walltime > 0 ? (double)lookups / walltime : 0.0);
+        if (updates > 0)
+            Error::info("Writer committed %d updates of %d ways each, CPU time %.3fms per update", updates, waysPerUpdate, updateCputime / 1000.0 / updates);
+        if (mismatches.load() > 0)
+            Error::warn("%d reader thread(s) %s: %d lookups returned wrong results", numReaders, label, mismatches.load());
+    }
+    const size_t memoryUpdated = tree.memoryUsage();
+    const size_t reclaimed = tree.reclaimVersions();
+    Error::info("Memory used by tree before updates: %.1f MiB, after updates: %.1f MiB; %d nodes and leaves of old versions reclaimed after readers finished", memoryBefore / 1048576.0, memoryUpdated / 1048576.0, reclaimed);
+}
+
+/**
+ * Compress a data structure's serialization with each codec and
+ * load the structure from the compressed data, see fileCodecs().
+ */
+template <class Structure>
+static void measureCodecs(const char *label, Structure *structure) {
+    if (structure == nullptr) return;
+    std::ostringstream serialization;
+    structure->write(serialization);
+    const std::string data = serialization.str();
+    const double megabytes = data.size() / 1048576.0;
+
+    for (const BlockStream::Codec codec : {BlockStream::NoCodec, BlockStream::GzipCodec, BlockStream::Lz4Codec, BlockStream::ZstdCodec}) {
+        std::ostringstream compressed;
+        Timer timer;
+        {
+            boost::iostreams::filtering_ostream out;
+            BlockStream::pushCompressor(out, compressed, codec);
+            out.write(data.data(), data.size());
+        }
+        int64_t cputime, writeWalltime, loadWalltime;
+        timer.elapsed(&cputime, &writeWalltime);
+
+        std::istringstream input(compressed.str());
+        timer.start();
+        Structure *loaded = nullptr;
+        {
+            boost::iostreams::filtering_istream in;
+            BlockStream::pushDecompressor(in, input);
+            loaded = new Structure(in);
+        }
+        timer.elapsed(&cputime, &loadWalltime);
+        delete loaded;
+
+        Error::info("%s with %s: %.1f MiB to %.1f MiB (%.1f%%), writing %.1f MiB/s, loading %.1f MiB/s (%.1fms)", label, BlockStream::codecName(codec), megabytes, input.str().size() / 1048576.0, data.empty() ? 0.0 : 100.0 * input.str().size() / data.size(), writeWalltime > 0 ? megabytes * 1000000.0 / writeWalltime : 0.0, loadWalltime > 0 ? megabytes * 1000000.0 / loadWalltime : 0.0, loadWalltime / 1000.0);
+    }
+}
+
+void Benchmark::fileCodecs() {
+    Error::info("Benchmarking codecs for separate files");
+    measureCodecs("node2Coord", node2Coord);
+    measureCodecs("wayNodes", wayNodes);
+    measureCodecs("relMembers", relMembers);
+    measureCodecs("nodeNames", nodeNames);
+    measureCodecs("wayNames", wayNames);
+    measureCodecs("relationNames", relationNames);
+    measureCodecs("swedishTextTree", swedishTextTree);
+    measureCodecs("sweden", sweden);
+}
+
+std::vector<uint64_t> Benchmark::roadWayIds() const {
+    std::vector<uint64_t> result;
+    static const uint16_t maxRoadNumber = 500;
+    for (uint16_t roadNumber = 1; roadNumber < maxRoadNumber; ++roadNumber)
+        for (const Sweden::RoadType roadType : {Sweden::Europe, Sweden::National}) {
+            const std::vector<uint64_t> ways = sweden->waysForRoad(roadType, roadNumber);
+            result.insert(result.end(), ways.cbegin(), ways.cend());
+        }
+    return result;
+}
+
+std::vector<uint64_t> Benchmark::roadNodeIds(std::vector<size_t> *wayOffsets) const {
+    std::vector<uint64_t> result;
+    if (wayOffsets != nullptr) wayOffsets->clear();
+    for (const uint64_t wayId : roadWayIds()) {
+        const WayNodes *wn = wayNodes->view(wayId);
+        if (wn != nullptr) {
+            if (wayOffsets != nullptr) wayOffsets->push_back(result.size());
+            for (uint32_t i = 0; i < wn->num_nodes; ++i)
+                result.push_back(wn->nodes[i]);
+        }
+    }
+    if (wayOffsets != nullptr) wayOffsets->push_back(result.size());
+    return result;
+}
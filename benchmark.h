@@ -0,0 +1,144 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by Thomas Fischer <thomas.fischer@his.se>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Micro benchmarks for the central data structures, run on the
+ * map data loaded by GlobalObjectManager. Results are written to
+ * the log. Enabled by setting 'benchmark = true' in the
+ * configuration file.
+ */
+class Benchmark {
+public:
+    void run();
+
+    /**
+     * Check that concurrent lookups in trees for coordinates, ways'
+     * nodes, and names give the same results as a single thread,
+     * both for modifiable and frozen trees with lookup caches.
+     * Unlike the benchmarks, this builds its own synthetic trees and
+     * needs neither a configuration nor map data, so that it can run
+     * as a test, see 'pbflookup --check-concurrent-readers'.
+     * @return true if all threads got correct results
+     */
+    static bool checkConcurrentReaders();
+
+    /**
+     * Check that IdTree<T>::Update inserts, overwrites, and removes
+     * elements of both a trie and a frozen tree, that modifications
+     * become visible on commit() only, that freezing again keeps them,
+     * and that versions still read under a ReadGuard do not get
+     * reclaimed. Like checkConcurrentReaders(), this runs on synthetic
+     * data only, see 'pbflookup --check-versioned-updates'.
+     * @return true if all checks passed
+     */
+    static bool checkVersionedUpdates();
+
+private:
+    /**
+     * Compare the storage backends for mapping nodes to coordinates
+     * regarding loading time, memory consumption, and lookup speed,
+     * both for looking up one node at a time and for looking up
+     * each way's nodes in one batch. PagedIdTree is measured both
+     * uncompressed and compressed.
+     */
+    void node2CoordBackends();
+
+    /**
+     * Compare inserting elements one by one with bulk loading
+     * regarding the time to build the storage backends for mapping
+     * nodes to coordinates from ascending node ids, as done during
+     * import.
+     */
+    void node2CoordImport();
+
+    /**
+     * Compare building the trees for nodes' coordinates and ways'
+     * nodes with a single thread using the trees' BulkLoader and with
+     * several threads using a ShardedLoader, each thread inserting
+     * blocks of consecutive elements into its own shard as a parser
+     * thread would.
+     */
+    void shardedImport();
+
+    /**
+     * Compare storing element names in a NameTree with storing
+     * them in an IdTree<WriteableString> as done before, regarding
+     * loading time and memory consumption.
+     */
+    void nameStorage();
+
+    /**
+     * Compare the tries for ways' nodes, relations' members, and
+     * ways' and relations' names with their frozen, read-only
+     * representation regarding memory consumption and lookup speed.
+     */
+    void frozenTrees();
+
+    /**
+     * Look up road nodes and ways with different sizes of the
+     * trees' lookup caches and compare time per lookup and hit rate,
+     * to choose the sizes in configuration group 'lookup_cache'.
+     */
+    void lookupCacheSizes();
+
+    /**
+     * Let several threads look up the same ways, nodes, and names
+     * concurrently and check that each thread gets the same results
+     * as a single thread does. Reports the lookup throughput per
+     * number of threads; wrong results are a fatal error.
+     */
+    void concurrentReaders();
+
+    /**
+     * Let several threads look up ways' nodes while another thread
+     * keeps replacing ways using IdTree<T>::Update, and compare the
+     * lookup throughput with and without this writer. Reports the
+     * time per committed update and the memory held by old versions.
+     */
+    void versionedUpdates();
+
+    /**
+     * Write each data structure to memory using each codec for
+     * separate files, see BlockStream, and report compression ratio
+     * and throughput when writing and when loading the structure
+     * again, counting uncompressed bytes.
+     */
+    void fileCodecs();
+
+    /**
+     * Collect the ways of all European and national roads as a
+     * realistic sample of way ids as looked up during queries.
+     * @return way ids
+     */
+    std::vector<uint64_t> roadWayIds() const;
+
+    /**
+     * Collect the nodes of all European and national roads as a
+     * realistic sample of node ids as looked up during queries.
+     * @param wayOffsets if not nullptr, receives for each way the position of its first node in the result, plus the result's size as last entry
+     * @return node ids in way order
+     */
+    std::vector<uint64_t> roadNodeIds(std::vector<size_t> *wayOffsets = nullptr) const;
+};
+
+#endif // BENCHMARK_H
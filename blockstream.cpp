@@ -0,0 +1,538 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "blockstream.h"
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <zlib.h>
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
+
+#include "threadpool.h"
+#include "error.h"
+
+const size_t BlockStream::blockSize = 1 << 20;
+
+/// Gzip member header: magic, method 'deflate', flag 'extra field',
+/// no modification time, no extra flags, unknown operating system,
+/// 8 bytes of extra fields, field 'PL' of 4 bytes with member's length
+static const unsigned char gzipHeader[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 8, 0, 'P', 'L', 4, 0};
+static const size_t gzipFixedHeaderLength = 12;
+static const size_t gzipHeaderLength = sizeof(gzipHeader) + sizeof(uint32_t);
+/// CRC32 and length of uncompressed data
+static const size_t gzipTrailerLength = 2 * sizeof(uint32_t);
+
+/// Header of blocks of other codecs: a skippable frame as defined by
+/// LZ4 and zstd, consisting of magic and length of frame's content,
+/// containing codec, length of compressed block, and length of data
+static const uint32_t skippableMagic = 0x184d2a50;
+static const size_t skippableHeaderLength = 5 * sizeof(uint32_t);
+
+static inline void putUint32(unsigned char *p, const uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static inline uint32_t getUint32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static ThreadPool &threadPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+/**
+ * Block being compressed or decompressed by the thread pool.
+ * Tasks must not call Error::err(..) as exiting from a pool's
+ * thread cannot join this thread, so errors are recorded instead.
+ */
+struct Block {
+    Block()
+        : codec(BlockStream::NoCodec), length(0), done(false), failed(false) {
+        /// nothing
+    }
+
+    BlockStream::Codec codec;
+    /// Length of uncompressed data, known in advance when decompressing
+    size_t length;
+    std::vector<char> input, output;
+    bool done, failed;
+};
+
+/**
+ * Compress a block into a complete gzip member.
+ */
+static bool compressGzip(Block &block, const int level) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    /// Raw deflate data, as header and trailer are written here
+    if (deflateInit2(&stream, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    const size_t bound = deflateBound(&stream, block.input.size());
+    block.output.resize(gzipHeaderLength + bound + gzipTrailerLength);
+    unsigned char *out = (unsigned char *)block.output.data();
+    stream.next_in = (unsigned char *)block.input.data();
+    stream.avail_in = block.input.size();
+    stream.next_out = out + gzipHeaderLength;
+    stream.avail_out = bound;
+    const int result = deflate(&stream, Z_FINISH);
+    const size_t compressedLength = stream.total_out;
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END)
+        return false;
+
+    const size_t memberLength = gzipHeaderLength + compressedLength + gzipTrailerLength;
+    memcpy(out, gzipHeader, sizeof(gzipHeader));
+    putUint32(out + sizeof(gzipHeader), memberLength);
+    putUint32(out + gzipHeaderLength + compressedLength, crc32(0, (const unsigned char *)block.input.data(), block.input.size()));
+    putUint32(out + gzipHeaderLength + compressedLength + sizeof(uint32_t), block.input.size());
+    block.output.resize(memberLength);
+    return true;
+}
+
+/**
+ * Decompress a gzip member's deflate data and trailer,
+ * i.e. a member without its header.
+ */
+static bool decompressGzip(Block &block) {
+    if (block.input.size() < gzipTrailerLength)
+        return false;
+    const unsigned char *trailer = (const unsigned char *)block.input.data() + block.input.size() - gzipTrailerLength;
+    const uint32_t expectedCrc = getUint32(trailer), length = getUint32(trailer + sizeof(uint32_t));
+    /// Blocks written by Sink never exceed blockSize, so a larger
+    /// length is corrupt and must not make this thread allocate it
+    if (length > BlockStream::blockSize)
+        return false;
+    block.output.resize(length);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return false;
+    stream.next_in = (unsigned char *)block.input.data();
+    stream.avail_in = block.input.size() - gzipTrailerLength;
+    stream.next_out = (unsigned char *)block.output.data();
+    stream.avail_out = length;
+    const int result = inflate(&stream, Z_FINISH);
+    const size_t decompressedLength = stream.total_out;
+    inflateEnd(&stream);
+    return result == Z_STREAM_END && decompressedLength == length && crc32(0, (const unsigned char *)block.output.data(), length) == expectedCrc;
+}
+
+/**
+ * Compress a block with a codec other than gzip,
+ * preceded by a skippable frame as header.
+ */
+static bool compressOther(Block &block, const int level) {
+    const size_t length = block.input.size();
+    size_t compressedLength = 0;
+    switch (block.codec) {
+    case BlockStream::Lz4Codec: {
+        block.output.resize(skippableHeaderLength + LZ4_compressBound(length));
+        char *out = block.output.data() + skippableHeaderLength;
+        const int capacity = block.output.size() - skippableHeaderLength;
+        /// Levels above 1 select LZ4's slower high-compression mode,
+        /// negative levels trade compression ratio for even more speed
+        const int result = level > 1 ? LZ4_compress_HC(block.input.data(), out, length, capacity, level) : LZ4_compress_fast(block.input.data(), out, length, capacity, level < 0 ? -level : 1);
+        if (result <= 0 && length > 0) return false;
+        compressedLength = result;
+        break;
+    }
+    case BlockStream::ZstdCodec: {
+        block.output.resize(skippableHeaderLength + ZSTD_compressBound(length));
+        const size_t result = ZSTD_compress(block.output.data() + skippableHeaderLength, block.output.size() - skippableHeaderLength, block.input.data(), length, level);
+        if (ZSTD_isError(result)) return false;
+        compressedLength = result;
+        break;
+    }
+    default:
+        block.output.resize(skippableHeaderLength + length);
+        if (length > 0)
+            memcpy(block.output.data() + skippableHeaderLength, block.input.data(), length);
+        compressedLength = length;
+    }
+
+    unsigned char *out = (unsigned char *)block.output.data();
+    putUint32(out, skippableMagic);
+    putUint32(out + sizeof(uint32_t), skippableHeaderLength - 2 * sizeof(uint32_t));
+    putUint32(out + 2 * sizeof(uint32_t), block.codec);
+    putUint32(out + 3 * sizeof(uint32_t), compressedLength);
+    putUint32(out + 4 * sizeof(uint32_t), length);
+    block.output.resize(skippableHeaderLength + compressedLength);
+    return true;
+}
+
+/**
+ * Decompress a block of a codec other than gzip, without its header.
+ */
+static bool decompressOther(Block &block) {
+    block.output.resize(block.length);
+    switch (block.codec) {
+    case BlockStream::Lz4Codec:
+        return LZ4_decompress_safe(block.input.data(), block.output.data(), block.input.size(), block.length) == (int)block.length;
+    case BlockStream::ZstdCodec: {
+        const size_t result = ZSTD_decompress(block.output.data(), block.length, block.input.data(), block.input.size());
+        return !ZSTD_isError(result) && result == block.length;
+    }
+    default:
+        return false;
+    }
+}
+
+static void compressBlock(Block &block, const int level) {
+    block.failed = !(block.codec == BlockStream::GzipCodec ? compressGzip(block, level) : compressOther(block, level));
+    std::vector<char>().swap(block.input);
+}
+
+static void decompressBlock(Block &block) {
+    block.failed = !(block.codec == BlockStream::GzipCodec ? decompressGzip(block) : decompressOther(block));
+    std::vector<char>().swap(block.input);
+}
+
+/**
+ * Blocks being processed by the thread pool, in the order they
+ * appear in the stream.
+ */
+class BlockQueue
+{
+public:
+    ~BlockQueue() {
+        /// Tasks refer to this queue, so wait for them
+        boost::mutex::scoped_lock lock(mutex);
+        for (const std::shared_ptr<Block> &block : blocks)
+            while (!block->done)
+                condition.wait(lock);
+    }
+
+    /**
+     * Append a block and let the thread pool process it.
+     * @param process function to process block with, empty if block is done already
+     */
+    void enqueue(const std::shared_ptr<Block> &block, const std::function<void(Block &)> &process) {
+        blocks.push_back(block);
+        if (!process) return;
+        threadPool().enqueue([this, block, process]() {
+            process(*block);
+            {
+                boost::mutex::scoped_lock lock(mutex);
+                block->done = true;
+            }
+            condition.notify_all();
+        });
+    }
+
+    /**
+     * Wait until the first block has been processed.
+     */
+    Block &waitForFront() {
+        boost::mutex::scoped_lock lock(mutex);
+        while (!blocks.front()->done)
+            condition.wait(lock);
+        return *blocks.front();
+    }
+
+    inline bool isFrontDone() {
+        boost::mutex::scoped_lock lock(mutex);
+        return blocks.front()->done;
+    }
+
+    /// Only called by the stream's thread, like enqueue(..)
+    inline void popFront() {
+        blocks.pop_front();
+    }
+
+    inline bool empty() const {
+        return blocks.empty();
+    }
+
+    inline size_t size() const {
+        return blocks.size();
+    }
+
+    /// Number of blocks to process ahead of the stream
+    static inline size_t window() {
+        return 2 * threadPool().numThreads();
+    }
+
+private:
+    std::deque<std::shared_ptr<Block> > blocks;
+    boost::mutex mutex;
+    boost::condition_variable condition;
+};
+
+class BlockStream::Sink::Private
+{
+public:
+    std::ostream &output;
+    const Codec codec;
+    const int level;
+    std::vector<char> current;
+    BlockQueue queue;
+    size_t numBlocks;
+    bool closed;
+
+    Private(std::ostream &_output, Codec _codec, int _level)
+        : output(_output), codec(_codec), level(_level), numBlocks(0), closed(false) {
+        current.reserve(blockSize);
+    }
+
+    ~Private() {
+        if (!closed) close();
+    }
+
+    void submit() {
+        std::shared_ptr<Block> block = std::make_shared<Block>();
+        block->codec = codec;
+        block->input.swap(current);
+        current.reserve(blockSize);
+        const int blockLevel = level;
+        queue.enqueue(block, [blockLevel](Block & b) {
+            compressBlock(b, blockLevel);
+        });
+        ++numBlocks;
+    }
+
+    /**
+     * Write blocks compressed so far in order.
+     * @param maxPending number of blocks that may remain in the queue
+     */
+    void writeCompressed(const size_t maxPending) {
+        while (!queue.empty() && (queue.size() > maxPending || queue.isFrontDone())) {
+            const Block &block = queue.waitForFront();
+            if (block.failed)
+                Error::err("BlockStream: Could not compress block using %s", codecName(codec));
+            output.write(block.output.data(), block.output.size());
+            queue.popFront();
+        }
+    }
+
+    void close() {
+        /// Streams without any data still get one empty block, e.g. to be valid gzip
+        if (!current.empty() || numBlocks == 0)
+            submit();
+        writeCompressed(0);
+        output.flush();
+        closed = true;
+    }
+};
+
+BlockStream::Sink::Sink(std::ostream &_output, Codec _codec, int _level)
+    : d(std::make_shared<Private>(_output, _codec, _level))
+{
+    /// nothing
+}
+
+std::streamsize BlockStream::Sink::write(const char *s, std::streamsize n) {
+    std::streamsize done = 0;
+    while (done < n) {
+        const size_t chunk = std::min((size_t)(n - done), blockSize - d->current.size());
+        d->current.insert(d->current.end(), s + done, s + done + chunk);
+        done += chunk;
+        if (d->current.size() == blockSize) {
+            d->submit();
+            d->writeCompressed(BlockQueue::window());
+        }
+    }
+    return n;
+}
+
+void BlockStream::Sink::close() {
+    d->close();
+}
+
+class BlockStream::Source::Private
+{
+public:
+    std::istream &input;
+    BlockQueue queue;
+    /// Reading position in the first block's data
+    size_t offset;
+    bool endOfInput;
+
+    Private(std::istream &_input)
+        : input(_input), offset(0), endOfInput(false) {
+        /// nothing
+    }
+
+    /**
+     * Read a gzip member's header and the remaining member.
+     * @param header first four bytes of member
+     */
+    void readGzipMember(const unsigned char *header, Block &block) {
+        unsigned char fixedHeader[gzipFixedHeaderLength];
+        memcpy(fixedHeader, header, sizeof(uint32_t));
+        input.read((char *)fixedHeader + sizeof(uint32_t), gzipFixedHeaderLength - sizeof(uint32_t));
+        if (!input || memcmp(fixedHeader, gzipHeader, 4) != 0)
+            Error::err("BlockStream: Invalid gzip block header");
+
+        /// Find member's length among the extra fields
+        const size_t extraLength = fixedHeader[10] | (fixedHeader[11] << 8);
+        std::vector<unsigned char> extra(extraLength);
+        input.read((char *)extra.data(), extraLength);
+        size_t memberLength = 0;
+        for (size_t pos = 0; pos + 4 <= extraLength;) {
+            const size_t fieldLength = extra[pos + 2] | (extra[pos + 3] << 8);
+            if (extra[pos] == 'P' && extra[pos + 1] == 'L' && fieldLength == sizeof(uint32_t) && pos + 4 + fieldLength <= extraLength)
+                memberLength = getUint32(extra.data() + pos + 4);
+            pos += 4 + fieldLength;
+        }
+        if (!input || memberLength < gzipFixedHeaderLength + extraLength + gzipTrailerLength)
+            Error::err("BlockStream: Gzip block without valid length");
+        if (memberLength > gzipFixedHeaderLength + extraLength + compressBound(blockSize) + gzipTrailerLength)
+            Error::err("BlockStream: Gzip block of %d bytes exceeds the block size", memberLength);
+
+        block.codec = GzipCodec;
+        block.input.resize(memberLength - gzipFixedHeaderLength - extraLength);
+    }
+
+    /**
+     * Read the header of a block of another codec.
+     * @param header first four bytes of header
+     */
+    void readOtherHeader(const unsigned char *header, Block &block) {
+        unsigned char fields[skippableHeaderLength];
+        memcpy(fields, header, sizeof(uint32_t));
+        input.read((char *)fields + sizeof(uint32_t), skippableHeaderLength - sizeof(uint32_t));
+        const uint32_t codec = getUint32(fields + 2 * sizeof(uint32_t));
+        const uint32_t compressedLength = getUint32(fields + 3 * sizeof(uint32_t));
+        block.length = getUint32(fields + 4 * sizeof(uint32_t));
+        if (!input || getUint32(fields + sizeof(uint32_t)) != skippableHeaderLength - 2 * sizeof(uint32_t) || (codec != NoCodec && codec != Lz4Codec && codec != ZstdCodec) || block.length > blockSize || (codec == NoCodec && compressedLength != block.length))
+            Error::err("BlockStream: Invalid block header");
+        /// Bound the length before allocating, as for gzip members;
+        /// uncompressed blocks are bounded by the block size above
+        const size_t maxCompressedLength = codec == Lz4Codec ? (size_t)LZ4_compressBound(blockSize) : (codec == ZstdCodec ? ZSTD_compressBound(blockSize) : blockSize);
+        if (compressedLength > maxCompressedLength)
+            Error::err("BlockStream: %s block of %d bytes exceeds the block size", codecName((Codec)codec), compressedLength);
+        block.codec = (Codec)codec;
+        block.input.resize(compressedLength);
+    }
+
+    /**
+     * Read blocks from input until enough blocks are being decompressed.
+     */
+    void fill() {
+        while (!endOfInput && queue.size() < BlockQueue::window()) {
+            unsigned char magic[sizeof(uint32_t)];
+            input.read((char *)magic, sizeof(magic));
+            if (input.gcount() == 0) {
+                endOfInput = true;
+                break;
+            } else if (input.gcount() < (std::streamsize)sizeof(magic))
+                Error::err("BlockStream: Block is truncated");
+
+            std::shared_ptr<Block> block = std::make_shared<Block>();
+            if (magic[0] == gzipHeader[0] && magic[1] == gzipHeader[1])
+                readGzipMember(magic, *block);
+            else if (getUint32(magic) == skippableMagic)
+                readOtherHeader(magic, *block);
+            else
+                Error::err("BlockStream: Unknown block type");
+
+            input.read(block->input.data(), block->input.size());
+            if (!input)
+                Error::err("BlockStream: Block is truncated");
+            if (block->codec == NoCodec) {
+                /// Nothing to decompress
+                block->output.swap(block->input);
+                block->done = true;
+                queue.enqueue(block, nullptr);
+            } else
+                queue.enqueue(block, decompressBlock);
+        }
+    }
+};
+
+BlockStream::Source::Source(std::istream &_input)
+    : d(std::make_shared<Private>(_input))
+{
+    /// nothing
+}
+
+std::streamsize BlockStream::Source::read(char *s, std::streamsize n) {
+    std::streamsize done = 0;
+    while (done < n) {
+        d->fill();
+        if (d->queue.empty()) break;
+        Block &block = d->queue.waitForFront();
+        if (block.failed)
+            Error::err("BlockStream: Block is corrupt (%s)", codecName(block.codec));
+        const size_t chunk = std::min((size_t)(n - done), block.output.size() - d->offset);
+        memcpy(s + done, block.output.data() + d->offset, chunk);
+        done += chunk;
+        d->offset += chunk;
+        if (d->offset == block.output.size()) {
+            d->queue.popFront();
+            d->offset = 0;
+        }
+    }
+    return done > 0 ? done : -1;
+}
+
+void BlockStream::pushCompressor(boost::iostreams::filtering_ostream &out, std::ostream &output, Codec codec, int level) {
+    out.push(Sink(output, codec, level));
+}
+
+void BlockStream::pushDecompressor(boost::iostreams::filtering_istream &in, std::istream &input) {
+    if (isBlockStream(input))
+        in.push(Source(input));
+    else {
+        in.push(boost::iostreams::gzip_decompressor());
+        in.push(input);
+    }
+}
+
+bool BlockStream::isBlockStream(std::istream &input) {
+    const std::istream::pos_type start = input.tellg();
+    unsigned char header[sizeof(gzipHeader)];
+    input.read((char *)header, sizeof(header));
+    const bool complete = input.gcount() == sizeof(header);
+    input.clear();
+    input.seekg(start);
+    return complete && (memcmp(header, gzipHeader, sizeof(header)) == 0 || (getUint32(header) == skippableMagic && getUint32(header + sizeof(uint32_t)) == skippableHeaderLength - 2 * sizeof(uint32_t)));
+}
+
+bool BlockStream::codecByName(const std::string &name, Codec &codec) {
+    for (const Codec c : {NoCodec, GzipCodec, Lz4Codec, ZstdCodec})
+        if (name == codecName(c)) {
+            codec = c;
+            return true;
+        }
+    return false;
+}
+
+const char *BlockStream::codecName(Codec codec) {
+    switch (codec) {
+    case NoCodec: return "none";
+    case GzipCodec: return "gzip";
+    case Lz4Codec: return "lz4";
+    case ZstdCodec: return "zstd";
+    }
+    return "unknown";
+}
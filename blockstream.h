@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef BLOCKSTREAM_H
+#define BLOCKSTREAM_H
+
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <string>
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+/**
+ * Compression in independently compressed blocks of up to blockSize
+ * bytes each. Each block carries its compressed length, so these
+ * lengths form an index: a reader can split a stream into its blocks
+ * without decompressing anything and decompress several blocks at
+ * once. Blocks are compressed and decompressed by a thread pool
+ * shared by all streams, using all cores.
+ *
+ * Blocks are encoded by one of several codecs, trading compression
+ * ratio for speed:
+ *  - GzipCodec: each block is a complete gzip 'member' whose header
+ *    carries an extra field 'PL' with the member's length in bytes,
+ *    similar to BGZF as used for genome data. As a gzip file may
+ *    consist of several members, such streams can be read by gzip,
+ *    zcat, etc. like any other gzip file.
+ *  - Lz4Codec: LZ4 blocks, several times faster to decompress than
+ *    gzip at a lower compression ratio.
+ *  - ZstdCodec: zstd frames, compressing about as well as gzip or
+ *    better while decompressing considerably faster. Can be read by
+ *    'zstd -d', which skips the blocks' headers.
+ *  - NoCodec: data is stored as it is.
+ * Blocks of all codecs except gzip start with a header in the form
+ * of a 'skippable frame' as defined by LZ4 and zstd. Readers detect
+ * the codec per block, so the codec used for writing does not need
+ * to be known when reading.
+ */
+class BlockStream
+{
+public:
+    enum Codec {NoCodec = 0, GzipCodec = 1, Lz4Codec = 2, ZstdCodec = 3};
+
+    /// Number of uncompressed bytes per block
+    static const size_t blockSize;
+
+    /**
+     * Device for boost::iostreams' filtering_ostream writing
+     * compressed blocks to another stream.
+     */
+    class Sink
+    {
+    public:
+        typedef char char_type;
+        struct category : boost::iostreams::sink_tag, boost::iostreams::closable_tag {};
+
+        /**
+         * @param _output stream to write to
+         * @param _codec codec to compress blocks with
+         * @param _level compression level of codec, 0 for codec's default
+         */
+        explicit Sink(std::ostream &_output, Codec _codec, int _level);
+
+        std::streamsize write(const char *s, std::streamsize n);
+        /**
+         * Write all remaining blocks, called by the filtering_ostream
+         * when it gets closed or deleted.
+         */
+        void close();
+
+    private:
+        class Private;
+        /// Devices get copied when pushed to a filtering stream
+        std::shared_ptr<Private> d;
+    };
+
+    /**
+     * Device for boost::iostreams' filtering_istream reading a
+     * stream written by Sink. Blocks ahead of the current reading
+     * position get decompressed in the background.
+     */
+    class Source
+    {
+    public:
+        typedef char char_type;
+        typedef boost::iostreams::source_tag category;
+
+        explicit Source(std::istream &_input);
+
+        std::streamsize read(char *s, std::streamsize n);
+
+    private:
+        class Private;
+        std::shared_ptr<Private> d;
+    };
+
+    /**
+     * Complete a filtering stream to write compressed blocks to a stream.
+     * @param level compression level of codec, 0 for codec's default
+     */
+    static void pushCompressor(boost::iostreams::filtering_ostream &out, std::ostream &output, Codec codec, int level = 0);
+
+    /**
+     * Complete a filtering stream to read a stream as written by
+     * pushCompressor(..) or, for files written by previous versions,
+     * a stream in plain gzip format.
+     * @param input stream to read from, has to support seeking
+     */
+    static void pushDecompressor(boost::iostreams::filtering_istream &in, std::istream &input);
+
+    /**
+     * Determine if a stream starts with a block as written by Sink.
+     * @param input stream to test, has to support seeking
+     */
+    static bool isBlockStream(std::istream &input);
+
+    /**
+     * Determine a codec by its name as used in the configuration,
+     * i.e. 'none', 'gzip', 'lz4', or 'zstd'.
+     * @return true if name is known
+     */
+    static bool codecByName(const std::string &name, Codec &codec);
+    static const char *codecName(Codec codec);
+};
+
+#endif // BLOCKSTREAM_H
@@ -0,0 +1,61 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "bufferedreader.h"
+
+#include <algorithm>
+
+const size_t BufferedReader::defaultBufferSize = 1 << 20;
+
+BufferedReader::BufferedReader(std::istream &_input, size_t _bufferSize)
+    : input(_input), buffer(_bufferSize > 0 ? _bufferSize : defaultBufferSize), consumed(0), valueStream(this)
+{
+    setg(buffer.data(), buffer.data(), buffer.data());
+}
+
+BufferedReader::int_type BufferedReader::underflow() {
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+
+    consumed += egptr() - eback();
+    input.read(buffer.data(), buffer.size());
+    const std::streamsize length = input.gcount();
+    setg(buffer.data(), buffer.data(), buffer.data() + length);
+    return length > 0 ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+}
+
+std::streamsize BufferedReader::xsgetn(char *destination, std::streamsize length) {
+    std::streamsize done = 0;
+    while (done < length) {
+        const std::streamsize available = egptr() - gptr();
+        if (available > 0) {
+            const std::streamsize chunk = std::min(available, length - done);
+            memcpy(destination + done, gptr(), chunk);
+            gbump(chunk);
+            done += chunk;
+        } else if ((size_t)(length - done) >= buffer.size()) {
+            /// Large reads bypass the buffer
+            consumed += egptr() - eback();
+            setg(buffer.data(), buffer.data(), buffer.data());
+            input.read(destination + done, length - done);
+            consumed += input.gcount();
+            done += input.gcount();
+            break;
+        } else if (underflow() == traits_type::eof())
+            break;
+    }
+    return done;
+}
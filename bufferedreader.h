@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef BUFFEREDREADER_H
+#define BUFFEREDREADER_H
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <streambuf>
+#include <vector>
+
+/**
+ * Reads a stream such as a gzip-decompressing filtering_istream in
+ * large chunks into a buffer of its own, so that deserializing a tree
+ * does not take one call to std::istream::read(..) per marker byte.
+ * next() and read(..) take bytes right from the buffer.
+ *
+ * Value types that deserialize themselves from a std::istream, like
+ * Coord or WayNodes, can read through stream(), which shares the same
+ * buffer.
+ *
+ * As the reader reads ahead, the underlying stream must not be used
+ * for anything else once a reader has been created for it.
+ */
+class BufferedReader : public std::streambuf
+{
+public:
+    static const size_t defaultBufferSize;
+
+    /**
+     * @param _input stream to read from
+     * @param _bufferSize number of bytes to read from _input at once
+     */
+    explicit BufferedReader(std::istream &_input, size_t _bufferSize = defaultBufferSize);
+
+    /**
+     * Read a single byte.
+     * @return next byte as unsigned char, or -1 at end of input
+     */
+    inline int next() {
+        if (gptr() == egptr() && underflow() == traits_type::eof())
+            return -1;
+        const unsigned char result = *gptr();
+        gbump(1);
+        return result;
+    }
+
+    /**
+     * Read a number of bytes.
+     * @return true if all bytes could be read
+     */
+    inline bool read(void *destination, const size_t length) {
+        if ((size_t)(egptr() - gptr()) >= length) {
+            memcpy(destination, gptr(), length);
+            gbump(length);
+            return true;
+        }
+        return xsgetn((char *)destination, length) == (std::streamsize)length;
+    }
+
+    template <class V>
+    inline bool read(V &value) {
+        return read(&value, sizeof(V));
+    }
+
+    /**
+     * Stream reading from this reader's buffer, for constructors
+     * taking a std::istream.
+     */
+    inline std::istream &stream() {
+        return valueStream;
+    }
+
+    /**
+     * Number of bytes read so far, for error messages.
+     */
+    inline uint64_t position() const {
+        return consumed + (gptr() - eback());
+    }
+
+protected:
+    virtual int_type underflow();
+    virtual std::streamsize xsgetn(char *destination, std::streamsize length);
+
+private:
+    std::istream &input;
+    std::vector<char> buffer;
+    /// Bytes read before the current buffer content
+    uint64_t consumed;
+    std::istream valueStream;
+};
+
+#endif // BUFFEREDREADER_H
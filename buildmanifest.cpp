@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "buildmanifest.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "error.h"
+
+BuildManifest::BuildManifest()
+    : inputHash(0), found(true)
+{
+    /// nothing
+}
+
+BuildManifest::BuildManifest(std::istream &input)
+    : inputHash(0), found(true)
+{
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+        if (kind == "input") {
+            Input entry;
+            fields >> entry.size >> entry.modificationTime >> std::hex >> entry.hash >> std::dec;
+            fields.ignore(1); ///< space before filename, which may contain spaces
+            std::getline(fields, entry.filename);
+            if (!fields.fail())
+                inputs.push_back(entry);
+        } else if (kind == "inputs") {
+            fields >> std::hex >> inputHash;
+        } else if (kind == "artifact") {
+            std::string name;
+            Artifact entry;
+            fields >> name >> entry.builderVersion >> std::hex >> entry.inputHash;
+            if (!fields.fail())
+                artifacts[name] = entry;
+        } else if (!kind.empty())
+            Error::warn("BuildManifest: Unknown line '%s'", line.c_str());
+    }
+}
+
+BuildManifest::BuildManifest(const std::vector<std::string> &filenames, const BuildManifest &previous)
+    : inputHash(14695981039346656037ULL), found(true)
+{
+    for (const std::string &filename : filenames) {
+        struct stat fileStatus;
+        if (stat(filename.c_str(), &fileStatus) != 0) {
+            Error::info("Input file '%s' not found, assuming artifacts built from it are up to date", filename.c_str());
+            inputs = previous.inputs;
+            inputHash = previous.inputHash;
+            found = false;
+            return;
+        }
+
+        Input entry;
+        entry.filename = filename;
+        entry.size = fileStatus.st_size;
+        entry.modificationTime = fileStatus.st_mtime;
+        entry.hash = 0;
+        bool known = false;
+        for (const Input &previousEntry : previous.inputs)
+            if (previousEntry.filename == filename && previousEntry.size == entry.size && previousEntry.modificationTime == entry.modificationTime) {
+                entry.hash = previousEntry.hash;
+                known = true;
+                break;
+            }
+        if (!known) {
+            Error::info("Computing hash of input file '%s'", filename.c_str());
+            if (!hashFile(filename, entry.hash)) {
+                Error::warn("Cannot read input file '%s', assuming artifacts built from it are up to date", filename.c_str());
+                inputs = previous.inputs;
+                inputHash = previous.inputHash;
+                found = false;
+                return;
+            }
+        }
+        inputs.push_back(entry);
+        inputHash = (inputHash ^ entry.hash) * 1099511628211ULL;
+    }
+}
+
+void BuildManifest::setArtifact(const std::string &name, unsigned int builderVersion) {
+    Artifact &entry = artifacts[name];
+    entry.builderVersion = builderVersion;
+    entry.inputHash = inputHash;
+}
+
+bool BuildManifest::isFresh(const std::string &name, unsigned int builderVersion, const BuildManifest &current) const {
+    const auto it = artifacts.find(name);
+    if (it == artifacts.cend()) {
+        if (!current.found) return true;
+        Error::info("Artifact '%s' is not recorded in manifest", name.c_str());
+        return false;
+    } else if (it->second.builderVersion != builderVersion) {
+        Error::info("Artifact '%s' was built by version %d, current version is %d", name.c_str(), it->second.builderVersion, builderVersion);
+        return false;
+    } else if (it->second.inputHash != current.inputHash) {
+        Error::info("Artifact '%s' was built from different input files", name.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::ostream &BuildManifest::write(std::ostream &output) const {
+    for (const Input &entry : inputs)
+        output << "input " << entry.size << ' ' << entry.modificationTime << ' ' << std::hex << entry.hash << std::dec << ' ' << entry.filename << std::endl;
+    output << "inputs " << std::hex << inputHash << std::dec << std::endl;
+    for (const auto &it : artifacts)
+        output << "artifact " << it.first << ' ' << it.second.builderVersion << ' ' << std::hex << it.second.inputHash << std::dec << std::endl;
+    return output;
+}
+
+bool BuildManifest::hashFile(const std::string &filename, uint64_t &hash) {
+    std::ifstream input(filename, std::ifstream::in | std::ifstream::binary);
+    if (!input) return false;
+
+    /// Mixes eight bytes at a time, which is considerably faster
+    /// than byte-wise hashing for files of several GiB
+    static const size_t bufferSize = 1 << 20;
+    std::vector<uint64_t> buffer(bufferSize / sizeof(uint64_t));
+    hash = 14695981039346656037ULL;
+    uint64_t length = 0;
+    while (input) {
+        input.read((char *)buffer.data(), bufferSize);
+        const size_t bytes = input.gcount();
+        if (bytes == 0) break;
+        length += bytes;
+        /// Zero the remainder of a partially filled last word
+        if (bytes % sizeof(uint64_t) != 0)
+            memset((char *)buffer.data() + bytes, 0, sizeof(uint64_t) - bytes % sizeof(uint64_t));
+        const size_t words = (bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        for (size_t i = 0; i < words; ++i) {
+            hash ^= buffer[i] * 0x87c37b91114253d5ULL;
+            hash = ((hash << 31) | (hash >> 33)) * 0x4cf5ad432745937fULL;
+        }
+    }
+    if (input.bad()) return false;
+    hash ^= length;
+    return true;
+}
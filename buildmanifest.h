@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef BUILDMANIFEST_H
+#define BUILDMANIFEST_H
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Records from which .osm.pbf files and by which version of the code
+ * each artifact, i.e. each data structure written to disk, was built.
+ * Comparing the manifest stored next to the artifacts with one for the
+ * current input files tells which artifacts are stale and have to be
+ * rebuilt.
+ *
+ * Input files are identified by a hash of their content, so that
+ * copying or touching a file does not make artifacts stale. As hashing
+ * large files takes a while, a file's size and modification time are
+ * recorded as well, and a file's previous hash is reused as long as
+ * both are unchanged.
+ *
+ * Manifests are stored as text, one line per input file or artifact.
+ */
+class BuildManifest
+{
+public:
+    /**
+     * Manifest without inputs or artifacts, such as for missing files.
+     */
+    explicit BuildManifest();
+    /**
+     * Read a manifest as written by write(..).
+     */
+    explicit BuildManifest(std::istream &input);
+    /**
+     * Manifest for the current input files, without any artifacts.
+     * If any input file cannot be read, the inputs of 'previous' are
+     * assumed to be unchanged, as there is nothing to rebuild from,
+     * see inputsFound().
+     * @param filenames .osm.pbf files all artifacts are built from
+     * @param previous manifest stored with the artifacts, to reuse hashes of unchanged files from
+     */
+    explicit BuildManifest(const std::vector<std::string> &filenames, const BuildManifest &previous);
+
+    /**
+     * Record that an artifact has been built from this
+     * manifest's input files.
+     * @param name name of artifact
+     * @param builderVersion version of the code building the artifact
+     */
+    void setArtifact(const std::string &name, unsigned int builderVersion);
+
+    /**
+     * Test if an artifact recorded in this manifest is up to date.
+     * @param name name of artifact
+     * @param builderVersion version of the code that would build the artifact now
+     * @param current manifest for the current input files
+     * @return true if the artifact was built by the same version from the same input files
+     */
+    bool isFresh(const std::string &name, unsigned int builderVersion, const BuildManifest &current) const;
+
+    /**
+     * Whether all input files could be read. If not, artifacts not
+     * recorded in a manifest are assumed to be up to date, as there
+     * is nothing to rebuild them from.
+     */
+    inline bool inputsFound() const {
+        return found;
+    }
+
+    std::ostream &write(std::ostream &output) const;
+
+private:
+    struct Input {
+        std::string filename;
+        uint64_t size;
+        int64_t modificationTime;
+        uint64_t hash;
+    };
+    struct Artifact {
+        unsigned int builderVersion;
+        uint64_t inputHash;
+    };
+
+    /**
+     * Hash over the content of a file, not meant to be cryptographically secure.
+     * @return false if the file cannot be read
+     */
+    static bool hashFile(const std::string &filename, uint64_t &hash);
+
+    std::vector<Input> inputs;
+    /// Hash over all inputs' hashes in order
+    uint64_t inputHash;
+    bool found;
+    std::map<std::string, Artifact> artifacts;
+};
+
+#endif // BUILDMANIFEST_H
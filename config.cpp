@@ -27,6 +27,7 @@
 #include <boost/algorithm/string/classification.hpp> /// Include boost::for is_any_of
 #include <boost/algorithm/string/split.hpp> /// Include for boost::split
 
+#include "blockstream.h"
 #include "error.h"
 #include "idtree.h"
 #include "helper.h"
@@ -41,6 +42,15 @@ std::string stopwordfilename;
 unsigned int http_port;
 std::string http_interface;
 std::string http_public_files;
+bool benchmark_mode;
+bool compress_coordinates;
+bool freeze_trees;
+bool snapshot_file;
+bool shared_snapshot;
+std::string file_codec;
+int file_codec_level;
+LazyNameTrees lazy_name_trees;
+std::map<std::string, unsigned int> lookup_cache_sizes;
 
 std::vector<struct testset> testsets;
 
@@ -240,6 +250,77 @@ bool init_configuration(const char *configfilename) {
         Error::debug("  stopwordfilename = '%s'", stopwordfilename.c_str());
 #endif // DEBUG
 
+        if (!configIfExistsLookup(config, "benchmark", benchmark_mode))
+            benchmark_mode = false;
+#ifdef DEBUG
+        Error::debug("  benchmark = %s", benchmark_mode ? "true" : "false");
+#endif // DEBUG
+
+        if (!configIfExistsLookup(config, "compress_coordinates", compress_coordinates))
+            compress_coordinates = false;
+#ifdef DEBUG
+        Error::debug("  compress_coordinates = %s", compress_coordinates ? "true" : "false");
+#endif // DEBUG
+
+        if (!configIfExistsLookup(config, "freeze_trees", freeze_trees))
+            freeze_trees = true;
+#ifdef DEBUG
+        Error::debug("  freeze_trees = %s", freeze_trees ? "true" : "false");
+#endif // DEBUG
+
+        if (!configIfExistsLookup(config, "snapshot_file", snapshot_file))
+            snapshot_file = true;
+#ifdef DEBUG
+        Error::debug("  snapshot_file = %s", snapshot_file ? "true" : "false");
+#endif // DEBUG
+
+        if (!configIfExistsLookup(config, "shared_snapshot", shared_snapshot))
+            shared_snapshot = false;
+#ifdef DEBUG
+        Error::debug("  shared_snapshot = %s", shared_snapshot ? "true" : "false");
+#endif // DEBUG
+
+        if (!configIfExistsLookup(config, "file_codec", file_codec))
+            file_codec = "gzip";
+        BlockStream::Codec codec;
+        if (!BlockStream::codecByName(file_codec, codec))
+            throw libconfig::SettingTypeException(config.lookup("file_codec"), "Codec must be one of 'none', 'gzip', 'lz4', or 'zstd'");
+        if (!configIfExistsLookup(config, "file_codec_level", file_codec_level))
+            file_codec_level = 0;
+#ifdef DEBUG
+        Error::debug("  file_codec = '%s'", file_codec.c_str());
+        Error::debug("  file_codec_level = %d", file_codec_level);
+#endif // DEBUG
+
+        lazy_name_trees = LazyNameTreesOff; ///< default value if nothing else set
+        if (configIfExistsLookup(config, "lazy_name_trees", str_buffer)) {
+            if (str_buffer == "wait")
+                lazy_name_trees = LazyNameTreesWait;
+            else if (str_buffer == "placeholder")
+                lazy_name_trees = LazyNameTreesPlaceholder;
+            else if (str_buffer != "off")
+                throw libconfig::SettingTypeException(config.lookup("lazy_name_trees"), "Lazy loading of name trees must be one of 'off', 'wait', or 'placeholder'");
+        }
+#ifdef DEBUG
+        Error::debug("  lazy_name_trees = '%s'", lazy_name_trees == LazyNameTreesWait ? "wait" : (lazy_name_trees == LazyNameTreesPlaceholder ? "placeholder" : "off"));
+#endif // DEBUG
+
+        lookup_cache_sizes.clear();
+        if (config.exists("lookup_cache")) {
+            const libconfig::Setting &setting = config.lookup("lookup_cache");
+            if (!setting.isGroup())
+                throw libconfig::SettingTypeException(setting, "Lookup cache sizes must be given as a group of tree names and numbers of entries");
+            for (const libconfig::Setting &treeSetting : setting) {
+                const int entries = treeSetting;
+                if (entries < 0)
+                    throw libconfig::SettingTypeException(treeSetting, "Lookup cache size must not be negative");
+                lookup_cache_sizes[treeSetting.getName()] = entries;
+#ifdef DEBUG
+                Error::debug("  lookup_cache.%s = %d", treeSetting.getName(), entries);
+#endif // DEBUG
+            }
+        }
+
         testsets.clear();
         static const std::vector<std::string> testsetKeySuffixes = {"", "1", "2", "3", "4", "5", "6", "A", "B", "C", "D", "E", "F"};
         for (const std::string &testsetKeySuffix : testsetKeySuffixes)
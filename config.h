@@ -19,6 +19,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 
 struct Coord;
 
@@ -30,6 +31,17 @@ extern std::string stopwordfilename;
 extern unsigned int http_port;
 extern std::string http_interface;
 extern std::string http_public_files;
+extern bool benchmark_mode;
+extern bool compress_coordinates;
+extern bool freeze_trees;
+extern bool snapshot_file;
+extern bool shared_snapshot;
+extern std::string file_codec;
+extern int file_codec_level;
+/// How to load name trees, see configuration option 'lazy_name_trees'
+enum LazyNameTrees {LazyNameTreesOff = 0, LazyNameTreesWait = 1, LazyNameTreesPlaceholder = 2};
+extern LazyNameTrees lazy_name_trees;
+extern std::map<std::string, unsigned int> lookup_cache_sizes;
 
 extern std::ofstream logfile; ///< defined in 'error.cpp'
 
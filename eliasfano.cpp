@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "eliasfano.h"
+
+#include "error.h"
+
+const size_t EliasFanoIdSet::notFound;
+const unsigned int EliasFanoIdSet::sampleBits;
+
+EliasFanoIdSet::EliasFanoIdSet()
+    : count(0), maxId(0), lowBits(0), lowMask(0), low(nullptr), high(nullptr), zeroSamples(nullptr), numLow(0), numHigh(0), numZeroSamples(0)
+{
+    /// nothing
+}
+
+EliasFanoIdSet::EliasFanoIdSet(const std::vector<uint64_t> &ids)
+    : count(ids.size()), maxId(ids.empty() ? 0 : ids.back()), lowBits(0), lowMask(0), low(nullptr), high(nullptr), zeroSamples(nullptr), numLow(0), numHigh(0), numZeroSamples(0)
+{
+    if (count == 0) return;
+
+    /// About one id per bucket
+    const uint64_t idsPerBucket = maxId / count;
+    while (lowBits < 63 && (2ULL << lowBits) <= idsPerBucket) ++lowBits;
+    lowMask = (1ULL << lowBits) - 1;
+
+    /// One spare word each, so that reading never goes past the end
+    ownLow.assign((count * lowBits + 63) / 64 + 1, 0);
+    const uint64_t numBuckets = (maxId >> lowBits) + 1;
+    const size_t highBits = count + numBuckets;
+    ownHigh.assign((highBits + 63) / 64 + 1, 0);
+    ownZeroSamples.reserve((numBuckets >> sampleBits) + 1);
+
+    uint64_t previousId = 0, bucket = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const uint64_t id = ids[i];
+        if (i > 0 && id <= previousId)
+            Error::err("EliasFanoIdSet: Ids not in strictly ascending order: %llu after %llu", id, previousId);
+        previousId = id;
+
+        /// Terminate all buckets before this id's bucket
+        for (; bucket < (id >> lowBits); ++bucket, ++pos)
+            if ((bucket & ((1 << sampleBits) - 1)) == 0)
+                ownZeroSamples.push_back(pos);
+        ownHigh[pos >> 6] |= 1ULL << (pos & 63);
+        ++pos;
+
+        if (lowBits > 0) {
+            const uint64_t value = id & lowMask;
+            const size_t bit = i * lowBits;
+            ownLow[bit >> 6] |= value << (bit & 63);
+            if ((bit & 63) + lowBits > 64)
+                ownLow[(bit >> 6) + 1] |= value >> (64 - (bit & 63));
+        }
+    }
+    /// Terminate last bucket
+    if ((bucket & ((1 << sampleBits) - 1)) == 0)
+        ownZeroSamples.push_back(pos);
+
+    low = ownLow.data();
+    numLow = ownLow.size();
+    high = ownHigh.data();
+    numHigh = ownHigh.size();
+    zeroSamples = ownZeroSamples.data();
+    numZeroSamples = ownZeroSamples.size();
+}
+
+EliasFanoIdSet::EliasFanoIdSet(Snapshot::Section &section)
+    : count(0), maxId(0), lowBits(0), lowMask(0), low(nullptr), high(nullptr), zeroSamples(nullptr), numLow(0), numHigh(0), numZeroSamples(0)
+{
+    count = section.value<uint64_t>();
+    maxId = section.value<uint64_t>();
+    lowBits = section.value<uint64_t>();
+    numLow = section.value<uint64_t>();
+    numHigh = section.value<uint64_t>();
+    numZeroSamples = section.value<uint64_t>();
+    /// Arrays are bounded by the section's length, so numbers
+    /// of bits in them below cannot overflow
+    low = section.array<uint64_t>(numLow);
+    high = section.array<uint64_t>(numHigh);
+    zeroSamples = section.array<uint64_t>(numZeroSamples);
+    if (lowBits > 63)
+        throw DataError("EliasFanoIdSet: Inconsistent set in snapshot");
+    lowMask = (1ULL << lowBits) - 1;
+    if (count == 0) return;
+
+    /// Bound header values before computing lengths from them
+    if (count > numHigh * 64 || (maxId >> lowBits) > numHigh * 64 || (lowBits > 0 && count > numLow * 64 / lowBits))
+        throw DataError("EliasFanoIdSet: Inconsistent set in snapshot");
+    const uint64_t numBuckets = (maxId >> lowBits) + 1;
+    const uint64_t numSamples = ((numBuckets - 1) >> sampleBits) + 1;
+    if (numLow < (count * lowBits + 63) / 64 + 1 || numHigh < (count + numBuckets + 63) / 64 + 1 || numZeroSamples < numSamples)
+        throw DataError("EliasFanoIdSet: Inconsistent set in snapshot");
+
+    /// Lookups use the contents of 'high' and the samples as
+    /// positions: the spare last word has to end each bucket, there
+    /// has to be a one per id and a zero per bucket, and each sample
+    /// has to be the position of its zero, see select0(..)
+    if (high[numHigh - 1] != 0)
+        throw DataError("EliasFanoIdSet: Set in snapshot lacks terminating word");
+    uint64_t ones = 0, zeros = 0, k = 0;
+    for (size_t word = 0; word < numHigh; ++word) {
+        ones += __builtin_popcountll(high[word]);
+        const uint64_t wordZeros = ~high[word];
+        const uint64_t numZeros = __builtin_popcountll(wordZeros);
+        for (; k < numSamples && (k << sampleBits) < zeros + numZeros; ++k) {
+            uint64_t remaining = wordZeros;
+            for (uint64_t skip = (k << sampleBits) - zeros; skip > 0; --skip)
+                remaining &= remaining - 1; ///< clear lowest zero
+            if (zeroSamples[k] != (word << 6) + __builtin_ctzll(remaining))
+                throw DataError("EliasFanoIdSet: Sample %llu in snapshot does not match its zero", (unsigned long long)k);
+        }
+        zeros += numZeros;
+    }
+    if (ones != count || zeros < numBuckets || k < numSamples)
+        throw DataError("EliasFanoIdSet: Set in snapshot does not match its %llu ids", (unsigned long long)count);
+}
+
+size_t EliasFanoIdSet::memoryUsage() const {
+    return sizeof(*this) + ownLow.capacity() * sizeof(uint64_t) + ownHigh.capacity() * sizeof(uint64_t) + ownZeroSamples.capacity() * sizeof(uint64_t);
+}
+
+void EliasFanoIdSet::writeSnapshot(std::ostream &output) const {
+    SnapshotWriter::writeValue<uint64_t>(output, count);
+    SnapshotWriter::writeValue<uint64_t>(output, maxId);
+    SnapshotWriter::writeValue<uint64_t>(output, lowBits);
+    SnapshotWriter::writeValue<uint64_t>(output, numLow);
+    SnapshotWriter::writeValue<uint64_t>(output, numHigh);
+    SnapshotWriter::writeValue<uint64_t>(output, numZeroSamples);
+    SnapshotWriter::writeArray(output, low, numLow);
+    SnapshotWriter::writeArray(output, high, numHigh);
+    SnapshotWriter::writeArray(output, zeroSamples, numZeroSamples);
+}
@@ -0,0 +1,170 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef ELIASFANO_H
+#define ELIASFANO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+#include "snapshot.h"
+
+/**
+ * Read-only set of ids in Elias-Fano encoding, determining for an
+ * id its position among all ids in ascending order ('rank'). Values
+ * belonging to the ids can be kept in an array in the same order.
+ *
+ * Each id is split into its lower 'lowBits' bits, stored as a packed
+ * array, and its upper bits ('bucket'). Buckets are stored as a bit
+ * vector where each id is a one and the end of each bucket is a zero,
+ * i.e. the ids of bucket h follow the h-th zero. 'lowBits' is chosen
+ * such that buckets hold about one id each, taking about 2+lowBits
+ * bits per id in total. For sparse ids like those of OSM ways, this
+ * is a few bits per id, where a trie needs several bytes.
+ *
+ * Looking up an id finds the start of its bucket by a 'select'
+ * operation on the bit vector, assisted by the position of every
+ * 256th zero, and compares the lower bits of the bucket's few ids.
+ *
+ * A set consists of three flat arrays, which can be written to a
+ * snapshot and used right where the snapshot is mapped into memory.
+ */
+class EliasFanoIdSet
+{
+public:
+    /// Returned by indexOf(..) for ids not in this set
+    static const size_t notFound = SIZE_MAX;
+
+    explicit EliasFanoIdSet();
+    /**
+     * @param ids ids in strictly ascending order
+     */
+    explicit EliasFanoIdSet(const std::vector<uint64_t> &ids);
+    /**
+     * Use a set as written by writeSnapshot(..) without copying it.
+     * @param section section positioned at the set, the snapshot has to outlive this set
+     */
+    explicit EliasFanoIdSet(Snapshot::Section &section);
+
+    EliasFanoIdSet(EliasFanoIdSet &&other) = default;
+    EliasFanoIdSet &operator=(EliasFanoIdSet &&other) = default;
+    /// Copying would leave the copy's arrays pointing to the original's vectors
+    EliasFanoIdSet(const EliasFanoIdSet &other) = delete;
+    EliasFanoIdSet &operator=(const EliasFanoIdSet &other) = delete;
+
+    /**
+     * Look up an id.
+     * @param id id to look up
+     * @return position of id among all ids in ascending order, or notFound
+     */
+    inline size_t indexOf(const uint64_t id) const {
+        if (count == 0 || id > maxId) return notFound;
+
+        const uint64_t bucket = id >> lowBits;
+        /// Bit position of bucket's first id in 'high'
+        size_t pos = bucket == 0 ? 0 : select0(bucket - 1) + 1;
+        size_t index = pos - bucket;
+        const uint64_t low = id & lowMask;
+        while ((high[pos >> 6] >> (pos & 63)) & 1) {
+            const uint64_t candidate = lowAt(index);
+            if (candidate == low) return index;
+            else if (candidate > low) break; ///< ids in bucket are sorted
+            ++pos;
+            ++index;
+        }
+        return notFound;
+    }
+
+    /**
+     * Call a function for each id in ascending order.
+     * @param visitor function taking an id's position and the id
+     */
+    template <class Visitor>
+    void forEach(Visitor visitor) const {
+        uint64_t bucket = 0;
+        size_t index = 0;
+        for (size_t pos = 0; index < count; ++pos) {
+            if ((high[pos >> 6] >> (pos & 63)) & 1) {
+                visitor(index, (bucket << lowBits) | lowAt(index));
+                ++index;
+            } else
+                ++bucket;
+        }
+    }
+
+    inline size_t size() const {
+        return count;
+    }
+
+    /**
+     * Number of bytes occupied by this set, not counting
+     * arrays inside a memory-mapped snapshot.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * Write this set to a snapshot section, see Snapshot.
+     */
+    void writeSnapshot(std::ostream &output) const;
+
+private:
+    /// Every 2^sampleBits-th zero's position is recorded
+    static const unsigned int sampleBits = 8;
+
+    inline uint64_t lowAt(const size_t index) const {
+        if (lowBits == 0) return 0;
+        const size_t bit = index * lowBits;
+        const size_t word = bit >> 6, shift = bit & 63;
+        uint64_t result = low[word] >> shift;
+        if (shift + lowBits > 64)
+            result |= low[word + 1] << (64 - shift);
+        return result & lowMask;
+    }
+
+    /**
+     * Position of the k-th zero (counting from 0) in 'high'.
+     */
+    inline size_t select0(uint64_t k) const {
+        size_t pos = zeroSamples[k >> sampleBits];
+        k &= (1 << sampleBits) - 1;
+        size_t word = pos >> 6;
+        /// Zeros in the first word, not counting those before 'pos'
+        uint64_t zeros = ~high[word] & (~0ULL << (pos & 63));
+        while (true) {
+            const uint64_t numZeros = __builtin_popcountll(zeros);
+            if (k < numZeros) break;
+            k -= numZeros;
+            zeros = ~high[++word];
+        }
+        for (; k > 0; --k)
+            zeros &= zeros - 1; ///< clear lowest zero
+        return (word << 6) + __builtin_ctzll(zeros);
+    }
+
+    size_t count;
+    uint64_t maxId;
+    unsigned int lowBits;
+    uint64_t lowMask;
+    /// Point to the vectors below or into a memory-mapped snapshot
+    const uint64_t *low, *high, *zeroSamples;
+    size_t numLow, numHigh, numZeroSamples;
+    /// Empty for sets inside a memory-mapped snapshot
+    std::vector<uint64_t> ownLow, ownHigh, ownZeroSamples;
+};
+
+#endif // ELIASFANO_H
@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "epochmanager.h"
+
+#include <boost/thread/mutex.hpp>
+
+boost::atomic<uint64_t> EpochManager::nextId(1);
+
+/// Positions of managers in each thread's list of records,
+/// reused once a manager is deleted
+static boost::mutex slotMutex;
+static std::vector<size_t> freeSlots;
+static size_t nextSlot = 0;
+
+EpochManager::EpochManager()
+    : epoch(1), readers(nullptr), id(nextId.fetch_add(1, boost::memory_order_relaxed))
+{
+    boost::mutex::scoped_lock lock(slotMutex);
+    if (freeSlots.empty())
+        slot = nextSlot++;
+    else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+}
+
+EpochManager::~EpochManager()
+{
+    for (Reader *r = readers.load(boost::memory_order_acquire); r != nullptr;) {
+        Reader *next = r->next;
+        delete r;
+        r = next;
+    }
+
+    boost::mutex::scoped_lock lock(slotMutex);
+    freeSlots.push_back(slot);
+}
+
+bool EpochManager::tryAdvance() {
+    const uint64_t e = epoch.load(boost::memory_order_seq_cst);
+    for (const Reader *r = readers.load(boost::memory_order_seq_cst); r != nullptr; r = r->next) {
+        const uint64_t readerEpoch = r->epoch.load(boost::memory_order_seq_cst);
+        if (readerEpoch != 0 && readerEpoch != e)
+            return false;
+    }
+    epoch.store(e + 1, boost::memory_order_seq_cst);
+    return true;
+}
+
+EpochManager::Reader *EpochManager::reader() const {
+    /// For each slot, the id of the manager the record belongs to
+    static thread_local std::vector<std::pair<uint64_t, Reader *> > recordsPerSlot;
+    if (slot >= recordsPerSlot.size())
+        recordsPerSlot.resize(slot + 1, std::make_pair(0, nullptr));
+    std::pair<uint64_t, Reader *> &record = recordsPerSlot[slot];
+    if (record.first != id) {
+        Reader *r = new Reader();
+        r->next = readers.load(boost::memory_order_relaxed);
+        while (!readers.compare_exchange_weak(r->next, r, boost::memory_order_seq_cst));
+        record = std::make_pair(id, r);
+    }
+    return record.second;
+}
@@ -0,0 +1,134 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef EPOCHMANAGER_H
+#define EPOCHMANAGER_H
+
+#include <cstdint>
+#include <vector>
+
+#include <boost/atomic.hpp>
+
+/**
+ * Keeps track of which threads are reading a data structure that
+ * another thread modifies by replacing parts of it, so that replaced
+ * parts get freed only once no reader can access them anymore
+ * ('epoch-based reclamation').
+ *
+ * Readers enter and leave the structure by means of a Guard. On
+ * entering, a reader records the current epoch. The modifying thread
+ * unlinks parts from the structure and tags them with the current
+ * epoch; then it tries to advance the epoch, which succeeds only if
+ * no reader is still in a previous epoch. Parts tagged with epoch e
+ * may be freed once the epoch has reached e+2: readers that entered
+ * in epoch e or earlier have left by then, and readers that entered
+ * later cannot reach the parts as they were unlinked before.
+ *
+ * Each thread has a record of its own, so that entering and leaving
+ * does not contend with other readers. Guards may be nested.
+ * Only one thread at a time may call tryAdvance().
+ */
+class EpochManager
+{
+private:
+    struct Reader {
+        Reader()
+            : epoch(0), next(nullptr), depth(0) {
+            /// nothing
+        }
+
+        /// Epoch this reader entered in, 0 if not reading
+        boost::atomic<uint64_t> epoch;
+        Reader *next;
+        /// Number of nested guards, only accessed by the owning thread
+        unsigned int depth;
+        /// Keep records of different threads in different cache lines
+        char padding[64 - sizeof(boost::atomic<uint64_t>) - sizeof(Reader *) - sizeof(unsigned int)];
+    };
+
+public:
+    explicit EpochManager();
+    ~EpochManager();
+
+    class Guard
+    {
+    public:
+        explicit Guard(const EpochManager &manager)
+            : reader(manager.enter()) {
+            /// nothing
+        }
+
+        ~Guard() {
+            EpochManager::leave(reader);
+        }
+
+    private:
+        Reader *const reader;
+    };
+
+    inline uint64_t current() const {
+        return epoch.load(boost::memory_order_seq_cst);
+    }
+
+    /**
+     * Advance the epoch unless a reader is still in a previous epoch.
+     * @return true if the epoch was advanced
+     */
+    bool tryAdvance();
+
+    /**
+     * Determine if parts unlinked during a given epoch
+     * cannot be accessed by any reader anymore.
+     */
+    inline bool isSafe(const uint64_t retiredEpoch) const {
+        return current() >= retiredEpoch + 2;
+    }
+
+private:
+    Reader *reader() const;
+
+    inline Reader *enter() const {
+        Reader *r = reader();
+        if (r->depth++ > 0) return r;
+        uint64_t e = epoch.load(boost::memory_order_seq_cst);
+        while (true) {
+            r->epoch.store(e, boost::memory_order_seq_cst);
+            /// The epoch may have been advanced before the
+            /// modifying thread could see this reader's record
+            const uint64_t confirmed = epoch.load(boost::memory_order_seq_cst);
+            if (confirmed == e) break;
+            e = confirmed;
+        }
+        return r;
+    }
+
+    static inline void leave(Reader *r) {
+        if (--r->depth == 0)
+            r->epoch.store(0, boost::memory_order_release);
+    }
+
+    boost::atomic<uint64_t> epoch;
+    /// Records of all threads that ever read, never removed
+    mutable boost::atomic<Reader *> readers;
+    /// Unique over all managers ever created, to recognize a thread's
+    /// record of a previous manager at the same address or slot
+    const uint64_t id;
+    size_t slot;
+
+    static boost::atomic<uint64_t> nextId;
+};
+
+#endif // EPOCHMANAGER_H
@@ -24,6 +24,8 @@
 
 #include <fstream>
 
+#include <boost/thread/mutex.hpp>
+
 /// For std::exit
 #include <cstdlib>
 
@@ -43,8 +45,12 @@ const bool Error::useColor = isatty(1);
 
 /// Prints a formatted message to stdout, optionally color coded
 void Error::msg(MessageType messageType, const char *format, int color, va_list args) {
-    static char message[maxStringLen];
+    /// Messages may be printed from several threads at the same time,
+    /// so format into a local buffer and serialize the output
+    static boost::mutex outputMutex;
+    char message[maxStringLen];
     vsnprintf(message, maxStringLen - 1, format, args);
+    boost::mutex::scoped_lock lock(outputMutex);
 
     /// Skip messages where level is lower than minimum logging level
     if ((int)messageType >= (int)minimumLoggingLevel) {
@@ -105,4 +111,15 @@ void Error::debug(const char *format, ...) {
     va_end(args);
 }
 
+DataError::DataError(const char *format, ...) {
+    char buffer[maxStringLen];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, maxStringLen - 1, format, args);
+    va_end(args);
+    message = buffer;
+}
 
+const char *DataError::what() const noexcept {
+    return message.c_str();
+}
@@ -19,6 +19,8 @@
 
 /// Used for va_list in debug-print methods
 #include <cstdarg>
+#include <exception>
+#include <string>
 
 class Error
 {
@@ -42,4 +44,22 @@ private:
     static void msg(MessageType messageType, const char *format, int color, va_list args);
 };
 
+/**
+ * Thrown instead of calling Error::err(..) where inconsistent data
+ * must not terminate the process, such as a corrupt snapshot getting
+ * reloaded while serving requests. Callers unable to recover catch
+ * it and pass what() on to Error::err(..).
+ */
+class DataError : public std::exception
+{
+public:
+    /// Formats a message like Error::err(..)
+    explicit DataError(const char *format, ...);
+
+    const char *what() const noexcept;
+
+private:
+    std::string message;
+};
+
 #endif // ERROR_H
@@ -19,25 +19,92 @@
 #include <iostream>
 #include <fstream>
 #include <istream>
+#include <algorithm>
 
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
 
+#include "blockstream.h"
+#include "buildmanifest.h"
 #include "error.h"
 #include "config.h"
+#include "helper.h"
 #include "osmpbfreader.h"
+#include "taskgraph.h"
 
 
-IdTree<WayNodes> *wayNodes = nullptr; ///< declared in 'globalobjects.h'
-IdTree<Coord> *node2Coord = nullptr; ///< declared in 'globalobjects.h'
-IdTree<RelationMem> *relMembers = nullptr; ///< declared in 'globalobjects.h'
-IdTree<WriteableString> *nodeNames = nullptr; ///< declared in 'globalobjects.h'
-IdTree<WriteableString> *wayNames = nullptr; ///< declared in 'globalobjects.h'
-IdTree<WriteableString> *relationNames = nullptr; ///< declared in 'globalobjects.h'
+IdTree<WayNodes, IdTreeLeanPolicy> *wayNodes = nullptr; ///< declared in 'globalobjects.h'
+PagedIdTree<Coord> *node2Coord = nullptr; ///< declared in 'globalobjects.h'
+IdTree<RelationMem, IdTreeLeanPolicy> *relMembers = nullptr; ///< declared in 'globalobjects.h'
+NameTree *nodeNames = nullptr; ///< declared in 'globalobjects.h'
+NameTree *wayNames = nullptr; ///< declared in 'globalobjects.h'
+NameTree *relationNames = nullptr; ///< declared in 'globalobjects.h'
 SwedishTextTree *swedishTextTree = nullptr; ///< declared in 'globalobjects.h'
 Sweden *sweden = nullptr; ///< declared in 'globalobjects.h'
 
+/// Cleared while a name tree is being loaded in the background
+static boost::atomic<bool> nodeNamesReady(true), wayNamesReady(true), relationNamesReady(true);
+static boost::mutex nameTreesMutex;
+static boost::condition_variable nameTreesCondition;
+
+/**
+ * Name tree for elements of the given type, see nameTree(..).
+ * @param wait if the tree is not ready yet, wait for it instead of returning nullptr
+ */
+static NameTree *readyNameTree(OSMElement::ElementType type, bool wait) {
+    NameTree *const *tree = nullptr;
+    const boost::atomic<bool> *ready = nullptr;
+    switch (type) {
+    case OSMElement::Node: tree = &nodeNames; ready = &nodeNamesReady; break;
+    case OSMElement::Way: tree = &wayNames; ready = &wayNamesReady; break;
+    case OSMElement::Relation: tree = &relationNames; ready = &relationNamesReady; break;
+    case OSMElement::UnknownElementType: return nullptr;
+    }
+
+    if (!ready->load()) {
+        if (!wait) return nullptr;
+        boost::unique_lock<boost::mutex> lock(nameTreesMutex);
+        while (!ready->load())
+            nameTreesCondition.wait(lock);
+    }
+    /// Only read after the tree is ready, as it is set by the loading thread
+    return *tree;
+}
+
+const NameTree *nameTree(OSMElement::ElementType type) {
+    return readyNameTree(type, lazy_name_trees != LazyNameTreesPlaceholder);
+}
+
+void waitForNameTrees() {
+    for (const OSMElement::ElementType type : {OSMElement::Node, OSMElement::Way, OSMElement::Relation})
+        readyNameTree(type, true);
+}
+
+static void setNameTreeReady(boost::atomic<bool> &ready) {
+    boost::lock_guard<boost::mutex> lock(nameTreesMutex);
+    ready = true;
+    nameTreesCondition.notify_all();
+}
+
+/**
+ * Codec for writing compressed files as set in
+ * the configuration, see BlockStream.
+ */
+static BlockStream::Codec configuredCodec() {
+    BlockStream::Codec codec = BlockStream::GzipCodec;
+    BlockStream::codecByName(file_codec, codec);
+    return codec;
+}
 
 void loadSwedishTextTree() {
     const std::string filename = tempdir + "/" + mapname + ".tt";
@@ -67,6 +134,41 @@ void saveSwedishTextTree() {
         Error::err("Cannot save swedishTextTree, variable is NULL");
 }
 
+/**
+ * Compress node2Coord if configured to do so,
+ * see PagedIdTree<T>::compress().
+ */
+void compressNode2Coord() {
+    if (node2Coord == nullptr || !compress_coordinates)
+        return;
+
+    const size_t memoryBefore = node2Coord->memoryUsage();
+    Timer timer;
+    node2Coord->compress();
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    Error::info("Spent CPU time to compress node2Coord: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("Memory used by node2Coord before compression: %.1f MiB, after: %.1f MiB", memoryBefore / 1048576.0, node2Coord->memoryUsage() / 1048576.0);
+}
+
+/**
+ * Replace a tree by its read-only representation if configured
+ * to do so, see IdTree<T>::freeze() and NameTree::freeze().
+ */
+template <class Tree>
+void freezeTree(Tree *tree, const char *name) {
+    if (tree == nullptr || !freeze_trees)
+        return;
+
+    const size_t memoryBefore = tree->memoryUsage();
+    Timer timer;
+    tree->freeze();
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    Error::info("Spent CPU time to freeze %s: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", name, cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("Memory used by %s before freezing: %.1f MiB, after: %.1f MiB", name, memoryBefore / 1048576.0, tree->memoryUsage() / 1048576.0);
+}
+
 void loadNode2Coord() {
     const std::string filename = tempdir + "/" + mapname + ".n2c";
     Error::debug("Reading from '%s' (mapping nodes to coordinates)", filename.c_str());
@@ -77,9 +179,9 @@ void loadNode2Coord() {
         return;
     }
     boost::iostreams::filtering_istream in;
-    in.push(boost::iostreams::gzip_decompressor());
-    in.push(node2CoordFile);
-    node2Coord = new IdTree<Coord>(in);
+    BlockStream::pushDecompressor(in, node2CoordFile);
+    node2Coord = new PagedIdTree<Coord>(in);
+    compressNode2Coord();
 }
 
 void saveNode2Coord() {
@@ -91,9 +193,11 @@ void saveNode2Coord() {
             Error::warn("Cannot write .n2c file");
             return;
         }
+        /// Counters are only needed while importing map data,
+        /// do not write them to keep them from being loaded again
+        node2Coord->dropCounters();
         boost::iostreams::filtering_ostream out;
-        out.push(boost::iostreams::gzip_compressor());
-        out.push(node2CoordFile);
+        BlockStream::pushCompressor(out, node2CoordFile, configuredCodec(), file_codec_level);
         node2Coord->write(out);
     } else
         Error::err("Cannot save node2Coord, variable is NULL");
@@ -109,9 +213,8 @@ void loadNodeNames() {
         return;
     }
     boost::iostreams::filtering_istream in;
-    in.push(boost::iostreams::gzip_decompressor());
-    in.push(nnfile);
-    nodeNames = new IdTree<WriteableString>(in);
+    BlockStream::pushDecompressor(in, nnfile);
+    nodeNames = new NameTree(in);
 }
 
 void saveNodeNames() {
@@ -124,8 +227,7 @@ void saveNodeNames() {
             return;
         }
         boost::iostreams::filtering_ostream out;
-        out.push(boost::iostreams::gzip_compressor());
-        out.push(nnfile);
+        BlockStream::pushCompressor(out, nnfile, configuredCodec(), file_codec_level);
         nodeNames->write(out);
     } else
         Error::err("Cannot save nodeNames, variable is NULL");
@@ -141,9 +243,9 @@ void loadWayNames() {
         return;
     }
     boost::iostreams::filtering_istream in;
-    in.push(boost::iostreams::gzip_decompressor());
-    in.push(wnfile);
-    wayNames = new IdTree<WriteableString>(in);
+    BlockStream::pushDecompressor(in, wnfile);
+    wayNames = new NameTree(in);
+    freezeTree(wayNames, "wayNames");
 }
 
 void saveWayNames() {
@@ -156,8 +258,7 @@ void saveWayNames() {
             return;
         }
         boost::iostreams::filtering_ostream out;
-        out.push(boost::iostreams::gzip_compressor());
-        out.push(wnfile);
+        BlockStream::pushCompressor(out, wnfile, configuredCodec(), file_codec_level);
         wayNames->write(out);
     } else
         Error::err("Cannot save wayNames, variable is NULL");
@@ -173,9 +274,9 @@ void loadRelationNames() {
         return;
     }
     boost::iostreams::filtering_istream in;
-    in.push(boost::iostreams::gzip_decompressor());
-    in.push(rnfile);
-    relationNames = new IdTree<WriteableString>(in);
+    BlockStream::pushDecompressor(in, rnfile);
+    relationNames = new NameTree(in);
+    freezeTree(relationNames, "relationNames");
 }
 
 void saveRelationNames() {
@@ -188,8 +289,7 @@ void saveRelationNames() {
             return;
         }
         boost::iostreams::filtering_ostream out;
-        out.push(boost::iostreams::gzip_compressor());
-        out.push(rnfile);
+        BlockStream::pushCompressor(out, rnfile, configuredCodec(), file_codec_level);
         relationNames->write(out);
     } else
         Error::err("Cannot save relationNames, variable is NULL");
@@ -205,9 +305,9 @@ void loadWayNodes() {
         return;
     }
     boost::iostreams::filtering_istream in;
-    in.push(boost::iostreams::gzip_decompressor());
-    in.push(wayNodeFile);
-    wayNodes = new IdTree<WayNodes>(in);
+    BlockStream::pushDecompressor(in, wayNodeFile);
+    wayNodes = new IdTree<WayNodes, IdTreeLeanPolicy>(in);
+    freezeTree(wayNodes, "wayNodes");
 }
 
 void saveWayNodes() {
@@ -220,8 +320,7 @@ void saveWayNodes() {
             return;
         }
         boost::iostreams::filtering_ostream out;
-        out.push(boost::iostreams::gzip_compressor());
-        out.push(wayNodeFile);
+        BlockStream::pushCompressor(out, wayNodeFile, configuredCodec(), file_codec_level);
         wayNodes->write(out);
     } else
         Error::err("Cannot save wayNodes, variable is NULL");
@@ -236,8 +335,9 @@ void loadRelMem() {
         relMembers = nullptr;
         return;
     }
-    relMembers = new IdTree<RelationMem>(relmemfile);
+    relMembers = new IdTree<RelationMem, IdTreeLeanPolicy>(relmemfile);
     relmemfile.close();
+    freezeTree(relMembers, "relMembers");
 }
 
 void saveRelMem() {
@@ -256,9 +356,9 @@ void saveRelMem() {
 }
 
 /**
- * Important: 'loadSweden()' cannot be run in parallel to the other
- * load functions, as it requires those data structures to be already
- * initialized.
+ * Important: 'loadSweden()' requires the trees for coordinates, way
+ * nodes, and relation members to be already initialized, see the
+ * dependencies in GlobalObjectManager::load().
  */
 void loadSweden() {
     const std::string filename = tempdir + "/" + mapname + ".sweden";
@@ -270,8 +370,7 @@ void loadSweden() {
         return;
     }
     boost::iostreams::filtering_istream in;
-    in.push(boost::iostreams::gzip_decompressor());
-    in.push(swedenfile);
+    BlockStream::pushDecompressor(in, swedenfile);
     sweden = new Sweden(in);
 }
 
@@ -285,14 +384,156 @@ void saveSweden() {
             return;
         }
         boost::iostreams::filtering_ostream out;
-        out.push(boost::iostreams::gzip_compressor());
-        out.push(swedenfile);
+        BlockStream::pushCompressor(out, swedenfile, configuredCodec(), file_codec_level);
         sweden->write(out);
     } else
         Error::err("Cannot save sweden, variable is NULL");
 }
 
-GlobalObjectManager::GlobalObjectManager() {
+/**
+ * Create a tree using its section of a snapshot in place,
+ * see for example IdTree<T>::IdTree(Snapshot::Section &).
+ */
+template <class Tree>
+Tree *treeFromSnapshot(const Snapshot &snapshot, Snapshot::SectionId id, const char *name) {
+    Snapshot::Section section = snapshot.section(id);
+    if (!section.isValid()) {
+        Error::warn("Snapshot does not contain %s", name);
+        return nullptr;
+    }
+    Error::debug("Using %s from snapshot", name);
+    return new Tree(section);
+}
+
+/**
+ * Read a data structure from its serialization inside a section
+ * of a snapshot, see for example Sweden::Sweden(std::istream &).
+ */
+template <class Structure>
+Structure *readFromSnapshot(const Snapshot &snapshot, Snapshot::SectionId id, const char *name) {
+    Snapshot::Section section = snapshot.section(id);
+    if (!section.isValid()) {
+        Error::warn("Snapshot does not contain %s", name);
+        return nullptr;
+    }
+    Error::debug("Reading %s from snapshot", name);
+    boost::iostreams::stream<boost::iostreams::array_source> input(section.remainingData(), section.remainingLength());
+    /// A truncated section must not be read past its end
+    input.exceptions(std::istream::failbit | std::istream::badbit);
+    return new Structure(input);
+}
+
+/// Artifacts built while parsing the .osm.pbf files, each with the
+/// version of the code building it. Increase an artifact's version
+/// whenever the way it gets built changes, so that artifacts built
+/// by earlier versions get rebuilt on startup.
+static const std::vector<std::pair<std::string, unsigned int> > parsedArtifacts = {
+    {"node2Coord", 1}, {"wayNodes", 1}, {"relMembers", 1}, {"nodeNames", 1}, {"wayNames", 1}, {"relationNames", 1}, {"swedishTextTree", 1}, {"sweden", 1}
+};
+/// Region polygons and regional roads assigned to regions, which get
+/// derived from the data structures above, see rebuildRegions()
+static const std::string regionsArtifact = "regions";
+static const unsigned int regionsBuilderVersion = 1;
+
+/**
+ * Manifest stored with the artifacts, i.e. inside the snapshot file
+ * or next to the separate files, whichever would be loaded.
+ * @return stored manifest, or an empty manifest if there is none
+ */
+static BuildManifest storedManifest() {
+    if (snapshot_file) {
+        const Snapshot snapshot(tempdir + "/" + mapname + ".snapshot");
+        const Snapshot::Section section = snapshot.section(Snapshot::ManifestSection);
+        if (section.isValid()) {
+            boost::iostreams::stream<boost::iostreams::array_source> input(section.remainingData(), section.remainingLength());
+            return BuildManifest(input);
+        } else if (snapshot.isValid())
+            return BuildManifest();
+    }
+
+    std::ifstream input(tempdir + "/" + mapname + ".manifest");
+    return input ? BuildManifest(input) : BuildManifest();
+}
+
+/**
+ * Lock a snapshot file against other processes building it, waiting
+ * until any other process holding the lock has published its snapshot.
+ * The lock is released by closing the returned file descriptor.
+ * @param filename snapshot file, the lock is taken on a file next to it
+ * @return file descriptor holding the lock, or -1 if locking failed
+ */
+static int lockSnapshot(const std::string &filename) {
+    const std::string lockFilename = filename + ".lock";
+    const int fd = open(lockFilename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        Error::warn("Cannot open lock file '%s': %s", lockFilename.c_str(), strerror(errno));
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        Error::info("Waiting for another process to publish snapshot '%s'", filename.c_str());
+        if (flock(fd, LOCK_EX) != 0) {
+            Error::warn("Cannot lock file '%s': %s", lockFilename.c_str(), strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/**
+ * A complete set of the data structures declared in 'globalobjects.h',
+ * loaded while the set in use keeps serving requests.
+ */
+struct GlobalObjectManager::ObjectSet {
+    ObjectSet()
+        : wayNodes(nullptr), node2Coord(nullptr), relMembers(nullptr), nodeNames(nullptr), wayNames(nullptr), relationNames(nullptr), swedishTextTree(nullptr), sweden(nullptr), snapshot(nullptr) {
+        /// nothing
+    }
+
+    ~ObjectSet() {
+        delete wayNodes;
+        delete node2Coord;
+        delete relMembers;
+        delete nodeNames;
+        delete wayNames;
+        delete relationNames;
+        delete swedishTextTree;
+        delete sweden;
+        /// Trees refer to the snapshot's memory until deleted
+        delete snapshot;
+    }
+
+    /**
+     * Exchange the data structures of this set with those in use.
+     */
+    void swapWithGlobals() {
+        std::swap(wayNodes, ::wayNodes);
+        std::swap(node2Coord, ::node2Coord);
+        std::swap(relMembers, ::relMembers);
+        std::swap(nodeNames, ::nodeNames);
+        std::swap(wayNames, ::wayNames);
+        std::swap(relationNames, ::relationNames);
+        std::swap(swedishTextTree, ::swedishTextTree);
+        std::swap(sweden, ::sweden);
+    }
+
+    IdTree<WayNodes, IdTreeLeanPolicy> *wayNodes;
+    PagedIdTree<Coord> *node2Coord;
+    IdTree<RelationMem, IdTreeLeanPolicy> *relMembers;
+    NameTree *nodeNames, *wayNames, *relationNames;
+    SwedishTextTree *swedishTextTree;
+    Sweden *sweden;
+    Snapshot *snapshot;
+};
+
+GlobalObjectManager::GlobalObjectManager()
+    : snapshot(nullptr), manifest(nullptr), nameTreeLoader(nullptr), reloader(nullptr), reloadedObjects(nullptr)
+{
+    if (pipe(reloadPipe) != 0) {
+        Error::warn("Cannot create pipe to signal reloaded data, reloading disabled");
+        reloadPipe[0] = reloadPipe[1] = -1;
+    }
+
     swedishTextTree = nullptr;
     node2Coord = nullptr;
     wayNodes = nullptr;
@@ -307,8 +548,30 @@ GlobalObjectManager::GlobalObjectManager() {
     /// would allow startup much faster by skipping parsing
     /// the .osm.pbf file
     const std::string filename = tempdir + "/" + mapname + ".tt";
-    if (testNonEmptyFile(filename)) {
+    /// Other processes sharing the snapshot wait until this
+    /// process has either loaded or built and published it
+    const int snapshotLock = snapshot_file && shared_snapshot ? lockSnapshot(tempdir + "/" + mapname + ".snapshot") : -1;
+
+    /// Artifacts built from the .osm.pbf files all get built in
+    /// the same pass, so if any is stale, all get rebuilt
+    const BuildManifest stored = storedManifest();
+    manifest = new BuildManifest(osmpbffilenames, stored);
+    bool parsedFresh = true;
+    for (const auto &artifact : parsedArtifacts)
+        parsedFresh = parsedFresh && stored.isFresh(artifact.first, artifact.second, *manifest);
+    const bool regionsFresh = stored.isFresh(regionsArtifact, regionsBuilderVersion, *manifest);
+    if (!parsedFresh && !manifest->inputsFound()) {
+        Error::warn("Cannot rebuild stale data without .osm.pbf files, using data as it is");
+        parsedFresh = true;
+    }
+
+    if (parsedFresh && snapshot_file && loadSnapshot()) {
+        if (!regionsFresh)
+            rebuildRegions();
+    } else if (parsedFresh && testNonEmptyFile(filename)) {
         load();
+        if (!regionsFresh)
+            rebuildRegions();
     } else {
         OsmPbfReader osmPbfReader;
 
@@ -336,17 +599,60 @@ GlobalObjectManager::GlobalObjectManager() {
         /// Clean up the protobuf lib
         google::protobuf::ShutdownProtobufLibrary();
 
-        if (sweden != nullptr)
+        if (sweden != nullptr) {
+            /// Region polygons are needed to fix unlabeled roads
+            sweden->buildRegionPolygons();
             sweden->fixUnlabeledRegionalRoads();
+        }
 
-        save();
+        stampArtifacts();
+        if (!snapshot_file)
+            save();
+        compressNode2Coord();
+        freezeTree(wayNames, "wayNames");
+        freezeTree(relationNames, "relationNames");
+        freezeTree(wayNodes, "wayNodes");
+        freezeTree(relMembers, "relMembers");
+        /// Written after compressing, so that the snapshot
+        /// holds coordinates in their compressed form
+        if (snapshot_file)
+            saveSnapshot();
+        ObjectSet *published = snapshot_file && shared_snapshot ? readSnapshotObjects() : nullptr;
+        if (published != nullptr) {
+            /// Use the published snapshot like all other processes,
+            /// so that its pages are the only copy of the map data
+            useObjects(published);
+            Error::info("Switched to published snapshot file, resident memory: %.1f MiB", residentMemory() / 1048576.0);
+        }
+        configureLookupCaches();
     }
+    if (snapshotLock >= 0)
+        close(snapshotLock);
 }
 
 GlobalObjectManager::~GlobalObjectManager() {
 #define delete_and_set_NULL(a) { delete a; a=nullptr; }
     Error::debug("Going to shut down, free'ing memory");
 
+    if (nameTreeLoader != nullptr) {
+        /// Trees still being loaded must not be deleted under the loader's feet
+        nameTreeLoader->join();
+        delete_and_set_NULL(nameTreeLoader);
+    }
+    if (reloader != nullptr) {
+        reloader->join();
+        delete_and_set_NULL(reloader);
+    }
+    if (reloadedObjects != nullptr)
+        delete_and_set_NULL(reloadedObjects);
+    if (reloadPipe[0] >= 0) {
+        close(reloadPipe[0]);
+        close(reloadPipe[1]);
+    }
+    if (manifest != nullptr)
+        delete_and_set_NULL(manifest);
+
+    const size_t residentBefore = residentMemory();
     Timer timer;
     timer.start();
     if (swedishTextTree != nullptr)
@@ -365,89 +671,418 @@ GlobalObjectManager::~GlobalObjectManager() {
         delete_and_set_NULL(relMembers);
     if (sweden != nullptr)
         delete_and_set_NULL(sweden);
+    /// Trees loaded from a snapshot refer to its memory until deleted
+    if (snapshot != nullptr)
+        delete_and_set_NULL(snapshot);
     int64_t cputime, walltime;
     timer.elapsed(&cputime, &walltime);
     Error::info("Spent CPU time to free memory: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("Resident memory before freeing: %.1f MiB, after freeing: %.1f MiB", residentBefore / 1048576.0, residentMemory() / 1048576.0);
+}
+
+/**
+ * Number of lookup cache entries configured for a tree.
+ * @param name name of tree as used in configuration group 'lookup_cache'
+ * @param defaultSize number of entries if not configured
+ */
+static size_t lookupCacheSize(const std::string &name, size_t defaultSize) {
+    const auto it = lookup_cache_sizes.find(name);
+    return it == lookup_cache_sizes.cend() ? defaultSize : it->second;
+}
+
+void GlobalObjectManager::configureLookupCaches() {
+    static const std::vector<std::string> knownNames = {"node2coord", "waynodes", "relmembers", "nodenames", "waynames", "relationnames"};
+    for (const auto &it : lookup_cache_sizes)
+        if (std::find(knownNames.cbegin(), knownNames.cend(), it.first) == knownNames.cend())
+            Error::warn("Unknown tree '%s' in configuration group 'lookup_cache'", it.first.c_str());
+
+    if (node2Coord != nullptr)
+        node2Coord->setCacheSize(lookupCacheSize("node2coord", 0));
+    if (wayNodes != nullptr)
+        wayNodes->setCacheSize(lookupCacheSize("waynodes", IdTree<WayNodes, IdTreeLeanPolicy>::defaultCacheSize));
+    if (relMembers != nullptr)
+        relMembers->setCacheSize(lookupCacheSize("relmembers", IdTree<RelationMem, IdTreeLeanPolicy>::defaultCacheSize));
+    /// Name trees loaded in the background get their caches sized once loaded
+    NameTree *tree = readyNameTree(OSMElement::Node, false);
+    if (tree != nullptr)
+        tree->setCacheSize(lookupCacheSize("nodenames", 0));
+    tree = readyNameTree(OSMElement::Way, false);
+    if (tree != nullptr)
+        tree->setCacheSize(lookupCacheSize("waynames", 0));
+    tree = readyNameTree(OSMElement::Relation, false);
+    if (tree != nullptr)
+        tree->setCacheSize(lookupCacheSize("relationnames", 0));
+}
+
+std::vector<std::pair<std::string, LookupCacheStatistics> > GlobalObjectManager::lookupCacheStatistics() {
+    std::vector<std::pair<std::string, LookupCacheStatistics> > result;
+    if (node2Coord != nullptr)
+        result.push_back(std::make_pair("node2coord", node2Coord->cacheStatistics()));
+    if (wayNodes != nullptr)
+        result.push_back(std::make_pair("waynodes", wayNodes->cacheStatistics()));
+    if (relMembers != nullptr)
+        result.push_back(std::make_pair("relmembers", relMembers->cacheStatistics()));
+    const NameTree *tree = readyNameTree(OSMElement::Node, false);
+    if (tree != nullptr)
+        result.push_back(std::make_pair("nodenames", tree->cacheStatistics()));
+    tree = readyNameTree(OSMElement::Way, false);
+    if (tree != nullptr)
+        result.push_back(std::make_pair("waynames", tree->cacheStatistics()));
+    tree = readyNameTree(OSMElement::Relation, false);
+    if (tree != nullptr)
+        result.push_back(std::make_pair("relationnames", tree->cacheStatistics()));
+    return result;
 }
 
 void GlobalObjectManager::load() {
+    const size_t residentBefore = residentMemory();
     Timer timer;
     try
     {
-        boost::thread threadLoadSwedishTextTree(loadSwedishTextTree);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadLoadNode2Cood(loadNode2Coord);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadLoadNodeNames(loadNodeNames);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadLoadWayNames(loadWayNames);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadLoadRelationNames(loadRelationNames);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadLoadWayNodes(loadWayNodes);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadLoadRelMem(loadRelMem);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        Error::debug("Waiting for load threads to join");
-        threadLoadSwedishTextTree.join();
-        threadLoadNode2Cood.join();
-        threadLoadNodeNames.join();
-        threadLoadWayNames.join();
-        threadLoadRelationNames.join();
-        threadLoadWayNodes.join();
-        threadLoadRelMem.join();
+        TaskGraph graph;
+        /// Largest files first, so that they get started first
+        const TaskGraph::TaskId node2CoordTask = graph.add("load node2Coord", loadNode2Coord);
+        const TaskGraph::TaskId wayNodesTask = graph.add("load wayNodes", loadWayNodes);
+        const TaskGraph::TaskId relMembersTask = graph.add("load relMembers", loadRelMem);
+        graph.add("load swedishTextTree", loadSwedishTextTree);
+        loadNameTrees(graph, loadNodeNames, loadWayNames, loadRelationNames);
+        graph.add("load sweden", loadSweden, {node2CoordTask, wayNodesTask, relMembersTask});
+        graph.run();
     } catch (std::exception const &ex) {
-        Error::err("Exception during thread processing while loading from files: %s", ex.what());
+        Error::err("Exception during loading data from files: %s", ex.what());
     }
+    configureLookupCaches();
 
-    Error::debug("All load threads joined, now loading 'sweden'");
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    Error::info("Spent CPU time to read files: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("Resident memory before loading: %.1f MiB, after loading: %.1f MiB", residentBefore / 1048576.0, residentMemory() / 1048576.0);
+}
+
+void GlobalObjectManager::loadNameTrees(TaskGraph &graph, const std::function<void()> &nodeNamesLoader, const std::function<void()> &wayNamesLoader, const std::function<void()> &relationNamesLoader) {
+    if (lazy_name_trees == LazyNameTreesOff) {
+        graph.add("load nodeNames", nodeNamesLoader);
+        graph.add("load wayNames", wayNamesLoader);
+        graph.add("load relationNames", relationNamesLoader);
+        return;
+    }
+
+    nodeNamesReady = wayNamesReady = relationNamesReady = false;
+    nameTreeLoader = new boost::thread([nodeNamesLoader, wayNamesLoader, relationNamesLoader]() {
+        Timer timer;
+        try
+        {
+            /// Each tree gets its lookup cache sized before becoming
+            /// ready, as sizing it is not safe while it is being used
+            TaskGraph graph;
+            graph.add("load nodeNames", [nodeNamesLoader]() {
+                nodeNamesLoader();
+                if (nodeNames != nullptr)
+                    nodeNames->setCacheSize(lookupCacheSize("nodenames", 0));
+                setNameTreeReady(nodeNamesReady);
+            });
+            graph.add("load wayNames", [wayNamesLoader]() {
+                wayNamesLoader();
+                if (wayNames != nullptr)
+                    wayNames->setCacheSize(lookupCacheSize("waynames", 0));
+                setNameTreeReady(wayNamesReady);
+            });
+            graph.add("load relationNames", [relationNamesLoader]() {
+                relationNamesLoader();
+                if (relationNames != nullptr)
+                    relationNames->setCacheSize(lookupCacheSize("relationnames", 0));
+                setNameTreeReady(relationNamesReady);
+            });
+            graph.run();
+        } catch (std::exception const &ex) {
+            Error::err("Exception during loading name trees in the background: %s", ex.what());
+        }
+
+        int64_t cputime, walltime;
+        timer.elapsed(&cputime, &walltime);
+        Error::info("Spent CPU time to load name trees in the background: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    });
+}
+
+void GlobalObjectManager::save() const {
+    Timer timer;
     try
     {
-        loadSweden();
+        /// Each file is written independently of the others
+        TaskGraph graph;
+        graph.add("save node2Coord", saveNode2Coord);
+        graph.add("save wayNodes", saveWayNodes);
+        graph.add("save relMembers", saveRelMem);
+        graph.add("save swedishTextTree", saveSwedishTextTree);
+        graph.add("save nodeNames", saveNodeNames);
+        graph.add("save wayNames", saveWayNames);
+        graph.add("save relationNames", saveRelationNames);
+        graph.add("save sweden", saveSweden);
+        graph.run();
     } catch (std::exception const &ex) {
-        Error::err("Exception during loading data from files: %s", ex.what());
+        Error::err("Exception during saving data to files: %s", ex.what());
     }
+    /// Written last, so that files are only considered
+    /// up to date once all of them have been written
+    saveManifest();
     int64_t cputime, walltime;
     timer.elapsed(&cputime, &walltime);
-    Error::info("Spent CPU time to read files: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("Spent CPU time to write files: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
 }
 
-void GlobalObjectManager::save() const {
+bool GlobalObjectManager::loadSnapshot() {
+    const std::string filename = tempdir + "/" + mapname + ".snapshot";
+    if (!testNonEmptyFile(filename))
+        return false;
+
+    const size_t residentBefore = residentMemory();
     Timer timer;
+    Error::debug("Mapping '%s' into memory", filename.c_str());
+    snapshot = new Snapshot(filename);
+    if (!snapshot->isValid()) {
+        Error::warn("Cannot use snapshot '%s'", filename.c_str());
+        delete snapshot;
+        snapshot = nullptr;
+        return false;
+    }
+
     try
     {
-        boost::thread threadSaveSwedishTextTree(saveSwedishTextTree);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadSaveNode2Cood(saveNode2Coord);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadSaveNodeNames(saveNodeNames);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadSaveWayNames(saveWayNames);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadSaveRelationNames(saveRelationNames);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadSaveWayNodes(saveWayNodes);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadSaveRelMem(saveRelMem);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        boost::thread threadSaveSweden(saveSweden);
-        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-        Error::debug("Waiting for save threads to join");
-        threadSaveSwedishTextTree.join();
-        threadSaveNode2Cood.join();
-        threadSaveNodeNames.join();
-        threadSaveWayNames.join();
-        threadSaveRelationNames.join();
-        threadSaveWayNodes.join();
-        threadSaveRelMem.join();
-        threadSaveSweden.join();
+        /// All trees are used where mapped and quick to set up,
+        /// only Sweden has to be read and waits for the trees
+        TaskGraph graph;
+        const TaskGraph::TaskId treesTask = graph.add("map trees", [this]() {
+            swedishTextTree = treeFromSnapshot<SwedishTextTree>(*snapshot, Snapshot::SwedishTextTreeSection, "swedishTextTree");
+            node2Coord = treeFromSnapshot<PagedIdTree<Coord> >(*snapshot, Snapshot::Node2CoordSection, "node2Coord");
+            wayNodes = treeFromSnapshot<IdTree<WayNodes, IdTreeLeanPolicy> >(*snapshot, Snapshot::WayNodesSection, "wayNodes");
+            relMembers = treeFromSnapshot<IdTree<RelationMem, IdTreeLeanPolicy> >(*snapshot, Snapshot::RelMembersSection, "relMembers");
+        });
+        loadNameTrees(graph, [this]() {
+            nodeNames = treeFromSnapshot<NameTree>(*snapshot, Snapshot::NodeNamesSection, "nodeNames");
+        }, [this]() {
+            wayNames = treeFromSnapshot<NameTree>(*snapshot, Snapshot::WayNamesSection, "wayNames");
+        }, [this]() {
+            relationNames = treeFromSnapshot<NameTree>(*snapshot, Snapshot::RelationNamesSection, "relationNames");
+        });
+        graph.add("read sweden", [this]() {
+            sweden = readFromSnapshot<Sweden>(*snapshot, Snapshot::SwedenSection, "sweden");
+        }, {treesTask});
+        graph.run();
     } catch (std::exception const &ex) {
-        Error::err("Exception during thread processing while saving to files: %s", ex.what());
+        Error::err("Exception during loading data from snapshot: %s", ex.what());
     }
-    Error::debug("All save threads joined");
+    configureLookupCaches();
+
     int64_t cputime, walltime;
     timer.elapsed(&cputime, &walltime);
-    Error::info("Spent CPU time to write files: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("Spent CPU time to load snapshot of %.1f MiB: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", snapshot->size() / 1048576.0, cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    Error::info("Resident memory before loading: %.1f MiB, after loading: %.1f MiB", residentBefore / 1048576.0, residentMemory() / 1048576.0);
+    return true;
+}
+
+bool GlobalObjectManager::startReload() {
+    if (!snapshot_file) {
+        Error::warn("Only snapshot files can be reloaded, but 'snapshot_file' is disabled");
+        return false;
+    } else if (reloadPipe[0] < 0) {
+        Error::warn("Cannot reload the snapshot file, as the pipe to signal reloaded data could not be created");
+        return false;
+    } else if (reloader != nullptr) {
+        Error::warn("Cannot start reloading the snapshot file, as a reload is already running");
+        return false;
+    }
+
+    Error::info("Reloading snapshot file in the background");
+    reloader = new boost::thread([this]() {
+        reloadedObjects = readSnapshotObjects();
+        /// Wake up whoever waits on reloadFileDescriptor()
+        const char done = 1;
+        if (write(reloadPipe[1], &done, sizeof(done)) != sizeof(done))
+            Error::warn("Cannot signal that reloading the snapshot file is done");
+    });
+    return true;
+}
+
+bool GlobalObjectManager::finishReload() {
+    if (reloader == nullptr) return false;
+
+    char done;
+    if (read(reloadPipe[0], &done, sizeof(done)) != sizeof(done))
+        Error::warn("Cannot read signal that reloading the snapshot file is done");
+    /// Joining makes the reloader's results visible to this thread
+    reloader->join();
+    delete reloader;
+    reloader = nullptr;
+    if (reloadedObjects == nullptr) {
+        Error::warn("Reloading the snapshot file failed, keeping the current data");
+        return false;
+    }
+
+    const size_t residentBefore = residentMemory();
+    useObjects(reloadedObjects);
+    reloadedObjects = nullptr;
+    configureLookupCaches();
+
+    Error::info("Switched to reloaded snapshot file, resident memory before freeing previous data: %.1f MiB, after: %.1f MiB", residentBefore / 1048576.0, residentMemory() / 1048576.0);
+    return true;
+}
+
+void GlobalObjectManager::useObjects(ObjectSet *objects) {
+    if (nameTreeLoader != nullptr) {
+        /// The current name trees may still be loading in the background
+        nameTreeLoader->join();
+        delete nameTreeLoader;
+        nameTreeLoader = nullptr;
+    }
+
+    objects->swapWithGlobals();
+    std::swap(snapshot, objects->snapshot);
+    /// The previous data structures are not used anymore
+    delete objects;
+}
+
+int GlobalObjectManager::reloadFileDescriptor() const {
+    return reloadPipe[0];
+}
+
+GlobalObjectManager::ObjectSet *GlobalObjectManager::readSnapshotObjects() {
+    const std::string filename = tempdir + "/" + mapname + ".snapshot";
+    if (!testNonEmptyFile(filename)) {
+        Error::warn("Snapshot file '%s' does not exist or is empty", filename.c_str());
+        return nullptr;
+    }
+
+    Timer timer;
+    ObjectSet *objects = new ObjectSet();
+    objects->snapshot = new Snapshot(filename);
+    if (!objects->snapshot->isValid()) {
+        Error::warn("Cannot use snapshot '%s'", filename.c_str());
+        delete objects;
+        return nullptr;
+    }
+
+    try
+    {
+        const Snapshot &snapshot = *objects->snapshot;
+        TaskGraph graph;
+        const TaskGraph::TaskId treesTask = graph.add("map trees", [objects, &snapshot]() {
+            objects->swedishTextTree = treeFromSnapshot<SwedishTextTree>(snapshot, Snapshot::SwedishTextTreeSection, "swedishTextTree");
+            objects->node2Coord = treeFromSnapshot<PagedIdTree<Coord> >(snapshot, Snapshot::Node2CoordSection, "node2Coord");
+            objects->wayNodes = treeFromSnapshot<IdTree<WayNodes, IdTreeLeanPolicy> >(snapshot, Snapshot::WayNodesSection, "wayNodes");
+            objects->relMembers = treeFromSnapshot<IdTree<RelationMem, IdTreeLeanPolicy> >(snapshot, Snapshot::RelMembersSection, "relMembers");
+            objects->nodeNames = treeFromSnapshot<NameTree>(snapshot, Snapshot::NodeNamesSection, "nodeNames");
+            objects->wayNames = treeFromSnapshot<NameTree>(snapshot, Snapshot::WayNamesSection, "wayNames");
+            objects->relationNames = treeFromSnapshot<NameTree>(snapshot, Snapshot::RelationNamesSection, "relationNames");
+        });
+        graph.add("read sweden", [objects, &snapshot]() {
+            objects->sweden = readFromSnapshot<Sweden>(snapshot, Snapshot::SwedenSection, "sweden");
+        }, {treesTask});
+        graph.run();
+    } catch (std::exception const &ex) {
+        Error::warn("Exception during reloading data from snapshot: %s", ex.what());
+        delete objects;
+        return nullptr;
+    }
+
+    if (objects->node2Coord == nullptr || objects->wayNodes == nullptr || objects->relMembers == nullptr || objects->nodeNames == nullptr || objects->wayNames == nullptr || objects->relationNames == nullptr || objects->swedishTextTree == nullptr || objects->sweden == nullptr) {
+        Error::warn("Snapshot '%s' is incomplete", filename.c_str());
+        delete objects;
+        return nullptr;
+    }
+
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    Error::info("Spent CPU time to reload snapshot of %.1f MiB: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", objects->snapshot->size() / 1048576.0, cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+    return objects;
+}
+
+void GlobalObjectManager::saveSnapshot() const {
+    const std::string filename = tempdir + "/" + mapname + ".snapshot";
+    Error::debug("Writing to '%s'", filename.c_str());
+    Timer timer;
+    SnapshotWriter writer(filename);
+    if (snapshot != nullptr) {
+        /// Sections are independent of their position in the file
+        for (const Snapshot::SectionId id : {Snapshot::Node2CoordSection, Snapshot::WayNodesSection, Snapshot::RelMembersSection, Snapshot::NodeNamesSection, Snapshot::WayNamesSection, Snapshot::RelationNamesSection, Snapshot::SwedishTextTreeSection}) {
+            const Snapshot::Section section = snapshot->section(id);
+            if (section.isValid())
+                writer.beginSection(id).write(section.remainingData(), section.remainingLength());
+        }
+    } else {
+        if (node2Coord != nullptr) {
+            /// Counters are only needed while importing map data
+            node2Coord->dropCounters();
+            node2Coord->writeSnapshot(writer.beginSection(Snapshot::Node2CoordSection));
+        }
+        if (wayNodes != nullptr)
+            wayNodes->writeSnapshot(writer.beginSection(Snapshot::WayNodesSection));
+        if (relMembers != nullptr)
+            relMembers->writeSnapshot(writer.beginSection(Snapshot::RelMembersSection));
+        if (nodeNames != nullptr)
+            nodeNames->writeSnapshot(writer.beginSection(Snapshot::NodeNamesSection));
+        if (wayNames != nullptr)
+            wayNames->writeSnapshot(writer.beginSection(Snapshot::WayNamesSection));
+        if (relationNames != nullptr)
+            relationNames->writeSnapshot(writer.beginSection(Snapshot::RelationNamesSection));
+        if (swedishTextTree != nullptr)
+            swedishTextTree->writeSnapshot(writer.beginSection(Snapshot::SwedishTextTreeSection));
+    }
+    if (sweden != nullptr)
+        sweden->write(writer.beginSection(Snapshot::SwedenSection));
+    if (manifest != nullptr)
+        manifest->write(writer.beginSection(Snapshot::ManifestSection));
+    if (!writer.finish())
+        Error::warn("Cannot write snapshot file");
+
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    Error::info("Spent CPU time to write snapshot: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
+}
+
+void GlobalObjectManager::stampArtifacts() {
+    for (const auto &artifact : parsedArtifacts)
+        manifest->setArtifact(artifact.first, artifact.second);
+    manifest->setArtifact(regionsArtifact, regionsBuilderVersion);
+}
+
+void GlobalObjectManager::saveManifest() const {
+    if (manifest == nullptr) return;
+    const std::string filename = tempdir + "/" + mapname + ".manifest";
+    const std::string temporaryFilename = filename + ".tmp";
+    Error::debug("Writing to '%s'", filename.c_str());
+    std::ofstream output(temporaryFilename);
+    manifest->write(output);
+    output.close();
+    if (output.fail() || rename(temporaryFilename.c_str(), filename.c_str()) != 0) {
+        Error::warn("Cannot write manifest '%s'", filename.c_str());
+        unlink(temporaryFilename.c_str());
+    }
+}
+
+void GlobalObjectManager::rebuildRegions() {
+    if (sweden == nullptr) return;
+
+    Error::info("Rebuilding region polygons and regional roads from loaded data");
+    Timer timer;
+    sweden->buildRegionPolygons();
+    sweden->fixUnlabeledRegionalRoads();
+    stampArtifacts();
+    if (snapshot != nullptr) {
+        saveSnapshot();
+        ObjectSet *published = shared_snapshot ? readSnapshotObjects() : nullptr;
+        if (published != nullptr) {
+            /// Other processes map the new snapshot file
+            useObjects(published);
+            configureLookupCaches();
+        }
+    } else {
+        saveSweden();
+        saveManifest();
+    }
+
+    int64_t cputime, walltime;
+    timer.elapsed(&cputime, &walltime);
+    Error::info("Spent CPU time to rebuild regions: %.1fms == %.1fs  (wall time: %.1fms == %.1fs)", cputime / 1000.0, cputime / 1000000.0, walltime / 1000.0, walltime / 1000000.0);
 }
 
 bool GlobalObjectManager::testNonEmptyFile(const std::string &filename, unsigned int minimumSize) {
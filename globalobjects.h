@@ -17,29 +17,132 @@
 #ifndef GLOBAL_OBJECTS_H
 #define GLOBAL_OBJECTS_H
 
+#include <functional>
+
 #include "idtree.h"
+#include "pagedidtree.h"
+#include "nametree.h"
 #include "swedishtexttree.h"
 #include "sweden.h"
+#include "snapshot.h"
 #include "timer.h"
+#include "types.h"
+
+namespace boost {
+class thread;
+}
+class BuildManifest;
+class TaskGraph;
 
-extern IdTree<WayNodes> *wayNodes; ///< defined in 'globalobjects.cpp'
-extern IdTree<Coord> *node2Coord; ///< defined in 'globalobjects.cpp'
-extern IdTree<RelationMem> *relMembers; ///< defined in 'globalobjects.cpp'
-extern IdTree<WriteableString> *nodeNames; ///< defined in 'globalobjects.cpp'
-extern IdTree<WriteableString> *wayNames; ///< defined in 'globalobjects.cpp'
-extern IdTree<WriteableString> *relationNames; ///< defined in 'globalobjects.cpp'
+extern IdTree<WayNodes, IdTreeLeanPolicy> *wayNodes; ///< defined in 'globalobjects.cpp'
+extern PagedIdTree<Coord> *node2Coord; ///< defined in 'globalobjects.cpp'
+extern IdTree<RelationMem, IdTreeLeanPolicy> *relMembers; ///< defined in 'globalobjects.cpp'
+extern NameTree *nodeNames; ///< defined in 'globalobjects.cpp'
+extern NameTree *wayNames; ///< defined in 'globalobjects.cpp'
+extern NameTree *relationNames; ///< defined in 'globalobjects.cpp'
 extern SwedishTextTree *swedishTextTree; ///< defined in 'globalobjects.cpp'
 extern Sweden *sweden; ///< defined in 'globalobjects.cpp'
 
+/**
+ * Name tree for elements of the given type. With configuration
+ * option 'lazy_name_trees', name trees get loaded in the background
+ * after startup. Until a tree is ready, this function either waits
+ * for it or returns nullptr, depending on that option. Name trees
+ * must not be accessed through nodeNames, wayNames, or relationNames
+ * while they may still be loading.
+ * @param type type of elements to get the name tree for
+ * @return name tree, or nullptr if not (yet) available
+ */
+const NameTree *nameTree(OSMElement::ElementType type);
+
+/**
+ * Wait until all name trees are ready, no matter how configuration
+ * option 'lazy_name_trees' is set.
+ */
+void waitForNameTrees();
+
 
 class GlobalObjectManager {
 public:
     GlobalObjectManager();
     ~GlobalObjectManager();
 
+    /**
+     * Hit and miss statistics of the lookup caches of all trees,
+     * each tree named as in configuration group 'lookup_cache'.
+     */
+    static std::vector<std::pair<std::string, LookupCacheStatistics> > lookupCacheStatistics();
+
+    /**
+     * Start loading the snapshot file anew in a background thread,
+     * for example after it has been replaced by one built from newer
+     * map data. Until finishReload() is called, all data structures
+     * currently in use stay untouched and the snapshot file may be
+     * replaced by renaming a new file over it, but not by overwriting
+     * it in place.
+     * @return false if a reload is already running or snapshots are disabled
+     */
+    bool startReload();
+    /**
+     * Make the data structures loaded since startReload() the ones
+     * in use and free the previous ones. Has to be called by the only
+     * thread using the data structures, at a time it does not use
+     * them, i.e. in between two requests.
+     * @return true if the data structures got replaced
+     */
+    bool finishReload();
+    /**
+     * File descriptor becoming readable once the data structures
+     * loaded since startReload() are ready for finishReload(),
+     * for use with select(..) and the like.
+     */
+    int reloadFileDescriptor() const;
+
 protected:
     void load();
     void save() const;
+    /**
+     * Load the name trees using the given functions. Unless
+     * 'lazy_name_trees' is enabled, the functions are added to the
+     * startup's task graph. Otherwise, they are run in a background
+     * thread, and each tree is marked ready once loaded, see nameTree(..).
+     */
+    void loadNameTrees(TaskGraph &graph, const std::function<void()> &nodeNamesLoader, const std::function<void()> &wayNamesLoader, const std::function<void()> &relationNamesLoader);
+
+    /**
+     * Load all data structures from the snapshot file, see Snapshot.
+     * @return false if no valid snapshot exists
+     */
+    bool loadSnapshot();
+    /**
+     * Write all data structures into a single snapshot file. Sections
+     * of data structures used in place from a snapshot, i.e. all but
+     * Sweden, get copied from that snapshot as they are.
+     */
+    void saveSnapshot() const;
+
+    /**
+     * Record in the manifest that all artifacts have been built from
+     * the current input files by the current code, see BuildManifest.
+     */
+    void stampArtifacts();
+    /**
+     * Write the manifest next to separate files, see 'snapshot_file'.
+     * Snapshots include their manifest instead.
+     */
+    void saveManifest() const;
+    /**
+     * Assemble region polygons and assign unlabeled regional roads to
+     * regions using the loaded data structures, then store the result.
+     * Regional roads assigned by earlier versions stay as they are.
+     */
+    void rebuildRegions();
+
+    /**
+     * Size the trees' lookup caches as configured in
+     * configuration group 'lookup_cache'.
+     */
+    static void configureLookupCaches();
 
     /**
      * Test if a file can be read and is not empty
@@ -49,7 +152,34 @@ protected:
     static bool testNonEmptyFile(const std::string &filename, unsigned int minimumSize = 16);
 
 private:
+    /// One complete set of the data structures in use
+    struct ObjectSet;
+
+    /**
+     * Load a complete set of data structures from the snapshot file,
+     * including the name trees, without touching those in use.
+     * @return loaded data structures, or nullptr if no valid snapshot exists
+     */
+    static ObjectSet *readSnapshotObjects();
+    /**
+     * Replace the data structures in use by the given set and delete
+     * the previous ones, which must not be in use anymore.
+     */
+    void useObjects(ObjectSet *objects);
+
     Timer timer;
+    /// Memory-mapped snapshot the data structures were loaded from, if any
+    Snapshot *snapshot;
+    /// Input files and artifacts built from them, see stampArtifacts()
+    BuildManifest *manifest;
+    /// Thread loading the name trees if 'lazy_name_trees' is enabled
+    boost::thread *nameTreeLoader;
+    /// Thread running readSnapshotObjects() after startReload()
+    boost::thread *reloader;
+    /// Result of the last reload, not yet in use
+    ObjectSet *reloadedObjects;
+    /// Written to by reloader once done, see reloadFileDescriptor()
+    int reloadPipe[2];
 };
 
 class PidFile {
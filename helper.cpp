@@ -18,6 +18,10 @@
 
 #include <queue>
 #include <set>
+#include <vector>
+#include <fstream>
+
+#include <unistd.h>
 
 #include "globalobjects.h"
 
@@ -27,15 +31,15 @@ OSMElement getNodeInOSMElement(const OSMElement &element) {
     /// a node; a node is needed to retrieve a coordinate from it
     while (cur.type != OSMElement::Node) {
         if (cur.type == OSMElement::Relation) {
-            RelationMem rm;
-            if (relMembers->retrieve(cur.id, rm) && rm.num_members > 0)
-                cur = rm.members[rm.num_members / 2]; ///< take a OSMElement in the middle of list of relation members
+            const RelationMem *rm = relMembers->view(cur.id);
+            if (rm != nullptr && rm->num_members > 0)
+                cur = rm->members[rm->num_members / 2]; ///< take a OSMElement in the middle of list of relation members
             else
                 break;
         } else if (cur.type == OSMElement::Way) {
-            WayNodes wn;
-            if (wayNodes->retrieve(cur.id, wn) && wn.num_nodes > 0)
-                cur = OSMElement(wn.nodes[wn.num_nodes / 2], OSMElement::Node, element.realworld_type); ///< take a node in the middle of the way
+            const WayNodes *wn = wayNodes->view(cur.id);
+            if (wn != nullptr && wn->num_nodes > 0)
+                cur = OSMElement(wn->nodes[wn->num_nodes / 2], OSMElement::Node, element.realworld_type); ///< take a node in the middle of the way
             else
                 break;
         }
@@ -55,36 +59,36 @@ bool getCenterOfOSMElement(const OSMElement &element, Coord &coord) {
         if (cur.type == OSMElement::Node)
             nodeIds.insert(cur.id);
         else if (cur.type == OSMElement::Way) {
-            WayNodes wn;
-            if (wayNodes->retrieve(cur.id, wn)) {
-                if (wn.num_nodes == 0)
+            const WayNodes *wn = wayNodes->view(cur.id);
+            if (wn != nullptr) {
+                if (wn->num_nodes == 0)
                     Error::err("Got %s without nodes: %llu", cur.operator std::string().c_str(), cur.id);
-                else if (wn.num_nodes == 1) {
-                    Error::warn("%s has only a single node: %llu", cur.operator std::string().c_str(), wn.nodes[0]);
-                    nodeIds.insert(wn.nodes[0]); ///< Way's only node
-                } else { /** wn.num_nodes>=2 */
-                    nodeIds.insert(wn.nodes[0]); ///< Way's first node
-                    nodeIds.insert(wn.nodes[wn.num_nodes - 1]); ///< Way's last node
-                    if (wn.num_nodes > 3) {
-                        nodeIds.insert(wn.nodes[wn.num_nodes / 2]); ///< Way's middle node
-                        if (wn.num_nodes > 6) {
-                            nodeIds.insert(wn.nodes[wn.num_nodes / 4]); ///< Way's 1st quartile node
-                            nodeIds.insert(wn.nodes[wn.num_nodes * 3 / 4]); ///< Way's 3st quartile node
-                            if (wn.num_nodes > 12) {
-                                nodeIds.insert(wn.nodes[wn.num_nodes / 8]);
-                                nodeIds.insert(wn.nodes[wn.num_nodes * 3 / 8]);
-                                nodeIds.insert(wn.nodes[wn.num_nodes * 5 / 8]);
-                                nodeIds.insert(wn.nodes[wn.num_nodes * 7 / 8]);
+                else if (wn->num_nodes == 1) {
+                    Error::warn("%s has only a single node: %llu", cur.operator std::string().c_str(), wn->nodes[0]);
+                    nodeIds.insert(wn->nodes[0]); ///< Way's only node
+                } else { /** wn->num_nodes>=2 */
+                    nodeIds.insert(wn->nodes[0]); ///< Way's first node
+                    nodeIds.insert(wn->nodes[wn->num_nodes - 1]); ///< Way's last node
+                    if (wn->num_nodes > 3) {
+                        nodeIds.insert(wn->nodes[wn->num_nodes / 2]); ///< Way's middle node
+                        if (wn->num_nodes > 6) {
+                            nodeIds.insert(wn->nodes[wn->num_nodes / 4]); ///< Way's 1st quartile node
+                            nodeIds.insert(wn->nodes[wn->num_nodes * 3 / 4]); ///< Way's 3st quartile node
+                            if (wn->num_nodes > 12) {
+                                nodeIds.insert(wn->nodes[wn->num_nodes / 8]);
+                                nodeIds.insert(wn->nodes[wn->num_nodes * 3 / 8]);
+                                nodeIds.insert(wn->nodes[wn->num_nodes * 5 / 8]);
+                                nodeIds.insert(wn->nodes[wn->num_nodes * 7 / 8]);
                             }
                         }
                     }
                 }
             }
         } else if (cur.type == OSMElement::Relation) {
-            RelationMem rm;
-            if (relMembers->retrieve(cur.id, rm)) {
-                for (int i = rm.num_members - 1; i >= 0; --i)
-                    queue.push(rm.members[i]);
+            const RelationMem *rm = relMembers->view(cur.id);
+            if (rm != nullptr) {
+                for (int i = rm->num_members - 1; i >= 0; --i)
+                    queue.push(rm->members[i]);
             }
         }
 
@@ -93,16 +97,19 @@ bool getCenterOfOSMElement(const OSMElement &element, Coord &coord) {
 
     if (nodeIds.empty()) return false; ///< no nodes referred to, nothing to do
 
+    const std::vector<uint64_t> nodeIdList(nodeIds.cbegin(), nodeIds.cend());
+    std::vector<Coord> coords(nodeIdList.size());
+    bool *found = (bool *)calloc(nodeIdList.size(), sizeof(bool));
+    node2Coord->retrieveMany(nodeIdList.data(), nodeIdList.size(), coords.data(), found);
     int64_t sumX = 0, sumY = 0;
     size_t count = 0;
-    for (const uint64_t nodeId : nodeIds) {
-        Coord c;
-        if (node2Coord->retrieve(nodeId, c)) {
-            sumX += c.x;
-            sumY += c.y;
+    for (size_t i = 0; i < nodeIdList.size(); ++i)
+        if (found[i]) {
+            sumX += coords[i].x;
+            sumY += coords[i].y;
             ++count;
         }
-    }
+    free(found);
 
     if (count > 0) {
         coord.x = sumX / count;
@@ -643,3 +650,11 @@ bool inSortedArray(const uint64_t *array, const size_t array_size, const uint64_
 
     return false;
 }
+
+size_t residentMemory() {
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0, residentPages = 0;
+    if (!(statm >> totalPages >> residentPages))
+        return 0;
+    return residentPages * sysconf(_SC_PAGESIZE);
+}
@@ -34,3 +34,10 @@ std::string rewrite_TeX_spaces(const std::string &input);
 #endif // LATEX_OUTPUT
 
 bool inSortedArray(const uint64_t *array, const size_t array_size, const uint64_t needle);
+
+/**
+ * Determine how much physical memory (RAM) this process occupies
+ * right now, as reported by the operating system.
+ * @return resident set size in bytes, 0 if unknown
+ */
+size_t residentMemory();
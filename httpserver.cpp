@@ -45,17 +45,32 @@ static const size_t maxBufferSize = 131072;
 int serverSocket;
 
 /// Internally used to quit server, may be set by signal handler
-bool doexitserver;
-
+volatile sig_atomic_t doexitserver;
+/// Internally used to reload map data, may be set by signal handler
+volatile sig_atomic_t doreloadserver;
+/// Last signal received, to be logged outside of the signal handler
+volatile sig_atomic_t receivedsignal;
+
+/**
+ * Only sets flags: logging is not async-signal-safe, as
+ * it may wait for a lock held by the interrupted code.
+ */
 void sigtermfn(int signal) {
-    if (signal == SIGTERM) {
-        Error::debug("Got SIGTERM");
-        doexitserver = true;
-    } else  if (signal == SIGINT) {
-        Error::debug("Got SIGINT");
-        doexitserver = true;
-    } else
-        Error::warn("Handling unknown signal %d", signal);
+    receivedsignal = signal;
+    if (signal == SIGHUP)
+        doreloadserver = 1;
+    else if (signal == SIGTERM || signal == SIGINT)
+        doexitserver = 1;
+}
+
+/**
+ * Fill a set with the signals handled by the HTTP server.
+ */
+static void serverSignals(sigset_t *sigset) {
+    sigemptyset(sigset);
+    sigaddset(sigset, SIGTERM);
+    sigaddset(sigset, SIGINT);
+    sigaddset(sigset, SIGHUP);
 }
 
 /// Taken from
@@ -72,6 +87,7 @@ int lat2tiley(double lat, int z)
 
 class HTTPServer::Private {
 public:
+    GlobalObjectManager &globalObjectManager;
     Timer timerServer, timerSearch;
     const char *start_time;
 
@@ -86,7 +102,8 @@ public:
         size_t pos;
     };
 
-    Private()
+    Private(GlobalObjectManager &_globalObjectManager)
+        : globalObjectManager(_globalObjectManager)
     {
         const time_t curtime = time(NULL);
         struct tm *brokentime = localtime(&curtime);
@@ -494,9 +511,11 @@ public:
                         case OSMElement::Relation: html_stream << "https://www.openstreetmap.org/relation/" + eid + "\">" << e.operator std::string(); break;
                         case OSMElement::UnknownElementType: html_stream << "https://www.openstreetmap.org/\">Unknown element type with id " << eid; break;
                         }
-                        const std::string name = e.name();
-                        if (!name.empty())
-                            html_stream << " (" + e.name() + ")";
+                        const char *name = e.name();
+                        if (name == nullptr)
+                            html_stream << " (" << e.nameOrPlaceholder() << ")";
+                        else if (name[0] != '\0')
+                            html_stream << " (" << name << ")";
                         html_stream << "</a></li>" << std::endl;
                     }
                     html_stream << "</ul></small>";
@@ -663,10 +682,39 @@ public:
         dprintf(fd, "Content-Length: %ld\r\n", html_code_size);
         dprintf(fd, "\r\n%s\r\n\r\n", html_code.c_str());
     }
+
+    /**
+     * Report the trees' lookup cache sizes, hits, and misses
+     * since loading, to tune the cache sizes under real load.
+     */
+    void writeCacheStatisticsJSON(int fd) {
+        std::ostringstream html_stream;
+        html_stream << "{" << std::endl;
+        const auto allStatistics = GlobalObjectManager::lookupCacheStatistics();
+        for (auto it = allStatistics.cbegin(); it != allStatistics.cend(); ++it) {
+            html_stream << "  \"" << it->first << "\": {" << std::endl;
+            html_stream << "    \"capacity\": " << it->second.capacity << "," << std::endl;
+            html_stream << "    \"hits\": " << it->second.hits << "," << std::endl;
+            html_stream << "    \"misses\": " << it->second.misses << "," << std::endl;
+            html_stream << "    \"hitrate\": " << it->second.hitRate() << std::endl;
+            html_stream << (it + 1 == allStatistics.cend() ? "  }" : "  },") << std::endl;
+        }
+        html_stream << "}";
+
+        const auto html_code = html_stream.str();
+        const auto html_code_size = html_code.length();
+
+        dprintf(fd, "HTTP/1.1 200 OK\r\n");
+        dprintf(fd, "Content-Type: application/json; charset=utf-8\n");
+        dprintf(fd, "Cache-Control: private, max-age=0, no-cache, no-store\r\n");
+        dprintf(fd, "Content-Transfer-Encoding: 8bit\r\n");
+        dprintf(fd, "Content-Length: %ld\r\n", html_code_size);
+        dprintf(fd, "\r\n%s\r\n\r\n", html_code.c_str());
+    }
 };
 
-HTTPServer::HTTPServer()
-    : d(new Private())
+HTTPServer::HTTPServer(GlobalObjectManager &_globalObjectManager)
+    : d(new Private(_globalObjectManager))
 {
     /// Sort testsets by their names
     std::sort(testsets.begin(), testsets.end(), [](struct testset & a, struct testset & b) {
@@ -678,6 +726,12 @@ HTTPServer::~HTTPServer() {
     delete d;
 }
 
+void HTTPServer::blockSignals() {
+    sigset_t sigset;
+    serverSignals(&sigset);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+}
+
 void HTTPServer::run() {
     /** Turn off bind address checking, and allow port numbers to be reused
      *  - otherwise the TIME_WAIT phenomenon will prevent binding to these
@@ -726,28 +780,35 @@ void HTTPServer::run() {
     const unsigned char a4 = serverName.sin_addr.s_addr == 0x0 ? 1 : (serverName.sin_addr.s_addr >> 24) & 255;
     Error::debug("Try http://%d.%d.%d.%d:%d/ to reach it", a1, a2, a3, a4, htons(serverName.sin_port));
 
-    doexitserver = false;
-    /// Install the signal handler for SIGTERM and SIGINT
+    doexitserver = 0;
+    doreloadserver = 0;
+    receivedsignal = 0;
+    /// Install the signal handler for SIGTERM, SIGINT, and SIGHUP
     struct sigaction s;
     s.sa_handler = sigtermfn;
     sigemptyset(&s.sa_mask);
     s.sa_flags = 0;
     sigaction(SIGTERM, &s, NULL);
     sigaction(SIGINT, &s, NULL);
+    sigaction(SIGHUP, &s, NULL);
 
-    /// Block SIGTERM and SIGINT
-    sigset_t sigset, oldsigset;
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGTERM);
-    sigaddset(&sigset, SIGINT);
+    /// Block SIGTERM, SIGINT, and SIGHUP, unless already done by
+    /// blockSignals(), and unblock them only while waiting in pselect(..)
+    sigset_t sigset, oldsigset, waitsigset;
+    serverSignals(&sigset);
     sigprocmask(SIG_BLOCK, &sigset, &oldsigset);
+    waitsigset = oldsigset;
+    sigdelset(&waitsigset, SIGTERM);
+    sigdelset(&waitsigset, SIGINT);
+    sigdelset(&waitsigset, SIGHUP);
 
     ResultGenerator resultGenerator;
     static const size_t maxNumberSlaveSockets = 16;
     size_t numberOfUsedSlaveSockets = 0;
     HTTPServer::Private::SlaveConnection slaveConnections[maxNumberSlaveSockets];
 
-    Error::info("Press Ctrl+C or send SIGTERM or SIGINT to pid %d", getpid());
+    Error::info("Press Ctrl+C or send SIGTERM or SIGINT to pid %d, send SIGHUP to reload the snapshot file", getpid());
+    const int reloadFd = d->globalObjectManager.reloadFileDescriptor();
     while (!doexitserver) {
         d->timerServer.start();
 
@@ -756,6 +817,11 @@ void HTTPServer::run() {
         FD_ZERO(&readfds);
         int maxSocket = serverSocket;
         FD_SET(serverSocket, &readfds); ///< Watch server socket for incoming requests
+        if (reloadFd >= 0) {
+            FD_SET(reloadFd, &readfds); ///< Watch for reloaded data becoming ready
+            if (reloadFd > maxSocket)
+                maxSocket = reloadFd;
+        }
         for (size_t i = 0; i < maxNumberSlaveSockets; ++i) {
             if (slaveConnections[i].socket < 0) continue;
             FD_SET(slaveConnections[i].socket, &readfds);
@@ -771,10 +837,10 @@ void HTTPServer::run() {
         timeout.tv_sec = timeout_sec;
         timeout.tv_nsec = 0;
 
-        const int pselect_result = pselect(maxSocket + 1, &readfds, NULL /** writefds */, NULL /** errorfds */, &timeout, &oldsigset);
+        const int pselect_result = pselect(maxSocket + 1, &readfds, NULL /** writefds */, NULL /** errorfds */, &timeout, &waitsigset);
         if (pselect_result < 0) {
             if (errno == EINTR)
-                Error::debug("pselect(..) received signal: doexitserver=%s", doexitserver ? "true" : "false");
+                Error::debug("pselect(..) received signal '%s': doexitserver=%s", strsignal(receivedsignal), doexitserver ? "true" : "false");
             else
                 Error::err("pselect(...)  errno=%d  select_result=%d", errno, pselect_result);
         } else if (pselect_result == 0) {
@@ -792,7 +858,14 @@ void HTTPServer::run() {
 
         if (doexitserver)
             break;
-        else if (FD_ISSET(serverSocket, &readfds)) {
+        else if (doreloadserver) {
+            doreloadserver = 0;
+            d->globalObjectManager.startReload();
+        } else if (reloadFd >= 0 && FD_ISSET(reloadFd, &readfds)) {
+            /// Requests are processed one at a time in this loop,
+            /// so no request is using the current data right now
+            d->globalObjectManager.finishReload();
+        } else if (FD_ISSET(serverSocket, &readfds)) {
             /// Connection attempt on server
             socklen_t sockaddr_in_size = sizeof(struct sockaddr_in);
             struct sockaddr_in their_addr;
@@ -912,6 +985,8 @@ void HTTPServer::run() {
                         if (getfilename == "/")
                             /// Serve default search form
                             d->writeFormHTML(slaveConnections[i].socket);
+                        else if (getfilename == "/cachestatistics")
+                            d->writeCacheStatisticsJSON(slaveConnections[i].socket);
                         else if (!http_public_files.empty())
                             d->deliverFile(slaveConnections[i].socket, getfilename.c_str());
                         else {
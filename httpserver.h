@@ -17,13 +17,27 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
+class GlobalObjectManager;
+
 class HTTPServer {
 public:
-    HTTPServer();
+    /**
+     * @param _globalObjectManager manager of the data structures, to reload them on SIGHUP
+     */
+    explicit HTTPServer(GlobalObjectManager &_globalObjectManager);
     ~HTTPServer();
 
     void run();
 
+    /**
+     * Block the signals handled by run() in the calling thread and
+     * in all threads it creates afterwards. Call this before any
+     * thread gets created, so that no other thread than the server
+     * loop receives these signals. They remain pending until run()
+     * starts waiting for requests.
+     */
+    static void blockSignals();
+
 private:
     class Private;
     Private *const d;
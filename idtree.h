@@ -22,21 +22,26 @@
 #include <istream>
 #include <ostream>
 #include <limits>
+#include <vector>
 
 #include <osmpbf/osmpbf.h>
 
 #include "error.h"
 #include "types.h"
 #include "global.h"
+#include "lookupcache.h"
+#include "eliasfano.h"
+#include "epochmanager.h"
+#include "snapshot.h"
 
 struct WayNodes {
     WayNodes()
-        : num_nodes(0), nodes(nullptr) {
+        : num_nodes(0), mapped(false), nodes(nullptr) {
         /// nothing
     }
 
     WayNodes(uint32_t _num_nodes)
-        : num_nodes(_num_nodes), nodes(nullptr) {
+        : num_nodes(_num_nodes), mapped(false), nodes(nullptr) {
         if (num_nodes == 0)
             Error::err("Creating way without nodes");
         nodes = (uint64_t *)calloc(_num_nodes, sizeof(uint64_t));
@@ -44,11 +49,32 @@ struct WayNodes {
             Error::err("Could not allocate memory for WayNodes::nodes");
     }
 
+    /**
+     * Refer to nodes stored elsewhere, such as inside a memory-mapped
+     * snapshot, without copying them. The nodes do not get freed.
+     */
+    WayNodes(uint32_t _num_nodes, const uint64_t *_nodes)
+        : num_nodes(_num_nodes), mapped(true), nodes(const_cast<uint64_t *>(_nodes)) {
+        /// nothing
+    }
+
+    WayNodes(const WayNodes &other)
+        : num_nodes(other.num_nodes), mapped(false), nodes(nullptr) {
+        if (num_nodes > 0) {
+            const size_t bytes = num_nodes * sizeof(uint64_t);
+            nodes = (uint64_t *)malloc(bytes);
+            if (nodes == nullptr)
+                Error::err("Could not allocate memory for WayNodes::nodes");
+            memcpy(nodes, other.nodes, bytes);
+        }
+    }
+
     WayNodes &operator=(const WayNodes &other) {
         if (other.num_nodes == 0 || other.nodes == nullptr)
             Error::err("Assigning way without nodes");
 
-        if (nodes != nullptr) free(nodes);
+        if (nodes != nullptr && !mapped) free(nodes);
+        mapped = false;
 
         /// Cast to circumvene 'const'ness
         uint32_t *_num_nodes = (uint32_t *)(&num_nodes);
@@ -64,7 +90,7 @@ struct WayNodes {
     }
 
     WayNodes(std::istream &input)
-        : num_nodes(0), nodes(nullptr) {
+        : num_nodes(0), mapped(false), nodes(nullptr) {
         /// Cast to circumvene 'const'ness
         uint32_t *_num_nodes = (uint32_t *)(&num_nodes);
         input.read((char *)_num_nodes, sizeof(num_nodes));
@@ -83,11 +109,11 @@ struct WayNodes {
     }
 
     ~WayNodes() {
-        if (nodes != nullptr)
+        if (nodes != nullptr && !mapped)
             free(nodes);
     }
 
-    std::ostream &write(std::ostream &output) {
+    std::ostream &write(std::ostream &output) const {
         output.write((char *)&num_nodes, sizeof(num_nodes));
         if (!output)
             Error::err("Could not write number of nodes to output stream");
@@ -102,6 +128,8 @@ struct WayNodes {
     }
 
     const uint32_t num_nodes;
+    /// Set if 'nodes' is not owned by this object
+    bool mapped;
     uint64_t *nodes;
 };
 
@@ -109,12 +137,12 @@ enum RelationFlags {RoleOuter = 1, RoleInner = 2, RoleInnerOuter = RoleOuter | R
 
 struct RelationMem {
     RelationMem()
-        : num_members(0), members(nullptr), member_flags(nullptr) {
+        : num_members(0), mapped(false), members(nullptr), member_flags(nullptr) {
         /// nothing
     }
 
     RelationMem(int num)
-        : num_members(num), members(nullptr), member_flags(nullptr) {
+        : num_members(num), mapped(false), members(nullptr), member_flags(nullptr) {
         if (num_members <= 0)
             Error::err("Creating relation without members");
 
@@ -126,14 +154,41 @@ struct RelationMem {
             Error::err("Could not allocate memory for RelationMem::member_flags");
     }
 
+    /**
+     * Refer to members stored elsewhere, such as inside a memory-mapped
+     * snapshot, without copying them. The members do not get freed.
+     */
+    RelationMem(uint32_t num, const OSMElement *_members, const uint16_t *_member_flags)
+        : num_members(num), mapped(true), members(const_cast<OSMElement *>(_members)), member_flags(const_cast<uint16_t *>(_member_flags)) {
+        /// nothing
+    }
+
+    RelationMem(const RelationMem &other)
+        : num_members(other.num_members), mapped(false), members(nullptr), member_flags(nullptr) {
+        if (num_members > 0) {
+            const size_t bytesElements = num_members * sizeof(OSMElement);
+            members = (OSMElement *)malloc(bytesElements);
+            if (members == nullptr)
+                Error::err("Could not allocate memory for RelationMem::members");
+            memcpy(members, other.members, bytesElements);
+
+            const size_t bytesFlags = num_members * sizeof(uint16_t);
+            member_flags = (uint16_t *)malloc(bytesFlags);
+            if (member_flags == nullptr)
+                Error::err("Could not allocate memory for RelationMem::member_flags");
+            memcpy(member_flags, other.member_flags, bytesFlags);
+        }
+    }
+
     RelationMem &operator=(const RelationMem &other) {
         if (other.num_members == 0 || other.members == nullptr || other.member_flags == nullptr)
             Error::err("Assigning relation without members");
 
-        if (members != nullptr)
+        if (members != nullptr && !mapped)
             free(members);
-        if (member_flags != nullptr)
+        if (member_flags != nullptr && !mapped)
             free(member_flags);
+        mapped = false;
 
         /// Cast to circumvene 'const'ness
         uint32_t *_num_members = (uint32_t *)(&num_members);
@@ -155,7 +210,7 @@ struct RelationMem {
     }
 
     RelationMem(std::istream &input)
-        : num_members(0), members(nullptr), member_flags(nullptr) {
+        : num_members(0), mapped(false), members(nullptr), member_flags(nullptr) {
         /// Cast to circumvene 'const'ness
         uint32_t *_num_members = (uint32_t *)(&num_members);
         input.read((char *)_num_members, sizeof(num_members));
@@ -182,13 +237,15 @@ struct RelationMem {
     }
 
     ~RelationMem() {
-        if (members != nullptr)
-            free(members);
-        if (member_flags != nullptr)
-            free(member_flags);
+        if (!mapped) {
+            if (members != nullptr)
+                free(members);
+            if (member_flags != nullptr)
+                free(member_flags);
+        }
     }
 
-    std::ostream &write(std::ostream &output) {
+    std::ostream &write(std::ostream &output) const {
         output.write((char *)&num_members, sizeof(num_members));
         if (!output)
             Error::err("Could not write number of members to output stream");
@@ -209,6 +266,8 @@ struct RelationMem {
     }
 
     const uint32_t num_members;
+    /// Set if 'members' and 'member_flags' are not owned by this object
+    bool mapped;
     OSMElement *members;
     uint16_t *member_flags;
 };
@@ -257,7 +316,7 @@ public:
         return *this;
     }
 
-    std::ostream &write(std::ostream &output) {
+    std::ostream &write(std::ostream &output) const {
         const char *data = c_str();
         const size_t len = length();
         output.write((char *)&len, sizeof(len));
@@ -340,7 +399,7 @@ struct Coord {
         x = y = 0;
     }
 
-    std::ostream &write(std::ostream &output) {
+    std::ostream &write(std::ostream &output) const {
         output.write((char *)&x, sizeof(x));
         if (!output)
             Error::err("Could not write coordinates to output stream");
@@ -493,19 +552,170 @@ struct hash<Coord>
 }
 
 
-template <typename T>
+/**
+ * Policies select the memory layout of an IdTree at compile time.
+ * While importing map data, elements' counters have to be tracked
+ * (build layout). A tree only used for lookups once map data has
+ * been imported can do without them (lean layout).
+ * Trees of either layout read and write the same serialization
+ * format as long as they use the same number of bits per node.
+ */
+struct IdTreeBuildPolicy {
+    /// Each element has a counter, see IdTree::increaseCounter(..)
+    static const bool withCounter = true;
+#ifdef DEBUG
+    /// Each element records its own id to validate lookups
+    static const bool withId = true;
+#else // DEBUG
+    static const bool withId = false;
+#endif // DEBUG
+    /// Each inner node consumes this many bits of an id,
+    /// i.e. has up to 2^bitsPerNode children
+    static const int bitsPerNode = 4;
+};
+
+struct IdTreeLeanPolicy {
+    static const bool withCounter = false;
+    static const bool withId = false;
+    static const int bitsPerNode = 4;
+};
+
+template <typename T, class Policy = IdTreeBuildPolicy>
 struct IdTreeNode;
 
+/**
+ * Layout of an IdTree's elements in a snapshot, see
+ * IdTree<T>::writeSnapshot(..). Elements are stored as flat arrays in
+ * ascending id order; reading them creates elements referring to
+ * these arrays instead of copies. Trees of value types without a
+ * specialization of this codec cannot be written to a snapshot.
+ */
 template <class T>
+struct IdTreeSnapshotCodec {
+    static const bool available = false;
+
+    static void write(std::ostream &, const std::vector<const T *> &) {
+        /// nothing
+    }
+
+    static void read(Snapshot::Section &, const size_t, std::vector<T> &) {
+        /// nothing
+    }
+};
+
+/**
+ * Ways are stored as the position of each way's first node in an
+ * array of all ways' nodes (one more position marking the end),
+ * followed by this array.
+ */
+template <>
+struct IdTreeSnapshotCodec<WayNodes> {
+    static const bool available = true;
+
+    static void write(std::ostream &output, const std::vector<const WayNodes *> &values) {
+        std::vector<uint64_t> starts(1, 0);
+        starts.reserve(values.size() + 1);
+        for (const WayNodes *wn : values)
+            starts.push_back(starts.back() + wn->num_nodes);
+        SnapshotWriter::writeArray(output, starts.data(), starts.size());
+        for (const WayNodes *wn : values)
+            SnapshotWriter::writeArray(output, wn->nodes, wn->num_nodes);
+    }
+
+    static void read(Snapshot::Section &section, const size_t count, std::vector<WayNodes> &values) {
+        const uint64_t *starts = section.array<uint64_t>(count + 1);
+        const uint64_t *nodes = section.array<uint64_t>(starts[count]);
+        values.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (starts[i + 1] <= starts[i] || starts[i + 1] - starts[i] > UINT32_MAX || starts[i + 1] > starts[count])
+                throw DataError("IdTreeSnapshotCodec<WayNodes>: Inconsistent way %llu in snapshot", (unsigned long long)i);
+            values.emplace_back((uint32_t)(starts[i + 1] - starts[i]), nodes + starts[i]);
+        }
+    }
+};
+
+/**
+ * Relations are stored like ways, see IdTreeSnapshotCodec<WayNodes>,
+ * with an array of all relations' members followed by an array of
+ * all members' flags.
+ */
+template <>
+struct IdTreeSnapshotCodec<RelationMem> {
+    static const bool available = true;
+
+    static void write(std::ostream &output, const std::vector<const RelationMem *> &values) {
+        std::vector<uint64_t> starts(1, 0);
+        starts.reserve(values.size() + 1);
+        for (const RelationMem *rm : values)
+            starts.push_back(starts.back() + rm->num_members);
+        SnapshotWriter::writeArray(output, starts.data(), starts.size());
+        std::vector<uint16_t> flags;
+        flags.reserve(starts.back());
+        for (const RelationMem *rm : values) {
+            SnapshotWriter::writeArray(output, rm->members, rm->num_members);
+            flags.insert(flags.end(), rm->member_flags, rm->member_flags + rm->num_members);
+        }
+        SnapshotWriter::writeArray(output, flags.data(), flags.size());
+    }
+
+    static void read(Snapshot::Section &section, const size_t count, std::vector<RelationMem> &values) {
+        const uint64_t *starts = section.array<uint64_t>(count + 1);
+        const OSMElement *members = section.array<OSMElement>(starts[count]);
+        const uint16_t *flags = section.array<uint16_t>(starts[count]);
+        values.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (starts[i + 1] <= starts[i] || starts[i + 1] - starts[i] > UINT32_MAX || starts[i + 1] > starts[count])
+                throw DataError("IdTreeSnapshotCodec<RelationMem>: Inconsistent relation %llu in snapshot", (unsigned long long)i);
+            values.emplace_back((uint32_t)(starts[i + 1] - starts[i]), members + starts[i], flags + starts[i]);
+        }
+    }
+};
+
+template <class T, class Policy = IdTreeBuildPolicy>
 class IdTree
 {
 public:
     explicit IdTree();
     explicit IdTree(std::istream &input);
+    /**
+     * Use the elements written by writeSnapshot(..) right where the
+     * snapshot is mapped into memory. The tree is frozen (see
+     * freeze()), and the elements refer to arrays inside the
+     * snapshot, which has to outlive the tree. Modifying the tree
+     * copies all elements into a trie first.
+     * @param section section positioned at the tree
+     */
+    explicit IdTree(Snapshot::Section &section);
     ~IdTree();
 
     bool insert(uint64_t id, T const &);
     bool retrieve(const uint64_t id, T &) const;
+    /**
+     * Look up the data stored for an id without copying it: the
+     * returned pointer refers to the tree's own storage and remains
+     * valid until the id gets removed or overwritten or the tree gets
+     * deleted. Neither allocates memory nor uses the lookup cache,
+     * which makes it the preferred way to access elements that are
+     * expensive to copy such as WayNodes or RelationMem.
+     * If the tree may get modified through an Update meanwhile, the
+     * pointer is only valid as long as the calling thread holds a
+     * ReadGuard for this tree.
+     * @param id id to look up
+     * @return pointer to the stored data or nullptr if id is not in this tree
+     */
+    const T *view(const uint64_t id) const;
+    /**
+     * Retrieve the data for many ids at once, which is faster than
+     * calling retrieve(..) for each id: ids are visited in sorted
+     * order, so that each lookup can continue from the path shared
+     * with the previous id.
+     * @param ids array of n ids to look up
+     * @param n number of ids
+     * @param out array of n elements, receives the data of each found id
+     * @param found array of n flags, set to whether the corresponding id was found
+     * @return number of ids found
+     */
+    size_t retrieveMany(const uint64_t *ids, size_t n, T *out, bool *found) const;
     bool remove(uint64_t id);
     /**
      * The number of elements inserted (and not yet removed)
@@ -514,10 +724,173 @@ public:
      */
     size_t size() const;
 
+    /**
+     * Counters are only available if the tree's policy provides
+     * them, otherwise calling these functions is an error.
+     */
     uint16_t counter(const uint64_t id) const;
     void increaseCounter(const uint64_t id);
 
+    /**
+     * Replace the trie by a read-only representation, for example
+     * once importing map data is complete and the tree is only read.
+     * Ids are kept in an EliasFanoIdSet, which determines an id's
+     * position among all ids, and the elements' data in an array in
+     * the same order. This takes less memory than the trie's nodes
+     * and a lookup does not have to descend through the trie's levels.
+     * Modifying a frozen tree by insert(..), remove(..), or
+     * increaseCounter(..) rebuilds the trie first, whereas an Update
+     * keeps the frozen arrays, see there. Freezing again after an
+     * Update merges its modifications into new arrays.
+     * Elements' counters are not kept and read as zero.
+     */
+    void freeze();
+
+    /**
+     * Number of bytes occupied by this tree's nodes and leaves or,
+     * if frozen, its ids and array of elements, not counting memory
+     * allocated by the elements themselves.
+     */
+    size_t memoryUsage() const;
+
+    /// Number of lookup cache entries per thread unless set otherwise
+    static const size_t defaultCacheSize = 1024;
+    /**
+     * Change the size of the cache used by retrieve(..), which
+     * remembers for recently retrieved ids where their data is
+     * stored. Each thread has its own entries.
+     * @param entries number of entries per thread, 0 disables the cache
+     */
+    void setCacheSize(size_t entries);
+    /**
+     * Number of hits and misses of the lookup cache over all threads
+     * since this tree was created.
+     */
+    LookupCacheStatistics cacheStatistics() const;
+
     std::ostream &write(std::ostream &output);
+    /**
+     * Write this tree's elements to a snapshot section in ascending
+     * id order, to be used by IdTree(Snapshot::Section &). The value
+     * type needs an IdTreeSnapshotCodec<T>. Counters are not written.
+     */
+    std::ostream &writeSnapshot(std::ostream &output) const;
+
+    /**
+     * Call a function for each element in the order of the tree's
+     * leaves, which is ascending id order if REVERSE_ID_TREE is defined.
+     * @param visitor function taking an id and the id's data
+     */
+    template <class Visitor>
+    void forEach(Visitor visitor) const;
+
+    /**
+     * Fills a tree with elements arriving in ascending order, such
+     * as ids read from an .osm.pbf file. Instead of descending from
+     * the root for each element, the tree gets built bottom-up: only
+     * the nodes on the path to the most recent element are kept open,
+     * and each node is created with its final size once no further
+     * children can arrive for it.
+     * Ascending order refers to the order of leaves in the tree,
+     * which is the ids' order if REVERSE_ID_TREE is defined. Once an
+     * element arrives out of order or if the tree was not empty when
+     * loading started, elements get added using insert(..) instead.
+     * The tree must not be accessed otherwise until finish() has been
+     * called or the loader has been deleted.
+     */
+    class BulkLoader
+    {
+    public:
+        explicit BulkLoader(IdTree &tree);
+        ~BulkLoader();
+
+        void append(uint64_t id, T const &data);
+        /**
+         * Complete the tree from the elements appended so far.
+         * Elements appended afterwards get inserted one by one.
+         */
+        void finish();
+
+    private:
+        void closeLevel(unsigned int level);
+
+        IdTree &tree;
+        bool bottomUp;
+        uint64_t lastId;
+        /// Children collected for each level's open node, i.e.
+        /// positions and references of numChildren many entries
+        std::vector<uint8_t> keys;
+        std::vector<uint32_t> refs;
+        std::vector<unsigned int> counts;
+    };
+
+    /**
+     * Modifies a tree while other threads keep reading it, for example
+     * to apply corrections to map data while serving queries.
+     *
+     * Modifications are copy-on-write: instead of changing the nodes
+     * on the path to an element, copies of them get modified, which
+     * form a new version of the tree together with all unchanged
+     * nodes. Readers keep using the version that was current when
+     * they started a lookup, until commit() makes the new version
+     * current by atomically replacing the tree's root. Nodes and
+     * leaves of previous versions get reclaimed by later commits or
+     * reclaimVersions() once no reader can access them anymore, as
+     * determined by an EpochManager.
+     *
+     * Only one Update may exist for a tree at a time, and the tree must
+     * not be modified otherwise, for example by insert(..), while
+     * readers are active. Lookups by retrieve(..) and the other const
+     * functions are only safe during an update while the reading
+     * thread holds a ReadGuard, which lookups do not take on their
+     * own so that trees without updates do not pay for it. write(..)
+     * waits until the Update has been deleted.
+     *
+     * Frozen trees, as used by the server, keep their arrays of ids
+     * and elements unchanged. Inserted elements go into the otherwise
+     * empty trie, which takes precedence over the arrays, and removed
+     * frozen ids into a sorted list, of which each commit publishes a
+     * modified copy. Replaced lists get reclaimed like nodes.
+     */
+    class Update
+    {
+    public:
+        explicit Update(IdTree &tree);
+        /// Commits all modifications not committed yet
+        ~Update();
+
+        bool insert(uint64_t id, T const &data);
+        bool remove(uint64_t id);
+        /**
+         * Make all modifications so far visible to readers.
+         * The update may continue with further modifications.
+         */
+        void commit();
+
+    private:
+        IdTree &tree;
+    };
+
+    /**
+     * Keeps the version of a tree that is current when the guard
+     * gets created from being reclaimed until the guard is deleted,
+     * see Update. Guards may be nested.
+     */
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(const IdTree &tree);
+
+    private:
+        EpochManager::Guard guard;
+    };
+
+    /**
+     * Free the nodes and leaves of versions replaced by an Update
+     * that no reader can access anymore.
+     * @return number of nodes and leaves freed
+     */
+    size_t reclaimVersions();
 
 private:
     class Private;
@@ -14,484 +14,1803 @@
  *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
  ***************************************************************************/
 
+
+#include <algorithm>
+#include <memory>
 #include <vector>
+#include <unordered_set>
 #include <typeinfo>
 
-template <typename T>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "slab.h"
+#include "bufferedreader.h"
+
+/**
+ * Inner nodes of an IdTree come in different sizes, depending on
+ * how many children they have. To avoid long chains of inner nodes
+ * with only a single child, as they occur on the upper levels where
+ * most ids have all bits set to zero, such chains are collapsed into
+ * the chain's last node ('path compression'). Each inner node
+ * records the level at which it branches ('depth') and the id bits
+ * of all levels above it ('prefix'), which every id in this node's
+ * subtree shares.
+ * Leaves, holding the actual data, are children of inner nodes on
+ * the last level only.
+ *
+ * Inner nodes with up to N children store the positions of their
+ * children ('keys') in a sorted list next to the references to them.
+ */
+template <typename T, unsigned int N>
+struct IdTreeSparseNode {
+    explicit IdTreeSparseNode()
+        : prefix(0), depth(0), count(0) {
+        /// nothing
+    }
+
+    inline uint32_t child(const unsigned int c) const {
+        for (unsigned int i = 0; i < count; ++i)
+            if (keys[i] == c) return children[i];
+        return 0;
+    }
+
+    inline uint32_t *childSlot(const unsigned int c) {
+        for (unsigned int i = 0; i < count; ++i)
+            if (keys[i] == c) return &children[i];
+        return nullptr;
+    }
+
+    /// Requires that this node has fewer than N children
+    void insertChild(const unsigned int c, const uint32_t ref) {
+        unsigned int i = count;
+        for (; i > 0 && keys[i - 1] > c; --i) {
+            keys[i] = keys[i - 1];
+            children[i] = children[i - 1];
+        }
+        keys[i] = c;
+        children[i] = ref;
+        ++count;
+    }
+
+    void removeChild(const unsigned int c) {
+        unsigned int i = 0;
+        while (i < count && keys[i] != c) ++i;
+        if (i >= count) return;
+        for (--count; i < count; ++i) {
+            keys[i] = keys[i + 1];
+            children[i] = children[i + 1];
+        }
+    }
+
+    uint64_t prefix;
+    uint8_t depth;
+    uint8_t count;
+    uint8_t keys[N];
+    uint32_t children[N];
+};
+
+/**
+ * Inner node of an IdTree with room for all possible children,
+ * addressed directly by their position.
+ */
+template <typename T, class Policy>
 struct IdTreeNode {
-    static const int bitsPerNode;
-    static const int bitsPerId;
-    static const unsigned int numChildren;
+    static const int bitsPerNode = Policy::bitsPerNode;
+    static const int bitsPerId = 64;
+    static const unsigned int numChildren = 1 << bitsPerNode;
 
     explicit IdTreeNode()
-    {
-        children = nullptr;
-#ifdef DEBUG
-        id = 0;
-#endif // DEBUG
-        counter = 0;
+        : prefix(0), depth(0), count(0) {
+        std::fill(children, children + numChildren, 0);
     }
 
-    explicit IdTreeNode(std::istream &input) {
-        counter = 0;
-#ifdef DEBUG
-        input.read((char *)&id, sizeof(id));
-#endif // DEBUG
+    inline uint32_t child(const unsigned int c) const {
+        return children[c];
+    }
 
-        char chr;
-        input.read((char *)&chr, sizeof(chr));
+    inline uint32_t *childSlot(const unsigned int c) {
+        return children[c] != 0 ? &children[c] : nullptr;
+    }
 
-        if (chr == 'N') {
-            /// Is leaf node
-            children = nullptr;
-            input.read((char *)&counter, sizeof(counter));
-            data = T(input);
-        } else if (chr == 'C') {
-            /// Is inner node
-            const size_t bytes = numChildren * sizeof(IdTreeNode<T> *);
-            children = (IdTreeNode<T> **)malloc(bytes);
-
-            for (int c = numChildren - 1; c >= 0; --c) {
-                input.read((char *)&chr, sizeof(chr));
-                if (chr == '0') {
-                    /// No child at this position
-                    children[c] = nullptr;
-                } else if (chr == '1') {
-                    children[c] = new IdTreeNode<T>(input);
-                } else
-                    Error::err("IdTree<%s>: Expected '0' or '1', got '0x%02x' at position %d", typeid(T).name(), chr, input.tellg());
-            }
-        } else
-            Error::err("IdTree<%s>: Expected 'N' or 'C', got '0x%02x' at position %d", typeid(T).name(), chr, input.tellg());
+    void insertChild(const unsigned int c, const uint32_t ref) {
+        children[c] = ref;
+        ++count;
     }
 
-    ~IdTreeNode() {
-        if (children != nullptr) {
-            for (int i = (1 << bitsPerNode) - 1; i >= 0; --i) {
-                if (children[i] != nullptr)
-                    delete children[i];
-            }
-            free(children);
-        }
+    void removeChild(const unsigned int c) {
+        if (children[c] == 0) return;
+        children[c] = 0;
+        --count;
     }
 
-    std::ostream &write(std::ostream &output) {
-#ifdef DEBUG
-        output.write((char *)&id, sizeof(id));
-#endif // DEBUG
+    uint64_t prefix;
+    uint8_t depth;
+    uint8_t count;
+    uint32_t children[numChildren];
+};
 
-        char chr = '\0';
-        if (children == nullptr) {
-            /// Is leaf node
-            chr = 'N';
-            output.write((char *)&chr, sizeof(chr));
-            output.write((char *)&counter, sizeof(counter));
-            data.write(output);
-        } else {
-            /// Is inner node
-            chr = 'C';
-            output.write((char *)&chr, sizeof(chr));
-            for (int c = numChildren - 1; c >= 0; --c) {
-                if (children[c] == nullptr) {
-                    chr = '0';
-                    output.write((char *)&chr, sizeof(chr));
-                } else {
-                    chr = '1';
-                    output.write((char *)&chr, sizeof(chr));
-                    children[c]->write(output);
-                }
-            }
-        }
+template <typename T, class Policy>
+const int IdTreeNode<T, Policy>::bitsPerNode;
+template <typename T, class Policy>
+const int IdTreeNode<T, Policy>::bitsPerId;
+template <typename T, class Policy>
+const unsigned int IdTreeNode<T, Policy>::numChildren;
 
-        return output;
+/**
+ * Optional fields of an IdTree's leaves as selected by the tree's
+ * policy. If a field is not selected, its base class is empty and
+ * does not take any space in the leaf.
+ */
+template <bool withId>
+struct IdTreeLeafId {
+    explicit IdTreeLeafId()
+        : id(0) {
+        /// nothing
     }
 
-    IdTreeNode<T> **children;
+    inline void setId(const uint64_t _id) {
+        id = _id;
+    }
+
+    inline uint64_t getId(const uint64_t) const {
+        return id;
+    }
 
-#ifdef DEBUG
     uint64_t id;
-#endif // DEBUG
-    T data;
+};
+
+template <>
+struct IdTreeLeafId<false> {
+    inline void setId(const uint64_t) {
+        /// nothing
+    }
+
+    /// Without an id of its own, a leaf is assumed to be the one searched for
+    inline uint64_t getId(const uint64_t expected) const {
+        return expected;
+    }
+};
+
+template <bool withCounter>
+struct IdTreeLeafCounter {
+    explicit IdTreeLeafCounter()
+        : counter(0) {
+        /// nothing
+    }
+
+    inline void setCounter(const uint16_t _counter) {
+        counter = _counter;
+    }
+
+    inline uint16_t getCounter() const {
+        return counter;
+    }
 
     uint16_t counter;
 };
 
-template <typename T>
-const int IdTreeNode<T>::bitsPerNode = 4;
-template <typename T>
-const int IdTreeNode<T>::bitsPerId = 64;
-template <typename T>
-const unsigned int IdTreeNode<T>::numChildren = 1 << IdTreeNode<T>::bitsPerNode;
+template <>
+struct IdTreeLeafCounter<false> {
+    inline void setCounter(const uint16_t) {
+        /// nothing
+    }
+
+    inline uint16_t getCounter() const {
+        return 0;
+    }
+};
+
+/**
+ * Leaf of an IdTree, holding the data for one id.
+ */
+template <typename T, class Policy>
+struct IdTreeLeaf : public IdTreeLeafId<Policy::withId>, public IdTreeLeafCounter<Policy::withCounter> {
+    T data;
+};
 
-template <class T>
-class IdTree<T>::Private
+template <class T, class Policy>
+class IdTree<T, Policy>::Private
 {
 private:
     IdTree *p;
-#ifdef REVERSE_ID_TREE
-    std::vector<IdTreeNode<T> *> zeroPath;
-    static const size_t zeroPathDepth = 8;
-#endif // REVERSE_ID_TREE
 
 public:
+    static_assert(Policy::bitsPerNode >= 1 && Policy::bitsPerNode <= 8 && 64 % Policy::bitsPerNode == 0, "Bits per node must divide 64 and be at most 8");
+
     static const unsigned int num_children;
     static const uint64_t mask;
-    size_t size;
+    boost::atomic<size_t> size;
+
+    /**
+     * References to inner nodes carry the node's kind in their
+     * upper bits and the node's index in the slab for this kind
+     * in their lower bits. Children of last-level nodes are plain
+     * indices into the slab of leaves.
+     */
+    static const unsigned int indexBits = 30;
+    static const uint32_t indexMask = (1U << indexBits) - 1;
+    enum NodeKind {Node2Kind = 1, Node4Kind = 2, NodeFullKind = 3};
 
-    struct IdTreeNode<T> *root;
+    /// All inner nodes and leaves of this tree
+    Slab<IdTreeSparseNode<T, 2> > nodes2;
+    Slab<IdTreeSparseNode<T, 4> > nodes4;
+    Slab<IdTreeNode<T, Policy> > nodesFull;
+    Slab<IdTreeLeaf<T, Policy> > leaves;
+    /// Reference to root node, 0 if tree is empty. If frozen, root
+    /// of the trie holding elements inserted by Updates, see below
+    boost::atomic<uint32_t> root;
 
     /**
-     * Simple cache to speed up retrieval of data from this tree.
-     * The cache has cache_size many entries, where each entry is
-     * a pair of id and data. The lowest log2(cache_size) many bits
-     * determine the line in this cache.
-     * Upon lookup, the cache row is uniquely determined by the id's
-     * lowest bits. If the id in the cache line is identical to the
-     * request id, it is a cache hit, otherwise a cache miss.
+     * Cache for retrieve(..) holding pointers to the data of recently
+     * retrieved elements. Leaves never move once allocated, so the
+     * cache has to be invalidated only if an element is removed or
+     * overwritten.
      */
-    struct CacheLine {
-        uint64_t id;
-        T data;
-    };
-    static const size_t cache_size = 1024;
-    CacheLine cache[cache_size];
-    size_t cache_hit_counter, cache_miss_counter;
+    LookupCache<const T *> cache;
+
+    /// Set by freeze(): the elements' ids and data are kept in
+    /// ascending id order instead of in the trie. Updates do not
+    /// modify these arrays, but insert elements into the otherwise
+    /// empty trie, which takes precedence over the arrays, and record
+    /// the ids removed from the arrays in 'frozenRemoved'
+    bool frozen;
+    EliasFanoIdSet frozenIds;
+    std::vector<T> frozenValues;
+    /// Sorted ids of frozen elements removed by Updates, nullptr if
+    /// none. Each commit replaces the list by a modified copy
+    boost::atomic<const std::vector<uint64_t> *> frozenRemoved;
+
+    /// Readers of the current and previous versions, see Update
+    EpochManager epochs;
+    /// Held by the Update in progress, if any
+    boost::mutex updateMutex;
+    /// Set while an Update is in progress
+    bool updating;
+    /// Root and size of the version being modified by an Update
+    uint32_t workingRoot;
+    size_t workingSize;
+    /// Nodes and leaves created for the version being modified,
+    /// which readers cannot access and which may be modified in place
+    std::unordered_set<uint32_t> freshNodes, freshLeaves;
+    /// Nodes and leaves replaced in the version being modified,
+    /// to be retired once the version gets committed
+    std::vector<uint32_t> replacedNodes, replacedLeaves;
+    /// Nodes and leaves of previous versions, each with the epoch of
+    /// the commit that replaced them, in ascending order of epochs
+    std::vector<std::pair<uint64_t, uint32_t> > retiredNodes, retiredLeaves;
+    /// Copy of 'frozenRemoved' modified by the version being
+    /// modified, nullptr if no frozen element was removed yet
+    std::vector<uint64_t> *workingRemoved;
+    /// Lists of removed frozen ids replaced by commits, see above
+    std::vector<std::pair<uint64_t, const std::vector<uint64_t> *> > retiredRemoved;
 
     Private(IdTree *parent)
-        : p(parent), size(0), root(nullptr) {
-        /// Invalidate all cache lines by setting 'id' to an invalid value (=0)
-        for (size_t i = 0; i < cache_size; ++i)
-            cache[i].id = 0;
-        /// Initialize cache hit/miss counters
-        cache_hit_counter = cache_miss_counter = 0;
+        : p(parent), size(0), root(0), cache(defaultCacheSize), frozen(false), frozenRemoved(nullptr), updating(false), workingRoot(0), workingSize(0), workingRemoved(nullptr) {
+        /// nothing
     }
 
     ~Private() {
-        Error::info("IdTree<%s>:  cache_hit= %d (%.1f%%)  cache_miss= %d", typeid(T).name(), cache_hit_counter, 100.0 * cache_hit_counter / (cache_hit_counter + cache_miss_counter), cache_miss_counter);
-        if (root != nullptr)
-            delete root;
+        const LookupCacheStatistics statistics = cache.statistics();
+        Error::info("IdTree<%s>:  cache_hit= %d (%.1f%%)  cache_miss= %d", typeid(T).name(), statistics.hits, 100.0 * statistics.hitRate(), statistics.misses);
+        clearFrozenRemoved();
+    }
+
+    static inline unsigned int levels() {
+        return IdTreeNode<T, Policy>::bitsPerId / IdTreeNode<T, Policy>::bitsPerNode;
     }
 
-#ifdef REVERSE_ID_TREE
     /**
-     * It is an observation that out of the 64-bit space for ids, most used ids are small,
-     * i.e. have their most significant bits set to zero. This results in that the id tree
-     * will be very unbalanced, as for the first levels the 0th child will be used.
-     * To avoid costly traversals of a tree that is unbalanced, here the id is checked if the
-     * bits used for the up to eight first traversal steps are all set to zero. If true,
-     * a pre-recorded path ('zeroPath') will be used that guides the search function faster
-     * through the tree than a 'regular' tree traversal would do.
-     * Initial tests showed a 25% decrease in CPU time if using this function.
-     * @param id
-     * @param s
-     * @param path
-     * @return
-     */
-    IdTreeNode<T> *skipAheadOnZeroPath(uint64_t &id, unsigned int &s, std::vector<IdTreeNode<T> *> *path = nullptr) {
-#define mask_for_level(n) (IdTree::Private::mask<<((sizeof(id) * 8 /** size in Bytes to size in Bits */) - ((n)+1) * IdTreeNode<T>::bitsPerNode))
-        static const uint64_t masks[zeroPathDepth] = {
-            mask_for_level(0),
-            mask_for_level(0) | mask_for_level(1),
-            mask_for_level(0) | mask_for_level(1) | mask_for_level(2),
-            mask_for_level(0) | mask_for_level(1) | mask_for_level(2) | mask_for_level(3),
-            mask_for_level(0) | mask_for_level(1) | mask_for_level(2) | mask_for_level(3) | mask_for_level(4),
-            mask_for_level(0) | mask_for_level(1) | mask_for_level(2) | mask_for_level(3) | mask_for_level(4) | mask_for_level(5),
-            mask_for_level(0) | mask_for_level(1) | mask_for_level(2) | mask_for_level(3) | mask_for_level(4) | mask_for_level(5) | mask_for_level(6),
-            mask_for_level(0) | mask_for_level(1) | mask_for_level(2) | mask_for_level(3) | mask_for_level(4) | mask_for_level(5) | mask_for_level(6) | mask_for_level(7)
-        };
+     * Determine which child to follow at a given depth when
+     * descending the tree towards an id.
+     */
+    static inline unsigned int childIndex(const uint64_t id, const unsigned int depth) {
+#ifdef REVERSE_ID_TREE
+        return (id >> (IdTreeNode<T, Policy>::bitsPerId - (depth + 1) * IdTreeNode<T, Policy>::bitsPerNode)) & IdTree::Private::mask;
+#else // REVERSE_ID_TREE
+        return (id >> (depth * IdTreeNode<T, Policy>::bitsPerNode)) & IdTree::Private::mask;
+#endif // REVERSE_ID_TREE
+    }
 
-        for (s = zeroPathDepth; s > 0; --s) {
-            if ((id & masks[s - 1]) == 0 && zeroPath.size() > s) {
-                /// id would pick child 0 for the first s-many levels when traversing tree
-                id <<= IdTreeNode<T>::bitsPerNode * s;
-                if (path != nullptr)
-                    for (unsigned int k = 0; k < s; ++k) path->push_back(zeroPath[k]);
-                return zeroPath[s];
-            }
-        }
+    /**
+     * Inverse of childIndex(..): the id bits selecting child c at a given depth.
+     */
+    static inline uint64_t childBits(const unsigned int c, const unsigned int depth) {
+#ifdef REVERSE_ID_TREE
+        return (uint64_t)c << (IdTreeNode<T, Policy>::bitsPerId - (depth + 1) * IdTreeNode<T, Policy>::bitsPerNode);
+#else // REVERSE_ID_TREE
+        return (uint64_t)c << (depth * IdTreeNode<T, Policy>::bitsPerNode);
+#endif // REVERSE_ID_TREE
+    }
 
-        return root;
+    /**
+     * Mask selecting the id bits used on all levels above a given depth.
+     */
+    static inline uint64_t prefixMask(const unsigned int depth) {
+        if (depth == 0) return 0;
+#ifdef REVERSE_ID_TREE
+        return ~0ULL << (IdTreeNode<T, Policy>::bitsPerId - depth * IdTreeNode<T, Policy>::bitsPerNode);
+#else // REVERSE_ID_TREE
+        return depth >= levels() ? ~0ULL : (1ULL << (depth * IdTreeNode<T, Policy>::bitsPerNode)) - 1;
+#endif // REVERSE_ID_TREE
     }
+
+    /**
+     * Map an id to a key that sorts ids in the order their leaves
+     * appear in the tree, so that neighbouring keys share long paths.
+     */
+    static inline uint64_t pathKey(uint64_t id) {
+#ifdef REVERSE_ID_TREE
+        return id;
+#else // REVERSE_ID_TREE
+        uint64_t key = 0;
+        for (unsigned int s = levels(); s > 0; --s) {
+            key = (key << IdTreeNode<T, Policy>::bitsPerNode) | (id & IdTree::Private::mask);
+            id >>= IdTreeNode<T, Policy>::bitsPerNode;
+        }
+        return key;
 #endif // REVERSE_ID_TREE
+    }
 
+    /**
+     * Determine the number of levels the paths from the root to
+     * two ids have in common.
+     */
+    static inline unsigned int commonDepth(const uint64_t a, const uint64_t b) {
+        if (a == b) return levels();
 #ifdef REVERSE_ID_TREE
-    void buildZeroPath() {
-        if (root == nullptr)
-            root = new IdTreeNode<T>();
-
-        IdTreeNode<T> *cur = root;
-        for (size_t s = 0; s < zeroPathDepth; ++s) {
-            zeroPath.push_back(cur);
-            if (s >= zeroPathDepth - 1) break; /// no need to build children for last node
-            if (cur->children == nullptr) {
-                cur->children = (IdTreeNode<T> **)calloc(IdTreeNode<T>::numChildren, sizeof(IdTreeNode<T> *));
-                if (cur->children == nullptr)
-                    Error::err("IdTree<%s>: Could not allocate memory for cur->children", typeid(T).name());
+        return __builtin_clzll(a ^ b) / IdTreeNode<T, Policy>::bitsPerNode;
+#else // REVERSE_ID_TREE
+        return __builtin_ctzll(a ^ b) / IdTreeNode<T, Policy>::bitsPerNode;
+#endif // REVERSE_ID_TREE
+    }
+
+    /**
+     * Descend one step from an inner node towards an id.
+     * @param node inner node to start from
+     * @param id id to search for
+     * @param depth set to the level at which node branches
+     * @return reference to next inner node or leaf, 0 if id is not in node's subtree
+     */
+    template <class Node>
+    static inline uint32_t step(const Node &node, const uint64_t id, unsigned int &depth) {
+        depth = node.depth;
+        if ((id & prefixMask(node.depth)) != node.prefix) return 0;
+        return node.child(childIndex(id, node.depth));
+    }
+
+    inline uint32_t step(const uint32_t ref, const uint64_t id, unsigned int &depth) const {
+        switch (ref >> indexBits) {
+        case Node2Kind:
+            return step(nodes2[ref & indexMask], id, depth);
+        case Node4Kind:
+            return step(nodes4[ref & indexMask], id, depth);
+        default:
+            return step(nodesFull[ref & indexMask], id, depth);
+        }
+    }
+
+    inline void nodeInfo(const uint32_t ref, uint64_t &prefix, unsigned int &depth, unsigned int &count) const {
+        switch (ref >> indexBits) {
+        case Node2Kind: {
+            const IdTreeSparseNode<T, 2> &node = nodes2[ref & indexMask];
+            prefix = node.prefix;
+            depth = node.depth;
+            count = node.count;
+            break;
+        }
+        case Node4Kind: {
+            const IdTreeSparseNode<T, 4> &node = nodes4[ref & indexMask];
+            prefix = node.prefix;
+            depth = node.depth;
+            count = node.count;
+            break;
+        }
+        default: {
+            const IdTreeNode<T, Policy> &node = nodesFull[ref & indexMask];
+            prefix = node.prefix;
+            depth = node.depth;
+            count = node.count;
+        }
+        }
+    }
+
+    inline unsigned int depthOf(const uint32_t ref) const {
+        uint64_t prefix;
+        unsigned int depth, count;
+        nodeInfo(ref, prefix, depth, count);
+        return depth;
+    }
+
+    inline uint32_t child(const uint32_t ref, const unsigned int c) const {
+        switch (ref >> indexBits) {
+        case Node2Kind:
+            return nodes2[ref & indexMask].child(c);
+        case Node4Kind:
+            return nodes4[ref & indexMask].child(c);
+        default:
+            return nodesFull[ref & indexMask].child(c);
+        }
+    }
+
+    inline uint32_t *childSlot(const uint32_t ref, const unsigned int c) {
+        switch (ref >> indexBits) {
+        case Node2Kind:
+            return nodes2[ref & indexMask].childSlot(c);
+        case Node4Kind:
+            return nodes4[ref & indexMask].childSlot(c);
+        default:
+            return nodesFull[ref & indexMask].childSlot(c);
+        }
+    }
+
+    /**
+     * Fill an array of numChildren many references with the
+     * children of an inner node, 0 for absent children.
+     */
+    void children(const uint32_t ref, uint32_t *result) const {
+        for (unsigned int c = 0; c < IdTreeNode<T, Policy>::numChildren; ++c)
+            result[c] = child(ref, c);
+    }
+
+    static inline void prefetch(const uint32_t ref, const bool isLeaf, const IdTree<T, Policy>::Private *d) {
+        if (isLeaf)
+            __builtin_prefetch(&d->leaves[ref]);
+        else switch (ref >> indexBits) {
+            case Node2Kind:
+                __builtin_prefetch(&d->nodes2[ref & indexMask]);
+                break;
+            case Node4Kind:
+                __builtin_prefetch(&d->nodes4[ref & indexMask]);
+                break;
+            default:
+                __builtin_prefetch(&d->nodesFull[ref & indexMask]);
             }
-            if (cur->children[0] == nullptr)
-                cur->children[0] = new IdTreeNode<T>();
-            cur = cur->children[0];
+    }
+
+    template <class Node>
+    static inline uint32_t allocateNode(Slab<Node> &slab, const NodeKind kind, const uint64_t prefix, const unsigned int depth) {
+        const uint32_t index = slab.allocate();
+        if (index > indexMask)
+            Error::err("IdTree<%s>: Exceeded maximum number of inner nodes", typeid(T).name());
+        slab[index].prefix = prefix;
+        slab[index].depth = depth;
+        return ((uint32_t)kind << indexBits) | index;
+    }
+
+    /**
+     * Create a new inner node suitable for the given number of children.
+     */
+    uint32_t newNode(const unsigned int capacity, const uint64_t prefix, const unsigned int depth) {
+        uint32_t ref;
+        if (capacity <= 2)
+            ref = allocateNode(nodes2, Node2Kind, prefix, depth);
+        else if (capacity <= 4)
+            ref = allocateNode(nodes4, Node4Kind, prefix, depth);
+        else
+            ref = allocateNode(nodesFull, NodeFullKind, prefix, depth);
+        if (updating)
+            freshNodes.insert(ref);
+        return ref;
+    }
+
+    inline uint32_t newLeaf() {
+        const uint32_t index = leaves.allocate();
+        if (updating)
+            freshLeaves.insert(index);
+        return index;
+    }
+
+    template <class Node>
+    static inline uint32_t copyNode(Slab<Node> &slab, const NodeKind kind, const uint32_t index) {
+        const uint32_t copy = slab.allocate();
+        if (copy > indexMask)
+            Error::err("IdTree<%s>: Exceeded maximum number of inner nodes", typeid(T).name());
+        slab[copy] = slab[index];
+        return ((uint32_t)kind << indexBits) | copy;
+    }
+
+    /**
+     * While an Update is in progress, replace the inner node referred
+     * to by '*slot' by a copy unless the node was created by this
+     * update, so that it can be modified without affecting readers.
+     * '*slot' itself must be modifiable, i.e. be part of a node
+     * created by this update or be the working root.
+     */
+    void ownNode(uint32_t *slot) {
+        if (!updating || freshNodes.count(*slot) > 0) return;
+
+        const uint32_t ref = *slot;
+        uint32_t copy;
+        switch (ref >> indexBits) {
+        case Node2Kind:
+            copy = copyNode(nodes2, Node2Kind, ref & indexMask);
+            break;
+        case Node4Kind:
+            copy = copyNode(nodes4, Node4Kind, ref & indexMask);
+            break;
+        default:
+            copy = copyNode(nodesFull, NodeFullKind, ref & indexMask);
+        }
+        freshNodes.insert(copy);
+        replacedNodes.push_back(ref);
+        *slot = copy;
+    }
+
+    /**
+     * Same as ownNode(..) for the leaf referred to by '*slot'.
+     */
+    void ownLeaf(uint32_t *slot) {
+        if (!updating || freshLeaves.count(*slot) > 0) return;
+
+        const uint32_t copy = newLeaf();
+        leaves[copy] = leaves[*slot];
+        replacedLeaves.push_back(*slot);
+        *slot = copy;
+    }
+
+    /**
+     * Release an inner node that is no longer part of the tree or, if
+     * readers may still access it, keep it until it can be reclaimed.
+     */
+    void discardNode(const uint32_t ref) {
+        if (updating && freshNodes.erase(ref) == 0)
+            replacedNodes.push_back(ref);
+        else
+            releaseNode(ref);
+    }
+
+    void discardLeaf(const uint32_t index) {
+        if (updating && freshLeaves.erase(index) == 0)
+            replacedLeaves.push_back(index);
+        else
+            leaves.release(index);
+    }
+
+    void releaseNode(const uint32_t ref) {
+        switch (ref >> indexBits) {
+        case Node2Kind:
+            nodes2.release(ref & indexMask);
+            break;
+        case Node4Kind:
+            nodes4.release(ref & indexMask);
+            break;
+        default:
+            nodesFull.release(ref & indexMask);
         }
     }
-#endif // REVERSE_ID_TREE
+
+    /**
+     * Add a child to the inner node referred to by '*slot'. If the
+     * node is full, it gets replaced by a larger node and '*slot'
+     * gets updated accordingly.
+     */
+    void addChild(uint32_t *slot, const unsigned int c, const uint32_t childRef) {
+        const uint32_t ref = *slot;
+        uint64_t prefix;
+        unsigned int depth, count;
+        nodeInfo(ref, prefix, depth, count);
+        const unsigned int capacity = (ref >> indexBits) == Node2Kind ? 2 : ((ref >> indexBits) == Node4Kind ? 4 : IdTreeNode<T, Policy>::numChildren);
+        if (count >= capacity) {
+            /// Grow node
+            const uint32_t grown = newNode(count + 1, prefix, depth);
+            uint32_t kids[IdTreeNode<T, Policy>::numChildren];
+            children(ref, kids);
+            for (unsigned int k = 0; k < IdTreeNode<T, Policy>::numChildren; ++k)
+                if (kids[k] != 0) insertChild(grown, k, kids[k]);
+            discardNode(ref);
+            *slot = grown;
+        }
+        insertChild(*slot, c, childRef);
+    }
+
+    inline void insertChild(const uint32_t ref, const unsigned int c, const uint32_t childRef) {
+        switch (ref >> indexBits) {
+        case Node2Kind:
+            nodes2[ref & indexMask].insertChild(c, childRef);
+            break;
+        case Node4Kind:
+            nodes4[ref & indexMask].insertChild(c, childRef);
+            break;
+        default:
+            nodesFull[ref & indexMask].insertChild(c, childRef);
+        }
+    }
+
+    inline void removeChild(const uint32_t ref, const unsigned int c) {
+        switch (ref >> indexBits) {
+        case Node2Kind:
+            nodes2[ref & indexMask].removeChild(c);
+            break;
+        case Node4Kind:
+            nodes4[ref & indexMask].removeChild(c);
+            break;
+        default:
+            nodesFull[ref & indexMask].removeChild(c);
+        }
+    }
+
+    /**
+     * Create a last-level inner node holding a single new leaf for an id.
+     * @param id id of new leaf
+     * @param leafIndex set to the index of the new leaf
+     * @return reference to new inner node
+     */
+    uint32_t newLeafNode(const uint64_t id, uint32_t &leafIndex) {
+        const unsigned int lastLevel = levels() - 1;
+        uint32_t ref = newNode(1, id & prefixMask(lastLevel), lastLevel);
+        leafIndex = newLeaf();
+        insertChild(ref, childIndex(id, lastLevel), leafIndex);
+        return ref;
+    }
 
     /**
      * This is the single most expensive function, taking 25-35% of the CPU time.
+     * @param top root of the version to search in
+     * @param id id to search for
+     * @param path if not nullptr, receives the inner nodes from root to the leaf's parent
+     * @return leaf for id or nullptr if id is not in this tree
      */
-    IdTreeNode<T> *findNodeForId(uint64_t id, std::vector<IdTreeNode<T> *> *path = nullptr) {
-        if (root == nullptr) {
+    IdTreeLeaf<T, Policy> *findLeafForId(const uint32_t top, const uint64_t id, std::vector<uint32_t> *path = nullptr) {
+        if (top == 0) {
             Error::warn("IdTree<%s> root is invalid, no id was ever added", typeid(T).name());
             return nullptr;
         }
 
-        unsigned int s = 0;
-        uint64_t workingId = id;
-#ifdef REVERSE_ID_TREE
-        IdTreeNode<T> *cur = skipAheadOnZeroPath(workingId, s, path);
-#else // REVERSE_ID_TREE
-        IdTreeNode<T> *cur = root;
-#endif // REVERSE_ID_TREE
-        for (unsigned int s_limit = (IdTreeNode<T>::bitsPerId / IdTreeNode<T>::bitsPerNode); s < s_limit; ++s) {
-            if (cur->children == nullptr) {
+        const unsigned int lastLevel = levels() - 1;
+        uint32_t cur = top;
+        unsigned int depth = 0;
+        do {
+            if (path != nullptr) path->push_back(cur);
+            cur = step(cur, id, depth);
+            if (cur == 0) {
 #ifdef DEBUG
-                Error::debug("IdTree<%s> node has no children to follow id %llu", typeid(T).name(), id);
+                Error::debug("IdTree<%s> node has no children at level %d to follow id %llu", typeid(T).name(), depth, id);
 #endif // DEBUG
                 return nullptr;
             }
+        } while (depth < lastLevel);
 
-#ifdef REVERSE_ID_TREE
-            /// For 64-bit-wide ids and 4 bits per node, shiftOffset is 60
-            static const int shiftOffset = (sizeof(workingId) * 8 /** size in Bytes to size in Bits */) - IdTreeNode<T>::bitsPerNode;
-            /// For 4 bits per node, mask is (2^4)-1 = 15 (i.e. four bits set)
-            /// Extracts the most-significant bitsPerNode-many bits from workingId,
-            /// then shifts them to be in range 0 .. (2^bitsPerNode)-1
-            const unsigned int bits = (workingId & (IdTree::Private::mask << shiftOffset)) >> shiftOffset;
-            /// Shift out to the left bits that were just extracted
-            workingId <<= IdTreeNode<T>::bitsPerNode;
-#else // REVERSE_ID_TREE
-            /// Extracts the least-significant bitsPerNode-many bits from workingId
-            /// Result will be in range 0 .. (2^bitsPerNode)-1
-            const unsigned int bits = workingId & IdTree::Private::mask;
-            /// Shift out to the right bits that were just extracted
-            workingId >>= IdTreeNode<T>::bitsPerNode;
-#endif // REVERSE_ID_TREE
+        IdTreeLeaf<T, Policy> *leaf = &leaves[cur];
+        if (leaf->getId(id) != id) {
+            Error::warn("IdTree<%s>: Ids do not match: %llu != %llu", typeid(T).name(), leaf->getId(id), id);
+            return nullptr;
+        }
+
+        return leaf;
+    }
 
-            if (cur->children[bits] == nullptr) {
+    /**
+     * Look up an element of a frozen tree, considering the elements
+     * inserted and removed by Updates.
+     * @return pointer to the element's data or nullptr if id is not in this tree
+     */
+    const T *findFrozen(const uint64_t id) const {
+        /// Commits publish the removed ids before the root, so a trie
+        /// read here is never older than the removed ids read below
+        const uint32_t top = root;
+        if (top != 0) {
+            const unsigned int lastLevel = levels() - 1;
+            uint32_t cur = top;
+            unsigned int depth = 0;
+            do {
+                cur = step(cur, id, depth);
+            } while (cur != 0 && depth < lastLevel);
+            if (cur != 0 && leaves[cur].getId(id) == id)
+                return &leaves[cur].data;
+        }
+
+        const std::vector<uint64_t> *removed = frozenRemoved;
+        if (removed != nullptr && std::binary_search(removed->cbegin(), removed->cend(), id))
+            return nullptr;
+        const size_t index = frozenIds.indexOf(id);
+        return index == EliasFanoIdSet::notFound ? nullptr : &frozenValues[index];
+    }
+
+    /**
+     * Tell if a frozen element is part of the version being modified
+     * by an Update, i.e. neither it nor its id got removed.
+     */
+    bool inWorkingFrozen(const uint64_t id) const {
+        if (!frozen || frozenIds.indexOf(id) == EliasFanoIdSet::notFound)
+            return false;
+        const std::vector<uint64_t> *removed = workingRemoved != nullptr ? workingRemoved : frozenRemoved.load();
+        return removed == nullptr || !std::binary_search(removed->cbegin(), removed->cend(), id);
+    }
+
+    /**
+     * Tell if Updates inserted or removed any elements of a frozen tree.
+     */
+    inline bool frozenModified() const {
+        return frozen && (root != 0 || frozenRemoved != nullptr);
+    }
+
+    /**
+     * Free all lists of removed frozen ids, for example once the
+     * frozen arrays get replaced.
+     */
+    void clearFrozenRemoved() {
+        delete frozenRemoved.exchange(nullptr);
+        delete workingRemoved;
+        workingRemoved = nullptr;
+        for (const auto &retired : retiredRemoved)
+            delete retired.second;
+        retiredRemoved.clear();
+    }
+
+    /**
+     * Insert an element into the version of the tree with the given
+     * root, see IdTree<T, Policy>::insert(..). While an Update is in
+     * progress, nodes and leaves of previous versions get replaced by
+     * copies instead of being modified.
+     * @param top root of the version to insert into, updated if the root changes
+     * @param id id of element
+     * @param data element's data
+     * @return true if a new leaf was added, false if an existing element was overwritten
+     */
+    bool insertInto(uint32_t &top, const uint64_t id, T const &data) {
+        const unsigned int lastLevel = levels() - 1;
+        uint32_t leafIndex = 0;
+        bool added = true;
+        /// Slot in parent node (or root) referring to the current node
+        uint32_t *slot = &top;
+        while (true) {
+            if (*slot == 0) {
+                /// Empty tree
+                *slot = newLeafNode(id, leafIndex);
+                break;
+            }
+
+            uint64_t prefix;
+            unsigned int depth, count;
+            nodeInfo(*slot, prefix, depth, count);
+            if ((id & prefixMask(depth)) != prefix) {
+                /// Id leaves the collapsed path before this node is reached:
+                /// split path by a new node where id and path diverge
+                const unsigned int splitDepth = commonDepth(id, prefix);
+                const uint32_t split = newNode(2, id & prefixMask(splitDepth), splitDepth);
+                insertChild(split, childIndex(prefix, splitDepth), *slot);
+                insertChild(split, childIndex(id, splitDepth), newLeafNode(id, leafIndex));
+                *slot = split;
+                break;
+            }
+
+            ownNode(slot);
+            const unsigned int c = childIndex(id, depth);
+            uint32_t *childSlot = this->childSlot(*slot, c);
+            if (childSlot == nullptr) {
+                /// Node has no child for this id yet
+                const uint32_t child = depth == lastLevel ? (leafIndex = newLeaf()) : newLeafNode(id, leafIndex);
+                addChild(slot, c, child);
+                break;
+            } else if (depth == lastLevel) {
 #ifdef DEBUG
-                Error::debug("IdTree<%s> node has no children at pos %d to follow id %llu", typeid(T).name(), bits, id);
+                /// During import, ids are expected to be unique
+                if (!updating)
+                    Error::err("IdTree<%s>: Leaf already in use: %llu != %llu", typeid(T).name(), id, leaves[*childSlot].getId(id));
 #endif // DEBUG
-                return nullptr;
+                /// Overwriting an existing element's data
+                ownLeaf(childSlot);
+                leafIndex = *childSlot;
+                added = false;
+                cache.invalidate();
+                break;
             }
+            slot = childSlot;
+        }
 
-            if (path != nullptr) path->push_back(cur);
-            cur = cur->children[bits];
+        IdTreeLeaf<T, Policy> &leaf = leaves[leafIndex];
+        leaf.setId(id);
+        leaf.data = data;
+        return added;
+    }
+
+    /**
+     * Remove an element from the version of the tree with the given
+     * root, see insertInto(..).
+     * @param top root of the version to remove from, updated if the root changes
+     * @param id id of element
+     * @return true if the element was removed, false if it was not in the tree
+     */
+    bool removeFrom(uint32_t &top, const uint64_t id) {
+        std::vector<uint32_t> path;
+        if (findLeafForId(top, id, &path) == nullptr)
+            return false;
+
+        if (updating) {
+            /// Replace all nodes on the path by modifiable copies
+            uint32_t *slot = &top;
+            for (size_t i = 0; i < path.size(); ++i) {
+                ownNode(slot);
+                path[i] = *slot;
+                if (i + 1 < path.size())
+                    slot = childSlot(path[i], childIndex(id, depthOf(path[i])));
+            }
         }
 
-#ifdef DEBUG
-        if (cur->id != id) {
-            Error::warn("IdTree<%s>: Ids do not match: %llu != %llu", typeid(T).name(), cur->id, id);
-            return nullptr;
+        const unsigned int lastLevel = levels() - 1;
+        discardLeaf(child(path.back(), childIndex(id, lastLevel)));
+        removeChild(path.back(), childIndex(id, lastLevel));
+
+        /// Inner nodes left without children get removed, inner nodes
+        /// left with a single inner node as child get collapsed into it
+        for (size_t i = path.size(); i > 0; --i) {
+            const uint32_t ref = path[i - 1];
+            uint64_t prefix;
+            unsigned int depth, count;
+            nodeInfo(ref, prefix, depth, count);
+            const unsigned int parentChild = i == 1 ? 0 : childIndex(id, depthOf(path[i - 2]));
+            uint32_t *slot = i == 1 ? &top : childSlot(path[i - 2], parentChild);
+            if (count == 0) {
+                discardNode(ref);
+                if (i == 1)
+                    *slot = 0;
+                else
+                    removeChild(path[i - 2], parentChild);
+            } else if (count == 1 && depth < lastLevel) {
+                uint32_t kids[IdTreeNode<T, Policy>::numChildren];
+                children(ref, kids);
+                for (unsigned int c = 0; c < IdTreeNode<T, Policy>::numChildren; ++c)
+                    if (kids[c] != 0) *slot = kids[c];
+                discardNode(ref);
+                break;
+            } else
+                break;
         }
+
+        return true;
+    }
+
+    /**
+     * Advance the epoch if possible and release all nodes and leaves
+     * of previous versions that readers cannot access anymore.
+     * @return number of nodes and leaves released
+     */
+    size_t reclaim() {
+        /// Without readers, two steps make the latest retired objects safe
+        for (unsigned int i = 0; i < 2 && epochs.tryAdvance(); ++i);
+
+        size_t released = 0;
+        size_t n = 0;
+        for (; n < retiredNodes.size() && epochs.isSafe(retiredNodes[n].first); ++n)
+            releaseNode(retiredNodes[n].second);
+        retiredNodes.erase(retiredNodes.begin(), retiredNodes.begin() + n);
+        released += n;
+        for (n = 0; n < retiredLeaves.size() && epochs.isSafe(retiredLeaves[n].first); ++n)
+            leaves.release(retiredLeaves[n].second);
+        retiredLeaves.erase(retiredLeaves.begin(), retiredLeaves.begin() + n);
+        released += n;
+        for (n = 0; n < retiredRemoved.size() && epochs.isSafe(retiredRemoved[n].first); ++n)
+            delete retiredRemoved[n].second;
+        retiredRemoved.erase(retiredRemoved.begin(), retiredRemoved.begin() + n);
+        return released;
+    }
+
+    /// Inner node being read by readTree(..), see there
+    struct ReadFrame {
+        uint64_t prefix;
+        /// Child whose marker is to be read next, counting down
+        int nextChild;
+        unsigned int count;
+        uint32_t onlyChild;
+        uint32_t kids[IdTreeNode<T, Policy>::numChildren];
+    };
+
+    /**
+     * Read the beginning of a node in the serialization format as
+     * written by writeNode(..). Leaves are read completely, inner
+     * nodes get a new frame on the stack for their children.
+     * @param reader reader to read from
+     * @param stack frames of all inner nodes on the path to this node
+     * @param prefix id bits determined by the path from root to this node
+     * @param result for leaves, index of leaf or 0 if leaf carries no element
+     * @return true if an inner node has been pushed on the stack
+     */
+    bool readNodeStart(BufferedReader &reader, std::vector<ReadFrame> &stack, const uint64_t prefix, uint32_t &result) {
+        const unsigned int depth = stack.size();
+#ifdef DEBUG
+        uint64_t id = 0;
+        reader.read(id);
+#endif // DEBUG
+
+        const int chr = reader.next();
+        if (chr == 'N') {
+            /// Is leaf node
+            uint16_t counter = 0;
+            reader.read(counter);
+            if (depth < levels()) {
+                /// Leaves above the last level carry no element, e.g. the
+                /// end of the 'zero path' in trees written by previous versions
+                const T unused(reader.stream());
+                result = 0;
+                return false;
+            }
+
+            const uint32_t index = leaves.allocate();
+            IdTreeLeaf<T, Policy> &leaf = leaves[index];
+#ifdef DEBUG
+            leaf.setId(id);
+#else // DEBUG
+            leaf.setId(prefix);
 #endif // DEBUG
+            leaf.setCounter(counter);
+            leaf.data = T(reader.stream());
+            ++size;
+            result = index;
+            return false;
+        } else if (chr == 'C') {
+            /// Is inner node
+            if (depth >= levels())
+                Error::err("IdTree<%s>: Inner node below last level at position %llu", typeid(T).name(), reader.position());
+            stack.push_back(ReadFrame());
+            ReadFrame &frame = stack.back();
+            frame.prefix = prefix;
+            frame.nextChild = IdTreeNode<T, Policy>::numChildren - 1;
+            frame.count = 0;
+            frame.onlyChild = 0;
+            std::fill(frame.kids, frame.kids + IdTreeNode<T, Policy>::numChildren, 0);
+            return true;
+        } else
+            Error::err("IdTree<%s>: Expected 'N' or 'C', got '0x%02x' at position %llu", typeid(T).name(), chr, reader.position());
 
-        return cur;
+        return false;
     }
 
-    size_t compute_size(const IdTreeNode<T> *cur, size_t depth = 0) const {
-        size_t result = 0;
+    /**
+     * Read a tree in the serialization format as written by
+     * writeNode(..). The format describes a trie with an inner node
+     * on every level, chains of inner nodes with a single child get
+     * collapsed while reading. Instead of recursing, the inner nodes
+     * on the path to the current node are kept on an explicit stack.
+     * @param reader reader to read from
+     * @return reference to root node or 0 for empty trees
+     */
+    uint32_t readTree(BufferedReader &reader) {
+        std::vector<ReadFrame> stack;
+        stack.reserve(levels());
+        uint32_t result = 0;
+        if (!readNodeStart(reader, stack, 0, result))
+            return result;
 
-        if (cur->children != nullptr)
-            for (size_t i = 0; i < IdTreeNode<T>::numChildren; ++i)
-                if (cur->children[i] != nullptr) {
-                    if (depth < 15)
-                        result += compute_size(cur->children[i], depth + 1);
-                    else ///< depth == 15
-                        ++result;
+        while (true) {
+            ReadFrame &frame = stack.back();
+            if (frame.nextChild >= 0) {
+                const int chr = reader.next();
+                if (chr == '1') {
+                    const unsigned int depth = stack.size() - 1;
+                    if (readNodeStart(reader, stack, frame.prefix | childBits(frame.nextChild, depth), result))
+                        continue; ///< read new inner node's children first
+                } else if (chr == '0')
+                    result = 0;
+                else
+                    Error::err("IdTree<%s>: Expected '0' or '1', got '0x%02x' at position %llu", typeid(T).name(), chr, reader.position());
+            } else {
+                /// All children read, create inner node
+                const unsigned int depth = stack.size() - 1;
+                if (frame.count == 0)
+                    result = 0;
+                else if (frame.count == 1 && depth < levels() - 1)
+                    /// Path compression: skip this node
+                    result = frame.onlyChild;
+                else {
+                    result = newNode(frame.count, frame.prefix, depth);
+                    for (unsigned int c = 0; c < IdTreeNode<T, Policy>::numChildren; ++c)
+                        if (frame.kids[c] != 0) insertChild(result, c, frame.kids[c]);
                 }
+                stack.pop_back();
+                if (stack.empty())
+                    return result;
+            }
+
+            /// Record child just read in its parent
+            ReadFrame &parent = stack.back();
+            if (result != 0) {
+                parent.kids[parent.nextChild] = result;
+                ++parent.count;
+                parent.onlyChild = result;
+            }
+            --parent.nextChild;
+        }
+    }
+
+    /**
+     * Call a function for each leaf in an inner node's subtree,
+     * see IdTree<T, Policy>::forEach(..).
+     */
+    template <class Visitor>
+    void visitNode(const uint32_t ref, Visitor &visitor) const {
+        uint64_t prefix;
+        unsigned int depth, count;
+        nodeInfo(ref, prefix, depth, count);
+        uint32_t kids[IdTreeNode<T, Policy>::numChildren];
+        children(ref, kids);
+        for (unsigned int c = 0; c < IdTreeNode<T, Policy>::numChildren; ++c) {
+            if (kids[c] == 0) continue;
+            if (depth == levels() - 1) {
+                const IdTreeLeaf<T, Policy> &leaf = leaves[kids[c]];
+                visitor(leaf.getId(prefix | childBits(c, depth)), leaf.data);
+            } else
+                visitNode(kids[c], visitor);
+        }
+    }
+
+    /**
+     * Collect all elements in ascending id order.
+     * @param elements receives pairs of id and pointer to the id's data
+     */
+    void sortedElements(std::vector<std::pair<uint64_t, const T *> > &elements) const {
+        elements.clear();
+        elements.reserve(size);
+        p->forEach([&elements](const uint64_t id, T const &data) {
+            elements.push_back(std::make_pair(id, &data));
+        });
+        /// Unless REVERSE_ID_TREE is defined, leaves are not in id order
+        const auto lessById = [](const std::pair<uint64_t, const T *> &a, const std::pair<uint64_t, const T *> &b) {
+            return a.first < b.first;
+        };
+        if (!std::is_sorted(elements.cbegin(), elements.cend(), lessById))
+            std::sort(elements.begin(), elements.end(), lessById);
+    }
+
+    /**
+     * Rebuild the trie of a frozen tree from its elements.
+     */
+    void thaw() {
+        if (!frozen) return;
+        Error::debug("IdTree<%s>: Modifying frozen tree, rebuilding trie", typeid(T).name());
 
-        return result;
+        /// Cached pointers refer to the frozen elements
+        cache.invalidate();
+        if (frozenModified()) {
+            /// Elements inserted by Updates are in the trie, which
+            /// gets rebuilt, so collect copies of all elements first
+            std::vector<std::pair<uint64_t, T> > elements;
+            elements.reserve(size);
+            p->forEach([&elements](const uint64_t id, T const &data) {
+                elements.push_back(std::make_pair(id, data));
+            });
+            clearTrie();
+            clearFrozenRemoved();
+            frozen = false;
+            frozenIds = EliasFanoIdSet();
+            std::vector<T>().swap(frozenValues);
+            size = 0;
+            IdTree::BulkLoader loader(*p);
+            for (const auto &element : elements)
+                loader.append(element.first, element.second);
+            return;
+        }
+
+        frozen = false;
+        EliasFanoIdSet ids;
+        std::swap(ids, frozenIds);
+        std::vector<T> values;
+        values.swap(frozenValues);
+        size = 0;
+        IdTree::BulkLoader loader(*p);
+        ids.forEach([&loader, &values](const size_t index, const uint64_t id) {
+            loader.append(id, values[index]);
+        });
+    }
+
+    /**
+     * Free all nodes and leaves, including those of previous versions.
+     */
+    void clearTrie() {
+        nodes2.clear();
+        nodes4.clear();
+        nodesFull.clear();
+        leaves.clear();
+        retiredNodes.clear();
+        retiredLeaves.clear();
+        root = 0;
+    }
+
+    /**
+     * Write a frozen tree in the same serialization format as
+     * written by writeNode(..) for a trie.
+     */
+    void writeFrozen(std::ostream &output) {
+        /// Pairs of id and element, in the order of the trie's leaves
+        std::vector<std::pair<uint64_t, const T *> > entries;
+        entries.reserve(size);
+        p->forEach([&entries](const uint64_t id, T const &data) {
+            entries.push_back(std::make_pair(id, &data));
+        });
+#ifndef REVERSE_ID_TREE
+        std::sort(entries.begin(), entries.end(), [](const std::pair<uint64_t, const T *> &a, const std::pair<uint64_t, const T *> &b) {
+            return pathKey(a.first) < pathKey(b.first);
+        });
+#endif // REVERSE_ID_TREE
+        writeFrozenNode(output, entries, 0, entries.size(), 0);
+    }
+
+    /**
+     * Write the inner node at a given depth which holds a range of
+     * entries, all of which share the path from the root to this node.
+     */
+    void writeFrozenNode(std::ostream &output, const std::vector<std::pair<uint64_t, const T *> > &entries, const size_t begin, const size_t end, const unsigned int depth) {
+        writeInnerNode(output);
+        /// Entries of child c are in range bounds[c]..bounds[c+1]-1
+        size_t bounds[IdTreeNode<T, Policy>::numChildren + 1];
+        size_t e = begin;
+        for (unsigned int c = 0; c <= IdTreeNode<T, Policy>::numChildren; ++c) {
+            while (e < end && childIndex(entries[e].first, depth) < c) ++e;
+            bounds[c] = e;
+        }
+        for (int c = IdTreeNode<T, Policy>::numChildren - 1; c >= 0; --c) {
+            if (bounds[c] == bounds[c + 1])
+                writeMarkers(output, '0', 1);
+            else {
+                writeMarkers(output, '1', 1);
+                if (depth == levels() - 1) {
+                    const std::pair<uint64_t, const T *> &entry = entries[bounds[c]];
+#ifdef DEBUG
+                    output.write((char *)&entry.first, sizeof(entry.first));
+#endif // DEBUG
+                    static const char chr = 'N';
+                    output.write(&chr, sizeof(chr));
+                    static const uint16_t counter = 0;
+                    output.write((char *)&counter, sizeof(counter));
+                    entry.second->write(output);
+                } else
+                    writeFrozenNode(output, entries, bounds[c], bounds[c + 1], depth + 1);
+            }
+        }
+    }
+
+    inline void writeInnerNode(std::ostream &output) {
+#ifdef DEBUG
+        static const uint64_t innerNodeId = 0;
+        output.write((char *)&innerNodeId, sizeof(innerNodeId));
+#endif // DEBUG
+        static const char chr = 'C';
+        output.write(&chr, sizeof(chr));
+    }
+
+    static inline void writeMarkers(std::ostream &output, const char chr, unsigned int count) {
+        while (count-- > 0)
+            output.write(&chr, sizeof(chr));
+    }
+
+    /**
+     * @param output stream to write to
+     * @param index index of leaf to write
+     * @param id id of leaf as determined by the path from root to this leaf
+     */
+    void writeLeaf(std::ostream &output, const uint32_t index, const uint64_t id) {
+        IdTreeLeaf<T, Policy> &leaf = leaves[index];
+#ifdef DEBUG
+        const uint64_t leafId = leaf.getId(id);
+        output.write((char *)&leafId, sizeof(leafId));
+#else // DEBUG
+        (void)id;
+#endif // DEBUG
+        static const char chr = 'N';
+        output.write(&chr, sizeof(chr));
+        const uint16_t counter = leaf.getCounter();
+        output.write((char *)&counter, sizeof(counter));
+        leaf.data.write(output);
+    }
+
+    /**
+     * Write an inner node and its subtree in the serialization
+     * format of a trie with an inner node on every level, i.e.
+     * collapsed chains of inner nodes get expanded again.
+     * @param output stream to write to
+     * @param ref inner node to write
+     * @param depth level at which the node is to be written, may be above the level the node branches at
+     */
+    void writeNode(std::ostream &output, const uint32_t ref, const unsigned int depth) {
+        uint64_t prefix;
+        unsigned int nodeDepth, count;
+        nodeInfo(ref, prefix, nodeDepth, count);
+
+        /// Expand collapsed chain of single-child inner nodes
+        for (unsigned int s = depth; s < nodeDepth; ++s) {
+            writeInnerNode(output);
+            writeMarkers(output, '0', IdTreeNode<T, Policy>::numChildren - 1 - childIndex(prefix, s));
+            writeMarkers(output, '1', 1);
+        }
+
+        writeInnerNode(output);
+        uint32_t kids[IdTreeNode<T, Policy>::numChildren];
+        children(ref, kids);
+        for (int c = IdTreeNode<T, Policy>::numChildren - 1; c >= 0; --c) {
+            if (kids[c] == 0)
+                writeMarkers(output, '0', 1);
+            else {
+                writeMarkers(output, '1', 1);
+                if (nodeDepth == levels() - 1)
+                    writeLeaf(output, kids[c], prefix | childBits(c, nodeDepth));
+                else
+                    writeNode(output, kids[c], nodeDepth + 1);
+            }
+        }
+
+        for (unsigned int s = nodeDepth; s > depth; --s)
+            writeMarkers(output, '0', childIndex(prefix, s - 1));
     }
 };
 
-template <typename T>
-const uint64_t IdTree<T>::Private::mask = (1 << IdTreeNode<T>::bitsPerNode) - 1;
+template <class T, class Policy>
+const uint64_t IdTree<T, Policy>::Private::mask = (1 << IdTreeNode<T, Policy>::bitsPerNode) - 1;
 
-template <class T>
-IdTree<T>::IdTree()
-    : d(new IdTree<T>::Private(this))
+template <class T, class Policy>
+IdTree<T, Policy>::IdTree()
+    : d(new IdTree<T, Policy>::Private(this))
 {
     if (d == nullptr)
         Error::err("Could not allocate memory for IdTree<T>::Private");
 #ifdef REVERSE_ID_TREE
     Error::debug("Using most significant bits as first sorting critera in IdTree<%s>", typeid(T).name());
-    d->buildZeroPath();
 #else // REVERSE_ID_TREE
     Error::debug("Using least significant bits as first sorting critera in IdTree<%s>", typeid(T).name());
 #endif // REVERSE_ID_TREE
 }
 
-template <class T>
-IdTree<T>::IdTree(std::istream &input)
-    : d(new IdTree<T>::Private(this))
+template <class T, class Policy>
+IdTree<T, Policy>::IdTree(std::istream &input)
+    : d(new IdTree<T, Policy>::Private(this))
 {
-    size_t s;
-    input.read((char *)&s, sizeof(s));
-    d->root = new IdTreeNode<T>(input);
+    BufferedReader reader(input);
+    size_t s = 0;
+    reader.read(s);
+    d->root = d->readTree(reader);
     if (s != size())
         Error::err("Recorded size of IdTree<%s> does not match actual size: %d != %d", typeid(T).name(), s, size());
-#ifdef REVERSE_ID_TREE
-    d->buildZeroPath();
-#endif // REVERSE_ID_TREE
 }
 
-template <class T>
-IdTree<T>::~IdTree()
+template <class T, class Policy>
+IdTree<T, Policy>::IdTree(Snapshot::Section &section)
+    : d(new IdTree<T, Policy>::Private(this))
+{
+    if (!IdTreeSnapshotCodec<T>::available)
+        Error::err("IdTree<%s>: Cannot read value type from snapshot", typeid(T).name());
+
+    /// Frees 'd' if reading throws, see PagedIdTree(Snapshot::Section &)
+    std::unique_ptr<Private> ownPrivate(d);
+    d->frozenIds = EliasFanoIdSet(section);
+    IdTreeSnapshotCodec<T>::read(section, d->frozenIds.size(), d->frozenValues);
+    d->size = d->frozenIds.size();
+    d->frozen = true;
+    ownPrivate.release();
+}
+
+template <class T, class Policy>
+IdTree<T, Policy>::~IdTree()
 {
-    Error::debug("IdTree<%s> had %d elements", typeid(T).name(), size());
+    Error::debug("IdTree<%s> had %d elements in %d+%d+%d inner nodes", typeid(T).name(), size(), d->nodes2.size(), d->nodes4.size(), d->nodesFull.size());
     delete d;
 }
 
-template <class T>
-bool IdTree<T>::insert(uint64_t id, T const &data) {
+template <class T, class Policy>
+bool IdTree<T, Policy>::insert(uint64_t id, T const &data) {
     if (id == 0)
         Error::err("Cannot insert element with id=0 into IdTree<%s>", typeid(T).name());
+    if (d->frozen)
+        d->thaw();
 
-    if (d->root == nullptr) {
-        d->root = new IdTreeNode<T>();
-        if (d->root == nullptr)
-            Error::err("Could not allocate memory for IdTree<%s>::root", typeid(T).name());
-    }
+    uint32_t top = d->root;
+    if (d->insertInto(top, id, data))
+        ++d->size;
+    d->root = top;
 
-    IdTreeNode<T> *cur = d->root;
-    uint64_t workingId = id;
-    for (int s = (IdTreeNode<T>::bitsPerId / IdTreeNode<T>::bitsPerNode) - 1; s >= 0; --s) {
-        if (cur->children == nullptr) {
-            cur->children = (IdTreeNode<T> **)calloc(IdTreeNode<T>::numChildren, sizeof(IdTreeNode<T> *));
-            if (cur->children == nullptr)
-                Error::err("IdTree<%s>: Could not allocate memory for cur->children", typeid(T).name());
-        }
+    return true;
+}
 
-#ifdef REVERSE_ID_TREE
-        static const int shiftOffset = 64 - IdTreeNode<T>::bitsPerNode;
-        const unsigned int lowerBits = (workingId & (IdTree::Private::mask << shiftOffset)) >> shiftOffset;
-        workingId <<= IdTreeNode<T>::bitsPerNode;
-#else // REVERSE_ID_TREE
-        const unsigned int lowerBits = workingId & IdTree::Private::mask;
-        workingId >>= IdTreeNode<T>::bitsPerNode;
-#endif // REVERSE_ID_TREE
+template <class T, class Policy>
+bool IdTree<T, Policy>::retrieve(const uint64_t id, T &data) const {
+    if (id == 0)
+        Error::err("Cannot retrieve IdTree<%s> data for id==0", typeid(T).name());
 
-        if (cur->children[lowerBits] == nullptr) {
-            cur->children[lowerBits] = new IdTreeNode<T>();
-            if (cur->children[lowerBits] == nullptr)
-                Error::err("IdTree<%s>: Could not allocate memory for cur->children[lowerBits]", typeid(T).name());
-        }
-#ifdef DEBUG
-        else if (s == 0)
-            Error::err("IdTree<%s>: Leaf already in use: %llu != %llu", typeid(T).name(), id, cur->children[lowerBits]->id);
-#endif // DEBUG
+    const uint64_t generation = d->cache.currentGeneration();
+    const T *cached = nullptr;
+    if (d->cache.lookup(id, cached)) {
+        data = *cached;
+        return true;
+    }
 
-        cur = cur->children[lowerBits];
+    if (d->frozen) {
+        /// Elements inserted by Updates may get replaced, so the
+        /// generation is checked as for elements of the trie
+        const T *value = d->findFrozen(id);
+        if (value == nullptr)
+            return false;
+        data = *value;
+        d->cache.store(id, value, generation);
+        return true;
     }
 
-#ifdef DEBUG
-    cur->id = id;
-#endif // DEBUG
-    cur->data = data;
+    const IdTreeLeaf<T, Policy> *leaf = d->findLeafForId(d->root, id);
+    if (leaf == nullptr)
+        return false;
+
+    data = leaf->data;
+    d->cache.store(id, &leaf->data, generation);
 
-    ++d->size;
     return true;
 }
 
-template <class T>
-bool IdTree<T>::retrieve(const uint64_t id, T &data) const {
+template <class T, class Policy>
+const T *IdTree<T, Policy>::view(const uint64_t id) const {
     if (id == 0)
-        Error::err("Cannot retrieve IdTree<%s> data for id==0", typeid(T).name());
+        Error::err("Cannot view IdTree<%s> data for id==0", typeid(T).name());
 
-    const size_t cache_index = id % Private::cache_size;
-    if (d->cache[cache_index].id == id) {
-        data = d->cache[cache_index].data;
-        ++d->cache_hit_counter;
-        return true;
-    } else
-        ++d->cache_miss_counter;
+    if (d->frozen)
+        return d->findFrozen(id);
 
-    IdTreeNode<T> *cur = d->findNodeForId(id);
-    if (cur == nullptr)
-        return false;
+    const IdTreeLeaf<T, Policy> *leaf = d->findLeafForId(d->root, id);
+    return leaf == nullptr ? nullptr : &leaf->data;
+}
+
+template <class T, class Policy>
+size_t IdTree<T, Policy>::retrieveMany(const uint64_t *ids, size_t n, T *out, bool *found) const {
+    if (d->frozen) {
+        size_t count = 0;
+        for (size_t k = 0; k < n; ++k) {
+            found[k] = retrieve(ids[k], out[k]);
+            if (found[k]) ++count;
+        }
+        return count;
+    }
+    const uint32_t top = d->root;
+    if (top == 0) {
+        std::fill(found, found + n, false);
+        return 0;
+    }
 
-    data = cur->data;
+    /// Ids get sorted in chunks, avoiding heap allocations
+    static const size_t chunkSize = 64;
+    uint8_t order[chunkSize];
+    /// path[0..pathLength-1] are the inner nodes passed for the previous
+    /// id, where each node's prefix matched; pathDepth[i] is the level
+    /// at which path[i] branches
+    uint32_t path[IdTreeNode<T, Policy>::bitsPerId];
+    unsigned int pathDepth[IdTreeNode<T, Policy>::bitsPerId];
+    const unsigned int lastLevel = Private::levels() - 1;
+    size_t count = 0;
+    for (size_t start = 0; start < n; start += chunkSize) {
+        const uint64_t *chunk = ids + start;
+        const size_t chunkLength = std::min(chunkSize, n - start);
+        for (size_t k = 0; k < chunkLength; ++k)
+            order[k] = k;
+        std::sort(order, order + chunkLength, [chunk](const uint8_t a, const uint8_t b) {
+            return Private::pathKey(chunk[a]) < Private::pathKey(chunk[b]);
+        });
 
-    d->cache[cache_index].id = id;
-    d->cache[cache_index].data = data;
+        unsigned int pathLength = 0;
+        for (size_t k = 0; k < chunkLength; ++k) {
+            const uint64_t id = chunk[order[k]];
+            if (id == 0)
+                Error::err("Cannot retrieve IdTree<%s> data for id==0", typeid(T).name());
 
-    return true;
-}
+            /// Resume at the deepest node shared with the previous id's path
+            if (k > 0) {
+                const unsigned int shared = Private::commonDepth(chunk[order[k - 1]], id);
+                while (pathLength > 0 && pathDepth[pathLength - 1] > shared) --pathLength;
+            }
+            uint32_t cur = pathLength > 0 ? path[pathLength - 1] : top;
+            if (pathLength > 0) --pathLength;
 
-template <class T>
-bool IdTree<T>::remove(uint64_t id) {
-    std::vector<IdTreeNode<T> *> path;
-    IdTreeNode<T> *cur = d->findNodeForId(id, &path);
-    if (cur == nullptr)
-        return false;
+            const IdTreeLeaf<T, Policy> *leaf = nullptr;
+            while (true) {
+                unsigned int depth;
+                const uint32_t next = d->step(cur, id, depth);
+                if (next == 0) break;
+                path[pathLength] = cur;
+                pathDepth[pathLength] = depth;
+                ++pathLength;
+                if (depth == lastLevel) {
+                    leaf = &d->leaves[next];
+                    break;
+                }
+                cur = next;
+            }
+
+            if (leaf != nullptr && leaf->getId(id) != id) {
+                Error::warn("IdTree<%s>: Ids do not match: %llu != %llu", typeid(T).name(), leaf->getId(id), id);
+                leaf = nullptr;
+            }
+            found[start + order[k]] = leaf != nullptr;
+            if (leaf != nullptr) {
+                out[start + order[k]] = leaf->data;
+                ++count;
+            }
 
-    int num_children = 0;
-    while (num_children == 0 && path.size() > 1) {
-        path.pop_back();
-        IdTreeNode<T> *parent = path.back();
-        num_children = 0;
-        if (parent->children != nullptr)
-            for (int i = (1 << IdTreeNode<T>::bitsPerNode) - 1; i >= 0; --i) {
-                if (cur != nullptr && parent->children[i] == cur) {
-                    delete cur;
-                    cur = nullptr;
-                    parent->children[i] = nullptr;
+            if (k + 1 < chunkLength && pathLength > 0) {
+                /// Prefetch the first node or leaf on the next id's path
+                /// that is not shared with this id's path
+                const uint64_t nextId = chunk[order[k + 1]];
+                const unsigned int shared = Private::commonDepth(id, nextId);
+                unsigned int i = pathLength;
+                while (i > 1 && pathDepth[i - 1] > shared) --i;
+                if (pathDepth[i - 1] <= shared) {
+                    const uint32_t next = d->child(path[i - 1], Private::childIndex(nextId, pathDepth[i - 1]));
+                    if (next != 0)
+                        Private::prefetch(next, pathDepth[i - 1] == lastLevel, d);
                 }
-                if (parent->children[i] != nullptr)
-                    ++num_children;
             }
-        cur = parent;
-    }
-    if (num_children == 0 && cur == d->root) {
-        delete d->root;
-        d->root = nullptr;
+        }
     }
 
+    return count;
+}
+
+template <class T, class Policy>
+bool IdTree<T, Policy>::remove(uint64_t id) {
+    if (d->frozen)
+        d->thaw();
+    uint32_t top = d->root;
+    if (!d->removeFrom(top, id))
+        return false;
+    d->root = top;
+
     --d->size;
+    d->cache.invalidate();
     return true;
 }
 
-template <class T>
-size_t IdTree<T>::size() const {
-    if (d->size == 0)
-        /// IdTree was loaded from file and size never computer, so do it now
-        d->size = d->compute_size(d->root);
+template <class T, class Policy>
+size_t IdTree<T, Policy>::size() const {
     return d->size;
 }
 
-template <class T>
-uint16_t IdTree<T>::counter(const uint64_t id) const {
-    IdTreeNode<T> *cur = d->findNodeForId(id);
-    if (cur == nullptr)
+template <class T, class Policy>
+void IdTree<T, Policy>::setCacheSize(size_t entries) {
+    d->cache.resize(entries);
+}
+
+template <class T, class Policy>
+LookupCacheStatistics IdTree<T, Policy>::cacheStatistics() const {
+    return d->cache.statistics();
+}
+
+template <class T, class Policy>
+void IdTree<T, Policy>::freeze() {
+    /// Freezing again merges the elements inserted and removed by Updates
+    if (d->frozen && !d->frozenModified()) return;
+    if (d->updating)
+        Error::err("Cannot freeze IdTree<%s> while an update is in progress", typeid(T).name());
+
+    std::vector<std::pair<uint64_t, const T *> > elements;
+    d->sortedElements(elements);
+
+    std::vector<uint64_t> ids;
+    ids.reserve(elements.size());
+    std::vector<T> values;
+    values.reserve(elements.size());
+    for (const auto &element : elements) {
+        ids.push_back(element.first);
+        values.push_back(*element.second);
+    }
+    d->frozenIds = EliasFanoIdSet(ids);
+    d->frozenValues.swap(values);
+
+    d->clearTrie();
+    d->clearFrozenRemoved();
+    d->frozen = true;
+    d->cache.invalidate();
+}
+
+template <class T, class Policy>
+size_t IdTree<T, Policy>::memoryUsage() const {
+    return sizeof(*this) + sizeof(*d) + d->nodes2.memoryUsage() + d->nodes4.memoryUsage() + d->nodesFull.memoryUsage() + d->leaves.memoryUsage() + d->frozenIds.memoryUsage() + d->frozenValues.capacity() * sizeof(T);
+}
+
+template <class T, class Policy>
+uint16_t IdTree<T, Policy>::counter(const uint64_t id) const {
+    if (!Policy::withCounter)
+        Error::err("IdTree<%s> has no counters", typeid(T).name());
+
+    if (d->frozen) {
+        if (d->findFrozen(id) == nullptr)
+            Error::err("Cannot retrieve counter for a non-existing IdTreeNode<%s> of id=%llu", typeid(T).name(), id);
+        return 0;
+    }
+
+    const IdTreeLeaf<T, Policy> *leaf = d->findLeafForId(d->root, id);
+    if (leaf == nullptr)
         Error::err("Cannot retrieve counter for a non-existing IdTreeNode<%s> of id=%llu", typeid(T).name(), id);
 
-    return cur->counter;
+    return leaf->getCounter();
 }
 
-template <class T>
-void IdTree<T>::increaseCounter(const uint64_t id) {
-    IdTreeNode<T> *cur = d->findNodeForId(id);
+template <class T, class Policy>
+void IdTree<T, Policy>::increaseCounter(const uint64_t id) {
+    if (!Policy::withCounter)
+        Error::err("IdTree<%s> has no counters", typeid(T).name());
+    if (d->frozen)
+        d->thaw();
 
-    if (cur != nullptr)
-        ++cur->counter;
+    IdTreeLeaf<T, Policy> *leaf = d->findLeafForId(d->root, id);
+    if (leaf != nullptr)
+        leaf->setCounter(leaf->getCounter() + 1);
     else
         Error::err("Cannot increase counter for a non-existing IdTreeNode<%s> of id=%llu", typeid(T).name(), id);
 }
 
-template <class T>
-std::ostream &IdTree<T>::write(std::ostream &output) {
-    if (d->root == nullptr)
-        return output;
+template <class T, class Policy>
+std::ostream &IdTree<T, Policy>::write(std::ostream &output) {
+    /// Size and root have to match, so wait for any Update to finish
+    boost::mutex::scoped_lock lock(d->updateMutex);
     const size_t s = size();
     output.write((char *)&s, sizeof(s));
-    return d->root->write(output);
+    const uint32_t top = d->root;
+    if (d->frozen)
+        d->writeFrozen(output);
+    else if (top == 0) {
+        /// Empty tree is written as root without children
+        d->writeInnerNode(output);
+        d->writeMarkers(output, '0', IdTreeNode<T, Policy>::numChildren);
+    } else
+        d->writeNode(output, top, 0);
+    return output;
+}
+
+template <class T, class Policy>
+std::ostream &IdTree<T, Policy>::writeSnapshot(std::ostream &output) const {
+    if (!IdTreeSnapshotCodec<T>::available)
+        Error::err("IdTree<%s>: Cannot write value type to snapshot", typeid(T).name());
+
+    boost::mutex::scoped_lock lock(d->updateMutex);
+    std::vector<const T *> values;
+    if (d->frozen && !d->frozenModified()) {
+        d->frozenIds.writeSnapshot(output);
+        values.reserve(d->frozenValues.size());
+        for (const T &value : d->frozenValues)
+            values.push_back(&value);
+    } else {
+        std::vector<std::pair<uint64_t, const T *> > elements;
+        d->sortedElements(elements);
+        std::vector<uint64_t> ids;
+        ids.reserve(elements.size());
+        values.reserve(elements.size());
+        for (const auto &element : elements) {
+            ids.push_back(element.first);
+            values.push_back(element.second);
+        }
+        EliasFanoIdSet(ids).writeSnapshot(output);
+    }
+    IdTreeSnapshotCodec<T>::write(output, values);
+    if (!output)
+        Error::err("IdTree<%s>: Could not write snapshot", typeid(T).name());
+
+    return output;
+}
+
+template <class T, class Policy>
+template <class Visitor>
+void IdTree<T, Policy>::forEach(Visitor visitor) const {
+    if (d->frozen && d->frozenModified()) {
+        /// Merge elements of the trie, which take precedence,
+        /// with frozen elements not removed, in ascending id order
+        std::vector<std::pair<uint64_t, const T *> > inserted;
+        const uint32_t top = d->root;
+        if (top != 0) {
+            auto collect = [&inserted](const uint64_t id, T const &data) {
+                inserted.push_back(std::make_pair(id, &data));
+            };
+            d->visitNode(top, collect);
+            std::sort(inserted.begin(), inserted.end(), [](const std::pair<uint64_t, const T *> &a, const std::pair<uint64_t, const T *> &b) {
+                return a.first < b.first;
+            });
+        }
+        const std::vector<uint64_t> *removed = d->frozenRemoved;
+        const std::vector<T> &values = d->frozenValues;
+        auto next = inserted.cbegin();
+        d->frozenIds.forEach([&visitor, &values, &inserted, &next, removed](const size_t index, const uint64_t id) {
+            for (; next != inserted.cend() && next->first < id; ++next)
+                visitor(next->first, *next->second);
+            if (next != inserted.cend() && next->first == id)
+                return; ///< visited below or by next call
+            if (removed == nullptr || !std::binary_search(removed->cbegin(), removed->cend(), id))
+                visitor(id, values[index]);
+        });
+        for (; next != inserted.cend(); ++next)
+            visitor(next->first, *next->second);
+    } else if (d->frozen) {
+        const std::vector<T> &values = d->frozenValues;
+        d->frozenIds.forEach([&visitor, &values](const size_t index, const uint64_t id) {
+            visitor(id, values[index]);
+        });
+    } else {
+        const uint32_t top = d->root;
+        if (top != 0)
+            d->visitNode(top, visitor);
+    }
+}
+
+template <class T, class Policy>
+IdTree<T, Policy>::BulkLoader::BulkLoader(IdTree &_tree)
+    : tree(_tree), bottomUp(false), lastId(0)
+{
+    if (tree.d->frozen)
+        tree.d->thaw();
+    bottomUp = tree.d->root == 0;
+    const unsigned int levels = Private::levels();
+    keys.resize(levels * IdTreeNode<T, Policy>::numChildren);
+    refs.resize(levels * IdTreeNode<T, Policy>::numChildren);
+    counts.assign(levels, 0);
+}
+
+template <class T, class Policy>
+IdTree<T, Policy>::BulkLoader::~BulkLoader()
+{
+    finish();
+}
+
+template <class T, class Policy>
+void IdTree<T, Policy>::BulkLoader::append(uint64_t id, T const &data) {
+    if (bottomUp && lastId > 0 && Private::pathKey(id) <= Private::pathKey(lastId)) {
+        Error::debug("IdTree<%s>: Id %llu not in ascending order after %llu, continuing with regular insertion", typeid(T).name(), id, lastId);
+        finish();
+    }
+    if (!bottomUp) {
+        tree.insert(id, data);
+        return;
+    }
+    if (id == 0)
+        Error::err("Cannot insert element with id=0 into IdTree<%s>", typeid(T).name());
+
+    const unsigned int lastLevel = Private::levels() - 1;
+    if (lastId > 0) {
+        /// Nodes below the level where the paths to the previous
+        /// and the new element split will not get any more children
+        const unsigned int shared = Private::commonDepth(lastId, id);
+        for (unsigned int level = lastLevel; level > shared; --level)
+            closeLevel(level);
+    }
+
+    IdTree::Private *d = tree.d;
+    const uint32_t leafIndex = d->leaves.allocate();
+    IdTreeLeaf<T, Policy> &leaf = d->leaves[leafIndex];
+    leaf.setId(id);
+    leaf.data = data;
+    ++d->size;
+
+    const size_t entry = lastLevel * IdTreeNode<T, Policy>::numChildren + counts[lastLevel]++;
+    keys[entry] = Private::childIndex(id, lastLevel);
+    refs[entry] = leafIndex;
+    lastId = id;
+}
+
+template <class T, class Policy>
+void IdTree<T, Policy>::BulkLoader::finish() {
+    if (!bottomUp) return;
+    bottomUp = false;
+    if (lastId == 0) return;
+
+    for (unsigned int level = Private::levels() - 1; level > 0; --level)
+        closeLevel(level);
+    /// Root node, unless compressed into its only child
+    closeLevel(0);
+    tree.d->root = refs[0];
+}
+
+/**
+ * Create the node for a level's collected children and add it to the
+ * node one level up. For the root level, the resulting reference is
+ * left as the level's first entry.
+ */
+template <class T, class Policy>
+void IdTree<T, Policy>::BulkLoader::closeLevel(const unsigned int level) {
+    const unsigned int count = counts[level];
+    if (count == 0) return;
+    counts[level] = 0;
+
+    IdTree::Private *d = tree.d;
+    const size_t first = level * IdTreeNode<T, Policy>::numChildren;
+    uint32_t ref = refs[first];
+    if (count > 1 || level == Private::levels() - 1) {
+        ref = d->newNode(count, lastId & Private::prefixMask(level), level);
+        for (unsigned int i = 0; i < count; ++i)
+            d->insertChild(ref, keys[first + i], refs[first + i]);
+    } /// else: path compression, pass the only child on to the parent
+
+    if (level == 0)
+        refs[0] = ref;
+    else {
+        const size_t entry = (level - 1) * IdTreeNode<T, Policy>::numChildren + counts[level - 1]++;
+        keys[entry] = Private::childIndex(lastId, level - 1);
+        refs[entry] = ref;
+    }
+}
+
+template <class T, class Policy>
+IdTree<T, Policy>::Update::Update(IdTree &_tree)
+    : tree(_tree)
+{
+    IdTree::Private *d = tree.d;
+    d->updateMutex.lock();
+    d->updating = true;
+    d->workingRoot = d->root;
+    d->workingSize = d->size;
+}
+
+template <class T, class Policy>
+IdTree<T, Policy>::Update::~Update()
+{
+    commit();
+    IdTree::Private *d = tree.d;
+    d->updating = false;
+    d->updateMutex.unlock();
+}
+
+template <class T, class Policy>
+bool IdTree<T, Policy>::Update::insert(uint64_t id, T const &data) {
+    if (id == 0)
+        Error::err("Cannot insert element with id=0 into IdTree<%s>", typeid(T).name());
+
+    IdTree::Private *d = tree.d;
+    /// Elements of a frozen tree get shadowed by those in the trie
+    const bool inFrozen = d->inWorkingFrozen(id);
+    if (d->insertInto(d->workingRoot, id, data) && !inFrozen)
+        ++d->workingSize;
+    return true;
+}
+
+template <class T, class Policy>
+bool IdTree<T, Policy>::Update::remove(uint64_t id) {
+    IdTree::Private *d = tree.d;
+    bool removed = d->workingRoot != 0 && d->removeFrom(d->workingRoot, id);
+    if (d->inWorkingFrozen(id)) {
+        /// Record the id as removed in a copy of the list of removed ids
+        if (d->workingRemoved == nullptr) {
+            const std::vector<uint64_t> *current = d->frozenRemoved;
+            d->workingRemoved = current != nullptr ? new std::vector<uint64_t>(*current) : new std::vector<uint64_t>();
+        }
+        d->workingRemoved->insert(std::lower_bound(d->workingRemoved->begin(), d->workingRemoved->end(), id), id);
+        removed = true;
+    }
+    if (!removed)
+        return false;
+    --d->workingSize;
+    return true;
+}
+
+template <class T, class Policy>
+void IdTree<T, Policy>::Update::commit() {
+    IdTree::Private *d = tree.d;
+    if (d->freshNodes.empty() && d->freshLeaves.empty() && d->replacedNodes.empty() && d->replacedLeaves.empty() && d->workingRemoved == nullptr)
+        return; ///< nothing modified
+
+    /// Published before the root, see Private::findFrozen(..)
+    const std::vector<uint64_t> *previousRemoved = nullptr;
+    if (d->workingRemoved != nullptr) {
+        previousRemoved = d->frozenRemoved.exchange(d->workingRemoved);
+        d->workingRemoved = nullptr;
+    }
+    d->root = d->workingRoot;
+    d->size = d->workingSize;
+    d->cache.invalidate();
+
+    /// Readers that entered up to this epoch may still use the nodes,
+    /// leaves, and list of removed ids replaced by this version
+    const uint64_t epoch = d->epochs.current();
+    if (previousRemoved != nullptr)
+        d->retiredRemoved.push_back(std::make_pair(epoch, previousRemoved));
+    for (const uint32_t ref : d->replacedNodes)
+        d->retiredNodes.push_back(std::make_pair(epoch, ref));
+    for (const uint32_t index : d->replacedLeaves)
+        d->retiredLeaves.push_back(std::make_pair(epoch, index));
+    d->replacedNodes.clear();
+    d->replacedLeaves.clear();
+    d->freshNodes.clear();
+    d->freshLeaves.clear();
+
+    d->reclaim();
+}
+
+template <class T, class Policy>
+IdTree<T, Policy>::ReadGuard::ReadGuard(const IdTree &tree)
+    : guard(tree.d->epochs)
+{
+    /// nothing
+}
+
+template <class T, class Policy>
+size_t IdTree<T, Policy>::reclaimVersions() {
+    boost::mutex::scoped_lock lock(d->updateMutex);
+    return d->reclaim();
 }
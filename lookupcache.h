@@ -0,0 +1,254 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef LOOKUPCACHE_H
+#define LOOKUPCACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Number of cache hits and misses as counted by a LookupCache.
+ */
+struct LookupCacheStatistics {
+    LookupCacheStatistics()
+        : capacity(0), hits(0), misses(0) {
+        /// nothing
+    }
+
+    inline double hitRate() const {
+        return hits + misses > 0 ? (double)hits / (hits + misses) : 0.0;
+    }
+
+    size_t capacity;
+    size_t hits, misses;
+};
+
+/**
+ * Cache for values looked up by id, such as the elements of a tree.
+ *
+ * The cache is set-associative: an id's lowest bits select a set of
+ * 'ways' many entries, each of which may hold the id. If all entries
+ * of a set are occupied, the CLOCK algorithm picks the entry to
+ * replace. Each entry has a reference bit that gets set on a hit; the
+ * set's clock hand skips entries with their bit set (clearing it) and
+ * stops at the first entry without, so that frequently hit entries
+ * survive a stream of one-time lookups.
+ *
+ * To allow concurrent lookups without locking, each thread has its
+ * own copy of the entries, allocated on the thread's first lookup.
+ * Whenever cached values may become stale, i.e. if an element gets
+ * removed or overwritten, the owner of the cache has to call
+ * invalidate(), which empties the entries in all threads.
+ * Hits and misses are counted over all threads.
+ *
+ * Values should be small, for example a pointer to the element's
+ * data in the tree instead of a copy of the data.
+ */
+template <class E>
+class LookupCache
+{
+public:
+    /// Number of entries per set
+    static const unsigned int ways = 4;
+
+    /**
+     * @param capacity number of entries, see resize(..)
+     */
+    explicit LookupCache(size_t capacity = 0)
+        : numSets(0), generation(nextGeneration.fetch_add(1, boost::memory_order_relaxed)), hits(0), misses(0) {
+        boost::mutex::scoped_lock lock(slotMutex);
+        if (freeSlots.empty())
+            slot = nextSlot++;
+        else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        resize(capacity);
+    }
+
+    ~LookupCache() {
+        /// Threads keep their entries for this slot until the slot
+        /// gets reused by another cache, which invalidates them
+        boost::mutex::scoped_lock lock(slotMutex);
+        freeSlots.push_back(slot);
+    }
+
+    /**
+     * Change the number of entries. Each thread empties its entries
+     * and adopts the new capacity on its next lookup.
+     * @param capacity number of entries, rounded up to a multiple of 'ways' times a power of two; 0 disables this cache
+     */
+    void resize(size_t capacity) {
+        size_t sets = 0;
+        if (capacity > 0)
+            for (sets = 1; sets * ways < capacity; sets <<= 1);
+        numSets.store(sets, boost::memory_order_relaxed);
+        invalidate();
+    }
+
+    inline size_t capacity() const {
+        return numSets.load(boost::memory_order_relaxed) * ways;
+    }
+
+    /**
+     * Look up an id in the calling thread's entries.
+     * @param id id to look up, must not be 0
+     * @param value receives the cached value if the id was found
+     * @return true if the id was found
+     */
+    inline bool lookup(const uint64_t id, E &value) const {
+        Set *set = setForId(id);
+        if (set == nullptr)
+            return false;
+
+        for (unsigned int w = 0; w < ways; ++w)
+            if (set->ids[w] == id) {
+                set->referenced |= 1 << w;
+                value = set->values[w];
+                hits.fetch_add(1, boost::memory_order_relaxed);
+                return true;
+            }
+        misses.fetch_add(1, boost::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * Record an id's value in the calling thread's entries,
+     * typically after a missed lookup.
+     * @param id id to store, must not be 0
+     * @param value value to store for this id
+     * @param validGeneration if not 0, value is only stored if the cache has not been invalidated since this value was returned by currentGeneration()
+     */
+    inline void store(const uint64_t id, const E &value, const uint64_t validGeneration = 0) const {
+        uint64_t observedGeneration = 0;
+        Set *set = setForId(id, &observedGeneration);
+        if (set == nullptr || (validGeneration != 0 && validGeneration != observedGeneration))
+            return;
+
+        while ((set->referenced & (1 << set->hand)) != 0) {
+            set->referenced &= ~(1 << set->hand);
+            set->hand = (set->hand + 1) % ways;
+        }
+        set->ids[set->hand] = id;
+        set->values[set->hand] = value;
+        set->hand = (set->hand + 1) % ways;
+    }
+
+    /**
+     * Empty this cache in all threads.
+     */
+    inline void invalidate() {
+        generation.store(nextGeneration.fetch_add(1, boost::memory_order_relaxed), boost::memory_order_release);
+    }
+
+    /**
+     * Changes whenever this cache gets invalidated. A thread looking
+     * up values while another thread replaces them determines the
+     * generation before looking up a value and passes it on to
+     * store(..), so that the value does not get stored if it was
+     * replaced in the meantime.
+     */
+    inline uint64_t currentGeneration() const {
+        return generation.load(boost::memory_order_acquire);
+    }
+
+    LookupCacheStatistics statistics() const {
+        LookupCacheStatistics result;
+        result.capacity = capacity();
+        result.hits = hits.load(boost::memory_order_relaxed);
+        result.misses = misses.load(boost::memory_order_relaxed);
+        return result;
+    }
+
+    void resetStatistics() {
+        hits.store(0, boost::memory_order_relaxed);
+        misses.store(0, boost::memory_order_relaxed);
+    }
+
+private:
+    struct Set {
+        Set()
+            : referenced(0), hand(0) {
+            for (unsigned int w = 0; w < ways; ++w)
+                ids[w] = 0;
+        }
+
+        uint64_t ids[ways]; ///< 0 for unused entries
+        E values[ways];
+        uint8_t referenced; ///< bit w is set if entry w was hit since the hand passed it
+        uint8_t hand; ///< next entry to consider for replacement
+    };
+
+    /**
+     * A thread's entries for one cache. They are only valid as long
+     * as the cache's generation matches, as generations are unique
+     * over all caches of the same type.
+     */
+    struct ThreadEntries {
+        ThreadEntries()
+            : generation(0) {
+            /// nothing
+        }
+
+        uint64_t generation;
+        std::vector<Set> sets;
+    };
+
+    inline Set *setForId(const uint64_t id, uint64_t *observedGeneration = nullptr) const {
+        const size_t sets = numSets.load(boost::memory_order_relaxed);
+        if (sets == 0)
+            return nullptr;
+
+        static thread_local std::vector<ThreadEntries> entriesPerSlot;
+        if (slot >= entriesPerSlot.size())
+            entriesPerSlot.resize(slot + 1);
+        ThreadEntries &entries = entriesPerSlot[slot];
+        const uint64_t currentGeneration = generation.load(boost::memory_order_relaxed);
+        if (entries.generation != currentGeneration || entries.sets.size() != sets) {
+            entries.sets.assign(sets, Set());
+            entries.generation = currentGeneration;
+        }
+        if (observedGeneration != nullptr)
+            *observedGeneration = currentGeneration;
+        return &entries.sets[id & (sets - 1)];
+    }
+
+    boost::atomic<size_t> numSets;
+    boost::atomic<uint64_t> generation;
+    mutable boost::atomic<size_t> hits, misses;
+    /// Position of this cache's entries in each thread's list of entries
+    size_t slot;
+
+    static boost::atomic<uint64_t> nextGeneration;
+    static boost::mutex slotMutex;
+    static std::vector<size_t> freeSlots;
+    static size_t nextSlot;
+};
+
+template <class E>
+boost::atomic<uint64_t> LookupCache<E>::nextGeneration(1);
+template <class E>
+boost::mutex LookupCache<E>::slotMutex;
+template <class E>
+std::vector<size_t> LookupCache<E>::freeSlots;
+template <class E>
+size_t LookupCache<E>::nextSlot = 0;
+
+#endif // LOOKUPCACHE_H
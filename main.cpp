@@ -26,6 +26,7 @@
 #include "config.h"
 #include "httpserver.h"
 #include "testset.h"
+#include "benchmark.h"
 
 inline bool ends_with(std::string const &value, std::string const &ending)
 {
@@ -80,6 +81,13 @@ bool file_exists_readable(const char *filename) {
 }
 
 int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "--check-concurrent-readers") == 0)
+        /// Runs on synthetic data only, neither reads a configuration
+        /// nor touches any files, see 'make test'
+        return Benchmark::checkConcurrentReaders() ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (argc == 2 && strcmp(argv[1], "--check-versioned-updates") == 0)
+        return Benchmark::checkVersionedUpdates() ? EXIT_SUCCESS : EXIT_FAILURE;
+
     if (getuid() == 0)
         Error::err("This program should never be run as root!");
 
@@ -121,11 +129,26 @@ int main(int argc, char *argv[]) {
     /// i.e. when started as a systemd service
     if (server_mode() && !isatty(1) && !debugged_with_gdb() && minimumLoggingLevel < LevelInfo) minimumLoggingLevel = LevelInfo;
 
+    /// Signals for the HTTP server must not interrupt threads
+    /// loading map data, including those started in background
+    if (server_mode())
+        HTTPServer::blockSignals();
+
     PidFile pidfile;
     GlobalObjectManager gom;
 
     /// Check if various global variables look reasonable (i.e. not NULL)
-    if (relMembers != nullptr && wayNodes != nullptr && node2Coord != nullptr && nodeNames != nullptr && wayNames != nullptr && relationNames != nullptr && swedishTextTree != nullptr && sweden != nullptr) {
+    /// Name trees may still be loading in the background, see 'lazy_name_trees'
+    const bool nameTreesLoaded = lazy_name_trees != LazyNameTreesOff || (nodeNames != nullptr && wayNames != nullptr && relationNames != nullptr);
+    if (relMembers != nullptr && wayNodes != nullptr && node2Coord != nullptr && nameTreesLoaded && swedishTextTree != nullptr && sweden != nullptr) {
+        if (benchmark_mode) {
+            /// Benchmarks requested in configuration, run them
+            /// before serving requests or processing testsets
+            waitForNameTrees();
+            Benchmark benchmark;
+            benchmark.run();
+        }
+
         /// If software started in 'server mode', create a TCP server socket
         serverSocket = server_mode() ? socket(PF_INET, SOCK_STREAM, IPPROTO_TCP) : -1;
         if (serverSocket < 0 && server_mode())
@@ -133,7 +156,7 @@ int main(int argc, char *argv[]) {
         if (serverSocket >= 0) {
             /// If a server socket was successfully created,
             /// start HTTP server to listen on this socket
-            HTTPServer httpServer;
+            HTTPServer httpServer(gom);
             httpServer.run();
             close(serverSocket);
         } else if (!testsets.empty()) {
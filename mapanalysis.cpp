@@ -89,10 +89,10 @@ std::vector<struct MapAnalysis::RoadCrossing> MapAnalysis::identifyCrossingRoads
                             if (element_A.type == OSMElement::Node)
                                 node_ids_A.insert(element_A.id);
                             else if (element_A.type == OSMElement::Way) {
-                                WayNodes wn;
-                                if (wayNodes->retrieve(element_A.id, wn))
-                                    for (size_t i = 0; i < wn.num_nodes; ++i)
-                                        node_ids_A.insert(wn.nodes[i]);
+                                const WayNodes *wn = wayNodes->view(element_A.id);
+                                if (wn != nullptr)
+                                    for (size_t i = 0; i < wn->num_nodes; ++i)
+                                        node_ids_A.insert(wn->nodes[i]);
                             }
                         }
                         if (node_ids_A.empty()) continue; ///< No OSM nodes are referred to the list of elements as found when searching for word_combo_A
@@ -112,10 +112,10 @@ std::vector<struct MapAnalysis::RoadCrossing> MapAnalysis::identifyCrossingRoads
                                 if (element_B.type == OSMElement::Node)
                                     node_ids_B.insert(element_B.id);
                                 else if (element_B.type == OSMElement::Way) {
-                                    WayNodes wn;
-                                    if (wayNodes->retrieve(element_B.id, wn))
-                                        for (size_t i = 0; i < wn.num_nodes; ++i)
-                                            node_ids_B.insert(wn.nodes[i]);
+                                    const WayNodes *wn = wayNodes->view(element_B.id);
+                                    if (wn != nullptr)
+                                        for (size_t i = 0; i < wn->num_nodes; ++i)
+                                            node_ids_B.insert(wn->nodes[i]);
                                 }
                             }
                             if (node_ids_B.empty()) continue; ///< No OSM nodes are referred to the list of elements as found when searching for word_combo_B
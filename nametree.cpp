@@ -0,0 +1,476 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "nametree.h"
+
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "pagedidtree.h"
+#include "eliasfano.h"
+#include "error.h"
+
+class NameTree::Private
+{
+public:
+    /// First eight bytes of a serialized NameTree, "namepool" in
+    /// little endian. Serialized IdTrees start with their size
+    /// instead, which never reaches this value.
+    static const uint64_t magic = 0x6c6f6f70656d616eULL;
+    /// Number of elements read or written at once
+    static const size_t chunkSize = 4096;
+
+    /// All names, each terminated by NUL
+    std::vector<char> pool;
+    /// For each id, the position of its name in 'pool'
+    PagedIdTree<uint32_t> *offsets;
+    size_t cacheSize;
+
+    /// Set by freeze(): 'offsets' is empty and the elements'
+    /// ids and offsets are kept in ascending id order instead
+    bool frozen;
+    EliasFanoIdSet frozenIds;
+    std::vector<uint32_t> frozenOffsets;
+    /// Cache for offsets looked up in 'frozenIds', taking the
+    /// place of the cache of 'offsets' while frozen
+    LookupCache<uint32_t> frozenCache;
+
+    /// Set if loaded from a snapshot: the tree is frozen, but
+    /// 'pool' and 'frozenOffsets' are empty and kept inside the
+    /// memory-mapped snapshot instead
+    const char *mappedPool;
+    size_t mappedPoolSize;
+    const uint32_t *mappedOffsets;
+
+    /**
+     * Hashing and comparing names by their position in 'pool',
+     * so that the set of known names does not store a second
+     * copy of each name.
+     */
+    struct PoolHash {
+        PoolHash(const std::vector<char> &_pool)
+            : pool(&_pool) {
+            /// nothing
+        }
+
+        size_t operator()(const uint32_t offset) const {
+            /// FNV-1a
+            size_t hash = 14695981039346656037ULL;
+            for (const char *c = pool->data() + offset; *c != '\0'; ++c)
+                hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+            return hash;
+        }
+
+        const std::vector<char> *pool;
+    };
+    struct PoolEqual {
+        PoolEqual(const std::vector<char> &_pool)
+            : pool(&_pool) {
+            /// nothing
+        }
+
+        bool operator()(const uint32_t a, const uint32_t b) const {
+            return strcmp(pool->data() + a, pool->data() + b) == 0;
+        }
+
+        const std::vector<char> *pool;
+    };
+    /**
+     * Positions of all distinct names in 'pool', only needed while
+     * inserting names. Released once a tree has been loaded and
+     * rebuilt when inserting into a loaded tree.
+     */
+    std::unordered_set<uint32_t, PoolHash, PoolEqual> knownNames;
+
+    Private()
+        : offsets(new PagedIdTree<uint32_t>()), cacheSize(0), frozen(false), frozenCache(0), mappedPool(nullptr), mappedPoolSize(0), mappedOffsets(nullptr), knownNames(0, PoolHash(pool), PoolEqual(pool)) {
+        /// nothing
+    }
+
+    ~Private() {
+        delete offsets;
+    }
+
+    inline const char *poolData() const {
+        return mappedPool != nullptr ? mappedPool : pool.data();
+    }
+
+    inline size_t poolSize() const {
+        return mappedPool != nullptr ? mappedPoolSize : pool.size();
+    }
+
+    inline uint32_t frozenOffset(const size_t index) const {
+        return mappedOffsets != nullptr ? mappedOffsets[index] : frozenOffsets[index];
+    }
+
+    /**
+     * Rebuild the PagedIdTree of offsets of a frozen tree.
+     */
+    void thaw() {
+        if (!frozen) return;
+        Error::debug("NameTree: Modifying frozen tree, rebuilding offsets");
+
+        if (mappedPool != nullptr) {
+            /// Copy names and offsets out of the snapshot
+            pool.assign(mappedPool, mappedPool + mappedPoolSize);
+            frozenOffsets.assign(mappedOffsets, mappedOffsets + frozenIds.size());
+            mappedPool = nullptr;
+            mappedPoolSize = 0;
+            mappedOffsets = nullptr;
+        }
+
+        frozen = false;
+        frozenCache.invalidate();
+        PagedIdTree<uint32_t>::BulkLoader loader(*offsets);
+        frozenIds.forEach([this, &loader](const size_t index, const uint64_t id) {
+            loader.append(id, frozenOffsets[index]);
+        });
+        frozenIds = EliasFanoIdSet();
+        std::vector<uint32_t>().swap(frozenOffsets);
+    }
+
+    /**
+     * Determine the position of a name in the pool,
+     * appending the name if it is not yet known.
+     * @param name name to look up
+     * @return position of name in 'pool'
+     */
+    uint32_t intern(const std::string &name) {
+        if (knownNames.empty() && !pool.empty())
+            rebuildKnownNames();
+
+        const size_t offset = pool.size();
+        if (offset + name.length() + 1 > UINT32_MAX)
+            Error::err("NameTree: Pool of names exceeds 4 GiB");
+        /// Append name tentatively, the set compares names in the pool
+        pool.insert(pool.end(), name.cbegin(), name.cend());
+        pool.push_back('\0');
+        const auto result = knownNames.insert(offset);
+        if (!result.second) {
+            /// Name was known before
+            pool.resize(offset);
+            return *result.first;
+        }
+        return offset;
+    }
+
+    void rebuildKnownNames() {
+        for (size_t offset = 0; offset < pool.size(); offset += strlen(pool.data() + offset) + 1)
+            knownNames.insert(offset);
+    }
+
+    void releaseKnownNames() {
+        std::unordered_set<uint32_t, PoolHash, PoolEqual>(0, PoolHash(pool), PoolEqual(pool)).swap(knownNames);
+    }
+
+    void read(std::istream &input) {
+        uint64_t poolSize = 0;
+        input.read((char *)&poolSize, sizeof(poolSize));
+        if (!input || poolSize > UINT32_MAX)
+            Error::err("NameTree: Could not read size of pool from input stream");
+        pool.resize(poolSize);
+        input.read(pool.data(), poolSize);
+        if (!input || (poolSize > 0 && pool.back() != '\0'))
+            Error::err("NameTree: Could not read pool from input stream");
+
+        uint64_t count = 0;
+        input.read((char *)&count, sizeof(count));
+        if (!input)
+            Error::err("NameTree: Could not read number of elements from input stream");
+        PagedIdTree<uint32_t>::BulkLoader loader(*offsets);
+        std::vector<char> buffer(chunkSize * (sizeof(uint64_t) + sizeof(uint32_t)));
+        for (uint64_t done = 0; done < count;) {
+            const size_t n = std::min<uint64_t>(chunkSize, count - done);
+            input.read(buffer.data(), n * (sizeof(uint64_t) + sizeof(uint32_t)));
+            if (!input)
+                Error::err("NameTree: Could not read elements from input stream");
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t id;
+                uint32_t offset;
+                memcpy(&id, buffer.data() + i * (sizeof(id) + sizeof(offset)), sizeof(id));
+                memcpy(&offset, buffer.data() + i * (sizeof(id) + sizeof(offset)) + sizeof(id), sizeof(offset));
+                if (offset >= poolSize)
+                    Error::err("NameTree: Offset %d of id %llu is outside of pool", offset, id);
+                loader.append(id, offset);
+            }
+            done += n;
+        }
+    }
+
+    static inline unsigned int legacyLevels() {
+        return IdTreeNode<WriteableString>::bitsPerId / IdTreeNode<WriteableString>::bitsPerNode;
+    }
+
+    /**
+     * Map a leaf's path in a serialized IdTree to its id,
+     * see PagedIdTree<T>::Private::trieKey(..).
+     */
+    static uint64_t legacyId(uint64_t key) {
+#ifdef REVERSE_ID_TREE
+        return key;
+#else // REVERSE_ID_TREE
+        static const uint64_t mask = (1 << IdTreeNode<WriteableString>::bitsPerNode) - 1;
+        uint64_t id = 0;
+        for (unsigned int s = legacyLevels(); s > 0; --s) {
+            id = (id << IdTreeNode<WriteableString>::bitsPerNode) | (key & mask);
+            key >>= IdTreeNode<WriteableString>::bitsPerNode;
+        }
+        return id;
+#endif // REVERSE_ID_TREE
+    }
+
+    /**
+     * Read a node as written by IdTree<WriteableString>, collecting
+     * its elements' ids and the positions of their names in the pool.
+     */
+    void readLegacyNode(std::istream &input, const unsigned int depth, const uint64_t key, std::string &name, std::vector<std::pair<uint64_t, uint32_t> > &elements) {
+#ifdef DEBUG
+        uint64_t id = 0;
+        input.read((char *)&id, sizeof(id));
+#endif // DEBUG
+
+        char chr;
+        input.read((char *)&chr, sizeof(chr));
+        if (chr == 'N') {
+            uint16_t counter = 0;
+            input.read((char *)&counter, sizeof(counter));
+            size_t len = 0;
+            input.read((char *)&len, sizeof(len));
+            if (!input)
+                Error::err("NameTree: Could not read string len from input stream");
+            name.resize(len);
+            input.read(&name[0], len);
+            if (!input)
+                Error::err("NameTree: Could not read string from input stream");
+            /// Leaves above the last level carry no element
+            if (depth == legacyLevels())
+                elements.push_back(std::make_pair(legacyId(key), intern(name)));
+        } else if (chr == 'C') {
+            for (int c = IdTreeNode<WriteableString>::numChildren - 1; c >= 0; --c) {
+                input.read((char *)&chr, sizeof(chr));
+                if (chr == '1')
+                    readLegacyNode(input, depth + 1, key | ((uint64_t)c << (IdTreeNode<WriteableString>::bitsPerId - (depth + 1) * IdTreeNode<WriteableString>::bitsPerNode)), name, elements);
+                else if (chr != '0')
+                    Error::err("NameTree: Expected '0' or '1', got '0x%02x' at position %d", chr, input.tellg());
+            }
+        } else
+            Error::err("NameTree: Expected 'N' or 'C', got '0x%02x' at position %d", chr, input.tellg());
+    }
+
+    void readLegacy(std::istream &input, const size_t expectedSize) {
+        std::vector<std::pair<uint64_t, uint32_t> > elements;
+        elements.reserve(expectedSize);
+        std::string name;
+        readLegacyNode(input, 0, 0, name, elements);
+        std::sort(elements.begin(), elements.end());
+        PagedIdTree<uint32_t>::BulkLoader loader(*offsets);
+        for (const auto &element : elements)
+            loader.append(element.first, element.second);
+    }
+};
+
+const uint64_t NameTree::Private::magic;
+const size_t NameTree::Private::chunkSize;
+
+NameTree::NameTree()
+    : d(new NameTree::Private())
+{
+    if (d == nullptr)
+        Error::err("Could not allocate memory for NameTree::Private");
+}
+
+NameTree::NameTree(std::istream &input)
+    : d(new NameTree::Private())
+{
+    uint64_t s = 0;
+    input.read((char *)&s, sizeof(s));
+    if (!input)
+        Error::err("NameTree: Could not read from input stream");
+    if (s == Private::magic)
+        d->read(input);
+    else {
+        if (s > 0)
+            d->readLegacy(input, s);
+        if (s != size())
+            Error::err("Recorded size of NameTree does not match actual size: %d != %d", s, size());
+    }
+    d->releaseKnownNames();
+    d->pool.shrink_to_fit();
+}
+
+NameTree::NameTree(Snapshot::Section &section)
+    : d(new NameTree::Private())
+{
+    /// Frees 'd' if reading throws, see PagedIdTree(Snapshot::Section &)
+    std::unique_ptr<Private> ownPrivate(d);
+    d->mappedPoolSize = section.value<uint64_t>();
+    d->mappedPool = section.array<char>(d->mappedPoolSize);
+    if (d->mappedPoolSize > UINT32_MAX || (d->mappedPoolSize > 0 && d->mappedPool[d->mappedPoolSize - 1] != '\0'))
+        throw DataError("NameTree: Inconsistent pool in snapshot");
+    d->frozenIds = EliasFanoIdSet(section);
+    d->mappedOffsets = section.array<uint32_t>(d->frozenIds.size());
+    for (size_t i = 0; i < d->frozenIds.size(); ++i)
+        if (d->mappedOffsets[i] >= d->mappedPoolSize)
+            throw DataError("NameTree: Offset %d of element %llu is outside of pool", d->mappedOffsets[i], (unsigned long long)i);
+    d->frozen = true;
+    ownPrivate.release();
+}
+
+NameTree::~NameTree()
+{
+    Error::debug("NameTree had %d elements and %d bytes of names", size(), d->poolSize());
+    delete d;
+}
+
+bool NameTree::insert(uint64_t id, const std::string &name) {
+    if (id == 0)
+        Error::err("Cannot insert element with id=0 into NameTree");
+    if (d->frozen)
+        d->thaw();
+    return d->offsets->insert(id, d->intern(name));
+}
+
+const char *NameTree::retrieve(const uint64_t id) const {
+    uint32_t offset = 0;
+    if (d->frozen) {
+        if (!d->frozenCache.lookup(id, offset)) {
+            const size_t index = d->frozenIds.indexOf(id);
+            if (index == EliasFanoIdSet::notFound)
+                return nullptr;
+            offset = d->frozenOffset(index);
+            d->frozenCache.store(id, offset);
+        }
+    } else if (!d->offsets->retrieve(id, offset))
+        return nullptr;
+    return d->poolData() + offset;
+}
+
+bool NameTree::retrieve(const uint64_t id, std::string &name) const {
+    const char *result = retrieve(id);
+    if (result == nullptr)
+        return false;
+    name = result;
+    return true;
+}
+
+size_t NameTree::size() const {
+    return d->frozen ? d->frozenIds.size() : d->offsets->size();
+}
+
+size_t NameTree::memoryUsage() const {
+    return sizeof(*this) + sizeof(*d) + d->pool.capacity() + d->offsets->memoryUsage() + d->frozenIds.memoryUsage() + d->frozenOffsets.capacity() * sizeof(uint32_t);
+}
+
+void NameTree::setCacheSize(size_t entries) {
+    d->cacheSize = entries;
+    d->offsets->setCacheSize(entries);
+    d->frozenCache.resize(entries);
+}
+
+LookupCacheStatistics NameTree::cacheStatistics() const {
+    /// Lookups before and after freezing are counted together
+    LookupCacheStatistics result = d->offsets->cacheStatistics();
+    const LookupCacheStatistics frozenStatistics = d->frozenCache.statistics();
+    if (d->frozen)
+        result.capacity = frozenStatistics.capacity;
+    result.hits += frozenStatistics.hits;
+    result.misses += frozenStatistics.misses;
+    return result;
+}
+
+void NameTree::freeze() {
+    if (d->frozen) return;
+
+    std::vector<uint64_t> ids;
+    ids.reserve(size());
+    std::vector<uint32_t> frozenOffsets;
+    frozenOffsets.reserve(size());
+    d->offsets->forEach([&ids, &frozenOffsets](const uint64_t id, const uint32_t offset) {
+        ids.push_back(id);
+        frozenOffsets.push_back(offset);
+    });
+    d->frozenIds = EliasFanoIdSet(ids);
+    d->frozenOffsets.swap(frozenOffsets);
+
+    delete d->offsets;
+    d->offsets = new PagedIdTree<uint32_t>();
+    d->offsets->setCacheSize(d->cacheSize);
+    d->frozen = true;
+}
+
+void NameTree::forEach(const std::function<void(uint64_t, const char *)> &visitor) const {
+    const char *pool = d->poolData();
+    if (d->frozen) {
+        const Private *p = d;
+        d->frozenIds.forEach([pool, p, &visitor](const size_t index, const uint64_t id) {
+            visitor(id, pool + p->frozenOffset(index));
+        });
+    } else
+        d->offsets->forEach([pool, &visitor](const uint64_t id, const uint32_t offset) {
+            visitor(id, pool + offset);
+        });
+}
+
+std::ostream &NameTree::write(std::ostream &output) {
+    output.write((const char *)&Private::magic, sizeof(Private::magic));
+    const uint64_t poolSize = d->poolSize();
+    output.write((const char *)&poolSize, sizeof(poolSize));
+    output.write(d->poolData(), poolSize);
+
+    const uint64_t count = size();
+    output.write((const char *)&count, sizeof(count));
+    static const size_t bufferSize = Private::chunkSize * (sizeof(uint64_t) + sizeof(uint32_t));
+    std::vector<char> buffer;
+    buffer.reserve(bufferSize);
+    forEach([&output, &buffer, this](const uint64_t id, const char *name) {
+        const uint32_t offset = name - d->poolData();
+        buffer.insert(buffer.end(), (const char *)&id, (const char *)&id + sizeof(id));
+        buffer.insert(buffer.end(), (const char *)&offset, (const char *)&offset + sizeof(offset));
+        if (buffer.size() >= bufferSize) {
+            output.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    });
+    output.write(buffer.data(), buffer.size());
+    if (!output)
+        Error::err("NameTree: Could not write to output stream");
+
+    return output;
+}
+
+std::ostream &NameTree::writeSnapshot(std::ostream &output) const {
+    SnapshotWriter::writeValue<uint64_t>(output, d->poolSize());
+    SnapshotWriter::writeArray(output, d->poolData(), d->poolSize());
+
+    std::vector<uint64_t> ids;
+    ids.reserve(size());
+    std::vector<uint32_t> offsets;
+    offsets.reserve(size());
+    const char *pool = d->poolData();
+    forEach([&ids, &offsets, pool](const uint64_t id, const char *name) {
+        ids.push_back(id);
+        offsets.push_back(name - pool);
+    });
+    EliasFanoIdSet(ids).writeSnapshot(output);
+    SnapshotWriter::writeArray(output, offsets.data(), offsets.size());
+    if (!output)
+        Error::err("NameTree: Could not write snapshot");
+
+    return output;
+}
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef NAMETREE_H
+#define NAMETREE_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <functional>
+
+#include "lookupcache.h"
+#include "snapshot.h"
+
+/**
+ * Storage for the names of OSM elements indexed by their ids.
+ *
+ * All names are kept in a single pool of NUL-terminated strings,
+ * each distinct name only once: many ways share names such as
+ * 'Storgatan' or 'Skolvägen'. For each id, a PagedIdTree stores the
+ * 32-bit offset of its name in the pool. Retrieving a name returns
+ * a pointer into the pool without copying or allocating memory.
+ *
+ * The serialization consists of the pool followed by the pairs of
+ * id and offset in ascending id order, so that loading reads the
+ * pool in one go and appends the offsets in bulk. Files written by
+ * IdTree<WriteableString> in earlier versions can still be read.
+ */
+class NameTree
+{
+public:
+    explicit NameTree();
+    explicit NameTree(std::istream &input);
+    /**
+     * Use the names written by writeSnapshot(..) right where the
+     * snapshot is mapped into memory, which has to outlive the tree.
+     * The tree is frozen, see freeze(). Inserting a name copies all
+     * names first.
+     * @param section section positioned at the tree
+     */
+    explicit NameTree(Snapshot::Section &section);
+    ~NameTree();
+
+    /**
+     * Set an element's name, replacing any previous name.
+     * @param id element's id, must not be 0
+     * @param name element's name
+     * @return true if the name was stored
+     */
+    bool insert(uint64_t id, const std::string &name);
+
+    /**
+     * Look up an element's name.
+     * @param id element's id
+     * @return NUL-terminated name stored in this tree, valid as long as this tree exists and no names get inserted, or nullptr if id has no name
+     */
+    const char *retrieve(const uint64_t id) const;
+    /**
+     * Look up an element's name and copy it into a string.
+     * @param id element's id
+     * @param name receives the element's name if found
+     * @return true if id has a name
+     */
+    bool retrieve(const uint64_t id, std::string &name) const;
+
+    /**
+     * The number of elements having a name in this tree.
+     * @return Number of elements
+     */
+    size_t size() const;
+
+    /**
+     * Number of bytes occupied by the pool of names and the offsets
+     * of all elements' names, not counting names and offsets inside
+     * a memory-mapped snapshot.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * Change the size of the cache for looking up offsets,
+     * see PagedIdTree<T>::setCacheSize(..).
+     */
+    void setCacheSize(size_t entries);
+    LookupCacheStatistics cacheStatistics() const;
+
+    /**
+     * Replace the offsets' PagedIdTree by a read-only representation,
+     * see IdTree<T>::freeze(). Frozen lookups use a cache of
+     * the same size.
+     * Inserting a name rebuilds the PagedIdTree first.
+     */
+    void freeze();
+
+    /**
+     * Call a function for each element in ascending id order.
+     * @param visitor function taking an id and the id's name
+     */
+    void forEach(const std::function<void(uint64_t, const char *)> &visitor) const;
+
+    std::ostream &write(std::ostream &output);
+    /**
+     * Write the pool of names followed by the ids in Elias-Fano
+     * encoding and the offsets of their names to a snapshot section.
+     */
+    std::ostream &writeSnapshot(std::ostream &output) const;
+
+private:
+    class Private;
+    Private *const d;
+};
+
+#endif // NAMETREE_H
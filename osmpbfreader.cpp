@@ -29,9 +29,12 @@
 
 /// For threading
 #include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/lockfree/queue.hpp>
 #include <boost/atomic.hpp>
 
+#include <map>
 #include <stack>
 #include <sstream>
 
@@ -40,8 +43,8 @@
 #include "error.h"
 #include "globalobjects.h"
 #include "helper.h"
-
-#define SHORT_STRING_BUFFER_SIZE     64
+#include "shardedloader.h"
+#include "threadpool.h"
 
 /// Data structure for producer-consumer threads
 /// which will simplify ways before storing them
@@ -150,7 +153,7 @@ size_t applyRamerDouglasPeucker(const OSMWay &way, uint64_t *result) {
     return p;
 }
 
-void simplifyWay(const OSMWay &way) {
+void simplifyWay(const OSMWay &way, IdTree<WayNodes, IdTreeLeanPolicy>::BulkLoader &wayNodesLoader) {
     if (way.size < 2) {
         /// Rare but exists in map: a node with only one node
         /// -> ignore those artefacts
@@ -173,7 +176,7 @@ void simplifyWay(const OSMWay &way) {
     memcpy(wn.nodes, simplifiedWay, sizeof(uint64_t) * wn.num_nodes);
     for (size_t k = 0; k < simplifiedWaySize; ++k)
         node2Coord->increaseCounter((simplifiedWay)[k]);
-    wayNodes->insert(way.id, wn);
+    wayNodesLoader.append(way.id, wn);
 }
 
 /// This method will be run by the consumer thread which is
@@ -183,11 +186,13 @@ void consumerWaySimplification(void) {
     Timer consumerThreadTimer;
 #endif // CPUTIMER
 
+    /// Ways arrive in ascending id order
+    IdTree<WayNodes, IdTreeLeanPolicy>::BulkLoader wayNodesLoader(*wayNodes);
     const OSMWay *way;
     while (!doneWaySimplification) {
         while (queueWaySimplification.pop(way)) {
             --queueWaySimplificationSize;
-            simplifyWay(*way);
+            simplifyWay(*way, wayNodesLoader);
             delete way;
         }
         /// Sleep a little bit to avoid busy waiting
@@ -196,9 +201,10 @@ void consumerWaySimplification(void) {
     }
     while (queueWaySimplification.pop(way)) {
         --queueWaySimplificationSize;
-        simplifyWay(*way);
+        simplifyWay(*way, wayNodesLoader);
         delete way;
     }
+    wayNodesLoader.finish();
 
 #ifdef CPUTIMER
     int64_t cpuTime, wallTime;
@@ -215,9 +221,10 @@ void consumerWaySimplification(void) {
  * @param element_type element type to notify if name belongs to a node, way, or relation
  * @param realworld_type real-world type of element to process
  * @param name_set a collection of key-value pairs of names such as "name:de=Oskars Schleussen"
+ * @return true if the element has at least one name of two or more characters
  */
-void insertNames(uint64_t id, OSMElement::ElementType element_type, OSMElement::RealWorldType realworld_type, const std::map<std::string, std::string> &name_set) {
-    bool first_name = true;
+bool insertNames(uint64_t id, OSMElement::ElementType element_type, OSMElement::RealWorldType realworld_type, const std::map<std::string, std::string> &name_set) {
+    bool has_name = false;
     std::string best_name; ///< if multiple names are available, record the 'best' name
     const OSMElement element(id, element_type, realworld_type);
     std::set<std::string> known_names; ///< track names to avoid duplicate insertions
@@ -229,10 +236,7 @@ void insertNames(uint64_t id, OSMElement::ElementType element_type, OSMElement::
         /// Consider only names of length 2 or longer
         if (name_value.length() < 2) continue;
 
-        if (first_name && element_type == OSMElement::Node) {
-            node2Coord->increaseCounter(id);
-            first_name = false;
-        }
+        has_name = true;
 
         if (name_key.find(":") != std::string::npos) {
             /// Name has components, split and check
@@ -266,14 +270,16 @@ void insertNames(uint64_t id, OSMElement::ElementType element_type, OSMElement::
     if (!best_name.empty()) {
         bool result = false;
         switch (element_type) {
-        case OSMElement::Node: result = nodeNames->insert(id, WriteableString(best_name)); break;
-        case OSMElement::Way: result = wayNames->insert(id, WriteableString(best_name)); break;
-        case OSMElement::Relation: result = relationNames->insert(id, WriteableString(best_name)); break;
+        case OSMElement::Node: result = nodeNames->insert(id, best_name); break;
+        case OSMElement::Way: result = wayNames->insert(id, best_name); break;
+        case OSMElement::Relation: result = relationNames->insert(id, best_name); break;
         case OSMElement::UnknownElementType: break;
         }
         if (!result)
             Error::warn("Cannot insert name %s for %s", best_name.c_str(), element.operator std::string().c_str());
     }
+
+    return has_name;
 }
 
 inline uint64_t record_max_id(const uint64_t current_id, uint64_t &variable_for_max) {
@@ -282,624 +288,866 @@ inline uint64_t record_max_id(const uint64_t current_id, uint64_t &variable_for_
     return current_id;
 }
 
-OsmPbfReader::OsmPbfReader()
-    : id_offset(0)
-{
-    swedishTextTree = nullptr;
-    node2Coord = nullptr;
-    nodeNames = nullptr;
-    wayNames = nullptr;
-    relationNames = nullptr;
-    wayNodes = nullptr;
-    relMembers = nullptr;
-    sweden = nullptr;
-
-    buffer = new char[OSMPBF::max_uncompressed_blob_size];
-    if (buffer == nullptr)
-        Error::err("Could not allocate memory for OsmPbfReader::buffer");
-    unpack_buffer = new char[OSMPBF::max_uncompressed_blob_size];
-    if (unpack_buffer == nullptr)
-        Error::err("Could not allocate memory for OsmPbfReader::unpack_buffer");
+/**
+ * Tell if a key holds a name other than the main name 'name', such as
+ * 'name:en', 'alt_name', or 'official_name'.
+ */
+static inline bool isOtherNameKey(const char *ckey) {
+    return strncmp("name:", ckey, 5) == 0 || strcmp("alt_name", ckey) == 0 || strncmp("alt_name:", ckey, 9) == 0 || strcmp("old_name", ckey) == 0 || strncmp("old_name:", ckey, 9) == 0 || strcmp("loc_name", ckey) == 0 || strncmp("loc_name:", ckey, 9) == 0 || strcmp("short_name", ckey) == 0 || strncmp("short_name:", ckey, 11) == 0 || strcmp("official_name", ckey) == 0 || strncmp("official_name:", ckey, 14) == 0;
 }
 
-OsmPbfReader::~OsmPbfReader()
-{
-    delete[] buffer;
-    delete[] unpack_buffer;
+/**
+ * Tell if a 'highway' value denotes a national or primary regional road.
+ */
+static inline bool isMajorHighway(const std::string &highway) {
+    return highway == "primary" || highway == "secondary" || highway == "tertiary" || highway == "trunk" || highway == "motorway";
 }
 
-bool OsmPbfReader::parse(std::istream &input, bool allow_overlapping_ids) {
-    std::vector<std::pair<uint64_t, std::string> > roadsWithoutRef;
-    size_t count_named_nodes = 0, count_named_ways = 0, count_named_relations = 0;
-    uint64_t largest_observed_id = 0;
+/**
+ * Reads the blobs of an .osm.pbf file in a background thread and
+ * decompresses and parses them into blocks on a pool of threads,
+ * handing out the parsed blocks in the order of the file.
+ *
+ * Decompressing and parsing blocks as well as evaluating the tags of
+ * their elements takes most of the time of reading an .osm.pbf file
+ * and does not depend on other blocks. In contrast, the evaluated
+ * elements have to be applied to the data structures in order, for
+ * example as ways can only be simplified once all nodes are known.
+ * At most a few blocks per thread are read ahead, which limits the
+ * memory held by blocks not processed yet.
+ *
+ * Relations' members do not depend on other elements, so the pool's
+ * threads insert them into 'relMembers' themselves, using one shard
+ * of a ShardedLoader per block being read ahead: the block at
+ * position p in the file uses shard p modulo the number of blocks
+ * read ahead, and is only read once the block that used this shard
+ * before has been handed out. Each shard is thus used by one thread
+ * at a time and receives its blocks' relations in ascending order.
+ * 'relMembers' is complete once the pipeline has been deleted.
+ *
+ * Errors in reading or parsing a blob get reported by next() in the
+ * order of the file, as neither the reading thread nor the pool's
+ * threads may call Error::err(..): exiting from there cannot join
+ * the other threads.
+ */
+class BlockPipeline
+{
+public:
+    /// Node with its tags evaluated
+    struct Node {
+        Node()
+            : id(0), realworld_type(OSMElement::UnknownRealWorldType), is_county(false), is_municipality(false), is_traffic_sign(false) {
+            /// nothing
+        }
 
-    if (!input || !input.good())
-        return false;
+        /// Id including the id offset
+        uint64_t id;
+        Coord coord;
+        OSMElement::RealWorldType realworld_type;
+        /// Names of counties, municipalities, and traffic signs do not get recorded
+        bool is_county, is_municipality, is_traffic_sign;
+        /// Various names like 'name', 'name:en', or 'name:bridge:dk'
+        std::map<std::string, std::string> name_set;
+    };
+
+    /// Way with its tags evaluated
+    struct Way {
+        Way()
+            : id(0), size(0), realworld_type(OSMElement::UnknownRealWorldType), osmWay(nullptr) {
+            /// nothing
+        }
 
-    if (swedishTextTree == nullptr)
-        swedishTextTree = new SwedishTextTree();
-    if (swedishTextTree == nullptr)
-        Error::err("Could not allocate memory for swedishTextTree");
-    if (node2Coord == nullptr)
-        node2Coord = new IdTree<Coord>();
-    if (node2Coord == nullptr)
-        Error::err("Could not allocate memory for node2Coord");
-    if (nodeNames == nullptr)
-        nodeNames = new IdTree<WriteableString>();
-    if (nodeNames == nullptr)
-        Error::err("Could not allocate memory for nodeNames");
-    if (wayNames == nullptr)
-        wayNames = new IdTree<WriteableString>();
-    if (wayNames == nullptr)
-        Error::err("Could not allocate memory for wayNames");
-    if (relationNames == nullptr)
-        relationNames = new IdTree<WriteableString>();
-    if (relationNames == nullptr)
-        Error::err("Could not allocate memory for relationNames");
-    if (wayNodes == nullptr)
-        wayNodes = new IdTree<WayNodes>();
-    if (wayNodes == nullptr)
-        Error::err("Could not allocate memory for wayNodes");
-    if (relMembers == nullptr)
-        relMembers = new IdTree<RelationMem>();
-    if (relMembers == nullptr)
-        Error::err("Could not allocate memory for relmem");
-    if (sweden == nullptr)
-        sweden = new Sweden();
-    if (sweden == nullptr)
-        Error::err("Could not allocate memory for Sweden");
+        /// Id including the id offset
+        uint64_t id;
+        int size;
+        OSMElement::RealWorldType realworld_type;
+        /// Various names like 'name', 'name:en', or 'name:bridge:dk'
+        std::map<std::string, std::string> name_set;
+        /// Values of tags 'ref' and 'highway', empty if not set
+        std::string ref, highway;
+        /// Way's nodes to be simplified, nullptr for ways with less than two nodes
+        OSMWay *osmWay;
+    };
+
+    /// Relation with its tags evaluated, without its members
+    struct Relation {
+        Relation()
+            : id(0), realworld_type(OSMElement::UnknownRealWorldType), admin_level(0) {
+            /// nothing
+        }
 
-    doneWaySimplification = false;
-    boost::thread waySimplificationThread(consumerWaySimplification);
-    size_t max_queue_size = 0;
+        /// Id including the id offset
+        uint64_t id;
+        OSMElement::RealWorldType realworld_type;
+        /// Various names like 'name', 'name:en', or 'name:bridge:dk'
+        std::map<std::string, std::string> name_set;
+        std::string boundary;
+        int admin_level;
+        /// Areas referred to by tags 'ref:scb' and 'ref:nuts:3'
+        std::vector<long int> scb_areas, nuts3_areas;
+        /// Values of above tags that are no numbers
+        std::vector<std::string> invalid_numbers;
+    };
+
+    /// Elements of one primitive group, nodes before dense nodes
+    struct Group {
+        Group()
+            : found_items(false) {
+            /// nothing
+        }
 
-#ifdef CPUTIMER
-    Timer primitiveGroupTimer;
-    int64_t accumulatedPrimitiveGroupTime = 0;
-#endif // CPUTIMER
+        std::vector<Node> nodes;
+        std::vector<Way> ways;
+        std::vector<Relation> relations;
+        bool found_items;
+    };
 
-    /// Read while the file has not reached its end
-    while (input.good()) {
-        /// Storage of size, used multiple times
-        int32_t sz;
+    struct Block {
+        Block()
+            : largest_id(0) {
+            /// nothing
+        }
 
-        /// Read the first 4 bytes of the file, this is the size of the blob-header
-        input.read((char *)(&sz), sizeof(sz));
-        if (!input.good()) {
-            break; /// End of file reached
+        ~Block() {
+            for (Group &group : groups)
+                for (Way &way : group.ways)
+                    delete way.osmWay;
         }
 
-        /// Convert the size from network byte-order to host byte-order
-        sz = ntohl(sz);
+        /// Type of blob as given in its header, such as 'OSMData'
+        std::string type;
+        /// Set for blobs of type 'OSMData' only
+        std::vector<Group> groups;
+        /// Largest id of any element, not including the id offset
+        uint64_t largest_id;
+        /// Set if the blob could not be decompressed or parsed
+        std::string error;
+    };
+
+    /**
+     * @param _input .osm.pbf file to read
+     * @param _id_offset offset to add to each element's id
+     * @param relMembers tree to insert relations' members into
+     */
+    explicit BlockPipeline(std::istream &_input, uint64_t _id_offset, IdTree<RelationMem, IdTreeLeanPolicy> &relMembers)
+        : input(_input), id_offset(_id_offset), pool(new ThreadPool()), numRead(0), numHandedOut(0), endOfFile(false), stopping(false) {
+        maxInFlight = 4 * pool->numThreads();
+        relMembersLoader = new ShardedLoader<IdTree<RelationMem, IdTreeLeanPolicy>, RelationMem>(relMembers, maxInFlight);
+        reader = new boost::thread([this]() {
+            read();
+        });
+    }
 
-        /// Ensure the blob-header is smaller then MAX_BLOB_HEADER_SIZE
-        if (sz > OSMPBF::max_blob_header_size) {
-            Error::err("blob-header-size is bigger then allowed (%u > %u)", sz, OSMPBF::max_blob_header_size);
+    ~BlockPipeline() {
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            stopping = true;
         }
+        condition.notify_all();
+        reader->join();
+        delete reader;
+        /// Waits for blocks still being parsed
+        delete pool;
+        for (auto &it : parsed)
+            delete it.second;
+        /// Merges the shards into 'relMembers'
+        delete relMembersLoader;
+    }
 
-        // read the blob-header from the file
-        input.read(buffer, sz);
-        if (input.gcount() != sz || input.fail()) {
-            Error::err("unable to read blob-header from file");
+    /**
+     * Wait for the next block in the order of the file.
+     * Exits if this block could not be read or parsed.
+     * @return next block to be deleted by the caller, or nullptr once all blocks have been handed out
+     */
+    Block *next() {
+        Block *block = nullptr;
+        std::string error;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while (parsed.find(numHandedOut) == parsed.end() && !(endOfFile && numHandedOut == numRead))
+                condition.wait(lock);
+            const auto it = parsed.find(numHandedOut);
+            if (it == parsed.end())
+                error = readError;
+            else {
+                block = it->second;
+                parsed.erase(it);
+                ++numHandedOut;
+                error = block->error;
+                /// Let reader continue
+                condition.notify_all();
+            }
         }
+        if (!error.empty())
+            Error::err("%s", error.c_str());
+        return block;
+    }
 
-        // parse the blob-header from the read-buffer
-        if (!blobheader.ParseFromArray(buffer, sz)) {
-            Error::err("unable to parse blob header");
+private:
+    /**
+     * Read blob headers and blobs until the end of the file and
+     * hand each blob to the pool of threads. Run by 'reader'.
+     */
+    void read() {
+        try {
+            std::vector<char> header(OSMPBF::max_blob_header_size);
+            while (input.good()) {
+                /// Read the first 4 bytes of the file, this is the size of the blob-header
+                int32_t sz;
+                input.read((char *)(&sz), sizeof(sz));
+                if (!input.good())
+                    break; /// End of file reached
+
+                /// Convert the size from network byte-order to host byte-order
+                sz = ntohl(sz);
+
+                /// Ensure the blob-header is smaller then MAX_BLOB_HEADER_SIZE
+                if (sz > OSMPBF::max_blob_header_size)
+                    throw DataError("blob-header-size is bigger then allowed (%u > %u)", sz, OSMPBF::max_blob_header_size);
+
+                // read the blob-header from the file
+                input.read(header.data(), sz);
+                if (input.gcount() != sz || input.fail())
+                    throw DataError("unable to read blob-header from file");
+
+                // parse the blob-header from the read-buffer
+                OSMPBF::BlobHeader blobheader;
+                if (!blobheader.ParseFromArray(header.data(), sz))
+                    throw DataError("unable to parse blob header");
+
+                // size of the following blob
+                sz = blobheader.datasize();
+
+                // ensure the blob is smaller then MAX_BLOB_SIZE
+                if (sz > OSMPBF::max_uncompressed_blob_size)
+                    throw DataError("blob-size is bigger then allowed (%u > %u)", sz, OSMPBF::max_uncompressed_blob_size);
+
+                // read the blob from the file
+                std::string *data = new std::string(sz, '\0');
+                input.read(&(*data)[0], sz);
+                if (input.gcount() != sz || input.fail()) {
+                    delete data;
+                    throw DataError("unable to read blob from file");
+                } else if (isatty(1))
+                    std::cout << (sz > (1 << 18) ? "*" : (sz > (1 << 16) ? ":" : ".")) << std::flush;
+
+                size_t sequence;
+                {
+                    boost::mutex::scoped_lock lock(mutex);
+                    while (numRead - numHandedOut >= maxInFlight && !stopping)
+                        condition.wait(lock);
+                    if (stopping) {
+                        delete data;
+                        return;
+                    }
+                    sequence = numRead++;
+                }
+                const std::string type = blobheader.type();
+                pool->enqueue([this, sequence, type, data]() {
+                    parse(sequence, type, data);
+                });
+            }
+        } catch (const DataError &e) {
+            /// Blocks read so far get handed out before the error gets reported
+            boost::mutex::scoped_lock lock(mutex);
+            readError = e.what();
         }
 
-        // size of the following blob
-        sz = blobheader.datasize();
-        //debug("  datasize = %u", sz);
+        boost::mutex::scoped_lock lock(mutex);
+        endOfFile = true;
+        condition.notify_all();
+    }
 
-        // ensure the blob is smaller then MAX_BLOB_SIZE
-        if (sz > OSMPBF::max_uncompressed_blob_size) {
-            Error::err("blob-size is bigger then allowed (%u > %u)", sz, OSMPBF::max_uncompressed_blob_size);
+    /**
+     * Decompress a blob, parse the block inside, and evaluate its
+     * elements. Run by the pool of threads.
+     * @param sequence position of blob in the file, counting from 0
+     * @param type type of blob as given in its header
+     * @param data blob as read from file, deleted by this function
+     */
+    void parse(const size_t sequence, const std::string &type, std::string *data) {
+        Block *block = new Block();
+        block->type = type;
+        try {
+            const std::string unpacked = decompress(*data);
+            delete data;
+            data = nullptr;
+
+            // switch between different blob-types
+            if (type == "OSMHeader") {
+                // parse the HeaderBlock from the blob
+                OSMPBF::HeaderBlock headerblock;
+                if (!headerblock.ParseFromString(unpacked))
+                    throw DataError("unable to parse header block");
+            } else if (type == "OSMData") {
+                // parse the PrimitiveBlock from the blob
+                OSMPBF::PrimitiveBlock primblock;
+                if (!primblock.ParseFromString(unpacked))
+                    throw DataError("unable to parse primitive block");
+                evaluate(primblock, sequence % maxInFlight, *block);
+            }
+        } catch (const DataError &e) {
+            delete data;
+            block->error = e.what();
         }
 
-        // read the blob from the file
-        input.read(buffer, sz);
-        if (input.gcount() != sz || input.fail()) {
-            Error::err("unable to read blob from file");
-        } else if (isatty(1))
-            std::cout << (sz > (1 << 18) ? "*" : (sz > (1 << 16) ? ":" : ".")) << std::flush;
+        boost::mutex::scoped_lock lock(mutex);
+        parsed[sequence] = block;
+        condition.notify_all();
+    }
 
-        // parse the blob from the read-buffer
-        if (!blob.ParseFromArray(buffer, sz)) {
-            Error::err("unable to parse blob");
-        }
+    /**
+     * Extract the data stream of a blob.
+     * @param data blob as read from file
+     * @return blob's decompressed data stream
+     */
+    static std::string decompress(const std::string &data) {
+        OSMPBF::Blob blob;
+        if (!blob.ParseFromString(data))
+            throw DataError("unable to parse blob");
 
         // set when we find at least one data stream
         bool found_data = false;
+        // decompressed data of the blob
+        std::string unpacked;
 
         // if the blob has uncompressed data
         if (blob.has_raw()) {
             // we have at least one datastream
             found_data = true;
 
-            // size of the blob-data
-            sz = blob.raw().size();
-
             // check that raw_size is set correctly
-            if (sz != blob.raw_size()) {
+            if ((int)blob.raw().size() != blob.raw_size())
                 Error::warn("  reports wrong raw_size: %u bytes", blob.raw_size());
-            }
-
-            // tell about the blob-data
-            //debug("  contains uncompressed data: %u bytes", sz);
 
-            // copy the uncompressed data over to the unpack_buffer
-            memcpy(unpack_buffer, buffer, sz);
+            unpacked = blob.raw();
         }
 
         // if the blob has zlib-compressed data
         if (blob.has_zlib_data()) {
             // issue a warning if there is more than one data steam, a blob may only contain one data stream
-            if (found_data) {
+            if (found_data)
                 Error::warn("  contains several data streams");
-            }
 
             // we have at least one datastream
             found_data = true;
 
-            // the size of the compressesd data
-            sz = blob.zlib_data().size();
+            if (blob.raw_size() > OSMPBF::max_uncompressed_blob_size)
+                throw DataError("blob-size is bigger then allowed (%u > %u)", blob.raw_size(), OSMPBF::max_uncompressed_blob_size);
+            unpacked.resize(blob.raw_size());
 
             // zlib information
             z_stream z;
-
-            // next byte to decompress
             z.next_in   = (unsigned char *) blob.zlib_data().c_str();
-
-            // number of bytes to decompress
-            z.avail_in  = sz;
-
-            // place of next decompressed byte
-            z.next_out  = (unsigned char *) unpack_buffer;
-
-            // space for decompressed data
-            z.avail_out = blob.raw_size();
-
-            // misc
+            z.avail_in  = blob.zlib_data().size();
+            z.next_out  = (unsigned char *) &unpacked[0];
+            z.avail_out = unpacked.size();
             z.zalloc    = Z_NULL;
             z.zfree     = Z_NULL;
             z.opaque    = Z_NULL;
 
-            if (inflateInit(&z) != Z_OK) {
-                Error::err("  failed to init zlib stream");
-            }
+            if (inflateInit(&z) != Z_OK)
+                throw DataError("  failed to init zlib stream");
             if (inflate(&z, Z_FINISH) != Z_STREAM_END) {
-                Error::err("  failed to inflate zlib stream");
-            }
-            if (inflateEnd(&z) != Z_OK) {
-                Error::err("  failed to deinit zlib stream");
+                inflateEnd(&z);
+                throw DataError("  failed to inflate zlib stream");
             }
+            if (inflateEnd(&z) != Z_OK)
+                throw DataError("  failed to deinit zlib stream");
 
             // unpacked size
-            sz = z.total_out;
+            unpacked.resize(z.total_out);
         }
 
         // if the blob has lzma-compressed data
         if (blob.has_lzma_data()) {
             // issue a warning if there is more than one data steam, a blob may only contain one data stream
-            if (found_data) {
+            if (found_data)
                 Error::warn("  contains several data streams");
-            }
 
-            // we have at least one datastream
-            found_data = true;
-
-            // issue a warning, lzma compression is not yet supported
-            Error::err("  lzma-decompression is not supported");
+            // lzma compression is not yet supported
+            throw DataError("  lzma-decompression is not supported");
         }
 
         // check we have at least one data-stream
-        if (!found_data) {
-            Error::err("  does not contain any known data stream");
+        if (!found_data)
+            throw DataError("  does not contain any known data stream");
+
+        return unpacked;
+    }
+
+    /**
+     * Evaluate the tags of a node, shared by plain and dense nodes.
+     */
+    static void evaluateNodeTag(const std::string &key, const std::string &value, Node &node) {
+        const char *ckey = key.c_str();
+        if (strcmp("name", ckey) == 0 || isOtherNameKey(ckey)) {
+            /// Store name string for later use
+            node.name_set.insert(make_pair(key, value));
+        } else if (strcmp("place", ckey) == 0) {
+            const char *cvalue = value.c_str();
+
+            if (strcmp("county", cvalue) == 0) {
+                /// FIX OSM DATA
+                /// Counties should not be represented by nodes, but by relations
+                /// representing an area
+                // realworld_type = OSMElement::PlaceLargeArea;
+                node.is_county = true;
+            } else if (strcmp("municipality", cvalue) == 0) {
+                /// FIX OSM DATA
+                /// Counties should not be represented by nodes, but by relations
+                /// representing an area
+                // realworld_type = OSMElement::PlaceLargeArea;
+                node.is_municipality = true;
+            } else if (strcmp("traffic_sign", cvalue) == 0) {
+                /// Traffic signs may simply point to a location, but not be *at* this location.
+                /// Thus, their names (if set) may be misleading and so they should be ignored.
+                node.is_traffic_sign = true;
+            }
+
+            if (strcmp("city", cvalue) == 0 || strcmp("municipality", cvalue) == 0)
+                node.realworld_type = OSMElement::PlaceLarge;
+            else if (strcmp("borough", cvalue) == 0 || strcmp("suburb", cvalue) == 0 || strcmp("town", cvalue) == 0 || strcmp("village", cvalue) == 0)
+                node.realworld_type = OSMElement::PlaceMedium;
+            else if (strcmp("quarter", cvalue) == 0 || strcmp("neighbourhood", cvalue) == 0 || strcmp("hamlet", cvalue) == 0 || strcmp("isolated_dwelling", cvalue) == 0)
+                /// Disabling 'city_block' as those may have misleading names like node 3188612201 ('Skaraborg') in Södermalm, Stockholm
+                node.realworld_type = OSMElement::PlaceSmall;
+            else if (strcmp("island", cvalue) == 0)
+                node.realworld_type = OSMElement::Island;
+            else {
+                /// Skipping other types of places:
+                /// * Administrative boundaries should be checked elsewhere like SCBareas or NUTS3areas
+                /// * Very small places like farms or plots neither
+            }
+        } else if (strcmp("natural", ckey) == 0) {
+            if (value == "water")
+                node.realworld_type = OSMElement::Water;
         }
+    }
 
-        // switch between different blob-types
-        if (blobheader.type() == "OSMHeader") {
-            // parse the HeaderBlock from the blob
-            if (!headerblock.ParseFromArray(unpack_buffer, sz)) {
-                Error::err("unable to parse header block");
+    /**
+     * Evaluate the elements of a primitive block and their tags,
+     * which does not depend on other blocks. Run by the pool of threads.
+     * @param shard shard of 'relMembersLoader' to insert relations' members into
+     */
+    void evaluate(const OSMPBF::PrimitiveBlock &primblock, const unsigned int shard, Block &block) {
+        const double coord_scale = 0.000000001;
+        const OSMPBF::StringTable &stringtable = primblock.stringtable();
+
+        block.groups.resize(primblock.primitivegroup_size());
+        // iterate over all PrimitiveGroups
+        for (int i = 0, l = primblock.primitivegroup_size(); i < l; i++) {
+            // one PrimitiveGroup from the the Block
+            const OSMPBF::PrimitiveGroup &pg = primblock.primitivegroup(i);
+            Group &group = block.groups[i];
+
+            if (pg.nodes_size() > 0) {
+                group.found_items = true;
+
+                const int maxnodes = pg.nodes_size();
+                for (int j = 0; j < maxnodes; ++j) {
+                    group.nodes.emplace_back();
+                    Node &node = group.nodes.back();
+                    node.id = record_max_id(pg.nodes(j).id(), block.largest_id) + id_offset;
+
+                    const double lat = coord_scale * (primblock.lat_offset() + (primblock.granularity() * pg.nodes(j).lat()));
+                    const double lon = coord_scale * (primblock.lon_offset() + (primblock.granularity() * pg.nodes(j).lon()));
+                    node.coord = Coord::fromLonLat(lon, lat);
+
+                    for (int k = 0; k < pg.nodes(j).keys_size(); ++k)
+                        evaluateNodeTag(stringtable.s(pg.nodes(j).keys(k)), stringtable.s(pg.nodes(j).vals(k)), node);
+                }
             }
-        } else if (blobheader.type() == "OSMData") {
-            // parse the PrimitiveBlock from the blob
-            if (!primblock.ParseFromArray(unpack_buffer, sz)) {
-                Error::err("unable to parse primitive block");
+
+            if (pg.has_dense()) {
+                group.found_items = true;
+
+                uint64_t last_id = 0;
+                int last_keyvals_pos = 0;
+                double last_lat = 0.0, last_lon = 0.0;
+                const int idmax = pg.dense().id_size();
+                for (int j = 0; j < idmax; ++j) {
+                    group.nodes.emplace_back();
+                    Node &node = group.nodes.back();
+
+                    last_id += pg.dense().id(j);
+                    node.id = record_max_id(last_id, block.largest_id) + id_offset;
+                    last_lat += coord_scale * (primblock.lat_offset() + (primblock.granularity() * pg.dense().lat(j)));
+                    last_lon += coord_scale * (primblock.lon_offset() + (primblock.granularity() * pg.dense().lon(j)));
+                    node.coord = Coord::fromLonLat(last_lon, last_lat);
+
+                    bool isKey = true;
+                    int key = 0, value = 0;
+                    while (last_keyvals_pos < pg.dense().keys_vals_size()) {
+                        const int key_val = pg.dense().keys_vals(last_keyvals_pos);
+                        ++last_keyvals_pos;
+                        if (key_val == 0) break;
+                        if (isKey) {
+                            key = key_val;
+                            isKey = false;
+                        } else { /// must be value
+                            value = key_val;
+                            isKey = true;
+                            evaluateNodeTag(stringtable.s(key), stringtable.s(value), node);
+                        }
+                    }
+                }
             }
 
-            // iterate over all PrimitiveGroups
-            for (int i = 0, l = primblock.primitivegroup_size(); i < l; i++) {
-                // one PrimitiveGroup from the the Block
-                OSMPBF::PrimitiveGroup pg = primblock.primitivegroup(i);
+            if (pg.ways_size() > 0) {
+                group.found_items = true;
 
-                bool found_items = false;
-                const double coord_scale = 0.000000001;
+                const int maxways = pg.ways_size();
+                group.ways.resize(maxways);
+                for (int w = 0; w < maxways; ++w) {
+                    Way &way = group.ways[w];
+                    way.id = record_max_id(pg.ways(w).id(), block.largest_id) + id_offset;
+                    way.size = pg.ways(w).refs_size();
 
-#ifdef CPUTIMER
-                primitiveGroupTimer.start();
-#endif // CPUTIMER
-                if (pg.nodes_size() > 0) {
-                    found_items = true;
-
-                    const int maxnodes = pg.nodes_size();
-                    for (int j = 0; j < maxnodes; ++j) {
-                        const uint64_t id = record_max_id(pg.nodes(j).id(), largest_observed_id);
-                        OSMElement::RealWorldType realworld_type = OSMElement::UnknownRealWorldType;
-                        /// Track various names like 'name', 'name:en', or 'name:bridge:dk'
-                        std::map<std::string, std::string> name_set;
-
-                        const double lat = coord_scale * (primblock.lat_offset() + (primblock.granularity() * pg.nodes(j).lat()));
-                        const double lon = coord_scale * (primblock.lon_offset() + (primblock.granularity() * pg.nodes(j).lon()));
-                        node2Coord->insert(id + (allow_overlapping_ids ? 0 : id_offset), Coord::fromLonLat(lon, lat));
-
-                        bool node_is_county = false, node_is_municipality = false, node_is_traffic_sign = false;
-                        for (int k = 0; k < pg.nodes(j).keys_size(); ++k) {
-                            const char *ckey = primblock.stringtable().s(pg.nodes(j).keys(k)).c_str();
-                            if (strcmp("name", ckey) == 0) {
-                                /// Store 'name' string for later use
-                                name_set.insert(make_pair(primblock.stringtable().s(pg.nodes(j).keys(k)), primblock.stringtable().s(pg.nodes(j).vals(k))));
-                                ++count_named_nodes;
-                            } else if (strncmp("name:", ckey, 5) == 0 || strcmp("alt_name", ckey) == 0 || strncmp("alt_name:", ckey, 9) == 0 || strcmp("old_name", ckey) == 0 || strncmp("old_name:", ckey, 9) == 0 || strcmp("loc_name", ckey) == 0 || strncmp("loc_name:", ckey, 9) == 0 || strcmp("short_name", ckey) == 0 || strncmp("short_name:", ckey, 11) == 0 || strcmp("official_name", ckey) == 0 || strncmp("official_name:", ckey, 14) == 0) {
-                                /// Store name string for later use
-                                name_set.insert(make_pair(primblock.stringtable().s(pg.nodes(j).keys(k)), primblock.stringtable().s(pg.nodes(j).vals(k))));
-                            } else if (strcmp("place", ckey) == 0) {
-                                const char *cvalue = primblock.stringtable().s(pg.nodes(j).vals(k)).c_str();
-
-                                if (strcmp("county", cvalue) == 0) {
-                                    /// FIX OSM DATA
-                                    /// Counties should not be represented by nodes, but by relations
-                                    /// representing an area
-                                    // realworld_type = OSMElement::PlaceLargeArea;
-                                    node_is_county = true;
-                                } else if (strcmp("municipality", cvalue) == 0) {
-                                    /// FIX OSM DATA
-                                    /// Counties should not be represented by nodes, but by relations
-                                    /// representing an area
-                                    // realworld_type = OSMElement::PlaceLargeArea;
-                                    node_is_municipality = true;
-                                } else if (strcmp("traffic_sign", cvalue) == 0) {
-                                    /// Traffic signs may simply point to a location, but not be *at* this location.
-                                    /// Thus, their names (if set) may be misleading and so they should be ignored.
-                                    node_is_traffic_sign = true;
-                                }
-
-                                if (strcmp("city", cvalue) == 0 || strcmp("municipality", cvalue) == 0)
-                                    realworld_type = OSMElement::PlaceLarge;
-                                else if (strcmp("borough", cvalue) == 0 || strcmp("suburb", cvalue) == 0 || strcmp("town", cvalue) == 0 || strcmp("village", cvalue) == 0)
-                                    realworld_type = OSMElement::PlaceMedium;
-                                else if (strcmp("quarter", cvalue) == 0 || strcmp("neighbourhood", cvalue) == 0 || strcmp("hamlet", cvalue) == 0 || strcmp("isolated_dwelling", cvalue) == 0)
-                                    /// Disabling 'city_block' as those may have misleading names like node 3188612201 ('Skaraborg') in Södermalm, Stockholm
-                                    realworld_type = OSMElement::PlaceSmall;
-                                else if (strcmp("island", cvalue) == 0)
-                                    realworld_type = OSMElement::Island;
-                                else {
-                                    /// Skipping other types of places:
-                                    /// * Administrative boundaries should be checked elsewhere like SCBareas or NUTS3areas
-                                    /// * Very small places like farms or plots neither
-                                }
-                            } else if (strcmp("natural", ckey) == 0) {
-                                const char *cvalue = primblock.stringtable().s(pg.nodes(j).vals(k)).c_str();
-                                if (strcmp("water", cvalue) == 0)
-                                    realworld_type = OSMElement::Water;
+                    if (way.size < 2) {
+                        /// Rare but exists in map: a node with only one node (or no node?)
+                        /// -> ignore those artefacts
+                        continue;
+                    }
+
+                    for (int k = 0; k < pg.ways(w).keys_size(); ++k) {
+                        const std::string &key = stringtable.s(pg.ways(w).keys(k));
+                        const char *ckey = key.c_str();
+                        if (strcmp("name", ckey) == 0 || isOtherNameKey(ckey)) {
+                            /// Store name string for later use
+                            way.name_set.insert(make_pair(key, stringtable.s(pg.ways(w).vals(k))));
+                        } else if (strcmp("highway", ckey) == 0) {
+                            /// Store 'highway' string for later use
+                            way.highway = stringtable.s(pg.ways(w).vals(k));
+                            const char *cvalue = way.highway.c_str();
+
+                            if (strcmp("motorway", cvalue) == 0 || strcmp("trunk", cvalue) == 0 || strcmp("primary", cvalue) == 0)
+                                way.realworld_type = OSMElement::RoadMajor;
+                            else if (strcmp("secondary", cvalue) == 0 || strcmp("tertiary", cvalue) == 0)
+                                way.realworld_type = OSMElement::RoadMedium;
+                            else if (strcmp("unclassified", cvalue) == 0 || strcmp("residential", cvalue) == 0 || strcmp("service", cvalue) == 0)
+                                way.realworld_type = OSMElement::RoadMinor;
+                            else {
+                                /// Skipping other types of roads:
+                                /// * Cycle or pedestrian ways
+                                /// * Hiking and 'offroad'
+                                /// * Special cases like turning circles
                             }
+                        } else if (strcmp("ref", ckey) == 0)
+                            /// Store 'ref' string for later use
+                            way.ref = stringtable.s(pg.ways(w).vals(k));
+                        else if (strcmp("building", ckey) == 0)
+                            /// Remember if way is a building
+                            way.realworld_type = OSMElement::Building;
+                        else if (strcmp("place", ckey) == 0) {
+                            if (stringtable.s(pg.ways(w).vals(k)) == "island")
+                                way.realworld_type = OSMElement::Island;
+                        } else if (strcmp("natural", ckey) == 0) {
+                            if (stringtable.s(pg.ways(w).vals(k)) == "water")
+                                way.realworld_type = OSMElement::Water;
                         }
-
-                        if (node_is_municipality)
-                            Error::info("Municipality '%s' is represented by node %llu, not recoding node's name", name_set["name"].c_str(), id + (allow_overlapping_ids ? 0 : id_offset));
-                        else if (node_is_county)
-                            Error::info("County '%s' is represented by node %llu, not recoding node's name", name_set["name"].c_str(), id + (allow_overlapping_ids ? 0 : id_offset));
-                        else if (node_is_traffic_sign)
-                            Error::info("Node %llu with name '%s' is a traffic sign, not recoding node's name", id + (allow_overlapping_ids ? 0 : id_offset), name_set["name"].c_str());
-                        else if (!name_set.empty() /** implicitly: not node_is_municipality and not node_is_county and not node_is_traffic_sign */)
-                            insertNames(id + (allow_overlapping_ids ? 0 : id_offset), OSMElement::Node, realworld_type, name_set);
                     }
+
+                    way.osmWay = new OSMWay(pg.ways(w), id_offset);
                 }
+            }
 
-                if (pg.has_dense()) {
-                    found_items = true;
-
-                    uint64_t last_id = 0;
-                    int last_keyvals_pos = 0;
-                    double last_lat = 0.0, last_lon = 0.0;
-                    const int idmax = pg.dense().id_size();
-                    for (int j = 0; j < idmax; ++j) {
-                        OSMElement::RealWorldType realworld_type = OSMElement::UnknownRealWorldType;
-                        /// Track various names like 'name', 'name:en', or 'name:bridge:dk'
-                        std::map<std::string, std::string> name_set;
-
-                        last_id += pg.dense().id(j);
-                        record_max_id(last_id, largest_observed_id);
-                        last_lat += coord_scale * (primblock.lat_offset() + (primblock.granularity() * pg.dense().lat(j)));
-                        last_lon += coord_scale * (primblock.lon_offset() + (primblock.granularity() * pg.dense().lon(j)));
-                        node2Coord->insert(last_id + (allow_overlapping_ids ? 0 : id_offset), Coord::fromLonLat(last_lon, last_lat));
-
-                        bool isKey = true;
-                        int key = 0, value = 0;
-                        bool node_is_county = false, node_is_municipality = false, node_is_traffic_sign = false;
-                        while (last_keyvals_pos < pg.dense().keys_vals_size()) {
-                            const int key_val = pg.dense().keys_vals(last_keyvals_pos);
-                            ++last_keyvals_pos;
-                            if (key_val == 0) break;
-                            if (isKey) {
-                                key = key_val;
-                                isKey = false;
-                            } else { /// must be value
-                                value = key_val;
-                                isKey = true;
-
-                                const char *ckey = primblock.stringtable().s(key).c_str();
-                                if (strcmp("name", ckey) == 0) {
-                                    /// Store 'name' string for later use
-                                    name_set.insert(make_pair(primblock.stringtable().s(key), primblock.stringtable().s(value)));
-                                    ++count_named_nodes;
-                                } else if (strncmp("name:", ckey, 5) == 0 || strcmp("alt_name", ckey) == 0 || strncmp("alt_name:", ckey, 9) == 0 || strcmp("old_name", ckey) == 0 || strncmp("old_name:", ckey, 9) == 0 || strcmp("loc_name", ckey) == 0 || strncmp("loc_name:", ckey, 9) == 0 || strcmp("short_name", ckey) == 0 || strncmp("short_name:", ckey, 11) == 0 || strcmp("official_name", ckey) == 0 || strncmp("official_name:", ckey, 14) == 0) {
-                                    /// Store name string for later use
-                                    name_set.insert(make_pair(primblock.stringtable().s(key), primblock.stringtable().s(value)));
-                                } else if (strcmp("place", ckey) == 0) {
-                                    const char *cvalue = primblock.stringtable().s(value).c_str();
-
-                                    if (strcmp("county", cvalue) == 0) {
-                                        /// FIX OSM DATA
-                                        /// Counties should not be represented by nodes, but by relations
-                                        /// representing an area
-                                        // realworld_type = OSMElement::PlaceLargeArea;
-                                        node_is_county = true;
-                                    } else if (strcmp("municipality", cvalue) == 0) {
-                                        /// FIX OSM DATA
-                                        /// Counties should not be represented by nodes, but by relations
-                                        /// representing an area
-                                        // realworld_type = OSMElement::PlaceLargeArea;
-                                        node_is_municipality = true;
-                                    } else if (strcmp("traffic_sign", cvalue) == 0) {
-                                        /// Traffic signs may simply point to a location, but not be *at* this location.
-                                        /// Thus, their names (if set) may be misleading and so they should be ignored.
-                                        node_is_traffic_sign = true;
-                                    }
-
-                                    if (strcmp("city", cvalue) == 0 || strcmp("municipality", cvalue) == 0)
-                                        realworld_type = OSMElement::PlaceLarge;
-                                    else if (strcmp("borough", cvalue) == 0 || strcmp("suburb", cvalue) == 0 || strcmp("town", cvalue) == 0 || strcmp("village", cvalue) == 0)
-                                        realworld_type = OSMElement::PlaceMedium;
-                                    else if (strcmp("quarter", cvalue) == 0 || strcmp("neighbourhood", cvalue) == 0 || strcmp("hamlet", cvalue) == 0 || strcmp("isolated_dwelling", cvalue) == 0)
-                                        /// Disabling 'city_block' as those may have misleading names like node 3188612201 ('Skaraborg') in Södermalm, Stockholm
-                                        realworld_type = OSMElement::PlaceSmall;
-                                    else if (strcmp("island", cvalue) == 0)
-                                        realworld_type = OSMElement::Island;
-                                    else {
-                                        /// Skipping other types of places:
-                                        /// * Administrative boundaries should be checked elsewhere like SCBareas or NUTS3areas
-                                        /// * Very small places like farms or plots neither
-                                    }
-                                } else if (strcmp("natural", ckey) == 0) {
-                                    const char *cvalue = primblock.stringtable().s(value).c_str();
-                                    if (strcmp("water", cvalue) == 0)
-                                        realworld_type = OSMElement::Water;
-                                }
+            if (pg.relations_size() > 0) {
+                group.found_items = true;
+
+                const int maxrelations = pg.relations_size();
+                group.relations.reserve(maxrelations);
+                for (int i = 0; i < maxrelations; ++i) {
+                    const uint64_t relId = record_max_id(pg.relations(i).id(), block.largest_id) + id_offset;
+
+                    /// Some relations should be ignored, e.g. for roads outside of Sweden
+                    /// which just happend to be included in the map data
+                    /// To sort:  echo '3, 1, 2' | sed -e 's/ //g' | tr ',' '\n' | sort -u -n | tr '\n' ',' | sed -e 's/,/, /g'
+                    static const uint64_t blacklistedRelIds[] = {2545969, 3189514, 5518156, 5756777, 5794315, 5794316, 0};
+                    /// To count: echo '3, 1, 2' | sed -e 's/ //g' | tr ',' '\n' | wc -l
+                    static const size_t blacklistedRelIds_count = 6;
+                    if (inSortedArray(blacklistedRelIds, blacklistedRelIds_count, relId)) continue;
+
+                    if (relId == 0)
+                        throw DataError("Relation has id 0");
+                    if (pg.relations(i).memids_size() <= 0)
+                        throw DataError("Relation %llu has no members", relId);
+                    group.relations.emplace_back();
+                    Relation &relation = group.relations.back();
+                    relation.id = relId;
+
+                    std::string type, route;
+                    const int maxkv = pg.relations(i).keys_size();
+                    for (int k = 0; k < maxkv; ++k) {
+                        const std::string &key = stringtable.s(pg.relations(i).keys(k));
+                        const char *ckey = key.c_str();
+                        if (strcmp("name", ckey) == 0 || isOtherNameKey(ckey)) {
+                            /// Store name string for later use
+                            relation.name_set.insert(make_pair(key, stringtable.s(pg.relations(i).vals(k))));
+                        } else if (strcmp("type", ckey) == 0) {
+                            /// Store 'type' string for later use
+                            type = stringtable.s(pg.relations(i).vals(k));
+                        } else if (strcmp("route", ckey) == 0) {
+                            /// Store 'route' string for later use
+                            route = stringtable.s(pg.relations(i).vals(k));
+                        } else if (strcmp("ref:scb", ckey) == 0 || strcmp("ref:se:scb", ckey) == 0) {
+                            /// Found SCB reference (two digits for lands, four digits for municipalities
+                            const char *s = stringtable.s(pg.relations(i).vals(k)).c_str();
+                            errno = 0;
+                            const long int v = strtol(s, NULL, 10);
+                            if (errno == 0)
+                                relation.scb_areas.push_back(v);
+                            else
+                                relation.invalid_numbers.push_back(s);
+                        } else if (strcmp("ref:nuts:3", ckey) == 0) {
+                            /// Found three-digit NUTS reference (SEnnn)
+                            const char *s = stringtable.s(pg.relations(i).vals(k)).c_str();
+                            if (s[0] == 'S' && s[1] == 'E' && s[2] >= '0' && s[2] <= '9') {
+                                errno = 0;
+                                const long int v = strtol(s + 2 /** adding 2 to skip 'SE' prefix */, NULL, 10);
+                                if (errno == 0 && v > 0)
+                                    relation.nuts3_areas.push_back(v);
+                                else
+                                    relation.invalid_numbers.push_back(s + 2);
                             }
+                        } else if (strcmp("boundary", ckey) == 0) {
+                            /// Store 'boundary' string for later use
+                            relation.boundary = stringtable.s(pg.relations(i).vals(k));
+                        } else if (strcmp("admin_level", ckey) == 0) {
+                            /// Store 'admin_level' string for later use
+                            std::stringstream ss(stringtable.s(pg.relations(i).vals(k)));
+                            ss >> relation.admin_level;
+                        } else if (strcmp("building", ckey) == 0)
+                            /// Remember if way is a building
+                            relation.realworld_type = OSMElement::Building;
+                        else if (strcmp("place", ckey) == 0) {
+                            if (stringtable.s(pg.relations(i).vals(k)) == "island")
+                                relation.realworld_type = OSMElement::Island;
+                        } else if (strcmp("natural", ckey) == 0) {
+                            if (stringtable.s(pg.relations(i).vals(k)) == "water")
+                                relation.realworld_type = OSMElement::Water;
                         }
+                        // TODO cover different types of relations to set 'realworld_type' properly
+                    }
 
-                        if (node_is_municipality)
-                            Error::info("Municipality '%s' is represented by node %llu, not recoding node's name", name_set["name"].c_str(), last_id + (allow_overlapping_ids ? 0 : id_offset));
-                        else if (node_is_county)
-                            Error::info("County '%s' is represented by node %llu, not recoding node's name", name_set["name"].c_str(), last_id + (allow_overlapping_ids ? 0 : id_offset));
-                        else if (node_is_traffic_sign)
-                            Error::info("Node %llu with name '%s' is a traffic sign, not recoding node's name", last_id + (allow_overlapping_ids ? 0 : id_offset), name_set["name"].c_str());
-                        else if (!name_set.empty() /** implicitly: not node_is_municipality and not node_is_county and not node_is_traffic_sign */)
-                            insertNames(last_id + (allow_overlapping_ids ? 0 : id_offset), OSMElement::Node, realworld_type, name_set);
+                    if (relation.realworld_type == OSMElement::UnknownRealWorldType && type.compare("route") == 0 && route.compare("road") == 0)
+                        relation.realworld_type = OSMElement::RoadMajor;
+                    else if (relation.realworld_type == OSMElement::UnknownRealWorldType && relation.boundary.compare("administrative") == 0)
+                        relation.realworld_type = OSMElement::PlaceLargeArea;
+
+                    RelationMem rm(pg.relations(i).memids_size());
+                    uint64_t memId = 0;
+                    for (int k = 0; k < pg.relations(i).memids_size(); ++k) {
+                        memId += pg.relations(i).memids(k);
+                        uint16_t flags = 0;
+                        if (strcmp("outer", stringtable.s(pg.relations(i).roles_sid(k)).c_str()) == 0)
+                            flags |= RelationFlags::RoleOuter;
+                        else if (strcmp("inner", stringtable.s(pg.relations(i).roles_sid(k)).c_str()) == 0)
+                            flags |= RelationFlags::RoleInner;
+                        OSMElement::ElementType type = OSMElement::UnknownElementType;
+                        if (pg.relations(i).types(k) == 0)
+                            type = OSMElement::Node;
+                        else if (pg.relations(i).types(k) == 1)
+                            type = OSMElement::Way;
+                        else if (pg.relations(i).types(k) == 2)
+                            type = OSMElement::Relation;
+                        else
+                            Error::warn("Unknown relation type for member %llu in relation %llu : type=%d", memId, relId, pg.relations(i).types(k));
+                        rm.members[k] = OSMElement(memId, type, OSMElement::UnknownRealWorldType);
+                        rm.member_flags[k] = flags;
                     }
+                    relMembersLoader->insert(shard, relId, rm);
                 }
+            }
+        }
+    }
 
-                if (pg.ways_size() > 0) {
-                    found_items = true;
+    std::istream &input;
+    const uint64_t id_offset;
+    ThreadPool *pool;
+    boost::thread *reader;
+
+    boost::mutex mutex;
+    /// Notified whenever a block got read, parsed, or handed out
+    boost::condition_variable condition;
+    /// Parsed blocks not handed out yet, by position in file
+    std::map<size_t, Block *> parsed;
+    /// Number of blobs read and handed out, respectively
+    size_t numRead, numHandedOut;
+    /// Maximum number of blobs read but not handed out yet
+    size_t maxInFlight;
+    /// One shard per blob read ahead, see above
+    ShardedLoader<IdTree<RelationMem, IdTreeLeanPolicy>, RelationMem> *relMembersLoader;
+    bool endOfFile, stopping;
+    /// Set if reading stopped before the end of the file
+    std::string readError;
+};
+
+OsmPbfReader::OsmPbfReader()
+    : id_offset(0)
+{
+    swedishTextTree = nullptr;
+    node2Coord = nullptr;
+    nodeNames = nullptr;
+    wayNames = nullptr;
+    relationNames = nullptr;
+    wayNodes = nullptr;
+    relMembers = nullptr;
+    sweden = nullptr;
+}
 
-                    char buffer_ref[SHORT_STRING_BUFFER_SIZE], buffer_highway[SHORT_STRING_BUFFER_SIZE];
-                    const int maxways = pg.ways_size();
-                    for (int w = 0; w < maxways; ++w) {
-                        const uint64_t wayId = record_max_id(pg.ways(w).id(), largest_observed_id);
-                        const int way_size = pg.ways(w).refs_size();
+OsmPbfReader::~OsmPbfReader()
+{
+    /// nothing
+}
 
-                        if (way_size < 2) {
-                            /// Rare but exists in map: a node with only one node (or no node?)
-                            /// -> ignore those artefacts
-                            Error::warn("Way %llu has only %d node(s)", wayId + (allow_overlapping_ids ? 0 : id_offset), way_size);
-                            continue;
-                        }
+bool OsmPbfReader::parse(std::istream &input, bool allow_overlapping_ids) {
+    std::vector<std::pair<uint64_t, std::string> > roadsWithoutRef;
+    size_t count_named_nodes = 0, count_named_ways = 0, count_named_relations = 0;
+    uint64_t largest_observed_id = 0;
 
-                        OSMElement::RealWorldType realworld_type = OSMElement::UnknownRealWorldType;
-                        /// Track various names like 'name', 'name:en', or 'name:bridge:dk'
-                        std::map<std::string, std::string> name_set;
-
-                        buffer_ref[0] = buffer_highway[0] = '\0'; /// clear buffers
-                        for (int k = 0; k < pg.ways(w).keys_size(); ++k) {
-                            const char *ckey = primblock.stringtable().s(pg.ways(w).keys(k)).c_str();
-                            if (strcmp("name", ckey) == 0) {
-                                /// Store 'name' string for later use
-                                name_set.insert(make_pair(primblock.stringtable().s(pg.ways(w).keys(k)), primblock.stringtable().s(pg.ways(w).vals(k))));
-                                ++count_named_nodes;
-                            } else if (strncmp("name:", ckey, 5) == 0 || strcmp("alt_name", ckey) == 0 || strncmp("alt_name:", ckey, 9) == 0 || strcmp("old_name", ckey) == 0 || strncmp("old_name:", ckey, 9) == 0 || strcmp("loc_name", ckey) == 0 || strncmp("loc_name:", ckey, 9) == 0 || strcmp("short_name", ckey) == 0 || strncmp("short_name:", ckey, 11) == 0 || strcmp("official_name", ckey) == 0 || strncmp("official_name:", ckey, 14) == 0) {
-                                /// Store name string for later use
-                                name_set.insert(make_pair(primblock.stringtable().s(pg.ways(w).keys(k)), primblock.stringtable().s(pg.ways(w).vals(k))));
-                            } else if (strcmp("highway", ckey) == 0) {
-                                const char *cvalue = primblock.stringtable().s(pg.ways(w).vals(k)).c_str();
-
-                                /// Store 'highway' string for later use
-                                strncpy(buffer_highway, cvalue, SHORT_STRING_BUFFER_SIZE);
-
-                                if (strcmp("motorway", cvalue) == 0 || strcmp("trunk", cvalue) == 0 || strcmp("primary", cvalue) == 0)
-                                    realworld_type = OSMElement::RoadMajor;
-                                else if (strcmp("secondary", cvalue) == 0 || strcmp("tertiary", cvalue) == 0)
-                                    realworld_type = OSMElement::RoadMedium;
-                                else if (strcmp("unclassified", cvalue) == 0 || strcmp("residential", cvalue) == 0 || strcmp("service", cvalue) == 0)
-                                    realworld_type = OSMElement::RoadMinor;
-                                else {
-                                    /// Skipping other types of roads:
-                                    /// * Cycle or pedestrian ways
-                                    /// * Hiking and 'offroad'
-                                    /// * Special cases like turning circles
-                                }
-                            } else if (strcmp("ref", ckey) == 0)
-                                /// Store 'ref' string for later use
-                                strncpy(buffer_ref, primblock.stringtable().s(pg.ways(w).vals(k)).c_str(), SHORT_STRING_BUFFER_SIZE);
-                            else if (strcmp("building", ckey) == 0)
-                                /// Remember if way is a building
-                                realworld_type = OSMElement::Building;
-                            else if (strcmp("place", ckey) == 0) {
-                                const char *cvalue = primblock.stringtable().s(pg.ways(w).vals(k)).c_str();
-                                if (strcmp("island", cvalue) == 0)
-                                    realworld_type = OSMElement::Island;
-                            } else if (strcmp("natural", ckey) == 0) {
-                                const char *cvalue = primblock.stringtable().s(pg.ways(w).vals(k)).c_str();
-                                if (strcmp("water", cvalue) == 0)
-                                    realworld_type = OSMElement::Water;
-                            }
-                        }
+    if (!input || !input.good())
+        return false;
 
-                        /// If 'ref' string is not empty and 'highway' string is 'primary', 'secondary', or 'tertiary' ...
-                        if (buffer_ref[0] != '\0' && buffer_highway[0] != '\0' && (strcmp(buffer_highway, "primary") == 0 || strcmp(buffer_highway, "secondary") == 0 || strcmp(buffer_highway, "tertiary") == 0 || strcmp(buffer_highway, "trunk") == 0 || strcmp(buffer_highway, "motorway") == 0))
-                            /// ... assume that this way is part of a national or primary regional road
-                            sweden->insertWayAsRoad(wayId + (allow_overlapping_ids ? 0 : id_offset), buffer_ref);
-
-                        /// This main thread is the 'producer' of ways,
-                        /// pushing ways into a queue. Another thread,
-                        /// the consumer, will pop ways, simplify them
-                        /// (removing superfluous nodes), and store them
-                        /// for searches later.
-                        queueWaySimplification.push(new OSMWay(pg.ways(w), allow_overlapping_ids ? 0 : id_offset));
-                        /// Keep track of queue size for statistical purposes
-                        ++queueWaySimplificationSize;
-                        if (queueWaySimplificationSize > max_queue_size) max_queue_size = queueWaySimplificationSize;
-                        if (queueWaySimplificationSize > queueWaySimplification_recommendedSize - 16) {
-                            /// Give consumer thread time to catch up
-                            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-                        }
+    if (swedishTextTree == nullptr)
+        swedishTextTree = new SwedishTextTree();
+    if (swedishTextTree == nullptr)
+        Error::err("Could not allocate memory for swedishTextTree");
+    if (node2Coord == nullptr)
+        node2Coord = new PagedIdTree<Coord>();
+    if (node2Coord == nullptr)
+        Error::err("Could not allocate memory for node2Coord");
+    if (nodeNames == nullptr)
+        nodeNames = new NameTree();
+    if (nodeNames == nullptr)
+        Error::err("Could not allocate memory for nodeNames");
+    if (wayNames == nullptr)
+        wayNames = new NameTree();
+    if (wayNames == nullptr)
+        Error::err("Could not allocate memory for wayNames");
+    if (relationNames == nullptr)
+        relationNames = new NameTree();
+    if (relationNames == nullptr)
+        Error::err("Could not allocate memory for relationNames");
+    if (wayNodes == nullptr)
+        wayNodes = new IdTree<WayNodes, IdTreeLeanPolicy>();
+    if (wayNodes == nullptr)
+        Error::err("Could not allocate memory for wayNodes");
+    if (relMembers == nullptr)
+        relMembers = new IdTree<RelationMem, IdTreeLeanPolicy>();
+    if (relMembers == nullptr)
+        Error::err("Could not allocate memory for relmem");
+    if (sweden == nullptr)
+        sweden = new Sweden();
+    if (sweden == nullptr)
+        Error::err("Could not allocate memory for Sweden");
 
-                        if (way_size > 3 && buffer_ref[0] == '\0' && buffer_highway[0] != '\0' && (strcmp(buffer_highway, "primary") == 0 || strcmp(buffer_highway, "secondary") == 0 || strcmp(buffer_highway, "tertiary") == 0 || strcmp(buffer_highway, "trunk") == 0 || strcmp(buffer_highway, "motorway") == 0))
-                            roadsWithoutRef.push_back(std::make_pair(wayId + (allow_overlapping_ids ? 0 : id_offset), std::string(buffer_highway)));
+    /// Nodes arrive in ascending id order
+    PagedIdTree<Coord>::BulkLoader node2CoordLoader(*node2Coord);
 
-                        if (!name_set.empty())
-                            insertNames(wayId + (allow_overlapping_ids ? 0 : id_offset), OSMElement::Way, realworld_type, name_set);
-                    }
+    doneWaySimplification = false;
+    boost::thread waySimplificationThread(consumerWaySimplification);
+    size_t max_queue_size = 0;
+
+#ifdef CPUTIMER
+    Timer primitiveGroupTimer;
+    int64_t accumulatedPrimitiveGroupTime = 0;
+#endif // CPUTIMER
+
+    /// Blocks get decompressed and parsed and their elements evaluated
+    /// in parallel, but the elements get processed in file order
+    BlockPipeline pipeline(input, allow_overlapping_ids ? 0 : id_offset, *relMembers);
+    BlockPipeline::Block *block;
+    while ((block = pipeline.next()) != nullptr) {
+        record_max_id(block->largest_id, largest_observed_id);
+
+        if (block->type == "OSMHeader") {
+            /// Nothing to process in header blocks
+        } else if (block->type == "OSMData") {
+            // iterate over all PrimitiveGroups
+            for (BlockPipeline::Group &group : block->groups) {
+#ifdef CPUTIMER
+                primitiveGroupTimer.start();
+#endif // CPUTIMER
+                for (BlockPipeline::Node &node : group.nodes) {
+                    if (node.name_set.find("name") != node.name_set.end())
+                        ++count_named_nodes;
+
+                    bool named = false;
+                    if (node.is_municipality)
+                        Error::info("Municipality '%s' is represented by node %llu, not recoding node's name", node.name_set["name"].c_str(), node.id);
+                    else if (node.is_county)
+                        Error::info("County '%s' is represented by node %llu, not recoding node's name", node.name_set["name"].c_str(), node.id);
+                    else if (node.is_traffic_sign)
+                        Error::info("Node %llu with name '%s' is a traffic sign, not recoding node's name", node.id, node.name_set["name"].c_str());
+                    else if (!node.name_set.empty() /** implicitly: not node_is_municipality and not node_is_county and not node_is_traffic_sign */)
+                        named = insertNames(node.id, OSMElement::Node, node.realworld_type, node.name_set);
+                    /// Named nodes start with a counter of 1 to protect them from way simplification
+                    node2CoordLoader.append(node.id, node.coord, named ? 1 : 0);
                 }
 
-                if (pg.relations_size() > 0) {
-                    found_items = true;
-
-                    const int maxrelations = pg.relations_size();
-                    for (int i = 0; i < maxrelations; ++i) {
-                        const uint64_t relId = record_max_id(pg.relations(i).id(), largest_observed_id);
-
-                        /// Some relations should be ignored, e.g. for roads outside of Sweden
-                        /// which just happend to be included in the map data
-                        /// To sort:  echo '3, 1, 2' | sed -e 's/ //g' | tr ',' '\n' | sort -u -n | tr '\n' ',' | sed -e 's/,/, /g'
-                        static const uint64_t blacklistedRelIds[] = {2545969, 3189514, 5518156, 5756777, 5794315, 5794316, 0};
-                        /// To count: echo '3, 1, 2' | sed -e 's/ //g' | tr ',' '\n' | wc -l
-                        static const size_t blacklistedRelIds_count = 6;
-                        if (inSortedArray(blacklistedRelIds, blacklistedRelIds_count, relId + (allow_overlapping_ids ? 0 : id_offset))) continue;
-
-                        OSMElement::RealWorldType realworld_type = OSMElement::UnknownRealWorldType;
-                        /// Track various names like 'name', 'name:en', or 'name:bridge:dk'
-                        std::map<std::string, std::string> name_set;
-                        std::string type, route, boundary;
-                        int admin_level = 0;
-                        const int maxkv = pg.relations(i).keys_size();
-                        for (int k = 0; k < maxkv; ++k) {
-                            const char *ckey = primblock.stringtable().s(pg.relations(i).keys(k)).c_str();
-                            if (strcmp("name", ckey) == 0) {
-                                /// Store 'name' string for later use
-                                name_set.insert(make_pair(primblock.stringtable().s(pg.relations(i).keys(k)), primblock.stringtable().s(pg.relations(i).vals(k))));
-                                ++count_named_nodes;
-                            } else if (strncmp("name:", ckey, 5) == 0 || strcmp("alt_name", ckey) == 0 || strncmp("alt_name:", ckey, 9) == 0 || strcmp("old_name", ckey) == 0 || strncmp("old_name:", ckey, 9) == 0 || strcmp("loc_name", ckey) == 0 || strncmp("loc_name:", ckey, 9) == 0 || strcmp("short_name", ckey) == 0 || strncmp("short_name:", ckey, 11) == 0 || strcmp("official_name", ckey) == 0 || strncmp("official_name:", ckey, 14) == 0) {
-                                /// Store name string for later use
-                                name_set.insert(make_pair(primblock.stringtable().s(pg.relations(i).keys(k)), primblock.stringtable().s(pg.relations(i).vals(k))));
-                            } else if (strcmp("type", ckey) == 0) {
-                                /// Store 'type' string for later use
-                                type = primblock.stringtable().s(pg.relations(i).vals(k));
-                            } else if (strcmp("route", ckey) == 0) {
-                                /// Store 'route' string for later use
-                                route = primblock.stringtable().s(pg.relations(i).vals(k));
-                            } else if (strcmp("ref:scb", ckey) == 0 || strcmp("ref:se:scb", ckey) == 0) {
-                                /// Found SCB reference (two digits for lands, four digits for municipalities
-                                const char *s = primblock.stringtable().s(pg.relations(i).vals(k)).c_str();
-                                errno = 0;
-                                const long int v = strtol(s, NULL, 10);
-                                if (errno == 0)
-                                    sweden->insertSCBarea(v, relId + (allow_overlapping_ids ? 0 : id_offset));
-                                else
-                                    Error::warn("Cannot convert '%s' to a number", s);
-                            } else if (strcmp("ref:nuts:3", ckey) == 0) {
-                                /// Found three-digit NUTS reference (SEnnn)
-                                const char *s = primblock.stringtable().s(pg.relations(i).vals(k)).c_str();
-                                if (s[0] == 'S' && s[1] == 'E' && s[2] >= '0' && s[2] <= '9') {
-                                    errno = 0;
-                                    const long int v = strtol(s + 2 /** adding 2 to skip 'SE' prefix */, NULL, 10);
-                                    if (errno == 0 && v > 0)
-                                        sweden->insertNUTS3area(v, relId + (allow_overlapping_ids ? 0 : id_offset));
-                                    else
-                                        Error::warn("Cannot convert '%s' to a number", s + 2);
-                                }
-                            } else if (strcmp("boundary", ckey) == 0) {
-                                /// Store 'boundary' string for later use
-                                boundary = primblock.stringtable().s(pg.relations(i).vals(k));
-                            } else if (strcmp("admin_level", ckey) == 0) {
-                                /// Store 'admin_level' string for later use
-                                std::stringstream ss(primblock.stringtable().s(pg.relations(i).vals(k)));
-                                ss >> admin_level;
-                            } else if (strcmp("building", ckey) == 0)
-                                /// Remember if way is a building
-                                realworld_type = OSMElement::Building;
-                            else if (strcmp("place", ckey) == 0) {
-                                const char *cvalue = primblock.stringtable().s(pg.relations(i).vals(k)).c_str();
-                                if (strcmp("island", cvalue) == 0)
-                                    realworld_type = OSMElement::Island;
-                            } else if (strcmp("natural", ckey) == 0) {
-                                const char *cvalue = primblock.stringtable().s(pg.relations(i).vals(k)).c_str();
-                                if (strcmp("water", cvalue) == 0)
-                                    realworld_type = OSMElement::Water;
-                            }
-                            // TODO cover different types of relations to set 'realworld_type' properly
-                        }
+                if (!group.ways.empty())
+                    /// All nodes have been read, way simplification needs their coordinates
+                    node2CoordLoader.finish();
 
-                        if (realworld_type == OSMElement::UnknownRealWorldType && type.compare("route") == 0 && route.compare("road") == 0)
-                            realworld_type = OSMElement::RoadMajor;
-                        else if (realworld_type == OSMElement::UnknownRealWorldType && boundary.compare("administrative") == 0)
-                            realworld_type = OSMElement::PlaceLargeArea;
-
-                        const auto name(name_set["name"]);
-                        if (admin_level > 0 && name.length() > 1 && (boundary.compare("administrative") == 0 || boundary.compare("historic") == 0))
-                            sweden->insertAdministrativeRegion(name, admin_level, relId + (allow_overlapping_ids ? 0 : id_offset));
-
-                        RelationMem rm(pg.relations(i).memids_size());
-                        uint64_t memId = 0;
-                        for (int k = 0; k < pg.relations(i).memids_size(); ++k) {
-                            memId += pg.relations(i).memids(k);
-                            uint16_t flags = 0;
-                            if (strcmp("outer", primblock.stringtable().s(pg.relations(i).roles_sid(k)).c_str()) == 0)
-                                flags |= RelationFlags::RoleOuter;
-                            else if (strcmp("inner", primblock.stringtable().s(pg.relations(i).roles_sid(k)).c_str()) == 0)
-                                flags |= RelationFlags::RoleInner;
-                            OSMElement::ElementType type = OSMElement::UnknownElementType;
-                            if (pg.relations(i).types(k) == 0)
-                                type = OSMElement::Node;
-                            else if (pg.relations(i).types(k) == 1)
-                                type = OSMElement::Way;
-                            else if (pg.relations(i).types(k) == 2)
-                                type = OSMElement::Relation;
-                            else
-                                Error::warn("Unknown relation type for member %llu in relation %llu : type=%d", memId, relId + (allow_overlapping_ids ? 0 : id_offset), pg.relations(i).types(k));
-                            rm.members[k] = OSMElement(memId, type, OSMElement::UnknownRealWorldType);
-                            rm.member_flags[k] = flags;
-                        }
-                        relMembers->insert(relId + (allow_overlapping_ids ? 0 : id_offset), rm);
+                for (BlockPipeline::Way &way : group.ways) {
+                    if (way.osmWay == nullptr) {
+                        /// Rare but exists in map: a node with only one node (or no node?)
+                        /// -> ignore those artefacts
+                        Error::warn("Way %llu has only %d node(s)", way.id, way.size);
+                        continue;
+                    }
 
-                        if (!name_set.empty())
-                            insertNames(relId + (allow_overlapping_ids ? 0 : id_offset), OSMElement::Relation, realworld_type, name_set);
+                    if (way.name_set.find("name") != way.name_set.end())
+                        ++count_named_nodes;
+
+                    /// If 'ref' string is not empty and 'highway' string is 'primary', 'secondary', or 'tertiary' ...
+                    if (!way.ref.empty() && isMajorHighway(way.highway))
+                        /// ... assume that this way is part of a national or primary regional road
+                        sweden->insertWayAsRoad(way.id, way.ref.c_str());
+
+                    /// This main thread is the 'producer' of ways,
+                    /// pushing ways into a queue. Another thread,
+                    /// the consumer, will pop ways, simplify them
+                    /// (removing superfluous nodes), and store them
+                    /// for searches later.
+                    queueWaySimplification.push(way.osmWay);
+                    way.osmWay = nullptr;
+                    /// Keep track of queue size for statistical purposes
+                    ++queueWaySimplificationSize;
+                    if (queueWaySimplificationSize > max_queue_size) max_queue_size = queueWaySimplificationSize;
+                    if (queueWaySimplificationSize > queueWaySimplification_recommendedSize - 16) {
+                        /// Give consumer thread time to catch up
+                        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
                     }
+
+                    if (way.size > 3 && way.ref.empty() && isMajorHighway(way.highway))
+                        roadsWithoutRef.push_back(std::make_pair(way.id, way.highway));
+
+                    if (!way.name_set.empty())
+                        insertNames(way.id, OSMElement::Way, way.realworld_type, way.name_set);
                 }
 
-                if (!found_items) {
+                for (BlockPipeline::Relation &relation : group.relations) {
+                    if (relation.name_set.find("name") != relation.name_set.end())
+                        ++count_named_nodes;
+
+                    for (const long int v : relation.scb_areas)
+                        sweden->insertSCBarea(v, relation.id);
+                    for (const long int v : relation.nuts3_areas)
+                        sweden->insertNUTS3area(v, relation.id);
+                    for (const std::string &s : relation.invalid_numbers)
+                        Error::warn("Cannot convert '%s' to a number", s.c_str());
+
+                    const auto name(relation.name_set["name"]);
+                    if (relation.admin_level > 0 && name.length() > 1 && (relation.boundary.compare("administrative") == 0 || relation.boundary.compare("historic") == 0))
+                        sweden->insertAdministrativeRegion(name, relation.admin_level, relation.id);
+
+                    if (!relation.name_set.empty())
+                        insertNames(relation.id, OSMElement::Relation, relation.realworld_type, relation.name_set);
+                }
+
+                if (!group.found_items) {
                     Error::warn("      contains no items");
                 }
             }
@@ -913,8 +1161,10 @@ bool OsmPbfReader::parse(std::istream &input, bool allow_overlapping_ids) {
 
         else {
             // unknown blob type
-            Error::warn("  unknown blob type: %s", blobheader.type().c_str());
+            Error::warn("  unknown blob type: %s", block->type.c_str());
         }
+
+        delete block;
     }
 
     /// Line break after series of dots
@@ -925,6 +1175,8 @@ bool OsmPbfReader::parse(std::istream &input, bool allow_overlapping_ids) {
     Error::debug("Time to process primitive groups: cpu= %.3fms", accumulatedPrimitiveGroupTime / 1000.0);
 #endif // CPUTIMER
 
+    node2CoordLoader.finish();
+
     Timer joinTimer;
     int64_t wallTime, cpuTime;
     doneWaySimplification = true;
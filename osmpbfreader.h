@@ -58,23 +58,6 @@ public:
     bool parse(std::istream &input, bool allow_overlapping_ids);
 
 private:
-    /// Buffer for reading a compressed blob from file
-    char *buffer;
-    /// Buffer for decompressing the blob
-    char *unpack_buffer;
-
-    // pbf struct of a BlobHeader
-    OSMPBF::BlobHeader blobheader;
-
-    // pbf struct of a Blob
-    OSMPBF::Blob blob;
-
-    // pbf struct of an OSM HeaderBlock
-    OSMPBF::HeaderBlock headerblock;
-
-    // pbf struct of an OSM PrimitiveBlock
-    OSMPBF::PrimitiveBlock primblock;
-
     static const uint64_t exclaveInclaveWays[];
 
     /// If loading multiple .osm.pbf files that *may* have overlapping
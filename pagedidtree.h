@@ -0,0 +1,182 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef PAGEDIDTREE_H
+#define PAGEDIDTREE_H
+
+#include <istream>
+#include <ostream>
+
+#include "idtree.h"
+
+template <class T>
+struct PagedIdTreePage;
+
+/**
+ * Storage for small, fixed-size values such as coordinates indexed by
+ * OSM ids. It is a drop-in replacement for IdTree<T> offering the same
+ * interface and reading/writing the same serialization format, so files
+ * written by one class can be read by the other.
+ *
+ * Instead of descending through 16 levels of a trie, an id is split into
+ * a page number (upper bits) and an offset inside this page (lower
+ * 16 bits). A flat page directory maps the page number to the page.
+ * Inside a page, the presence of ids is recorded either as a sorted
+ * list of 16-bit offsets (pages with few ids) or as a bitmap annotated
+ * with rank counts (pages with many ids), the values themselves are
+ * stored in a compact array in ascending id order.
+ * For regional extracts like Sweden's, node ids are far from dense
+ * over the whole id space but come in long runs, making most pages
+ * either nearly empty or rather full.
+ * As pages consist of flat arrays only, they can be written to a
+ * snapshot and used right where the snapshot is mapped into memory.
+ */
+template <class T>
+class PagedIdTree
+{
+public:
+    explicit PagedIdTree();
+    explicit PagedIdTree(std::istream &input);
+    /**
+     * Use the pages written by writeSnapshot(..) right where the
+     * snapshot is mapped into memory, which has to outlive the tree.
+     * Modifying the tree copies all pages first.
+     * @param section section positioned at the tree
+     */
+    explicit PagedIdTree(Snapshot::Section &section);
+    ~PagedIdTree();
+
+    bool insert(uint64_t id, T const &);
+    bool retrieve(const uint64_t id, T &) const;
+    /**
+     * Retrieve the data for many ids at once. Ids are processed in
+     * the given order, but memory accesses for later ids are
+     * prefetched while earlier ids are being processed, so that
+     * cache misses of several lookups overlap.
+     * @param ids array of n ids to look up
+     * @param n number of ids
+     * @param out array of n elements, receives the data of each found id
+     * @param found array of n flags, set to whether the corresponding id was found
+     * @return number of ids found
+     */
+    size_t retrieveMany(const uint64_t *ids, size_t n, T *out, bool *found) const;
+    bool remove(uint64_t id);
+    /**
+     * The number of elements inserted (and not yet removed)
+     * into this tree.
+     * @return Number of elements
+     */
+    size_t size() const;
+
+    uint16_t counter(const uint64_t id) const;
+    void increaseCounter(const uint64_t id);
+    /**
+     * Release the memory used for counters, for example once
+     * importing map data is complete and counters are no longer
+     * needed. Afterwards, all elements have a counter of zero.
+     */
+    void dropCounters();
+
+    /**
+     * Compress the values of all pages to save memory, for example
+     * once importing map data is complete and the tree is only read.
+     * Values are encoded in blocks by PagedIdTreeCodec<T>, and a
+     * lookup decodes the part of the block up to the requested value.
+     * Modifying a compressed page decompresses it first.
+     * For value types without a codec and for trees loaded from a
+     * snapshot, this function does nothing.
+     */
+    void compress();
+
+    /**
+     * Number of bytes occupied by this tree, including the page
+     * directory, presence information, values, and counters, but
+     * not counting pages inside a memory-mapped snapshot.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * Change the size of the cache used by retrieve(..), which keeps
+     * copies of recently retrieved values. Each thread has its own
+     * entries. Disabled by default, as a lookup in this tree is
+     * hardly more expensive than in the cache.
+     * @param entries number of entries per thread, 0 disables the cache
+     */
+    void setCacheSize(size_t entries);
+    /**
+     * Number of hits and misses of the lookup cache over all threads
+     * since this tree was created.
+     */
+    LookupCacheStatistics cacheStatistics() const;
+
+    std::ostream &write(std::ostream &output);
+    /**
+     * Write this tree's pages to a snapshot section as they are,
+     * compressed or not, to be used by PagedIdTree(Snapshot::Section &).
+     * Counters are not written.
+     */
+    std::ostream &writeSnapshot(std::ostream &output) const;
+
+    /**
+     * Call a function for each element in ascending id order.
+     * @param visitor function taking an id and the id's data
+     */
+    template <class Visitor>
+    void forEach(Visitor visitor) const;
+
+    /**
+     * Fills a tree with elements arriving in ascending id order, such
+     * as ids read from an .osm.pbf file. Elements get appended to
+     * their page without searching for their position, and each
+     * page's presence information is built in one go once the page
+     * is complete. Elements arriving out of order or belonging to
+     * pages that existed before loading started are inserted using
+     * insert(..). The tree must not be accessed otherwise until finish()
+     * has been called or the loader has been deleted.
+     */
+    class BulkLoader
+    {
+    public:
+        explicit BulkLoader(PagedIdTree &tree);
+        ~BulkLoader();
+
+        /**
+         * @param id id of element, ideally larger than all previously appended ids
+         * @param data element's data
+         * @param counter initial value of element's counter
+         */
+        void append(uint64_t id, T const &data, uint16_t counter = 0);
+        /**
+         * Complete the page of the elements appended so far.
+         * The loader may still be used afterwards.
+         */
+        void finish();
+
+    private:
+        PagedIdTree &tree;
+        /// Page currently being filled, its elements are
+        /// kept in a sorted list of offsets until it is complete
+        PagedIdTreePage<T> *page;
+    };
+
+private:
+    class Private;
+    Private *const d;
+};
+
+#include "pagedidtree_impl.h"
+
+#endif // PAGEDIDTREE_H
@@ -0,0 +1,1315 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <typeinfo>
+
+#include "bufferedreader.h"
+
+/**
+ * Codec to compress the values of a page, see PagedIdTree<T>::compress().
+ * Values are encoded in blocks, each block independently of others.
+ * Value types without a specialization of this codec do not get
+ * compressed.
+ */
+template <class T>
+struct PagedIdTreeCodec {
+    static const bool available = false;
+    /// Number of bytes after the last block that decode(..) may read
+    static const size_t padding = 0;
+
+    static void encode(const T *, const size_t, std::vector<uint8_t> &) {
+        /// nothing
+    }
+
+    static T decode(const uint8_t *, const size_t) {
+        return T();
+    }
+};
+
+/**
+ * Nodes with nearby ids are usually close to each other, for example
+ * consecutive nodes along a way. Each block stores the smallest x and
+ * y value among its coordinates, followed by all coordinates' offsets
+ * from those values, bit-packed with as many bits as the largest
+ * offset in this block requires. Thus, most coordinates take 4 to 5
+ * bytes instead of 8, and decoding a single coordinate does not
+ * require decoding its predecessors in the block.
+ */
+template <>
+struct PagedIdTreeCodec<Coord> {
+    static const bool available = true;
+    /// A field of zero bits at the very end of a block
+    /// still reads the eight bytes following its position
+    static const size_t padding = sizeof(uint64_t);
+
+    /**
+     * Encode a block of coordinates.
+     * @param values coordinates to encode
+     * @param n number of coordinates, at least 1
+     * @param output vector to append the encoded block to
+     */
+    static void encode(const Coord *values, const size_t n, std::vector<uint8_t> &output) {
+        Header header;
+        header.minX = header.minY = INT32_MAX;
+        int32_t maxX = INT32_MIN, maxY = INT32_MIN;
+        for (size_t i = 0; i < n; ++i) {
+            header.minX = std::min(header.minX, (int32_t)values[i].x);
+            header.minY = std::min(header.minY, (int32_t)values[i].y);
+            maxX = std::max(maxX, (int32_t)values[i].x);
+            maxY = std::max(maxY, (int32_t)values[i].y);
+        }
+        header.bitsX = bitsFor((uint32_t)((int64_t)maxX - header.minX));
+        header.bitsY = bitsFor((uint32_t)((int64_t)maxY - header.minY));
+        const uint8_t *h = (const uint8_t *)&header;
+        output.insert(output.end(), h, h + sizeof(header));
+
+        uint64_t buffer = 0;
+        unsigned int bufferedBits = 0;
+        const auto append = [&buffer, &bufferedBits, &output](const uint64_t value, const unsigned int bits) {
+            buffer |= value << bufferedBits;
+            bufferedBits += bits;
+            while (bufferedBits >= 8) {
+                output.push_back(buffer & 0xff);
+                buffer >>= 8;
+                bufferedBits -= 8;
+            }
+        };
+        for (size_t i = 0; i < n; ++i) {
+            append((uint32_t)((int64_t)values[i].x - header.minX), header.bitsX);
+            append((uint32_t)((int64_t)values[i].y - header.minY), header.bitsY);
+        }
+        if (bufferedBits > 0)
+            output.push_back(buffer & 0xff);
+    }
+
+    /**
+     * Decode a single coordinate of a block.
+     * @param block start of encoded block
+     * @param k position of coordinate inside block
+     * @return decoded coordinate
+     */
+    static Coord decode(const uint8_t *block, const size_t k) {
+        Header header;
+        memcpy(&header, block, sizeof(header));
+        const uint8_t *bits = block + sizeof(header);
+        const size_t position = k * (header.bitsX + header.bitsY);
+        return Coord((int)(header.minX + (int64_t)extract(bits, position, header.bitsX)), (int)(header.minY + (int64_t)extract(bits, position + header.bitsX, header.bitsY)));
+    }
+
+private:
+    struct __attribute__((packed)) Header {
+        int32_t minX, minY;
+        uint8_t bitsX, bitsY;
+    };
+
+    static inline uint8_t bitsFor(const uint32_t value) {
+        return value == 0 ? 0 : 32 - __builtin_clz(value);
+    }
+
+    /**
+     * Read a value of up to 32 bits starting at an arbitrary bit
+     * position. Reads eight bytes, which is why blocks are followed
+     * by 'padding' bytes.
+     */
+    static inline uint32_t extract(const uint8_t *bits, const size_t position, const unsigned int width) {
+        uint64_t word;
+        memcpy(&word, bits + position / 8, sizeof(word));
+        return (word >> (position % 8)) & ((1ULL << width) - 1);
+    }
+};
+
+template <class T>
+struct PagedIdTreePageView;
+
+template <class T>
+struct PagedIdTreePage {
+    /// Number of lower id bits used to address an element inside a page
+    static const int offsetBits = 16;
+    static const uint64_t offsetMask = (1ULL << offsetBits) - 1;
+    static const size_t numWords = (1 << offsetBits) / 64;
+    /**
+     * A page with up to sparseLimit many elements keeps a sorted list of
+     * 16-bit offsets (2 bytes per element) searched by bisection. Above
+     * this limit, a bitmap with rank counts (16 KiB per page, i.e. at
+     * most 4 bytes per element) allows constant-time lookups.
+     */
+    static const size_t sparseLimit = 4096;
+    /// Number of values per block in compressed pages
+    static const size_t blockSize = 128;
+
+    /**
+     * One 64-bit word of the presence bitmap together with the number
+     * of bits set in all preceding words, so that testing an id and
+     * locating its value in 'data' touches only a single cache line.
+     */
+    struct Word {
+        uint64_t bits;
+        uint32_t rank;
+    };
+
+    PagedIdTreePage()
+        : words(nullptr), highestWord(0), packedCount(0) {
+        /// nothing
+    }
+
+    ~PagedIdTreePage() {
+        if (words != nullptr)
+            free(words);
+    }
+
+    /**
+     * Determine the position of an offset's value in 'data'.
+     * @param offset offset of an id inside this page
+     * @return position in 'data' or -1 if offset is not in use
+     */
+    inline int indexOf(const uint16_t offset) const {
+        return words != nullptr ? indexOfDense(words, offset) : indexOfSparse(offsets.data(), offsets.size(), offset);
+    }
+
+    static inline int indexOfDense(const Word *words, const uint16_t offset) {
+        const Word &word = words[offset >> 6];
+        const uint64_t bit = 1ULL << (offset & 63);
+        if ((word.bits & bit) == 0)
+            return -1;
+        return word.rank + __builtin_popcountll(word.bits & (bit - 1));
+    }
+
+    static inline int indexOfSparse(const uint16_t *offsets, const size_t n, const uint16_t offset) {
+        const uint16_t *it = std::lower_bound(offsets, offsets + n, offset);
+        if (it == offsets + n || *it != offset)
+            return -1;
+        return it - offsets;
+    }
+
+    /**
+     * Number of elements in this page, whether compressed or not.
+     */
+    inline size_t count() const {
+        return packed.empty() ? data.size() : packedCount;
+    }
+
+    /**
+     * Value at a given position, decoding it if this page is compressed.
+     * @param index position as returned by indexOf(..)
+     */
+    inline T value(const size_t index) const {
+        if (packed.empty())
+            return data[index];
+        return PagedIdTreeCodec<T>::decode(packed.data() + blockStarts[index / blockSize], index % blockSize);
+    }
+
+    /**
+     * Read-only access to this page, valid until the page is modified.
+     */
+    inline PagedIdTreePageView<T> view() const;
+
+    inline void prefetchValue(const size_t index) const {
+        if (packed.empty())
+            __builtin_prefetch(data.data() + index);
+        else
+            __builtin_prefetch(packed.data() + blockStarts[index / blockSize]);
+    }
+
+    /**
+     * Replace 'data' by its compressed form in 'packed'.
+     * Does nothing if the value type has no codec.
+     */
+    void compress() {
+        if (!PagedIdTreeCodec<T>::available || !packed.empty() || data.empty())
+            return;
+
+        blockStarts.reserve((data.size() + blockSize - 1) / blockSize);
+        for (size_t i = 0; i < data.size(); i += blockSize) {
+            blockStarts.push_back(packed.size());
+            PagedIdTreeCodec<T>::encode(data.data() + i, std::min(blockSize, data.size() - i), packed);
+        }
+        packed.insert(packed.end(), PagedIdTreeCodec<T>::padding, 0);
+        packed.shrink_to_fit();
+        packedCount = data.size();
+        std::vector<T>().swap(data);
+    }
+
+    /**
+     * Restore 'data' from 'packed', required before modifying a
+     * compressed page.
+     */
+    void decompress() {
+        if (packed.empty()) return;
+
+        data.reserve(packedCount);
+        for (size_t i = 0; i < packedCount; ++i)
+            data.push_back(value(i));
+        std::vector<uint8_t>().swap(packed);
+        std::vector<uint32_t>().swap(blockStarts);
+        packedCount = 0;
+    }
+
+    /**
+     * Number of bytes occupied by this page including its vectors.
+     */
+    size_t memoryUsage() const {
+        return sizeof(*this) + offsets.capacity() * sizeof(uint16_t) + (words != nullptr ? numWords * sizeof(Word) : 0) + data.capacity() * sizeof(T) + counters.capacity() * sizeof(uint16_t) + packed.capacity() + blockStarts.capacity() * sizeof(uint32_t);
+    }
+
+    /**
+     * Determine the position of an offset's value in 'data', making
+     * room for a new value if the offset has not been used before.
+     * Appending in ascending order is the fast path, as it is the
+     * order in which .osm.pbf files and serialized trees provide ids.
+     * @param offset offset of an id inside this page
+     * @param isNew set to true if a new slot was created
+     * @return position in 'data'
+     */
+    size_t slotFor(const uint16_t offset, bool &isNew) {
+        decompress();
+        size_t index = 0;
+        isNew = false;
+        if (words != nullptr) {
+            const size_t w = offset >> 6;
+            const uint64_t bit = 1ULL << (offset & 63);
+            if (w > highestWord) {
+                /// All words after 'highestWord' are empty, their rank
+                /// is only initialized when they get used
+                for (size_t k = highestWord + 1; k <= w; ++k)
+                    words[k].rank = data.size();
+                highestWord = w;
+            }
+            index = words[w].rank + __builtin_popcountll(words[w].bits & (bit - 1));
+            if ((words[w].bits & bit) != 0)
+                return index;
+            words[w].bits |= bit;
+            for (size_t k = w + 1; k <= highestWord; ++k)
+                ++words[k].rank;
+        } else if (offsets.empty() || offsets.back() < offset) {
+            index = offsets.size();
+            offsets.push_back(offset);
+        } else {
+            const std::vector<uint16_t>::iterator it = std::lower_bound(offsets.begin(), offsets.end(), offset);
+            index = it - offsets.begin();
+            if (*it == offset)
+                return index;
+            offsets.insert(it, offset);
+        }
+
+        isNew = true;
+        if (index == data.size())
+            data.push_back(T());
+        else
+            data.insert(data.begin() + index, T());
+        if (!counters.empty())
+            counters.insert(counters.begin() + index, 0);
+
+        if (words == nullptr && offsets.size() > sparseLimit)
+            makeDense();
+
+        return index;
+    }
+
+    /**
+     * Fill an empty page in one go, choosing the presence
+     * representation by the final number of elements instead of
+     * converting from sparse to dense while the page grows.
+     * @param newOffsets offsets in strictly ascending order, will be moved into this page
+     * @param newData values for the offsets, will be moved into this page
+     */
+    void assign(std::vector<uint16_t> &newOffsets, std::vector<T> &newData) {
+        offsets.swap(newOffsets);
+        data.swap(newData);
+        if (offsets.size() > sparseLimit)
+            makeDense();
+    }
+
+    /**
+     * Remove an offset and its value from this page.
+     * @param offset offset of an id inside this page
+     * @return true if offset was in use and got removed
+     */
+    bool erase(const uint16_t offset) {
+        const int index = indexOf(offset);
+        if (index < 0)
+            return false;
+
+        decompress();
+        if (words != nullptr) {
+            const size_t w = offset >> 6;
+            words[w].bits &= ~(1ULL << (offset & 63));
+            for (size_t k = w + 1; k <= highestWord; ++k)
+                --words[k].rank;
+        } else
+            offsets.erase(offsets.begin() + index);
+        data.erase(data.begin() + index);
+        if (!counters.empty())
+            counters.erase(counters.begin() + index);
+
+        return true;
+    }
+
+    /**
+     * Fill the provided vector with all offsets in use, in ascending order.
+     * @param result vector to fill, previous content gets removed
+     */
+    void offsetList(std::vector<uint16_t> &result) const {
+        if (words == nullptr) {
+            result = offsets;
+            return;
+        }
+
+        result.clear();
+        result.reserve(count());
+        for (size_t w = 0; w <= highestWord; ++w)
+            for (uint64_t bits = words[w].bits; bits != 0; bits &= bits - 1)
+                result.push_back((w << 6) | __builtin_ctzll(bits));
+    }
+
+    void makeDense() {
+        words = (Word *)calloc(numWords, sizeof(Word));
+        if (words == nullptr)
+            Error::err("PagedIdTree<%s>: Could not allocate memory for page bitmap", typeid(T).name());
+
+        for (const uint16_t offset : offsets)
+            words[offset >> 6].bits |= 1ULL << (offset & 63);
+        highestWord = offsets.back() >> 6;
+        uint32_t rank = 0;
+        for (size_t w = 0; w <= highestWord; ++w) {
+            words[w].rank = rank;
+            rank += __builtin_popcountll(words[w].bits);
+        }
+
+        std::vector<uint16_t>().swap(offsets);
+    }
+
+    std::vector<uint16_t> offsets; ///< only used in sparse pages
+    Word *words; ///< only used in dense pages, nullptr for sparse pages
+    size_t highestWord; ///< words after this one are empty, their rank is not maintained
+    std::vector<T> data; ///< empty in compressed pages
+    std::vector<uint16_t> counters; ///< empty until the first counter gets increased
+    std::vector<uint8_t> packed; ///< only used in compressed pages, values encoded in blocks of blockSize values
+    std::vector<uint32_t> blockStarts; ///< only used in compressed pages, position of each block in 'packed'
+    uint32_t packedCount; ///< only used in compressed pages, number of values in 'packed'
+};
+
+template <class T>
+const int PagedIdTreePage<T>::offsetBits;
+template <class T>
+const uint64_t PagedIdTreePage<T>::offsetMask;
+template <class T>
+const size_t PagedIdTreePage<T>::numWords;
+template <class T>
+const size_t PagedIdTreePage<T>::sparseLimit;
+template <class T>
+const size_t PagedIdTreePage<T>::blockSize;
+
+/**
+ * Read-only access to a page's presence information and values,
+ * no matter if they are kept by a PagedIdTreePage or inside a
+ * memory-mapped snapshot.
+ */
+template <class T>
+struct PagedIdTreePageView {
+    typedef typename PagedIdTreePage<T>::Word Word;
+
+    const Word *words; ///< nullptr for sparse pages
+    const uint16_t *offsets; ///< only used in sparse pages
+    size_t count;
+    const T *data; ///< nullptr for compressed pages
+    const uint8_t *packed; ///< only used in compressed pages
+    size_t packedLength; ///< only used in compressed pages, number of bytes in 'packed'
+    const uint32_t *blockStarts; ///< only used in compressed pages
+    const uint16_t *counters; ///< nullptr if no counters
+
+    /// See PagedIdTreePage<T>::indexOf(..)
+    inline int indexOf(const uint16_t offset) const {
+        return words != nullptr ? PagedIdTreePage<T>::indexOfDense(words, offset) : PagedIdTreePage<T>::indexOfSparse(offsets, count, offset);
+    }
+
+    /// See PagedIdTreePage<T>::value(..)
+    inline T value(const size_t index) const {
+        if (data != nullptr)
+            return data[index];
+        return PagedIdTreeCodec<T>::decode(packed + blockStarts[index / PagedIdTreePage<T>::blockSize], index % PagedIdTreePage<T>::blockSize);
+    }
+
+    inline uint16_t counter(const size_t index) const {
+        return counters == nullptr ? 0 : counters[index];
+    }
+
+    inline void prefetchPresence(const uint16_t offset) const {
+        if (words != nullptr)
+            __builtin_prefetch(words + (offset >> 6));
+        else if (count > 0)
+            __builtin_prefetch(offsets + count / 2);
+    }
+
+    inline void prefetchValue(const size_t index) const {
+        if (data != nullptr)
+            __builtin_prefetch(data + index);
+        else
+            __builtin_prefetch(packed + blockStarts[index / PagedIdTreePage<T>::blockSize]);
+    }
+
+    /// See PagedIdTreePage<T>::offsetList(..)
+    void offsetList(std::vector<uint16_t> &result) const {
+        result.clear();
+        if (words == nullptr) {
+            result.assign(offsets, offsets + count);
+            return;
+        }
+
+        result.reserve(count);
+        for (size_t w = 0; w < PagedIdTreePage<T>::numWords && result.size() < count; ++w)
+            for (uint64_t bits = words[w].bits; bits != 0; bits &= bits - 1)
+                result.push_back((w << 6) | __builtin_ctzll(bits));
+    }
+};
+
+template <class T>
+inline PagedIdTreePageView<T> PagedIdTreePage<T>::view() const {
+    PagedIdTreePageView<T> result;
+    result.words = words;
+    result.offsets = offsets.data();
+    result.count = count();
+    result.data = packed.empty() ? data.data() : nullptr;
+    result.packed = packed.data();
+    result.packedLength = packed.size();
+    result.blockStarts = blockStarts.data();
+    result.counters = counters.empty() ? nullptr : counters.data();
+    return result;
+}
+
+template <class T>
+class PagedIdTree<T>::Private
+{
+public:
+    /// Ids larger than 2^40 are not expected, protect against a runaway directory
+    static const uint64_t maxPages = 1ULL << (40 - PagedIdTreePage<T>::offsetBits);
+
+    std::vector<PagedIdTreePage<T> *> pages;
+    size_t size;
+    /**
+     * Cache for retrieve(..) holding copies of recently retrieved
+     * values, as values of compressed pages do not exist in
+     * decoded form. To be invalidated if an element is removed
+     * or overwritten.
+     */
+    LookupCache<T> cache;
+
+    /**
+     * A page as stored in a snapshot. Positions refer to the
+     * snapshot's data following the directory of all pages.
+     */
+    struct MappedPage {
+        enum Flags {Dense = 1, Compressed = 2};
+
+        uint32_t count; ///< 0 if page does not exist
+        uint32_t flags;
+        uint64_t presence; ///< position of bitmap words or of offsets
+        uint64_t values; ///< position of values, encoded if compressed
+        uint64_t valuesLength; ///< number of bytes of values
+        uint64_t blockStarts; ///< only used for compressed pages
+    };
+    /// Set if the pages are kept inside a memory-mapped snapshot,
+    /// in which case 'pages' is empty
+    const MappedPage *mappedPages;
+    size_t numMappedPages;
+    const char *mappedData;
+
+    PagedIdTree *parent;
+
+    Private(PagedIdTree *_parent)
+        : size(0), mappedPages(nullptr), numMappedPages(0), mappedData(nullptr), parent(_parent) {
+        /// nothing
+    }
+
+    ~Private() {
+        for (PagedIdTreePage<T> *page : pages)
+            if (page != nullptr)
+                delete page;
+    }
+
+    inline PagedIdTreePage<T> *pageForId(const uint64_t id) const {
+        const uint64_t p = id >> PagedIdTreePage<T>::offsetBits;
+        return p < pages.size() ? pages[p] : nullptr;
+    }
+
+    /**
+     * Number of page numbers in use, i.e. the largest
+     * page number plus one.
+     */
+    inline size_t numPages() const {
+        return mappedPages != nullptr ? numMappedPages : pages.size();
+    }
+
+    /**
+     * Provide read-only access to a page, whether mapped or not.
+     * @param p page number
+     * @param view receives the page's view if the page exists
+     * @return true if the page exists
+     */
+    inline bool viewForPage(const uint64_t p, PagedIdTreePageView<T> &view) const {
+        if (mappedPages == nullptr) {
+            if (p >= pages.size() || pages[p] == nullptr)
+                return false;
+            view = pages[p]->view();
+            return true;
+        }
+
+        if (p >= numMappedPages || mappedPages[p].count == 0)
+            return false;
+        const MappedPage &page = mappedPages[p];
+        const bool compressed = (page.flags & MappedPage::Compressed) != 0;
+        view.words = (page.flags & MappedPage::Dense) != 0 ? (const typename PagedIdTreePage<T>::Word *)(mappedData + page.presence) : nullptr;
+        view.offsets = (const uint16_t *)(mappedData + page.presence);
+        view.count = page.count;
+        view.data = compressed ? nullptr : (const T *)(mappedData + page.values);
+        view.packed = (const uint8_t *)(mappedData + page.values);
+        view.packedLength = page.valuesLength;
+        view.blockStarts = (const uint32_t *)(mappedData + page.blockStarts);
+        view.counters = nullptr;
+        return true;
+    }
+
+    inline bool viewForId(const uint64_t id, PagedIdTreePageView<T> &view) const {
+        return viewForPage(id >> PagedIdTreePage<T>::offsetBits, view);
+    }
+
+    /**
+     * Replace the pages inside a memory-mapped snapshot
+     * by regular pages, required before modifying the tree.
+     */
+    void unmap() {
+        if (mappedPages == nullptr) return;
+        Error::debug("PagedIdTree<%s>: Modifying tree loaded from snapshot, copying pages", typeid(T).name());
+
+        std::vector<PagedIdTreePageView<T> > views(numMappedPages);
+        std::vector<bool> exists(numMappedPages, false);
+        for (size_t p = 0; p < numMappedPages; ++p)
+            exists[p] = viewForPage(p, views[p]);
+        mappedPages = nullptr;
+        numMappedPages = 0;
+        mappedData = nullptr;
+        size = 0;
+
+        std::vector<uint16_t> offsets;
+        PagedIdTree::BulkLoader loader(*parent);
+        for (size_t p = 0; p < views.size(); ++p) {
+            if (!exists[p]) continue;
+            views[p].offsetList(offsets);
+            for (size_t i = 0; i < offsets.size(); ++i)
+                loader.append(((uint64_t)p << PagedIdTreePage<T>::offsetBits) | offsets[i], views[p].value(i));
+        }
+    }
+
+    PagedIdTreePage<T> *pageForIdCreate(const uint64_t id) {
+        const uint64_t p = id >> PagedIdTreePage<T>::offsetBits;
+        if (p >= pages.size()) {
+            if (p >= maxPages)
+                Error::err("PagedIdTree<%s>: Id %llu is too large", typeid(T).name(), id);
+            pages.resize(p + 1, nullptr);
+        }
+        if (pages[p] == nullptr) {
+            pages[p] = new PagedIdTreePage<T>();
+            if (pages[p] == nullptr)
+                Error::err("PagedIdTree<%s>: Could not allocate memory for page", typeid(T).name());
+        }
+        return pages[p];
+    }
+
+    /**
+     * Issue a prefetch for the presence information of an id's page,
+     * i.e. the bitmap word or the middle of the offset list where
+     * the bisection starts.
+     */
+    inline void prefetchPresence(const uint64_t id) const {
+        PagedIdTreePageView<T> page;
+        if (viewForId(id, page))
+            page.prefetchPresence(id & PagedIdTreePage<T>::offsetMask);
+    }
+
+    static inline unsigned int levels() {
+        return IdTreeNode<T>::bitsPerId / IdTreeNode<T>::bitsPerNode;
+    }
+
+    /**
+     * Serialized IdTrees store at each inner node its children in
+     * decreasing order. This function maps an id to a key which, when
+     * read from the most significant bits on, enumerates the
+     * child indices along the path from root to the id's leaf.
+     * The mapping is its own inverse.
+     */
+    static uint64_t trieKey(uint64_t id) {
+#ifdef REVERSE_ID_TREE
+        return id;
+#else // REVERSE_ID_TREE
+        static const uint64_t mask = (1 << IdTreeNode<T>::bitsPerNode) - 1;
+        uint64_t key = 0;
+        for (unsigned int s = levels(); s > 0; --s) {
+            key = (key << IdTreeNode<T>::bitsPerNode) | (id & mask);
+            id >>= IdTreeNode<T>::bitsPerNode;
+        }
+        return key;
+#endif // REVERSE_ID_TREE
+    }
+
+    static inline unsigned int childIndex(const uint64_t key, const unsigned int depth) {
+        static const uint64_t mask = (1 << IdTreeNode<T>::bitsPerNode) - 1;
+        return (key >> (IdTreeNode<T>::bitsPerId - (depth + 1) * IdTreeNode<T>::bitsPerNode)) & mask;
+    }
+
+    /**
+     * Elements read from a serialized IdTree arrive in decreasing
+     * order. To insert them in increasing order, the elements of
+     * the current page get collected and inserted in reverse once
+     * the next page is reached.
+     */
+    struct PendingElement {
+        uint64_t id;
+        uint16_t counter;
+        T data;
+    };
+    std::vector<PendingElement> pending;
+
+    void flushPending() {
+        if (pending.empty()) return;
+        const auto lessId = [](const PendingElement & a, const PendingElement & b) {
+            return a.id < b.id;
+        };
+        /// Stable sort: for repeated ids, the last element wins as with insert(..)
+        if (!std::is_sorted(pending.begin(), pending.end(), lessId))
+            std::stable_sort(pending.begin(), pending.end(), lessId);
+
+        PagedIdTreePage<T> *page = pageForIdCreate(pending.front().id);
+        if (page->count() == 0) {
+            /// New page, build it in one go
+            std::vector<uint16_t> offsets;
+            offsets.reserve(pending.size());
+            std::vector<T> data;
+            data.reserve(pending.size());
+            for (const PendingElement &element : pending) {
+                const uint16_t offset = element.id & PagedIdTreePage<T>::offsetMask;
+                if (!offsets.empty() && offsets.back() == offset) {
+                    data.back() = element.data;
+                    if (!page->counters.empty()) page->counters.back() = element.counter;
+                    continue;
+                }
+                offsets.push_back(offset);
+                data.push_back(element.data);
+                if (element.counter > 0 || !page->counters.empty()) {
+                    page->counters.resize(data.size() - 1, 0);
+                    page->counters.push_back(element.counter);
+                }
+            }
+            size += offsets.size();
+            page->assign(offsets, data);
+        } else {
+            page->decompress();
+            page->data.reserve(page->data.size() + pending.size());
+            for (const PendingElement &element : pending) {
+                bool isNew = false;
+                const size_t index = page->slotFor(element.id & PagedIdTreePage<T>::offsetMask, isNew);
+                page->data[index] = element.data;
+                if (element.counter > 0) {
+                    if (page->counters.empty())
+                        page->counters.assign(page->data.size(), 0);
+                    page->counters[index] = element.counter;
+                }
+                if (isNew) ++size;
+            }
+        }
+        pending.clear();
+    }
+
+    /**
+     * Read a tree in the serialization format of IdTreeNode<T> and
+     * append its elements to 'pending'. Instead of recursing, the key
+     * prefix and next child of all inner nodes on the path to the
+     * current node are kept on an explicit stack.
+     */
+    void readTree(BufferedReader &reader) {
+        /// Pairs of key prefix and child whose marker is to be read next
+        std::vector<std::pair<uint64_t, int> > stack;
+        stack.reserve(levels() + 1);
+        uint64_t key = 0;
+        while (true) {
+            /// Read node with given key at depth stack.size()
+            const unsigned int depth = stack.size();
+#ifdef DEBUG
+            uint64_t id = 0;
+            reader.read(id);
+#endif // DEBUG
+
+            const int chr = reader.next();
+            if (chr == 'N') {
+                uint16_t counter = 0;
+                reader.read(counter);
+                const T data(reader.stream());
+                /// Leaves above the last level carry no element, e.g.
+                /// the end of the 'zero path' in trees using REVERSE_ID_TREE
+                if (depth == levels()) {
+                    PendingElement element;
+                    element.id = trieKey(key);
+#ifdef DEBUG
+                    if (element.id != id)
+                        Error::warn("PagedIdTree<%s>: Ids do not match: %llu != %llu", typeid(T).name(), element.id, id);
+#endif // DEBUG
+                    element.counter = counter;
+                    element.data = data;
+                    if (!pending.empty() && (pending.back().id >> PagedIdTreePage<T>::offsetBits) != (element.id >> PagedIdTreePage<T>::offsetBits))
+                        flushPending();
+                    pending.push_back(element);
+                }
+            } else if (chr == 'C')
+                stack.push_back(std::make_pair(key, IdTreeNode<T>::numChildren - 1));
+            else
+                Error::err("PagedIdTree<%s>: Expected 'N' or 'C', got '0x%02x' at position %llu", typeid(T).name(), chr, reader.position());
+
+            /// Find next child present, leaving all inner nodes whose children have been read
+            while (true) {
+                if (stack.empty()) return;
+                std::pair<uint64_t, int> &frame = stack.back();
+                if (frame.second < 0) {
+                    stack.pop_back();
+                    continue;
+                }
+                const int c = frame.second--;
+                const int marker = reader.next();
+                if (marker == '1') {
+                    key = frame.first | ((uint64_t)c << (IdTreeNode<T>::bitsPerId - stack.size() * IdTreeNode<T>::bitsPerNode));
+                    break;
+                } else if (marker != '0')
+                    Error::err("PagedIdTree<%s>: Expected '0' or '1', got '0x%02x' at position %llu", typeid(T).name(), marker, reader.position());
+            }
+        }
+    }
+
+    /**
+     * Writes elements in the serialization format of IdTreeNode<T>
+     * without materializing the trie: elements have to be appended
+     * in the order they appear in the serialization, i.e. by
+     * decreasing trie key. For each level, the writer remembers the
+     * next child index to be written and emits '0' markers for all
+     * skipped children.
+     */
+    class StreamWriter {
+    public:
+        StreamWriter(std::ostream &_output)
+            : output(_output), nextChild(levels(), -1), previousKey(0), empty(true) {
+            /// nothing
+        }
+
+        void append(const uint64_t key, const uint64_t id, const uint16_t counter, T &data) {
+            unsigned int depth = 0;
+            if (empty) {
+                writeInnerNode();
+                nextChild[0] = IdTreeNode<T>::numChildren - 1;
+                empty = false;
+            } else {
+                /// Find level where path to this element branches off from previous element's path
+                while (depth < levels() && childIndex(previousKey, depth) == childIndex(key, depth)) ++depth;
+                if (depth >= levels() || childIndex(key, depth) > childIndex(previousKey, depth))
+                    Error::err("PagedIdTree<%s>: Elements not written in serialization order: %llu after %llu", typeid(T).name(), trieKey(key), trieKey(previousKey));
+                /// Close all inner nodes below the branching point
+                for (unsigned int s = levels() - 1; s > depth; --s)
+                    writeAbsentChildren(nextChild[s] + 1);
+            }
+
+            int c = childIndex(key, depth);
+            writeAbsentChildren(nextChild[depth] - c);
+            writeMarker('1');
+            nextChild[depth] = c - 1;
+            for (unsigned int s = depth + 1; s < levels(); ++s) {
+                writeInnerNode();
+                c = childIndex(key, s);
+                writeAbsentChildren(IdTreeNode<T>::numChildren - 1 - c);
+                writeMarker('1');
+                nextChild[s] = c - 1;
+            }
+
+#ifdef DEBUG
+            output.write((char *)&id, sizeof(id));
+#endif // DEBUG
+            writeMarker('N');
+            output.write((char *)&counter, sizeof(counter));
+            data.write(output);
+
+            previousKey = key;
+        }
+
+        void finish() {
+            if (empty) return;
+            for (unsigned int s = levels(); s > 0; --s)
+                writeAbsentChildren(nextChild[s - 1] + 1);
+        }
+
+    private:
+        std::ostream &output;
+        std::vector<int> nextChild;
+        uint64_t previousKey;
+        bool empty;
+
+        inline void writeMarker(const char chr) {
+            output.write(&chr, sizeof(chr));
+        }
+
+        void writeInnerNode() {
+#ifdef DEBUG
+            static const uint64_t innerNodeId = 0;
+            output.write((char *)&innerNodeId, sizeof(innerNodeId));
+#endif // DEBUG
+            writeMarker('C');
+        }
+
+        void writeAbsentChildren(int count) {
+            static const char zeros[] = {'0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0'};
+            while (count > 0) {
+                const int chunk = std::min(count, (int)sizeof(zeros));
+                output.write(zeros, chunk);
+                count -= chunk;
+            }
+        }
+    };
+};
+
+template <class T>
+PagedIdTree<T>::PagedIdTree()
+    : d(new PagedIdTree<T>::Private(this))
+{
+    if (d == nullptr)
+        Error::err("Could not allocate memory for PagedIdTree<T>::Private");
+}
+
+template <class T>
+PagedIdTree<T>::PagedIdTree(std::istream &input)
+    : d(new PagedIdTree<T>::Private(this))
+{
+    BufferedReader reader(input);
+    size_t s = 0;
+    if (reader.read(s) && s > 0) {
+        d->readTree(reader);
+        d->flushPending();
+        d->pending.shrink_to_fit();
+    }
+    if (s != d->size)
+        Error::err("Recorded size of PagedIdTree<%s> does not match actual size: %d != %d", typeid(T).name(), s, d->size);
+}
+
+template <class T>
+PagedIdTree<T>::PagedIdTree(Snapshot::Section &section)
+    : d(new PagedIdTree<T>::Private(this))
+{
+    /// Frees 'd' if the section turns out to be inconsistent, as
+    /// no destructor runs for a constructor throwing a DataError
+    std::unique_ptr<Private> ownPrivate(d);
+    typedef typename Private::MappedPage MappedPage;
+    d->size = section.value<uint64_t>();
+    d->numMappedPages = section.value<uint64_t>();
+    const uint64_t dataLength = section.value<uint64_t>();
+    const MappedPage *mappedPages = section.array<MappedPage>(d->numMappedPages);
+    d->mappedData = section.array<char>(dataLength);
+
+    /// Check that all pages are inside the snapshot
+    static const size_t wordsLength = PagedIdTreePage<T>::numWords * sizeof(typename PagedIdTreePage<T>::Word);
+    size_t count = 0;
+    for (size_t p = 0; p < d->numMappedPages; ++p) {
+        const MappedPage &page = mappedPages[p];
+        if (page.count == 0) continue;
+        count += page.count;
+        const bool compressed = (page.flags & MappedPage::Compressed) != 0;
+        const size_t presenceLength = (page.flags & MappedPage::Dense) != 0 ? wordsLength : page.count * sizeof(uint16_t);
+        const size_t valuesLength = compressed ? page.valuesLength : page.count * sizeof(T);
+        const size_t blockStartsLength = compressed ? (page.count + PagedIdTreePage<T>::blockSize - 1) / PagedIdTreePage<T>::blockSize * sizeof(uint32_t) : 0;
+        if (page.count > (1 << PagedIdTreePage<T>::offsetBits) || page.presence > dataLength || presenceLength > dataLength - page.presence || page.values > dataLength || valuesLength > dataLength - page.values || page.blockStarts > dataLength || blockStartsLength > dataLength - page.blockStarts)
+            throw DataError("PagedIdTree<%s>: Page %llu in snapshot is inconsistent", typeid(T).name(), (unsigned long long)p);
+        if (compressed && !PagedIdTreeCodec<T>::available)
+            throw DataError("PagedIdTree<%s>: Snapshot contains compressed page %llu, but value type has no codec", typeid(T).name(), (unsigned long long)p);
+
+        /// Check the page's contents that lookups use as positions
+        if ((page.flags & MappedPage::Dense) != 0) {
+            const typename PagedIdTreePage<T>::Word *words = (const typename PagedIdTreePage<T>::Word *)(d->mappedData + page.presence);
+            /// Words without bits are never used for lookups, and
+            /// their ranks are not maintained, see PagedIdTreePage
+            size_t rank = 0;
+            for (size_t w = 0; w < PagedIdTreePage<T>::numWords; ++w) {
+                if (words[w].bits != 0 && words[w].rank != rank)
+                    throw DataError("PagedIdTree<%s>: Page %llu in snapshot has inconsistent ranks", typeid(T).name(), (unsigned long long)p);
+                rank += __builtin_popcountll(words[w].bits);
+            }
+            if (rank != page.count)
+                throw DataError("PagedIdTree<%s>: Page %llu in snapshot has %d offsets in use, expected %d", typeid(T).name(), (unsigned long long)p, rank, page.count);
+        } else {
+            const uint16_t *offsets = (const uint16_t *)(d->mappedData + page.presence);
+            for (size_t i = 1; i < page.count; ++i)
+                if (offsets[i - 1] >= offsets[i])
+                    throw DataError("PagedIdTree<%s>: Offsets of page %llu in snapshot are not ascending", typeid(T).name(), (unsigned long long)p);
+        }
+        if (compressed) {
+            const uint32_t *blockStarts = (const uint32_t *)(d->mappedData + page.blockStarts);
+            for (size_t b = 0; b < blockStartsLength / sizeof(uint32_t); ++b)
+                if (blockStarts[b] >= page.valuesLength)
+                    throw DataError("PagedIdTree<%s>: Block %llu of page %llu in snapshot starts outside its values", typeid(T).name(), (unsigned long long)b, (unsigned long long)p);
+        }
+    }
+    if (count != d->size)
+        throw DataError("Recorded size of PagedIdTree<%s> in snapshot does not match actual size: %d != %d", typeid(T).name(), d->size, count);
+    d->mappedPages = mappedPages;
+    ownPrivate.release();
+}
+
+template <class T>
+PagedIdTree<T>::~PagedIdTree()
+{
+    Error::debug("PagedIdTree<%s> had %d elements", typeid(T).name(), size());
+    delete d;
+}
+
+template <class T>
+bool PagedIdTree<T>::insert(uint64_t id, T const &data) {
+    if (id == 0)
+        Error::err("Cannot insert element with id=0 into PagedIdTree<%s>", typeid(T).name());
+    d->unmap();
+
+    PagedIdTreePage<T> *page = d->pageForIdCreate(id);
+    bool isNew = false;
+    const size_t index = page->slotFor(id & PagedIdTreePage<T>::offsetMask, isNew);
+    page->data[index] = data;
+    if (isNew)
+        ++d->size;
+    else
+        d->cache.invalidate();
+
+    return true;
+}
+
+template <class T>
+bool PagedIdTree<T>::retrieve(const uint64_t id, T &data) const {
+    if (id == 0)
+        Error::err("Cannot retrieve PagedIdTree<%s> data for id==0", typeid(T).name());
+
+    if (d->cache.lookup(id, data))
+        return true;
+
+    PagedIdTreePageView<T> page;
+    if (!d->viewForId(id, page))
+        return false;
+    const int index = page.indexOf(id & PagedIdTreePage<T>::offsetMask);
+    if (index < 0)
+        return false;
+
+    data = page.value(index);
+    d->cache.store(id, data);
+    return true;
+}
+
+template <class T>
+size_t PagedIdTree<T>::retrieveMany(const uint64_t *ids, size_t n, T *out, bool *found) const {
+    /// Software pipeline: while processing ids[i], the presence
+    /// information for ids[i + presenceDistance] gets prefetched,
+    /// and the value of ids[i + dataDistance] gets located and prefetched
+    static const size_t presenceDistance = 16, dataDistance = 8;
+    struct Slot {
+        PagedIdTreePageView<T> page;
+        int index;
+    } slots[dataDistance + 1];
+
+    auto locate = [this, ids](const size_t j, Slot & slot) {
+        if (ids[j] == 0)
+            Error::err("Cannot retrieve PagedIdTree<%s> data for id==0", typeid(T).name());
+        slot.index = d->viewForId(ids[j], slot.page) ? slot.page.indexOf(ids[j] & PagedIdTreePage<T>::offsetMask) : -1;
+        if (slot.index >= 0)
+            slot.page.prefetchValue(slot.index);
+    };
+
+    for (size_t j = 0; j < n && j < presenceDistance; ++j)
+        d->prefetchPresence(ids[j]);
+    for (size_t j = 0; j < n && j < dataDistance; ++j)
+        locate(j, slots[j % (dataDistance + 1)]);
+
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (i + presenceDistance < n)
+            d->prefetchPresence(ids[i + presenceDistance]);
+        if (i + dataDistance < n)
+            locate(i + dataDistance, slots[(i + dataDistance) % (dataDistance + 1)]);
+
+        const Slot &slot = slots[i % (dataDistance + 1)];
+        found[i] = slot.index >= 0;
+        if (found[i]) {
+            out[i] = slot.page.value(slot.index);
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+template <class T>
+bool PagedIdTree<T>::remove(uint64_t id) {
+    d->unmap();
+    PagedIdTreePage<T> *page = d->pageForId(id);
+    if (page == nullptr || !page->erase(id & PagedIdTreePage<T>::offsetMask))
+        return false;
+
+    if (page->count() == 0) {
+        delete page;
+        d->pages[id >> PagedIdTreePage<T>::offsetBits] = nullptr;
+    }
+
+    --d->size;
+    d->cache.invalidate();
+    return true;
+}
+
+template <class T>
+size_t PagedIdTree<T>::size() const {
+    return d->size;
+}
+
+template <class T>
+uint16_t PagedIdTree<T>::counter(const uint64_t id) const {
+    PagedIdTreePageView<T> page;
+    const int index = d->viewForId(id, page) ? page.indexOf(id & PagedIdTreePage<T>::offsetMask) : -1;
+    if (index < 0)
+        Error::err("Cannot retrieve counter for a non-existing element in PagedIdTree<%s> of id=%llu", typeid(T).name(), id);
+
+    return page.counter(index);
+}
+
+template <class T>
+void PagedIdTree<T>::increaseCounter(const uint64_t id) {
+    d->unmap();
+    PagedIdTreePage<T> *page = d->pageForId(id);
+    const int index = page == nullptr ? -1 : page->indexOf(id & PagedIdTreePage<T>::offsetMask);
+    if (index < 0)
+        Error::err("Cannot increase counter for a non-existing element in PagedIdTree<%s> of id=%llu", typeid(T).name(), id);
+
+    if (page->counters.empty())
+        page->counters.assign(page->count(), 0);
+    ++page->counters[index];
+}
+
+template <class T>
+PagedIdTree<T>::BulkLoader::BulkLoader(PagedIdTree &_tree)
+    : tree(_tree), page(nullptr)
+{
+    tree.d->unmap();
+}
+
+template <class T>
+PagedIdTree<T>::BulkLoader::~BulkLoader()
+{
+    finish();
+}
+
+template <class T>
+void PagedIdTree<T>::BulkLoader::append(uint64_t id, T const &data, uint16_t counter) {
+    if (id == 0)
+        Error::err("Cannot insert element with id=0 into PagedIdTree<%s>", typeid(T).name());
+
+    const uint16_t offset = id & PagedIdTreePage<T>::offsetMask;
+    if (page == nullptr || tree.d->pageForId(id) != page || offset <= page->offsets.back()) {
+        finish();
+        if (tree.d->pageForId(id) == nullptr) {
+            /// Start a new page, elements get appended to
+            /// its list of offsets until the page is complete
+            page = tree.d->pageForIdCreate(id);
+        } else {
+            /// Existing page or element out of order
+            tree.insert(id, data);
+            if (counter > 0) {
+                PagedIdTreePage<T> *existing = tree.d->pageForId(id);
+                const int index = existing->indexOf(offset);
+                if (existing->counters.empty())
+                    existing->counters.assign(existing->count(), 0);
+                existing->counters[index] = counter;
+            }
+            return;
+        }
+    }
+
+    page->offsets.push_back(offset);
+    page->data.push_back(data);
+    if (counter > 0 || !page->counters.empty()) {
+        page->counters.resize(page->data.size() - 1, 0);
+        page->counters.push_back(counter);
+    }
+    ++tree.d->size;
+}
+
+template <class T>
+void PagedIdTree<T>::BulkLoader::finish() {
+    if (page == nullptr) return;
+    /// Choose the page's final representation
+    if (page->offsets.size() > PagedIdTreePage<T>::sparseLimit)
+        page->makeDense();
+    else
+        page->offsets.shrink_to_fit();
+    page->data.shrink_to_fit();
+    page->counters.shrink_to_fit();
+    page = nullptr;
+}
+
+template <class T>
+void PagedIdTree<T>::dropCounters() {
+    for (PagedIdTreePage<T> *page : d->pages)
+        if (page != nullptr)
+            std::vector<uint16_t>().swap(page->counters);
+}
+
+template <class T>
+template <class Visitor>
+void PagedIdTree<T>::forEach(Visitor visitor) const {
+    std::vector<uint16_t> offsets;
+    PagedIdTreePageView<T> page;
+    for (size_t p = 0; p < d->numPages(); ++p) {
+        if (!d->viewForPage(p, page)) continue;
+        page.offsetList(offsets);
+        for (size_t i = 0; i < offsets.size(); ++i)
+            visitor(((uint64_t)p << PagedIdTreePage<T>::offsetBits) | offsets[i], page.value(i));
+    }
+}
+
+template <class T>
+void PagedIdTree<T>::compress() {
+    for (PagedIdTreePage<T> *page : d->pages)
+        if (page != nullptr)
+            page->compress();
+}
+
+template <class T>
+void PagedIdTree<T>::setCacheSize(size_t entries) {
+    d->cache.resize(entries);
+}
+
+template <class T>
+LookupCacheStatistics PagedIdTree<T>::cacheStatistics() const {
+    return d->cache.statistics();
+}
+
+template <class T>
+size_t PagedIdTree<T>::memoryUsage() const {
+    size_t result = sizeof(*this) + sizeof(*d) + d->pages.capacity() * sizeof(PagedIdTreePage<T> *);
+    for (const PagedIdTreePage<T> *page : d->pages)
+        if (page != nullptr)
+            result += page->memoryUsage();
+    return result;
+}
+
+template <class T>
+std::ostream &PagedIdTree<T>::write(std::ostream &output) {
+    const size_t s = size();
+    output.write((char *)&s, sizeof(s));
+    /// Empty tree is written as its size only, matching the reader
+    if (s == 0)
+        return output;
+
+    typename Private::StreamWriter writer(output);
+    std::vector<uint16_t> offsets;
+    PagedIdTreePageView<T> page;
+#ifdef REVERSE_ID_TREE
+    /// With the most significant bits first, serialization
+    /// order is simply decreasing id order
+    for (size_t p = d->numPages(); p > 0; --p) {
+        if (!d->viewForPage(p - 1, page)) continue;
+        page.offsetList(offsets);
+        for (size_t i = offsets.size(); i > 0; --i) {
+            const uint64_t id = ((uint64_t)(p - 1) << PagedIdTreePage<T>::offsetBits) | offsets[i - 1];
+            T data = page.value(i - 1);
+            writer.append(id, id, page.counter(i - 1), data);
+        }
+    }
+#else // REVERSE_ID_TREE
+    std::vector<uint64_t> keys;
+    keys.reserve(d->size);
+    for (size_t p = 0; p < d->numPages(); ++p) {
+        if (!d->viewForPage(p, page)) continue;
+        page.offsetList(offsets);
+        for (const uint16_t offset : offsets)
+            keys.push_back(Private::trieKey(((uint64_t)p << PagedIdTreePage<T>::offsetBits) | offset));
+    }
+    std::sort(keys.begin(), keys.end(), std::greater<uint64_t>());
+    for (const uint64_t key : keys) {
+        const uint64_t id = Private::trieKey(key);
+        d->viewForId(id, page);
+        const int index = page.indexOf(id & PagedIdTreePage<T>::offsetMask);
+        T data = page.value(index);
+        writer.append(key, id, page.counter(index), data);
+    }
+#endif // REVERSE_ID_TREE
+    writer.finish();
+
+    return output;
+}
+
+template <class T>
+std::ostream &PagedIdTree<T>::writeSnapshot(std::ostream &output) const {
+    typedef typename Private::MappedPage MappedPage;
+    static const size_t wordsLength = PagedIdTreePage<T>::numWords * sizeof(typename PagedIdTreePage<T>::Word);
+
+    /// Determine each page's position first, as the
+    /// directory of all pages precedes the pages
+    const size_t numPages = d->numPages();
+    std::vector<MappedPage> directory(numPages);
+    std::vector<PagedIdTreePageView<T> > views(numPages);
+    uint64_t position = 0;
+    for (size_t p = 0; p < numPages; ++p) {
+        MappedPage &entry = directory[p];
+        if (!d->viewForPage(p, views[p])) continue;
+        const PagedIdTreePageView<T> &page = views[p];
+        entry.count = page.count;
+        entry.presence = position;
+        if (page.words != nullptr) {
+            entry.flags |= MappedPage::Dense;
+            position += Snapshot::alignedSize(wordsLength);
+        } else
+            position += Snapshot::alignedSize(page.count * sizeof(uint16_t));
+        entry.values = position;
+        if (page.data == nullptr) {
+            entry.flags |= MappedPage::Compressed;
+            entry.valuesLength = page.packedLength;
+            position += Snapshot::alignedSize(entry.valuesLength);
+            entry.blockStarts = position;
+            position += Snapshot::alignedSize((page.count + PagedIdTreePage<T>::blockSize - 1) / PagedIdTreePage<T>::blockSize * sizeof(uint32_t));
+        } else {
+            entry.valuesLength = page.count * sizeof(T);
+            position += Snapshot::alignedSize(entry.valuesLength);
+        }
+    }
+
+    SnapshotWriter::writeValue<uint64_t>(output, d->size);
+    SnapshotWriter::writeValue<uint64_t>(output, numPages);
+    SnapshotWriter::writeValue<uint64_t>(output, position);
+    SnapshotWriter::writeArray(output, directory.data(), directory.size());
+    for (size_t p = 0; p < numPages; ++p) {
+        if (directory[p].count == 0) continue;
+        const PagedIdTreePageView<T> &page = views[p];
+        if (page.words != nullptr)
+            SnapshotWriter::writeArray(output, page.words, PagedIdTreePage<T>::numWords);
+        else
+            SnapshotWriter::writeArray(output, page.offsets, page.count);
+        if (page.data == nullptr) {
+            SnapshotWriter::writeArray(output, page.packed, page.packedLength);
+            SnapshotWriter::writeArray(output, page.blockStarts, (page.count + PagedIdTreePage<T>::blockSize - 1) / PagedIdTreePage<T>::blockSize);
+        } else
+            SnapshotWriter::writeArray(output, page.data, page.count);
+    }
+    if (!output)
+        Error::err("PagedIdTree<%s>: Could not write snapshot", typeid(T).name());
+
+    return output;
+}
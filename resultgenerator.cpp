@@ -186,12 +186,10 @@ std::vector<Result> ResultGenerator::findResults(const std::string &text, int du
         for (const auto &adminRegionMatch : adminRegionMatches) {
             Coord c;
             if (getCenterOfOSMElement(adminRegionMatch.match, c)) {
-                WriteableString matchName("UNSET");
-                switch (adminRegionMatch.match.type) {
-                case OSMElement::Node: nodeNames->retrieve(adminRegionMatch.match.id, matchName); break;
-                case OSMElement::Way: wayNames->retrieve(adminRegionMatch.match.id, matchName); break;
-                case OSMElement::Relation: relationNames->retrieve(adminRegionMatch.match.id, matchName); break;
-                case OSMElement::UnknownElementType: matchName = WriteableString("Unknown"); break;
+                std::string matchName("Unknown");
+                if (adminRegionMatch.match.type != OSMElement::UnknownElementType) {
+                    matchName = adminRegionMatch.match.nameOrPlaceholder();
+                    if (matchName.empty()) matchName = "UNSET";
                 }
 
                 Result r(c, adminRegionMatch.quality * .95, std::string("Places inside admin bound: ") + adminRegionMatch.adminRegion.name + " (relation " + std::to_string(adminRegionMatch.adminRegion.relationId) + ") > '" + matchName + "' (" + adminRegionMatch.match.operator std::string() + ", found via: '" + adminRegionMatch.combined + "')");
@@ -231,7 +229,7 @@ std::vector<Result> ResultGenerator::findResults(const std::string &text, int du
         for (const auto &localPlacesMatch : localPlacesMatches) {
             Coord c;
             if (getCenterOfOSMElement(localPlacesMatch.local, c)) {
-                Result r(c, localPlacesMatch.quality * .75, std::string("Local near global place: ") + localPlacesMatch.local.operator std::string() + " ('" + localPlacesMatch.local.name() + "') near " + localPlacesMatch.global.operator std::string() + " ('" + localPlacesMatch.global.name() + "')");
+                Result r(c, localPlacesMatch.quality * .75, std::string("Local near global place: ") + localPlacesMatch.local.operator std::string() + " ('" + localPlacesMatch.local.nameOrPlaceholder() + "') near " + localPlacesMatch.global.operator std::string() + " ('" + localPlacesMatch.global.nameOrPlaceholder() + "')");
                 r.elements.push_back(localPlacesMatch.global);
                 r.elements.push_back(localPlacesMatch.local);
                 results.push_back(r);
@@ -259,11 +257,11 @@ std::vector<Result> ResultGenerator::findResults(const std::string &text, int du
     for (const auto &uniqueMatch : uniqueMatches) {
         Coord c;
         if (getCenterOfOSMElement(uniqueMatch.element, c)) {
-            Result r(c, uniqueMatch.quality * .8, std::string("Unique name '") + uniqueMatch.element.name().c_str() + "' (" + uniqueMatch.element.operator std::string() + ") found via '" + uniqueMatch.combined + "'");
+            Result r(c, uniqueMatch.quality * .8, std::string("Unique name '") + uniqueMatch.element.nameOrPlaceholder() + "' (" + uniqueMatch.element.operator std::string() + ") found via '" + uniqueMatch.combined + "'");
             r.elements.push_back(uniqueMatch.element);
             results.push_back(r);
             if (verbosity > VerbositySilent)
-                Error::debug("Got a result for combined word '%s': %s (%s)", uniqueMatch.combined.c_str(), uniqueMatch.element.name().c_str(), uniqueMatch.element.operator std::string().c_str());
+                Error::debug("Got a result for combined word '%s': %s (%s)", uniqueMatch.combined.c_str(), uniqueMatch.element.nameOrPlaceholder().c_str(), uniqueMatch.element.operator std::string().c_str());
         }
     }
 #ifdef CPUTIMER
@@ -306,11 +304,11 @@ std::vector<Result> ResultGenerator::findResults(const std::string &text, int du
             const double quality = rwt == OSMElement::PlaceLarge ? 1.0 : (rwt == OSMElement::PlaceMedium?.9 : (rwt == OSMElement::PlaceLargeArea?.6 : (rwt == OSMElement::PlaceSmall?.8 : .5)));
             Coord c;
             if (getCenterOfOSMElement(bestPlace, c)) {
-                Result r(c, quality * .5, std::string("Large place: ") + bestPlace.name() + " (" + bestPlace.operator std::string() + ")");
+                Result r(c, quality * .5, std::string("Large place: ") + bestPlace.nameOrPlaceholder() + " (" + bestPlace.operator std::string() + ")");
                 r.elements.push_back(bestPlace);
                 results.push_back(r);
                 if (verbosity > VerbositySilent)
-                    Error::debug("Best place is %s (%s)", bestPlace.name().c_str(), bestPlace.operator std::string().c_str());
+                    Error::debug("Best place is %s (%s)", bestPlace.nameOrPlaceholder().c_str(), bestPlace.operator std::string().c_str());
             }
         }
 #ifdef CPUTIMER
@@ -0,0 +1,137 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef SHARDEDLOADER_H
+#define SHARDEDLOADER_H
+
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <typeinfo>
+
+#include "error.h"
+
+/**
+ * Fills a tree such as IdTree<T> or PagedIdTree<T> from several
+ * threads at once, for example threads parsing different blocks of
+ * an .osm.pbf file.
+ *
+ * Each thread owns one shard and inserts its elements only into this
+ * shard, so inserting needs no locks. A shard collects its elements
+ * in insertion order; as each thread typically processes its blocks
+ * in ascending id order, each shard is a sorted run of elements.
+ * Sharding by id instead would let threads working on neighbouring
+ * blocks insert into the same shard, interleaving their ids, which is
+ * the slowest case for a BulkLoader.
+ *
+ * Once all threads are done, finish() merges the shards' runs and
+ * passes all elements in ascending id order to the target tree's
+ * BulkLoader. Shards that are not sorted get sorted first. Unless
+ * REVERSE_ID_TREE is defined, ascending id order is not the order of
+ * an IdTree's leaves and elements get inserted one by one instead.
+ * Elements' counters are not carried over. The target tree must not be
+ * accessed otherwise until finish() has been called or the loader has
+ * been deleted.
+ */
+template <class Tree, class T>
+class ShardedLoader
+{
+public:
+    /**
+     * @param _tree tree to fill
+     * @param _numShards number of shards, usually the number of threads inserting elements
+     */
+    explicit ShardedLoader(Tree &_tree, unsigned int _numShards)
+        : tree(_tree), shards(_numShards) {
+        if (_numShards == 0)
+            Error::err("ShardedLoader<%s>: Need at least one shard", typeid(T).name());
+    }
+
+    ~ShardedLoader() {
+        finish();
+    }
+
+    inline unsigned int numShards() const {
+        return shards.size();
+    }
+
+    /**
+     * Add an element to a shard. Different shards may be used by
+     * different threads at the same time, but each shard only by
+     * one thread at a time.
+     * @param shard shard to add element to, less than numShards()
+     * @param id id of element, must not be 0
+     * @param data element's data
+     */
+    inline void insert(const unsigned int shard, const uint64_t id, T const &data) {
+        if (id == 0)
+            Error::err("Cannot insert element with id=0 into ShardedLoader<%s>", typeid(T).name());
+        shards[shard].emplace_back(id, data);
+    }
+
+    /**
+     * Move all elements inserted so far into the target tree.
+     * Must not be called while other threads are still inserting.
+     * The loader may be used again afterwards.
+     */
+    void finish() {
+        const auto lessById = [](const Element &a, const Element &b) {
+            return a.first < b.first;
+        };
+        for (Run &run : shards)
+            if (!std::is_sorted(run.cbegin(), run.cend(), lessById))
+                std::sort(run.begin(), run.end(), lessById);
+
+        typename Tree::BulkLoader loader(tree);
+        while (true) {
+            /// Find the run with the smallest next id and
+            /// the smallest next id of all other runs
+            Run *smallest = nullptr;
+            uint64_t runnerUp = UINT64_MAX;
+            for (Run &run : shards) {
+                if (run.empty()) continue;
+                if (smallest == nullptr || run.front().first < smallest->front().first) {
+                    if (smallest != nullptr) runnerUp = smallest->front().first;
+                    smallest = &run;
+                } else if (run.front().first < runnerUp)
+                    runnerUp = run.front().first;
+            }
+            if (smallest == nullptr) break;
+
+            /// Runs consist of whole blocks of ids, so take as
+            /// many elements as possible from the same run
+            do {
+                loader.append(smallest->front().first, smallest->front().second);
+                smallest->pop_front();
+            } while (!smallest->empty() && smallest->front().first <= runnerUp);
+        }
+
+        for (Run &run : shards)
+            Run().swap(run);
+    }
+
+private:
+    typedef std::pair<uint64_t, T> Element;
+    /// Unlike a vector, a deque does not copy its elements when
+    /// growing and releases memory while its front gets removed
+    typedef std::deque<Element> Run;
+
+    Tree &tree;
+    std::vector<Run> shards;
+};
+
+#endif // SHARDEDLOADER_H
@@ -0,0 +1,157 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cstdint>
+#include <algorithm>
+#include <new>
+#include <vector>
+#include <typeinfo>
+
+#include <boost/atomic.hpp>
+
+#include "error.h"
+
+/**
+ * Storage for many small objects of the same type, such as the
+ * nodes of a tree. Objects are kept in large, contiguous chunks
+ * and are referred to by 32-bit indices instead of pointers.
+ * Index 0 is never handed out and can be used as 'no object'.
+ *
+ * Objects never move once allocated, so references to them stay
+ * valid until the object is released or the slab is deleted.
+ * Released objects get reset and are reused by later allocations.
+ * Deleting the slab takes one free per chunk instead of one per
+ * object.
+ *
+ * One thread may allocate objects while other threads access objects
+ * allocated before: if the directory of chunks is full, it gets
+ * replaced by a copy twice its size and the old directory is kept
+ * until the slab gets cleared or deleted.
+ */
+template <class E>
+class Slab
+{
+public:
+    /// 4096 objects per chunk
+    static const unsigned int chunkBits = 12;
+    static const uint32_t chunkSize = 1 << chunkBits;
+    static const uint32_t chunkMask = chunkSize - 1;
+
+    explicit Slab()
+        : directory(nullptr), numChunks(0), directoryCapacity(0), used(1) {
+        /// nothing
+    }
+
+    ~Slab() {
+        clear();
+    }
+
+    /**
+     * Allocate a default-constructed object.
+     * @return index of new object, never 0
+     */
+    uint32_t allocate() {
+        if (!released.empty()) {
+            const uint32_t index = released.back();
+            released.pop_back();
+            return index;
+        }
+
+        if (used == UINT32_MAX)
+            Error::err("Slab<%s>: Exceeded maximum number of objects", typeid(E).name());
+        if ((used >> chunkBits) >= numChunks) {
+            E *chunk = new E[chunkSize];
+            E **current = directory.load(boost::memory_order_relaxed);
+            if (directories.empty() || numChunks == directoryCapacity) {
+                /// Directory is full, continue with a larger copy
+                directoryCapacity = directories.empty() ? 16 : 2 * directoryCapacity;
+                E **grown = new E *[directoryCapacity];
+                std::copy(current, current + numChunks, grown);
+                directories.push_back(grown);
+                current = grown;
+            }
+            current[numChunks++] = chunk;
+            directory.store(current, boost::memory_order_release);
+        }
+        return used++;
+    }
+
+    /**
+     * Give an object back to the slab. It gets reset to a
+     * default-constructed object and will be reused by a
+     * later allocation.
+     * @param index index of object as returned by allocate()
+     */
+    void release(const uint32_t index) {
+        E &object = (*this)[index];
+        object.~E();
+        new (&object) E();
+        released.push_back(index);
+    }
+
+    /**
+     * Release all objects and the memory of all chunks.
+     */
+    void clear() {
+        E **current = directory.load(boost::memory_order_relaxed);
+        for (size_t c = 0; c < numChunks; ++c)
+            delete[] current[c];
+        for (E **old : directories)
+            delete[] old;
+        std::vector<E **>().swap(directories);
+        std::vector<uint32_t>().swap(released);
+        directory.store(nullptr, boost::memory_order_relaxed);
+        numChunks = 0;
+        used = 1;
+    }
+
+    inline E &operator[](const uint32_t index) {
+        return directory.load(boost::memory_order_acquire)[index >> chunkBits][index & chunkMask];
+    }
+
+    inline const E &operator[](const uint32_t index) const {
+        return directory.load(boost::memory_order_acquire)[index >> chunkBits][index & chunkMask];
+    }
+
+    /**
+     * Number of objects in use, i.e. allocated and not released.
+     */
+    inline size_t size() const {
+        return used - 1 - released.size();
+    }
+
+    /**
+     * Number of bytes occupied by chunks, whether in use or not.
+     */
+    inline size_t memoryUsage() const {
+        return numChunks * chunkSize * sizeof(E);
+    }
+
+private:
+    /// Pointers to all chunks, replaced when full
+    boost::atomic<E **> directory;
+    /// All directories ever used, the last one is the current one
+    std::vector<E **> directories;
+    size_t numChunks, directoryCapacity;
+    std::vector<uint32_t> released;
+    /// Number of objects handed out so far, including reserved index 0
+    uint32_t used;
+};
+
+#endif // SLAB_H
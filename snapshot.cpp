@@ -0,0 +1,267 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+
+#include "snapshot.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const size_t Snapshot::sectionAlignment;
+
+namespace {
+
+/// First eight bytes of a snapshot file, "pbfsnap\0" in little endian
+const uint64_t magic = 0x0070616e73666270ULL;
+/// To be increased whenever the layout of any section changes
+const uint32_t version = 2;
+const uint32_t maxSections = 32;
+
+struct SectionEntry {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t numSections;
+    SectionEntry sections[maxSections];
+};
+
+}
+
+class Snapshot::Private
+{
+public:
+    Private()
+        : data(nullptr), size(0), header(nullptr) {
+        /// nothing
+    }
+
+    const char *data;
+    size_t size;
+    const Header *header;
+
+    /**
+     * Check that the mapped file is a snapshot of the
+     * expected version and that all sections are inside it.
+     */
+    bool validate(const std::string &filename) const {
+        if (size < sizeof(Header) || header->magic != magic) {
+            Error::warn("Snapshot: File '%s' is not a snapshot", filename.c_str());
+            return false;
+        }
+        if (header->version != version) {
+            Error::warn("Snapshot: File '%s' has version %d, expected version %d", filename.c_str(), header->version, version);
+            return false;
+        }
+        if (header->numSections > maxSections) {
+            Error::warn("Snapshot: File '%s' has too many sections: %d", filename.c_str(), header->numSections);
+            return false;
+        }
+        for (uint32_t i = 0; i < header->numSections; ++i) {
+            const SectionEntry &entry = header->sections[i];
+            if (entry.offset % sectionAlignment != 0 || entry.offset > size || entry.length > size - entry.offset) {
+                Error::warn("Snapshot: Section %d of file '%s' is outside of file, snapshot may be truncated", entry.id, filename.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+Snapshot::Snapshot(const std::string &filename)
+    : d(new Snapshot::Private())
+{
+    if (d == nullptr)
+        Error::err("Could not allocate memory for Snapshot::Private");
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat fileStatus;
+    if (fstat(fd, &fileStatus) == 0 && fileStatus.st_size > 0) {
+        void *mapped = mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED) {
+            d->data = (const char *)mapped;
+            d->size = fileStatus.st_size;
+            d->header = (const Header *)mapped;
+        } else
+            Error::warn("Snapshot: Could not map file '%s' into memory: %s", filename.c_str(), strerror(errno));
+    }
+    /// The mapping stays valid after closing the file
+    close(fd);
+
+    if (d->data != nullptr && !d->validate(filename)) {
+        munmap((void *)d->data, d->size);
+        d->data = nullptr;
+        d->size = 0;
+        d->header = nullptr;
+    }
+}
+
+Snapshot::~Snapshot() {
+    if (d->data != nullptr)
+        munmap((void *)d->data, d->size);
+    delete d;
+}
+
+bool Snapshot::isValid() const {
+    return d->data != nullptr;
+}
+
+Snapshot::Section Snapshot::section(SectionId id) const {
+    if (d->header != nullptr)
+        for (uint32_t i = 0; i < d->header->numSections; ++i) {
+            const SectionEntry &entry = d->header->sections[i];
+            if (entry.id == (uint32_t)id)
+                return Section(d->data + entry.offset, entry.length);
+        }
+    return Section();
+}
+
+size_t Snapshot::size() const {
+    return d->size;
+}
+
+/**
+ * The process's file mode creation mask. umask(..) can only be read by
+ * setting it, so this is done once during static initialization, before
+ * any thread may create files with the temporarily changed mask.
+ */
+static const mode_t fileCreationMask = []() {
+    const mode_t mask = umask(0);
+    umask(mask);
+    return mask;
+}();
+
+/**
+ * Create a new, uniquely named file next to the given filename,
+ * so that concurrent writers never share a temporary file.
+ * Returns the new file's name or an empty string on failure.
+ */
+static std::string createTemporaryFile(const std::string &filename) {
+    std::string pattern = filename + ".XXXXXX";
+    const int fd = mkstemp(&pattern[0]);
+    if (fd < 0) {
+        Error::warn("SnapshotWriter: Cannot create temporary file for '%s': %s", filename.c_str(), strerror(errno));
+        return std::string();
+    }
+    /// mkstemp creates files only accessible to the owner, but the
+    /// snapshot should get the permissions of any other new file
+    fchmod(fd, 0666 & ~fileCreationMask);
+    close(fd);
+    return pattern;
+}
+
+class SnapshotWriter::Private
+{
+public:
+    Private(const std::string &_filename)
+        : filename(_filename), temporaryFilename(createTemporaryFile(_filename)), output(temporaryFilename.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc), inSection(false) {
+        memset(&header, 0, sizeof(header));
+        header.magic = magic;
+        header.version = version;
+    }
+
+    const std::string filename, temporaryFilename;
+    std::ofstream output;
+    Header header;
+    bool inSection;
+
+    /**
+     * Pad the file with zeros up to the next multiple of sectionAlignment.
+     */
+    void padToAlignment() {
+        static const char zeros[Snapshot::sectionAlignment] = {0};
+        const size_t position = output.tellp();
+        const size_t padding = (Snapshot::sectionAlignment - position % Snapshot::sectionAlignment) % Snapshot::sectionAlignment;
+        output.write(zeros, padding);
+    }
+
+    void endSection() {
+        if (!inSection) return;
+        SectionEntry &entry = header.sections[header.numSections - 1];
+        entry.length = (size_t)output.tellp() - entry.offset;
+        padToAlignment();
+        inSection = false;
+    }
+};
+
+SnapshotWriter::SnapshotWriter(const std::string &filename)
+    : d(new SnapshotWriter::Private(filename))
+{
+    if (d == nullptr)
+        Error::err("Could not allocate memory for SnapshotWriter::Private");
+    if (!d->output.good())
+        Error::warn("SnapshotWriter: Cannot write file '%s'", d->temporaryFilename.c_str());
+
+    /// Reserve space for the header, written by finish()
+    d->output.write((const char *)&d->header, sizeof(d->header));
+    d->padToAlignment();
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    if (d->output.is_open()) {
+        /// finish() was not called or failed
+        d->output.close();
+        unlink(d->temporaryFilename.c_str());
+    }
+    delete d;
+}
+
+std::ostream &SnapshotWriter::beginSection(Snapshot::SectionId id) {
+    d->endSection();
+    for (uint32_t i = 0; i < d->header.numSections; ++i)
+        if (d->header.sections[i].id == (uint32_t)id)
+            Error::err("SnapshotWriter: Section %d written twice", id);
+    if (d->header.numSections >= maxSections)
+        Error::err("SnapshotWriter: Too many sections");
+
+    SectionEntry &entry = d->header.sections[d->header.numSections++];
+    entry.id = id;
+    entry.offset = d->output.tellp();
+    d->inSection = true;
+    return d->output;
+}
+
+bool SnapshotWriter::finish() {
+    d->endSection();
+    d->output.seekp(0);
+    d->output.write((const char *)&d->header, sizeof(d->header));
+    d->output.close();
+    if (d->output.fail()) {
+        Error::warn("SnapshotWriter: Could not write file '%s'", d->temporaryFilename.c_str());
+        unlink(d->temporaryFilename.c_str());
+        return false;
+    }
+    if (rename(d->temporaryFilename.c_str(), d->filename.c_str()) != 0) {
+        Error::warn("SnapshotWriter: Could not rename '%s' to '%s': %s", d->temporaryFilename.c_str(), d->filename.c_str(), strerror(errno));
+        unlink(d->temporaryFilename.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,196 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "error.h"
+
+/**
+ * Read-only access to a snapshot file holding all data structures
+ * loaded at startup, mapped into memory as a whole.
+ *
+ * A snapshot starts with a header listing its sections, each section
+ * holding one data structure and starting at a page boundary. Trees
+ * store their elements in sections as flat arrays of fixed-size
+ * records, referring to each other by positions instead of pointers,
+ * and can be queried right where the arrays are mapped: loading a
+ * tree from a snapshot neither copies nor decompresses its elements.
+ * The operating system reads pages from disk when they are touched
+ * first, and processes mapping the same snapshot share these pages
+ * through the page cache.
+ *
+ * The only data structure that cannot be queried in place, Sweden,
+ * stores its regular serialization in a section and gets read from
+ * the mapped memory.
+ *
+ * All values are stored in the byte order of the machine writing the
+ * snapshot, which is assumed to be the one reading it.
+ */
+class Snapshot
+{
+public:
+    enum SectionId {Node2CoordSection = 1, WayNodesSection, RelMembersSection, NodeNamesSection, WayNamesSection, RelationNamesSection, SwedishTextTreeSection, SwedenSection, ManifestSection};
+
+    /**
+     * Reads values and arrays one after another from a section.
+     * Arrays are returned as pointers into the mapped memory. All
+     * reads are checked against the section's end: reading beyond
+     * it, as from a corrupt or truncated snapshot, throws a DataError.
+     */
+    class Section
+    {
+    public:
+        explicit Section(const char *_data = nullptr, size_t _length = 0)
+            : data(_data), length(_length), position(0) {
+            /// nothing
+        }
+
+        inline bool isValid() const {
+            return data != nullptr;
+        }
+
+        /**
+         * Map an array of n elements, to be read later by array<V>(..)
+         * as written by SnapshotWriter::writeArray(..).
+         * @param n number of elements in array
+         * @return pointer to first element inside mapped memory
+         */
+        template <class V>
+        const V *array(const size_t n) {
+            const size_t bytes = n * sizeof(V);
+            if (n > length / sizeof(V) || position + bytes > length)
+                throw DataError("Snapshot: Section too short for array of %llu elements of %d bytes at position %llu", (unsigned long long)n, (int)sizeof(V), (unsigned long long)position);
+            const V *result = (const V *)(data + position);
+            position += alignedSize(bytes);
+            if (position > length) position = length;
+            return result;
+        }
+
+        template <class V>
+        V value() {
+            return *array<V>(1);
+        }
+
+        /**
+         * The section's bytes not read yet, for example to
+         * deserialize a data structure from a stream.
+         */
+        inline const char *remainingData() const {
+            return data + position;
+        }
+        inline size_t remainingLength() const {
+            return length - position;
+        }
+
+    private:
+        const char *data;
+        size_t length;
+        size_t position;
+    };
+
+    /**
+     * Map a snapshot file into memory. If the file does not exist or
+     * is not a snapshot of the expected version, the snapshot is not
+     * valid and all sections are invalid.
+     * @param filename snapshot file to map
+     */
+    explicit Snapshot(const std::string &filename);
+    ~Snapshot();
+
+    bool isValid() const;
+
+    /**
+     * Locate a section.
+     * @param id section to locate
+     * @return section positioned at its start, invalid if the snapshot does not contain this section
+     */
+    Section section(SectionId id) const;
+
+    /**
+     * Number of bytes mapped, i.e. the size of the snapshot file.
+     */
+    size_t size() const;
+
+    /// Sections start at multiples of this many bytes
+    static const size_t sectionAlignment = 4096;
+
+    /// Arrays inside sections start at multiples of eight bytes
+    static inline size_t alignedSize(const size_t bytes) {
+        return (bytes + 7) & ~(size_t)7;
+    }
+
+private:
+    class Private;
+    Private *const d;
+};
+
+/**
+ * Writes a snapshot file to be mapped by Snapshot. The file is
+ * written under a temporary name and renamed once finish() has
+ * completed successfully, so that an incomplete snapshot never
+ * replaces a complete one.
+ */
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(const std::string &filename);
+    ~SnapshotWriter();
+
+    /**
+     * Start a new section, completing any previous one.
+     * @param id section to start, each id may be written only once
+     * @return stream to write the section's content to
+     */
+    std::ostream &beginSection(Snapshot::SectionId id);
+
+    /**
+     * Complete the last section, write the header listing all
+     * sections, and move the snapshot file to its final name.
+     * @return true if the file was written successfully
+     */
+    bool finish();
+
+    /**
+     * Write an array of n elements to be mapped by Snapshot::Section::array<V>(..),
+     * padding it to a multiple of eight bytes.
+     */
+    template <class V>
+    static void writeArray(std::ostream &output, const V *values, const size_t n) {
+        static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        const size_t bytes = n * sizeof(V);
+        output.write((const char *)values, bytes);
+        output.write(zeros, Snapshot::alignedSize(bytes) - bytes);
+    }
+
+    template <class V>
+    static void writeValue(std::ostream &output, const V &value) {
+        writeArray(output, &value, 1);
+    }
+
+private:
+    class Private;
+    Private *const d;
+};
+
+#endif // SNAPSHOT_H
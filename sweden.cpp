@@ -32,10 +32,14 @@
 #include <vector>
 #include <unordered_set>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
 #include "error.h"
 #include "globalobjects.h"
 #include "svgwriter.h"
 #include "helper.h"
+#include "threadpool.h"
 
 const double minlon = 4.4; ///< declared in 'global.h'
 const double minlat = 53.8; ///< declared in 'global.h'
@@ -145,7 +149,8 @@ public:
             input.read((char *)&str_len, sizeof(str_len));
             static const size_t buffer_len = 8192;
             static char buffer[buffer_len];
-            /// Assumption: str_len * sizeof(char) < 8192
+            if (str_len >= buffer_len)
+                throw DataError("AdministrativeRegion: Name of %d bytes is too long", str_len);
             input.read(buffer, str_len * sizeof(char));
             buffer[str_len] = '\0';
             region.name = std::string(buffer);
@@ -176,6 +181,14 @@ public:
         return output;
     }
 
+    std::vector<uint64_t> relationIds() const {
+        std::vector<uint64_t> result;
+        result.reserve(regions.size());
+        for (const Region &region : regions)
+            result.push_back(region.relationId);
+        return result;
+    }
+
     void insert(const std::string &name, int admin_level, uint64_t relationId) {
         const std::string internal_name = normalizeAdministrativeRegionName(name);
         Region region(internal_name, admin_level, relationId);
@@ -235,12 +248,28 @@ public:
     static const uint16_t terminator16bit;
     static const size_t terminatorSizeT;
 
+    /**
+     * Polygons of a relation, stored back-to-back in one flat array
+     * of coordinates: polygon i consists of coordinates ringStart[i]
+     * up to, but excluding, ringStart[i + 1]. Relations whose polygons
+     * could not be assembled have no polygons at all.
+     */
     struct Region {
-        std::vector<std::deque<Coord> > polygons;
+        std::vector<Coord> coords;
+        std::vector<uint32_t> ringStart;
         int minx, miny, maxx, maxy;
+
+        inline size_t numPolygons() const {
+            return ringStart.empty() ? 0 : ringStart.size() - 1;
+        }
     };
     std::map<int, uint64_t> scbcode_to_relationid, nuts3code_to_relationid;
+    /// Polygons of all SCB, NUTS3, and administrative regions, assembled
+    /// once by buildRegionPolygons() and not modified afterwards
     std::map<uint64_t, Region> relationId_to_polygons;
+    /// Polygons of other relations, assembled when first needed
+    std::map<uint64_t, Region> lazy_relationId_to_polygons;
+    boost::mutex lazyPolygonsMutex;
 
     static constexpr size_t european_len = 30, national_len = 500;
     static const size_t regional_outer_len, regional_inner_len;
@@ -376,39 +405,41 @@ public:
         return false;
     }
 
-    void buildPolygonForRelation(uint64_t relid) {
-        if (relationId_to_polygons.find(relid) != relationId_to_polygons.cend()) return;
+    Region buildPolygonForRelation(uint64_t relid) {
+        Region region;
+        region.minx = region.miny = INT_RANGE;
+        region.maxx = region.maxy = -1;
 
         int minx = INT_RANGE, miny = INT_RANGE, maxx = -1, maxy = -1;
-        RelationMem rel;
-        if (relMembers->retrieve(relid, rel) && rel.num_members > 0) {
+        const RelationMem *rel = relMembers->view(relid);
+        if (rel != nullptr && rel->num_members > 0) {
             std::vector<std::deque<Coord> > polygonlist;
 
             /// Keep track of which ways of a relation have already been added to one of the polygons
-            std::unique_ptr<bool[]> wayattached(new bool[rel.num_members]);
+            std::unique_ptr<bool[]> wayattached(new bool[rel->num_members]);
             uint32_t expected_outer_members = 0;
-            for (int i = rel.num_members - 1; i >= 0; --i) {
+            for (int i = rel->num_members - 1; i >= 0; --i) {
                 wayattached[i] = false; ///< initially, no way is added to any polygon
                 /// Compute how many ways are expected to describe the outer boundary of a polygon
-                if (rel.members[i].type == OSMElement::Way && (rel.member_flags[i] & RelationFlags::RoleInnerOuter) > 0) ++expected_outer_members;
+                if (rel->members[i].type == OSMElement::Way && (rel->member_flags[i] & RelationFlags::RoleInnerOuter) > 0) ++expected_outer_members;
             }
 
             uint32_t successful_additions = 0;
             /// 'wrap around' is neccessary, as multiple iterations over the set of ways
             /// may be required to identify all ways in the correct order for insertion
-            for (uint32_t wrap_around = 0; successful_additions < expected_outer_members && wrap_around < rel.num_members + 5; ++wrap_around)
-                for (uint32_t i = 0; i < rel.num_members && successful_additions < expected_outer_members; ++i) {
+            for (uint32_t wrap_around = 0; successful_additions < expected_outer_members && wrap_around < rel->num_members + 5; ++wrap_around)
+                for (uint32_t i = 0; i < rel->num_members && successful_additions < expected_outer_members; ++i) {
                     if (wayattached[i]) continue; ///< skip ways that got added in previous wrap_around iterations
-                    if (rel.members[i].type != OSMElement::Way) continue; ///< consider only ways as polygon boundaries
-                    if ((rel.member_flags[i] & RelationFlags::RoleInnerOuter) == 0) continue; ///< consider only members of role 'outer' or 'inner'
+                    if (rel->members[i].type != OSMElement::Way) continue; ///< consider only ways as polygon boundaries
+                    if ((rel->member_flags[i] & RelationFlags::RoleInnerOuter) == 0) continue; ///< consider only members of role 'outer' or 'inner'
 
-                    WayNodes wn;
-                    const uint64_t memid = rel.members[i].id;
-                    if (wayNodes->retrieve(memid, wn)) {
+                    const uint64_t memid = rel->members[i].id;
+                    const WayNodes *wn = wayNodes->view(memid);
+                    if (wn != nullptr) {
                         bool successfullyAdded = false;
                         for (std::vector<std::deque<Coord> >::iterator it = polygonlist.begin(); !successfullyAdded && it != polygonlist.end(); ++it) {
                             /// Test existing polygons if current way can be attached
-                            if (addWayToPolygon(wn, *it)) {
+                            if (addWayToPolygon(*wn, *it)) {
                                 successfullyAdded = true;
                             }
                         }
@@ -416,7 +447,7 @@ public:
                             /// No existing polygon was feasible to attach the way to,
                             /// so create a new polygon, add way, and add polygon to list of polygons
                             std::deque<Coord> polygon;
-                            if (addWayToPolygon(wn, polygon)) {
+                            if (addWayToPolygon(*wn, polygon)) {
                                 successfullyAdded = true;
                                 polygonlist.push_back(polygon);
                             }
@@ -430,8 +461,8 @@ public:
                             /// retrieve coordinates and record min/max coordinates
                             /// later used to determine bounding rectangle around polygons
                             Coord c;
-                            for (int i = wn.num_nodes - 1; i >= 0; --i)
-                                if (node2Coord->retrieve(wn.nodes[i], c)) {
+                            for (int i = wn->num_nodes - 1; i >= 0; --i)
+                                if (node2Coord->retrieve(wn->nodes[i], c)) {
                                     if (c.x < minx) minx = c.x;
                                     if (c.x > maxx) maxx = c.x;
                                     if (c.y < miny) miny = c.y;
@@ -508,30 +539,55 @@ public:
                     } else
                         Error::warn("Unexpectedly, the first and last element in polygon %d for relation %llu do not match", i, relid);
                 }
-                Region region;
-                region.polygons = polygonlist;
+                size_t numCoords = 0;
+                for (const std::deque<Coord> &polygon : polygonlist)
+                    numCoords += polygon.size();
+                region.coords.reserve(numCoords);
+                region.ringStart.reserve(polygonlist.size() + 1);
+                for (const std::deque<Coord> &polygon : polygonlist) {
+                    region.ringStart.push_back(region.coords.size());
+                    region.coords.insert(region.coords.end(), polygon.cbegin(), polygon.cend());
+                }
+                region.ringStart.push_back(region.coords.size());
                 region.minx = minx;
                 region.miny = miny;
                 region.maxx = maxx;
                 region.maxy = maxy;
-                relationId_to_polygons.insert(std::pair<uint64_t, Region>(relid, region));
             } else
                 Error::info("Could not insert relation %llu, not all ways found/known?", relid);
         }
+
+        return region;
+    }
+
+    /**
+     * Polygons of a relation. Unless assembled by buildRegionPolygons()
+     * or read from a file, they get assembled when first needed.
+     */
+    const Region &polygonsForRelation(uint64_t relid) {
+        const auto it = relationId_to_polygons.find(relid);
+        if (it != relationId_to_polygons.cend()) return it->second;
+
+        boost::lock_guard<boost::mutex> lock(lazyPolygonsMutex);
+        auto lazyIt = lazy_relationId_to_polygons.find(relid);
+        if (lazyIt == lazy_relationId_to_polygons.end())
+            lazyIt = lazy_relationId_to_polygons.insert(std::make_pair(relid, buildPolygonForRelation(relid))).first;
+        /// Elements of a std::map do not move when other elements are inserted
+        return lazyIt->second;
     }
 
     bool nodeInsideRelationRegion(const Coord &coord, uint64_t relationId) {
-        buildPolygonForRelation(relationId);
-        const Region &region = relationId_to_polygons.at(relationId);
+        const Region &region = polygonsForRelation(relationId);
 
         /// Quick check if node is outside rectangle that encloses all polygons,
         /// avoids costly operations further below
         if (coord.x < region.minx || coord.x > region.maxx || coord.y < region.miny || coord.y > region.maxy) return false;
 
         bool success = false;
-        for (const std::deque<Coord> &polygon : region.polygons) {
+        for (size_t p = 0; p < region.numPolygons(); ++p) {
             /// For a good explanation, see here: http://alienryderflex.com/polygon/
-            const size_t polyCorners = polygon.size();
+            const Coord *polygon = region.coords.data() + region.ringStart[p];
+            const size_t polyCorners = region.ringStart[p + 1] - region.ringStart[p];
             int j = polyCorners - 1;
             bool oddNodes = false;
 
@@ -569,16 +625,15 @@ public:
         for (auto itCRID = code_to_relationid.cbegin(); itCRID != code_to_relationid.cend(); ++itCRID) {
             const int &code = itCRID->first;
             const uint64_t &relId = itCRID->second;
-            buildPolygonForRelation(relId);
-            const Region &region = relationId_to_polygons[relId];
+            const Region &region = polygonsForRelation(relId);
 
             char buffer[maxStringLen];
             snprintf(buffer, maxStringLen, "area code: %i", code);
-            for (const std::deque<Coord> dequeCoord : region.polygons) {
+            for (size_t p = 0; p < region.numPolygons(); ++p) {
                 std::vector<int> x, y;
-                for (auto itC = dequeCoord.cbegin(); itC != dequeCoord.cend(); ++itC) {
-                    x.push_back(itC->x);
-                    y.push_back(itC->y);
+                for (uint32_t i = region.ringStart[p]; i < region.ringStart[p + 1]; ++i) {
+                    x.push_back(region.coords[i].x);
+                    y.push_back(region.coords[i].y);
                 }
                 svgWriter.drawPolygon(x, y, SvgWriter::BaseGroup, std::string(buffer));
             }
@@ -589,19 +644,25 @@ public:
         resultNodeId = 0;
         minSqDistance = INT64_MAX;
 
-        WayNodes wn;
-        if (wayNodes->retrieve(wayId, wn)) {
-            for (uint32_t i = 0; i < wn.num_nodes; ++i) {
-                Coord c;
-                if (node2Coord->retrieve(wn.nodes[i], c)) {
-                    const int64_t dX = c.x - x;
-                    const int64_t dY = c.y - y;
-                    const int64_t sqDist = dX * dX + dY * dY;
-                    if (sqDist < minSqDistance) {
-                        resultNodeId = wn.nodes[i];
-                        minSqDistance = sqDist;
+        const WayNodes *wn = wayNodes->view(wayId);
+        if (wn != nullptr) {
+            /// Retrieve coordinates in chunks to avoid heap allocations
+            static const uint32_t chunkSize = 64;
+            Coord coords[chunkSize];
+            bool found[chunkSize];
+            for (uint32_t start = 0; start < wn->num_nodes; start += chunkSize) {
+                const uint32_t count = std::min(chunkSize, wn->num_nodes - start);
+                node2Coord->retrieveMany(wn->nodes + start, count, coords, found);
+                for (uint32_t i = 0; i < count; ++i)
+                    if (found[i]) {
+                        const int64_t dX = coords[i].x - x;
+                        const int64_t dY = coords[i].y - y;
+                        const int64_t sqDist = dX * dX + dY * dY;
+                        if (sqDist < minSqDistance) {
+                            resultNodeId = wn->nodes[start + i];
+                            minSqDistance = sqDist;
+                        }
                     }
-                }
             }
         }
     }
@@ -707,6 +768,8 @@ Sweden::Sweden()
 Sweden::Sweden(std::istream &input)
     : d(new Sweden::Private())
 {
+    /// Frees 'd' if the input turns out to be inconsistent
+    std::unique_ptr<Private> ownPrivate(d);
     char chr = '\0';
     input.read((char *)&chr, sizeof(chr));
     if (chr == 'S') {
@@ -742,7 +805,7 @@ Sweden::Sweden(std::istream &input)
             size_t count;
             input.read((char *)&count, sizeof(count));
             if (count > reasonableLargeSizeT)
-                Error::err("Count %ld looks unrealistically large", count);
+                throw DataError("Count %ld looks unrealistically large", count);
             uint64_t wayid;
             for (size_t r = 0; r < count; ++r) {
                 input.read((char *)&wayid, sizeof(wayid));
@@ -756,13 +819,13 @@ Sweden::Sweden(std::istream &input)
     if (chr == 'R') {
         uint16_t road;
         input.read((char *)&road, sizeof(road));
-        if (road >= Sweden::Private::national_len)
-            Error::err("Road number %d is larger than Sweden::Private::national_len=%d", road, Sweden::Private::national_len);
+        if (road != Private::terminator16bit && road >= Sweden::Private::national_len)
+            throw DataError("Road number %d is larger than Sweden::Private::national_len=%d", road, Sweden::Private::national_len);
         while (road != Private::terminator16bit) {
             size_t count;
             input.read((char *)&count, sizeof(count));
             if (count > reasonableLargeSizeT)
-                Error::err("Count %ld looks unrealistically large", count);
+                throw DataError("Count %ld looks unrealistically large", count);
             uint64_t wayid;
             for (size_t r = 0; r < count; ++r) {
                 input.read((char *)&wayid, sizeof(wayid));
@@ -770,6 +833,8 @@ Sweden::Sweden(std::istream &input)
             }
 
             input.read((char *)&road, sizeof(road));
+            if (road != Private::terminator16bit && road >= Sweden::Private::national_len)
+                throw DataError("Road number %d is larger than Sweden::Private::national_len=%d", road, Sweden::Private::national_len);
         }
     } else
         Error::warn("Sweden: Expected 'R', got '0x%02x' at position %d", chr, input.tellg());
@@ -779,25 +844,25 @@ Sweden::Sweden(std::istream &input)
         size_t region;
         input.read((char *)&region, sizeof(region));
         if (region != Private::terminatorSizeT && region >= Sweden::Private::regional_len)
-            Error::err("Region %ld looks unrealistically large or is larger than Sweden::Private::regional_len=%d", region, Sweden::Private::regional_len);
+            throw DataError("Region %ld looks unrealistically large or is larger than Sweden::Private::regional_len=%d", region, Sweden::Private::regional_len);
         while (region != Private::terminatorSizeT) {
             d->roads.regional[region] = (std::vector<uint64_t> ** *)calloc(Private::regional_outer_len, sizeof(std::vector<uint64_t> **));
             size_t a;
             input.read((char *)&a, sizeof(a));
             if (a != Private::terminatorSizeT && a >= Sweden::Private::regional_outer_len)
-                Error::err("Variable a=%ld looks unrealistically large or is larger than Sweden::Private::regional_outer_len=%d", a, Sweden::Private::regional_outer_len);
+                throw DataError("Variable a=%ld looks unrealistically large or is larger than Sweden::Private::regional_outer_len=%d", a, Sweden::Private::regional_outer_len);
             while (a != Private::terminatorSizeT) {
                 d->roads.regional[region][a] = (std::vector<uint64_t> **)calloc(Private::regional_inner_len, sizeof(std::vector<uint64_t> *));
                 size_t b;
                 input.read((char *)&b, sizeof(b));
                 if (b != Private::terminatorSizeT && b >= Sweden::Private::regional_inner_len)
-                    Error::err("Variable b=%ld looks unrealistically large or is larger than Sweden::Private::regional_inner_len=%d", b, Sweden::Private::regional_inner_len);
+                    throw DataError("Variable b=%ld looks unrealistically large or is larger than Sweden::Private::regional_inner_len=%d", b, Sweden::Private::regional_inner_len);
                 while (b != Private::terminatorSizeT) {
                     d->roads.regional[region][a][b] = new std::vector<uint64_t>();
                     size_t count;
                     input.read((char *)&count, sizeof(count));
                     if (count > reasonableLargeSizeT)
-                        Error::err("Count %ld looks unrealistically large", count);
+                        throw DataError("Count %ld looks unrealistically large", count);
                     uint64_t wayid;
                     for (size_t r = 0; r < count; ++r) {
                         input.read((char *)&wayid, sizeof(wayid));
@@ -806,17 +871,17 @@ Sweden::Sweden(std::istream &input)
 
                     input.read((char *)&b, sizeof(b));
                     if (b != Private::terminatorSizeT && b >= Sweden::Private::regional_inner_len)
-                        Error::err("Variable b=%ld looks unrealistically large or is larger than Sweden::Private::regional_inner_len=%d", b, Sweden::Private::regional_inner_len);
+                        throw DataError("Variable b=%ld looks unrealistically large or is larger than Sweden::Private::regional_inner_len=%d", b, Sweden::Private::regional_inner_len);
                 }
 
                 input.read((char *)&a, sizeof(a));
                 if (a != Private::terminatorSizeT && a >= Sweden::Private::regional_outer_len)
-                    Error::err("Variable a=%ld looks unrealistically large or is larger than Sweden::Private::regional_outer_len=%d", a, Sweden::Private::regional_outer_len);
+                    throw DataError("Variable a=%ld looks unrealistically large or is larger than Sweden::Private::regional_outer_len=%d", a, Sweden::Private::regional_outer_len);
             }
 
             input.read((char *)&region, sizeof(region));
             if (region != Private::terminatorSizeT && region >= Sweden::Private::regional_len)
-                Error::err("Region %ld looks unrealistically large or is larger than Sweden::Private::regional_len=%d", region, Sweden::Private::regional_len);
+                throw DataError("Region %ld looks unrealistically large or is larger than Sweden::Private::regional_len=%d", region, Sweden::Private::regional_len);
         }
     } else
         Error::warn("Sweden: Expected 'L', got '0x%02x' at position %d", chr, input.tellg());
@@ -827,8 +892,47 @@ Sweden::Sweden(std::istream &input)
     d->administrativeRegion.read(input);
 
     input.read((char *)&chr, sizeof(chr));
+    if (chr == 'P') {
+        size_t num_elements;
+        input.read((char *)&num_elements, sizeof(num_elements));
+        if (num_elements > reasonableLargeSizeT)
+            throw DataError("Sweden: Number of region polygons looks unrealistically large: %d", num_elements);
+        for (size_t i = 0; i < num_elements; ++i) {
+            uint64_t relid;
+            input.read((char *)&relid, sizeof(relid));
+            Private::Region &region = d->relationId_to_polygons[relid];
+            input.read((char *)&region.minx, sizeof(region.minx));
+            input.read((char *)&region.miny, sizeof(region.miny));
+            input.read((char *)&region.maxx, sizeof(region.maxx));
+            input.read((char *)&region.maxy, sizeof(region.maxy));
+            size_t count;
+            input.read((char *)&count, sizeof(count));
+            if (!input || count > reasonableLargeSizeT)
+                throw DataError("Sweden: Number of polygons for relation %llu looks unrealistically large: %ld", relid, count);
+            region.ringStart.resize(count);
+            input.read((char *)region.ringStart.data(), count * sizeof(uint32_t));
+            input.read((char *)&count, sizeof(count));
+            if (!input || count > reasonableLargeSizeT)
+                throw DataError("Sweden: Number of polygon coordinates for relation %llu looks unrealistically large: %ld", relid, count);
+            region.coords.resize(count);
+            input.read((char *)region.coords.data(), count * sizeof(Coord));
+            if (!input)
+                throw DataError("Sweden: Could not read polygons for relation %llu", relid);
+
+            /// Polygons get looked up by ringStart, so its values must
+            /// start at 0, never decrease, and end at the last coordinate
+            if (region.ringStart.empty() ? !region.coords.empty() : region.ringStart.front() != 0 || region.ringStart.back() != region.coords.size())
+                throw DataError("Sweden: Polygons for relation %llu do not cover its %ld coordinates", relid, region.coords.size());
+            if (!std::is_sorted(region.ringStart.cbegin(), region.ringStart.cend()))
+                throw DataError("Sweden: Polygons for relation %llu do not start in ascending order", relid);
+        }
+        input.read((char *)&chr, sizeof(chr));
+    }
+    /// Data written by earlier versions has no 'P' section,
+    /// polygons get assembled when first needed then
     if (chr != '_')
         Error::warn("Sweden: Expected '_', got '0x%02x' at position %d", chr, input.tellg());
+    ownPrivate.release();
 }
 
 Sweden::~Sweden()
@@ -913,6 +1017,25 @@ std::ostream &Sweden::write(std::ostream &output) {
     output.write((char *)&chr, sizeof(chr));
     d->administrativeRegion.write(output);
 
+    chr = 'P';
+    output.write((char *)&chr, sizeof(chr));
+    num_elements = d->relationId_to_polygons.size();
+    output.write((char *)&num_elements, sizeof(num_elements));
+    for (auto it = d->relationId_to_polygons.cbegin(); it != d->relationId_to_polygons.cend(); ++it) {
+        const Private::Region &region = it->second;
+        output.write((char *) & (it->first), sizeof(uint64_t));
+        output.write((char *) &region.minx, sizeof(region.minx));
+        output.write((char *) &region.miny, sizeof(region.miny));
+        output.write((char *) &region.maxx, sizeof(region.maxx));
+        output.write((char *) &region.maxy, sizeof(region.maxy));
+        size_t count = region.ringStart.size();
+        output.write((char *) &count, sizeof(count));
+        output.write((char *) region.ringStart.data(), count * sizeof(uint32_t));
+        count = region.coords.size();
+        output.write((char *) &count, sizeof(count));
+        output.write((char *) region.coords.data(), count * sizeof(Coord));
+    }
+
     chr = '_';
     output.write((char *)&chr, sizeof(chr));
 
@@ -1325,7 +1448,6 @@ void Sweden::drawSCBareas(SvgWriter &svgWriter) {
 }
 
 void Sweden::drawRoads(SvgWriter &svgWriter) {
-    WayNodes wn;
     Coord c;
     std::vector<int> x, y;
     char buffer[maxStringLen];
@@ -1337,13 +1459,14 @@ void Sweden::drawRoads(SvgWriter &svgWriter) {
             x.clear();
             y.clear();
             const uint64_t wayid = d->roads.european[Private::europeanRoadNumberToIndex(d->EuropeanRoadNumbers[i])][r];
-            if (wayNodes->retrieve(wayid, wn)) {
-                for (uint32_t n = 0; n < wn.num_nodes; ++n)
-                    if (node2Coord->retrieve(wn.nodes[n], c)) {
+            const WayNodes *wn = wayNodes->view(wayid);
+            if (wn != nullptr) {
+                for (uint32_t n = 0; n < wn->num_nodes; ++n)
+                    if (node2Coord->retrieve(wn->nodes[n], c)) {
                         x.push_back(c.x);
                         y.push_back(c.y);
                     }
-                snprintf(buffer, maxStringLen, "E%d  segm %lu of %lu with %d nodes, way id %lu", d->EuropeanRoadNumbers[i], r, count, wn.num_nodes, wayid);
+                snprintf(buffer, maxStringLen, "E%d  segm %lu of %lu with %d nodes, way id %lu", d->EuropeanRoadNumbers[i], r, count, wn->num_nodes, wayid);
                 svgWriter.drawRoad(x, y, SvgWriter::RoadMajorImportance, std::string(buffer));
             }
         }
@@ -1354,15 +1477,16 @@ void Sweden::drawRoads(SvgWriter &svgWriter) {
         if (!d->roads.national[i].empty())
             for (int j = d->roads.national[i].size() - 1; j >= 0; --j) {
                 const uint64_t wayid = d->roads.national[i][j];
-                if (wayNodes->retrieve(wayid, wn)) {
+                const WayNodes *wn = wayNodes->view(wayid);
+                if (wn != nullptr) {
                     x.clear();
                     y.clear();
-                    for (uint32_t n = 0; n < wn.num_nodes; ++n)
-                        if (node2Coord->retrieve(wn.nodes[n], c)) {
+                    for (uint32_t n = 0; n < wn->num_nodes; ++n)
+                        if (node2Coord->retrieve(wn->nodes[n], c)) {
                             x.push_back(c.x);
                             y.push_back(c.y);
                         }
-                    snprintf(buffer, maxStringLen, "R%lu  segm %d of %lu with %d nodes, way id %lu", i, j, d->roads.national[i].size(), wn.num_nodes, wayid);
+                    snprintf(buffer, maxStringLen, "R%lu  segm %d of %lu with %d nodes, way id %lu", i, j, d->roads.national[i].size(), wn->num_nodes, wayid);
                     svgWriter.drawRoad(x, y, SvgWriter::RoadAvgImportance, std::string(buffer));
                 }
             }
@@ -1782,6 +1906,36 @@ std::vector<struct Sweden::Road> Sweden::identifyRoads(const std::vector<std::st
     return result;
 }
 
+void Sweden::buildRegionPolygons() {
+    std::vector<uint64_t> relationIds = d->administrativeRegion.relationIds();
+    for (auto it = d->scbcode_to_relationid.cbegin(); it != d->scbcode_to_relationid.cend(); ++it)
+        relationIds.push_back(it->second);
+    for (auto it = d->nuts3code_to_relationid.cbegin(); it != d->nuts3code_to_relationid.cend(); ++it)
+        relationIds.push_back(it->second);
+    std::sort(relationIds.begin(), relationIds.end());
+    relationIds.erase(std::unique(relationIds.begin(), relationIds.end()), relationIds.end());
+
+    /// Assembling a relation's polygons only reads the trees,
+    /// so different relations can be assembled in parallel
+    std::vector<Private::Region> regions(relationIds.size());
+    {
+        ThreadPool threadPool;
+        for (size_t i = 0; i < relationIds.size(); ++i)
+            threadPool.enqueue([this, &regions, &relationIds, i]() {
+                regions[i] = d->buildPolygonForRelation(relationIds[i]);
+            });
+    }
+
+    size_t numCoords = 0;
+    d->relationId_to_polygons.clear();
+    for (size_t i = 0; i < relationIds.size(); ++i) {
+        numCoords += regions[i].coords.size();
+        d->relationId_to_polygons[relationIds[i]] = std::move(regions[i]);
+    }
+    d->lazy_relationId_to_polygons.clear();
+    Error::info("Assembled polygons of %d regions with %d coordinates", relationIds.size(), numCoords);
+}
+
 void Sweden::fixUnlabeledRegionalRoads() {
     const int unknownLanIdx = (int)LanUnknown - 2;
     if (d->roads.regional[unknownLanIdx] != nullptr) {
@@ -1791,9 +1945,9 @@ void Sweden::fixUnlabeledRegionalRoads() {
                     if (d->roads.regional[unknownLanIdx][outer][inner] != nullptr) {
                         std::vector<uint64_t> *wayIds = d->roads.regional[unknownLanIdx][outer][inner];
                         for (auto it = wayIds->cbegin(); it != wayIds->cend();) {
-                            WayNodes wn;
-                            if (wayNodes->retrieve(*it, wn) && wn.num_nodes > 0) {
-                                const uint64_t pivotNodeId = wn.nodes[wn.num_nodes / 2];
+                            const WayNodes *wn = wayNodes->view(*it);
+                            if (wn != nullptr && wn->num_nodes > 0) {
+                                const uint64_t pivotNodeId = wn->nodes[wn->num_nodes / 2];
                                 const int scbArea = insideSCBarea(pivotNodeId, Sweden::LevelCounty);
                                 if (scbArea > 0) {
                                     const RoadType properLan = roadTypeForSCBarea(scbArea);
@@ -1869,7 +2023,7 @@ std::vector<struct OSMElement> Sweden::identifyPlaces(const std::vector<std::str
     memset(id_str, 0, maxlen);
     char *p = id_str;
     for (auto it = result.cbegin(); it != result.cend() && (size_t)(p - id_str) < maxlen; ++it)
-        p += snprintf(p, maxlen - (p - id_str), " %s (%s)", it->operator std::string().c_str(), it->name().c_str());
+        p += snprintf(p, maxlen - (p - id_str), " %s (%s)", it->operator std::string().c_str(), it->nameOrPlaceholder().c_str());
     Error::debug("Num of global places: %d  List of node ids:%s", result.size(), id_str);
 #endif
 
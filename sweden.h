@@ -161,6 +161,14 @@ public:
      */
     void fixUnlabeledRegionalRoads();
 
+    /**
+     * Assemble the polygons of all SCB areas, NUTS3 areas, and
+     * administrative regions from their relations' ways. The polygons
+     * get written by write(..), so that testing whether a location is
+     * inside a region does not need to assemble them on first use.
+     */
+    void buildRegionPolygons();
+
     /**
      * Process the provided list of word combination and see if there
      * are known places (cities, towns, hamlets, ...) referred to.
@@ -16,121 +16,237 @@
 
 #include "swedishtexttree.h"
 
+#include "bufferedreader.h"
 #include "tokenizer.h"
 #include "error.h"
 #include "helper.h"
 
-const size_t SwedishTextTree::num_codes = 48;
+const size_t SwedishTextTree::num_codes;
 const unsigned int SwedishTextTree::default_num_indices = 8;
 const int SwedishTextTree::code_word_sep = SwedishTextTree::num_codes - 2;
 const int SwedishTextTree::code_unknown = SwedishTextTree::num_codes - 1;
 
-SwedishTextNode::SwedishTextNode() {
-    children = nullptr;
+SwedishTextNode::SwedishTextNode()
+    : children(0) {
+    /// nothing
 }
 
-SwedishTextNode::SwedishTextNode(std::istream &input) {
-    char chr;
-
-    input.read((char *)&chr, sizeof(chr));
-    if (chr == 'N') {
-        children = nullptr;
-    } else if (chr == 'C') {
-        const size_t bytes = SwedishTextTree::num_codes * sizeof(SwedishTextNode *);
-        children = (SwedishTextNode **)malloc(bytes);
-
-        for (size_t i = 0; i < SwedishTextTree::num_codes; ++i) {
-            input.read((char *)&chr, sizeof(chr));
-            if (chr == '0') {
-                /// No child at this position
-                children[i] = nullptr;
-            } else if (chr == '1') {
-                children[i] = new SwedishTextNode(input);
-            } else
-                Error::err("SwedishTextNode: Expected '0' or '1', got '0x%02x' at position %d", chr, input.tellg());
+SwedishTextChildren::SwedishTextChildren() {
+    std::fill(node, node + SwedishTextTree::num_codes, 0);
+}
+
+
+SwedishTextTree::SwedishTextTree()
+    : flatNodes(nullptr), flatChildren(nullptr), flatElements(nullptr) {
+    root = nodes.allocate();
+    _size = 0;
+}
+
+SwedishTextTree::SwedishTextTree(std::istream &input)
+    : flatNodes(nullptr), flatChildren(nullptr), flatElements(nullptr) {
+    BufferedReader reader(input);
+    root = readTree(reader);
+    _size = 0;
+}
+
+SwedishTextTree::SwedishTextTree(Snapshot::Section &section)
+    : flatNodes(nullptr), flatChildren(nullptr), flatElements(nullptr) {
+    const uint64_t numNodes = section.value<uint64_t>();
+    const uint64_t numChildren = section.value<uint64_t>();
+    const uint64_t numElements = section.value<uint64_t>();
+    if (numNodes == 0 || numNodes > UINT32_MAX || numChildren == 0 || numChildren > UINT32_MAX / num_codes)
+        throw DataError("SwedishTextTree: Inconsistent tree in snapshot");
+    const FlatNode *mappedNodes = section.array<FlatNode>(numNodes);
+    const uint32_t *mappedChildren = section.array<uint32_t>(numChildren * num_codes);
+    flatElements = section.array<OSMElement>(numElements);
+
+    /// Check that all nodes refer to entries inside the snapshot
+    for (size_t i = 0; i < numNodes; ++i)
+        if (mappedNodes[i].children >= numChildren || mappedNodes[i].firstElement > numElements || mappedNodes[i].numElements > numElements - mappedNodes[i].firstElement)
+            throw DataError("SwedishTextTree: Node %llu in snapshot is inconsistent", (unsigned long long)i);
+    for (size_t i = num_codes; i < numChildren * num_codes; ++i)
+        if (mappedChildren[i] >= numNodes)
+            throw DataError("SwedishTextTree: Child %llu in snapshot is outside of tree", (unsigned long long)i);
+    flatNodes = mappedNodes;
+    flatChildren = mappedChildren;
+    root = 0;
+    _size = numElements;
+}
+
+SwedishTextTree::~SwedishTextTree() {
+    Error::debug("SwedishTextTree had %d elements", size());
+}
+
+std::ostream &SwedishTextTree::write(std::ostream &output) {
+    writeNode(output, root);
+    return output;
+}
+
+void SwedishTextTree::writeSnapshot(std::ostream &output) const {
+    /// Nodes in breadth-first order, the position in 'order' being
+    /// a node's index in the snapshot; children entry 0 is unused
+    std::vector<uint32_t> order(1, root);
+    uint64_t numChildren = 1, numElements = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const uint32_t childrenIndex = childrenOf(order[i]);
+        if (childrenIndex != 0) {
+            ++numChildren;
+            for (size_t code = 0; code < num_codes; ++code) {
+                const uint32_t child = childOf(childrenIndex, code);
+                if (child != 0) order.push_back(child);
+            }
         }
-    } else
-        Error::err("SwedishTextNode: Expected 'N' or 'C', got '0x%02x' at position %d", chr, input.tellg());
+        size_t count = 0;
+        elementsOf(order[i], count);
+        numElements += count;
+    }
+    if (order.size() > UINT32_MAX || numChildren > UINT32_MAX / num_codes)
+        Error::err("SwedishTextTree: Tree too large for snapshot");
+
+    SnapshotWriter::writeValue<uint64_t>(output, order.size());
+    SnapshotWriter::writeValue<uint64_t>(output, numChildren);
+    SnapshotWriter::writeValue<uint64_t>(output, numElements);
+
+    /// Arrays of 16-byte nodes and elements and of num_codes indices
+    /// are multiples of eight bytes, so that writing them piece by
+    /// piece gives the same padding as writing them as a whole
+    uint32_t nextChildren = 1;
+    uint64_t nextElement = 0;
+    for (const uint32_t cur : order) {
+        FlatNode flat;
+        flat.children = childrenOf(cur) != 0 ? nextChildren++ : 0;
+        size_t count = 0;
+        elementsOf(cur, count);
+        flat.numElements = count;
+        flat.firstElement = nextElement;
+        nextElement += count;
+        SnapshotWriter::writeValue(output, flat);
+    }
+
+    uint32_t block[num_codes];
+    std::fill(block, block + num_codes, 0);
+    SnapshotWriter::writeArray(output, block, num_codes);
+    /// Children get numbered in the order they were appended to 'order'
+    uint32_t nextNode = 1;
+    for (const uint32_t cur : order) {
+        const uint32_t childrenIndex = childrenOf(cur);
+        if (childrenIndex == 0) continue;
+        for (size_t code = 0; code < num_codes; ++code)
+            block[code] = childOf(childrenIndex, code) != 0 ? nextNode++ : 0;
+        SnapshotWriter::writeArray(output, block, num_codes);
+    }
+
+    for (const uint32_t cur : order) {
+        size_t count = 0;
+        const OSMElement *elements = elementsOf(cur, count);
+        SnapshotWriter::writeArray(output, elements, count);
+    }
+}
+
+uint32_t SwedishTextTree::childrenOf(const uint32_t cur) const {
+    return flatNodes != nullptr ? flatNodes[cur].children : nodes[cur].children;
+}
+
+uint32_t SwedishTextTree::childOf(const uint32_t childrenIndex, const size_t code) const {
+    return flatNodes != nullptr ? flatChildren[(size_t)childrenIndex * num_codes + code] : children[childrenIndex].node[code];
+}
+
+const OSMElement *SwedishTextTree::elementsOf(const uint32_t cur, size_t &count) const {
+    if (flatNodes != nullptr) {
+        count = flatNodes[cur].numElements;
+        return flatElements + flatNodes[cur].firstElement;
+    }
+    const std::vector<OSMElement> &elements = nodes[cur].elements;
+    count = elements.size();
+    return elements.data();
+}
+
+uint32_t SwedishTextTree::readTree(BufferedReader &reader) {
+    /// Pairs of node whose children are being read and code of next child
+    std::vector<std::pair<uint32_t, size_t> > stack;
+    const uint32_t result = nodes.allocate();
+    uint32_t cur = result;
+    while (true) {
+        const int chr = reader.next();
+        if (chr == 'N')
+            /// Node without children
+            readElements(reader, cur);
+        else if (chr == 'C') {
+            nodes[cur].children = children.allocate();
+            stack.push_back(std::make_pair(cur, 0));
+        } else
+            Error::err("SwedishTextNode: Expected 'N' or 'C', got '0x%02x' at position %llu", chr, reader.position());
+
+        /// Find next child present, completing all nodes whose children have been read
+        while (true) {
+            if (stack.empty()) return result;
+            std::pair<uint32_t, size_t> &frame = stack.back();
+            if (frame.second == num_codes) {
+                /// Elements follow a node's children
+                readElements(reader, frame.first);
+                stack.pop_back();
+                continue;
+            }
+            const size_t code = frame.second++;
+            const int marker = reader.next();
+            if (marker == '1') {
+                cur = nodes.allocate();
+                children[nodes[frame.first].children].node[code] = cur;
+                break;
+            } else if (marker != '0')
+                Error::err("SwedishTextNode: Expected '0' or '1', got '0x%02x' at position %llu", marker, reader.position());
+        }
+    }
+}
 
-    input.read((char *)&chr, sizeof(chr));
-    elements.clear();
+void SwedishTextTree::readElements(BufferedReader &reader, const uint32_t cur) {
+    const int chr = reader.next();
+    std::vector<OSMElement> &elements = nodes[cur].elements;
     if (chr == 'n') {
         /// No elements to process
     } else if (chr == 'i') {
         size_t count = 0;
-        input.read((char *)&count, sizeof(count));
-        for (size_t i = 0; i < count; ++i) {
-            OSMElement element;
-            input.read((char *)&element, sizeof(OSMElement));
-            elements.push_back(element);
-        }
+        reader.read(count);
+        elements.resize(count);
+        if (!reader.read(elements.data(), count * sizeof(OSMElement)))
+            Error::err("SwedishTextNode: Could not read %d elements at position %llu", count, reader.position());
     } else
-        Error::err("SwedishTextNode: Expected 'n' or 'i', got '0x%02x' at position %d", chr, input.tellg());
-}
-
-SwedishTextNode::~SwedishTextNode() {
-    if (children != nullptr) {
-        for (size_t i = 0; i < SwedishTextTree::num_codes; ++i)
-            if (children[i] != nullptr) delete children[i];
-        free(children);
-    }
+        Error::err("SwedishTextNode: Expected 'n' or 'i', got '0x%02x' at position %llu", chr, reader.position());
 }
 
-std::ostream &SwedishTextNode::write(std::ostream &output) {
+void SwedishTextTree::writeNode(std::ostream &output, const uint32_t cur) const {
+    const uint32_t childrenIndex = childrenOf(cur);
     char chr = '\0';
-    if (children == nullptr) {
+    if (childrenIndex == 0) {
         chr = 'N';
         output.write((char *)&chr, sizeof(chr));
     } else {
         chr = 'C';
         output.write((char *)&chr, sizeof(chr));
-        for (size_t i = 0; i < SwedishTextTree::num_codes; ++i) {
-            if (children[i] == nullptr) {
+        for (size_t i = 0; i < num_codes; ++i) {
+            const uint32_t child = childOf(childrenIndex, i);
+            if (child == 0) {
                 chr = '0';
                 output.write((char *)&chr, sizeof(chr));
             } else {
                 chr = '1';
                 output.write((char *)&chr, sizeof(chr));
-                children[i]->write(output);
+                writeNode(output, child);
             }
         }
     }
 
-    if (elements.empty()) {
+    size_t count = 0;
+    const OSMElement *elements = elementsOf(cur, count);
+    if (count == 0) {
         chr = 'n';
         output.write((char *)&chr, sizeof(chr));
     } else {
         chr = 'i';
         output.write((char *)&chr, sizeof(chr));
-        const size_t count = elements.size();
         output.write((char *)&count, sizeof(count));
-        for (size_t i = 0; i < count; ++i) {
-            const OSMElement &element = elements[i];
-            output.write((char *)&element, sizeof(OSMElement));
-        }
+        output.write((const char *)elements, count * sizeof(OSMElement));
     }
-
-    return output;
-}
-
-
-SwedishTextTree::SwedishTextTree() {
-    root = new SwedishTextNode();
-    _size = 0;
-}
-
-SwedishTextTree::SwedishTextTree(std::istream &input) {
-    root = new SwedishTextNode(input);
-    _size = 0;
-}
-
-SwedishTextTree::~SwedishTextTree() {
-    Error::debug("SwedishTextTree had %d elements", size());
-    delete root;
-}
-
-std::ostream &SwedishTextTree::write(std::ostream &output) {
-    return root->write(output);
 }
 
 bool SwedishTextTree::insert(const std::string &input, const OSMElement &element) {
@@ -166,34 +282,31 @@ bool SwedishTextTree::insert(const std::string &input, const OSMElement &element
 }
 
 bool SwedishTextTree::internal_insert(const char *word, const OSMElement &element) {
+    if (flatNodes != nullptr)
+        Error::err("SwedishTextTree: Cannot insert into a tree inside a snapshot");
+
     const code_word &code = to_code_word(word);
     if (code.empty())
         return false;
 
-    SwedishTextNode *cur = root;
+    uint32_t cur = root;
     unsigned int pos = 0;
     while (pos < code.size()) {
         const unsigned int nc = code[pos];
-        if (cur->children == nullptr) {
-            cur->children = (SwedishTextNode **)calloc(num_codes, sizeof(SwedishTextNode *));
-            if (cur->children == nullptr) {
-                Error::err("Could not allocate memory for cur->children");
-                return false;
-            }
+        if (nodes[cur].children == 0) {
+            const uint32_t childrenIndex = children.allocate();
+            nodes[cur].children = childrenIndex;
         }
-        SwedishTextNode *next = cur->children[nc];
-        if (next == nullptr) {
-            next = cur->children[nc] = new SwedishTextNode();
-            if (next == nullptr) {
-                Error::err("Could not allocate memory for next Node");
-                return false;
-            }
+        uint32_t next = children[nodes[cur].children].node[nc];
+        if (next == 0) {
+            next = nodes.allocate();
+            children[nodes[cur].children].node[nc] = next;
         }
         ++pos;
         cur = next;
     }
 
-    cur->elements.push_back(element);
+    nodes[cur].elements.push_back(element);
     ++_size;
 
     return true;
@@ -203,18 +316,19 @@ std::vector<OSMElement> SwedishTextTree::retrieve(const char *word, Warnings war
     const code_word &code = to_code_word(word);
     std::vector<OSMElement> result;
 
-    SwedishTextNode *cur = root;
+    uint32_t cur = root;
     unsigned int pos = 0;
     while (pos < code.size()) {
-        if (cur->children == nullptr) {
+        const uint32_t childrenIndex = childrenOf(cur);
+        if (childrenIndex == 0) {
 #ifdef DEBUG
             if (warnings & WarningWordNotInTree)
                 Error::debug("SwedishTextTree node has no children to follow for word %s at position %d", word, pos);
 #endif // DEBUG
             return result; ///< empty
         }
-        SwedishTextNode *next = cur->children[code[pos]];
-        if (next == nullptr) {
+        const uint32_t next = childOf(childrenIndex, code[pos]);
+        if (next == 0) {
 #ifdef DEBUG
             if (warnings & WarningWordNotInTree)
                 Error::debug("SwedishTextTree node has no children to follow for word %s at position %d for code %d", word, pos, code[pos]);
@@ -225,9 +339,9 @@ std::vector<OSMElement> SwedishTextTree::retrieve(const char *word, Warnings war
         cur = next;
     }
 
-    if (cur == nullptr)
-        return result; ///< empty
-    if (cur->elements.empty()) {
+    size_t count = 0;
+    const OSMElement *elements = elementsOf(cur, count);
+    if (count == 0) {
 #ifdef DEBUG
         if (warnings & WarningWordNotInTree)
             Error::debug("SwedishTextTree did not find valid leaf for word %s", word);
@@ -235,20 +349,23 @@ std::vector<OSMElement> SwedishTextTree::retrieve(const char *word, Warnings war
         return result; ///< empty
     }
 
-    std::copy(cur->elements.cbegin(), cur->elements.cend(), std::back_inserter(result));
+    result.assign(elements, elements + count);
 
     return result;
 }
 
-size_t SwedishTextTree::compute_size(const SwedishTextNode *cur) const {
+size_t SwedishTextTree::compute_size(const uint32_t cur) const {
     size_t result = 0;
 
-    if (cur->children != nullptr)
+    const uint32_t childrenIndex = childrenOf(cur);
+    if (childrenIndex != 0)
         for (size_t i = 0; i < num_codes; ++i)
-            if (cur->children[i] != nullptr)
-                result += compute_size(cur->children[i]);
+            if (childOf(childrenIndex, i) != 0)
+                result += compute_size(childOf(childrenIndex, i));
 
-    result += cur->elements.size();
+    size_t count = 0;
+    elementsOf(cur, count);
+    result += count;
 
     return result;
 }
@@ -23,14 +23,24 @@
 #include <google/protobuf/stubs/common.h>
 
 #include "types.h"
+#include "slab.h"
+#include "snapshot.h"
 
+class BufferedReader;
 struct SwedishTextNode;
+struct SwedishTextChildren;
 
 class SwedishTextTree {
 public:
     enum Warnings {NoWarnings = 0, WarningWordNotInTree = 1, WarningsAll = 0x0fffffff};
     explicit SwedishTextTree();
     explicit SwedishTextTree(std::istream &input);
+    /**
+     * Use a tree as written by writeSnapshot(..) without copying it.
+     * Such a tree cannot be inserted into.
+     * @param section section positioned at the tree, the snapshot has to outlive this tree
+     */
+    explicit SwedishTextTree(Snapshot::Section &section);
     ~SwedishTextTree();
 
     bool insert(const std::string &input, const OSMElement &element);
@@ -40,7 +50,13 @@ public:
 
     std::ostream &write(std::ostream &output);
 
-    static const size_t num_codes;
+    /**
+     * Write this tree to a snapshot section as flat arrays of nodes,
+     * children, and elements, see SwedishTextTree(Snapshot::Section &).
+     */
+    void writeSnapshot(std::ostream &output) const;
+
+    static const size_t num_codes = 48;
     static const unsigned int default_num_indices;
 
 private:
@@ -48,11 +64,43 @@ private:
     static const int code_word_sep;
     static const int code_unknown;
 
-    SwedishTextNode *root;
+    /// All nodes of this tree and their children, referred to by index
+    Slab<SwedishTextNode> nodes;
+    Slab<SwedishTextChildren> children;
+    /// Index of root node in 'nodes'
+    uint32_t root;
     size_t _size;
 
+    /// Node of a tree inside a memory-mapped snapshot
+    struct FlatNode {
+        /// Index of this node's children in 'flatChildren', 0 if none
+        uint32_t children;
+        uint32_t numElements;
+        /// Index of this node's first element in 'flatElements'
+        uint64_t firstElement;
+    };
+    /// Point into a memory-mapped snapshot, nullptr for trees built in
+    /// memory. Node 0 is the root, 'flatChildren' holds num_codes node
+    /// indices for each node with children, starting at index 1.
+    const FlatNode *flatNodes;
+    const uint32_t *flatChildren;
+    const OSMElement *flatElements;
+
+    /// Access nodes the same way whether in slabs or in a snapshot
+    uint32_t childrenOf(const uint32_t cur) const;
+    uint32_t childOf(const uint32_t childrenIndex, const size_t code) const;
+    const OSMElement *elementsOf(const uint32_t cur, size_t &count) const;
+
     bool internal_insert(const char *word, const OSMElement &element);
-    size_t compute_size(const SwedishTextNode *cur) const;
+    size_t compute_size(const uint32_t cur) const;
+
+    /**
+     * Read a tree as written by writeNode(..) without recursion.
+     * @return index of root node
+     */
+    uint32_t readTree(BufferedReader &reader);
+    void readElements(BufferedReader &reader, const uint32_t cur);
+    void writeNode(std::ostream &output, const uint32_t cur) const;
 
     code_word to_code_word(const char *word) const;
     unsigned int code_char(const unsigned char &prev_c, const unsigned char &c) const;
@@ -60,13 +108,22 @@ private:
 
 struct SwedishTextNode {
     explicit SwedishTextNode();
-    explicit SwedishTextNode(std::istream &input);
-    ~SwedishTextNode();
-
-    std::ostream &write(std::ostream &output);
 
-    SwedishTextNode **children;
+    /// Index of this node's children in the tree's slab of
+    /// children, 0 if this node has no children
+    uint32_t children;
     std::vector<OSMElement> elements;
 };
 
+/**
+ * Children of a SwedishTextNode, one for each code
+ * as returned by SwedishTextTree::code_char(..).
+ */
+struct SwedishTextChildren {
+    explicit SwedishTextChildren();
+
+    /// Index of child node in the tree's slab of nodes, 0 if no child
+    uint32_t node[SwedishTextTree::num_codes];
+};
+
 #endif // SWEDISHTEXTTREE_H
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "taskgraph.h"
+
+#include <exception>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "threadpool.h"
+#include "timer.h"
+#include "error.h"
+
+class TaskGraph::Private
+{
+public:
+    struct Task {
+        std::string name;
+        std::function<void()> function;
+        std::vector<TaskId> dependents;
+        size_t numDependencies;
+        /// Dependencies not done yet while running
+        size_t numPending;
+    };
+
+    const unsigned int numThreads;
+    std::vector<Task> tasks;
+
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    ThreadPool *pool;
+    size_t numRunning;
+    std::exception_ptr failure;
+
+    Private(unsigned int _numThreads)
+        : numThreads(_numThreads), pool(nullptr), numRunning(0) {
+        /// nothing
+    }
+
+    /**
+     * Hand a task to the pool. Requires the mutex to be locked.
+     */
+    void start(const TaskId id) {
+        ++numRunning;
+        pool->enqueue([this, id]() {
+            execute(id);
+        });
+    }
+
+    void execute(const TaskId id) {
+        Task &task = tasks[id];
+        Timer timer;
+        std::exception_ptr exception;
+        try {
+            task.function();
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        int64_t cputime, walltime;
+        timer.elapsed(&cputime, &walltime);
+        Error::debug("Task '%s' done after %.1fms wall time", task.name.c_str(), walltime / 1000.0);
+
+        boost::mutex::scoped_lock lock(mutex);
+        if (exception && !failure)
+            failure = exception;
+        if (!failure)
+            for (const TaskId dependent : task.dependents)
+                if (--tasks[dependent].numPending == 0)
+                    start(dependent);
+        --numRunning;
+        condition.notify_all();
+    }
+};
+
+TaskGraph::TaskGraph(unsigned int _numThreads)
+    : d(new Private(_numThreads))
+{
+    if (d == nullptr)
+        Error::err("Could not allocate memory for TaskGraph::Private");
+}
+
+TaskGraph::~TaskGraph()
+{
+    delete d;
+}
+
+TaskGraph::TaskId TaskGraph::add(const std::string &name, const std::function<void()> &function, const std::vector<TaskId> &dependencies) {
+    const TaskId id = d->tasks.size();
+    for (const TaskId dependency : dependencies) {
+        if (dependency >= id)
+            Error::err("TaskGraph: Task '%s' depends on unknown task %d", name.c_str(), dependency);
+        d->tasks[dependency].dependents.push_back(id);
+    }
+
+    Private::Task task;
+    task.name = name;
+    task.function = function;
+    task.numDependencies = dependencies.size();
+    task.numPending = 0;
+    d->tasks.push_back(task);
+    return id;
+}
+
+void TaskGraph::run() {
+    if (d->tasks.empty()) return;
+
+    ThreadPool pool(d->numThreads);
+    {
+        boost::mutex::scoped_lock lock(d->mutex);
+        d->pool = &pool;
+        d->failure = nullptr;
+        for (Private::Task &task : d->tasks)
+            task.numPending = task.numDependencies;
+        for (TaskId id = 0; id < d->tasks.size(); ++id)
+            if (d->tasks[id].numDependencies == 0)
+                d->start(id);
+        while (d->numRunning > 0)
+            d->condition.wait(lock);
+        d->pool = nullptr;
+    }
+
+    if (d->failure)
+        std::rethrow_exception(d->failure);
+}
@@ -0,0 +1,63 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Runs a set of tasks on a bounded pool of threads, each task as
+ * soon as all tasks it depends on are done. Dependencies can only
+ * refer to tasks added before, so the graph is free of cycles.
+ *
+ * If a task throws an exception, no further tasks get started and
+ * run() rethrows the first exception once all running tasks are done.
+ */
+class TaskGraph
+{
+public:
+    typedef size_t TaskId;
+
+    /**
+     * @param _numThreads maximum number of tasks running at the same time, 0 for one per core
+     */
+    explicit TaskGraph(unsigned int _numThreads = 0);
+    ~TaskGraph();
+
+    /**
+     * Add a task to the graph.
+     * @param name name used in log messages
+     * @param function function to run
+     * @param dependencies tasks that have to be done before this task gets started
+     * @return identifier to use as dependency of other tasks
+     */
+    TaskId add(const std::string &name, const std::function<void()> &function, const std::vector<TaskId> &dependencies = std::vector<TaskId>());
+
+    /**
+     * Run all tasks and wait until they are done.
+     */
+    void run();
+
+private:
+    class Private;
+    Private *const d;
+};
+
+#endif // TASKGRAPH_H
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <deque>
+
+#include <boost/thread.hpp>
+
+#include "error.h"
+
+class ThreadPool::Private
+{
+public:
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    std::deque<std::function<void()> > tasks;
+    bool stopping;
+    boost::thread_group threads;
+    unsigned int numThreads;
+
+    Private()
+        : stopping(false), numThreads(0) {
+        /// nothing
+    }
+
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                boost::mutex::scoped_lock lock(mutex);
+                while (tasks.empty() && !stopping)
+                    condition.wait(lock);
+                if (tasks.empty()) return; ///< stopping and nothing left to do
+                task.swap(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+ThreadPool::ThreadPool(unsigned int _numThreads)
+    : d(new Private())
+{
+    if (d == nullptr)
+        Error::err("Could not allocate memory for ThreadPool::Private");
+
+    d->numThreads = _numThreads > 0 ? _numThreads : std::max(1u, boost::thread::hardware_concurrency());
+    for (unsigned int i = 0; i < d->numThreads; ++i)
+        d->threads.create_thread([this]() {
+            d->run();
+        });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        boost::mutex::scoped_lock lock(d->mutex);
+        d->stopping = true;
+    }
+    d->condition.notify_all();
+    d->threads.join_all();
+    delete d;
+}
+
+void ThreadPool::enqueue(const std::function<void()> &task) {
+    {
+        boost::mutex::scoped_lock lock(d->mutex);
+        d->tasks.push_back(task);
+    }
+    d->condition.notify_one();
+}
+
+unsigned int ThreadPool::numThreads() const {
+    return d->numThreads;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+ *   Copyright (C) 2015-2016 by Thomas Fischer <thomas.fischer@his.se>     *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; version 3 of the License.               *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <functional>
+
+/**
+ * Fixed number of threads running tasks in the order they were
+ * enqueued. Tasks must not wait for other tasks of the same pool.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @param _numThreads number of threads, 0 for one per core
+     */
+    explicit ThreadPool(unsigned int _numThreads = 0);
+    /**
+     * Runs all tasks still enqueued, then stops the threads.
+     */
+    ~ThreadPool();
+
+    void enqueue(const std::function<void()> &task);
+
+    unsigned int numThreads() const;
+
+private:
+    class Private;
+    Private *const d;
+};
+
+#endif // THREADPOOL_H
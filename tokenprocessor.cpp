@@ -57,21 +57,21 @@ public:
             if (element.type == OSMElement::Node)
                 node_ids.insert(element.id);
             else if (element.type == OSMElement::Way) {
-                WayNodes wn;
-                if (wayNodes->retrieve(element.id, wn))
-                    for (size_t i = 0; i < wn.num_nodes; ++i)
-                        node_ids.insert(wn.nodes[i]);
+                const WayNodes *wn = wayNodes->view(element.id);
+                if (wn != nullptr)
+                    for (size_t i = 0; i < wn->num_nodes; ++i)
+                        node_ids.insert(wn->nodes[i]);
             } else if (element.type == OSMElement::Relation) {
-                RelationMem rm;
-                if (relMembers->retrieve(element.id, rm)) {
-                    for (size_t i = 0; i < rm.num_members; ++i)
-                        if (rm.members[i].type == OSMElement::Node)
-                            node_ids.insert(rm.members[i].id);
-                        else if (rm.members[i].type == OSMElement::Way) {
-                            WayNodes wn;
-                            if (wayNodes->retrieve(rm.members[i].id, wn))
-                                for (size_t i = 0; i < wn.num_nodes; ++i)
-                                    node_ids.insert(wn.nodes[i]);
+                const RelationMem *rm = relMembers->view(element.id);
+                if (rm != nullptr) {
+                    for (size_t i = 0; i < rm->num_members; ++i)
+                        if (rm->members[i].type == OSMElement::Node)
+                            node_ids.insert(rm->members[i].id);
+                        else if (rm->members[i].type == OSMElement::Way) {
+                            const WayNodes *wn = wayNodes->view(rm->members[i].id);
+                            if (wn != nullptr)
+                                for (size_t i = 0; i < wn->num_nodes; ++i)
+                                    node_ids.insert(wn->nodes[i]);
                         }
                 }
             }
@@ -89,6 +89,11 @@ public:
         int i = 0;
         for (auto it = node_ids.cbegin(); it != node_ids.cend(); ++it, ++i)
             node_id_array[i] = *it;
+        /// Each node's coordinates are needed several times below,
+        /// so retrieve all of them in one go
+        std::vector<Coord> coord_array(result.considered_nodes);
+        bool *coord_found = (bool *)calloc(result.considered_nodes, sizeof(bool));
+        node2Coord->retrieveMany(node_id_array, result.considered_nodes, coord_array.data(), coord_found);
 
         std::vector<int> distances;
         // TODO remove static const int very_few_nodes = 5;
@@ -102,14 +107,13 @@ public:
         int bestDistanceAverage = INT_MAX;
         for (size_t a = 0; a < result.considered_nodes; ++a) {
             size_t b = a;
-            Coord cA;
-            if (node2Coord->retrieve(node_id_array[a], cA)) {
+            if (coord_found[a]) {
+                const Coord &cA = coord_array[a];
                 int sumDistances = 0, countDistances = 0;
                 for (int s = 0; s < stepcount; ++s) {
                     b = (b + step) % result.considered_nodes;
-                    Coord cB;
-                    if (node2Coord->retrieve(node_id_array[b], cB)) {
-                        const int d = Coord::distanceLatLon(cA, cB);
+                    if (coord_found[b]) {
+                        const int d = Coord::distanceLatLon(cA, coord_array[b]);
                         if (a < b) ///< record each distance only once
                             distances.push_back(d);
                         sumDistances += d;
@@ -124,6 +128,7 @@ public:
                 }
             }
         }
+        free(coord_found);
         free(node_id_array);
         result.considered_distances = distances.size();
         if (result.considered_distances == 0) return InterIdEstimatedDistanceResult(); ///< too few distances computed
@@ -302,13 +307,16 @@ std::vector<struct TokenProcessor::LocalPlaceMatch> TokenProcessor::evaluateNear
          * 2. Prefer local places that are closer to their global places'
          *    location.
          */
-        std::string globalNameA = a.global.name(), globalNameB;
+        /// Names not known yet are treated like missing names
+        const char *nameA = a.global.name();
+        std::string globalNameA = nameA != nullptr ? nameA : "", globalNameB;
         utf8tolower(globalNameA);
         if (a.global.id == b.global.id)
             /// Avoid looking up same id twice
             globalNameB = globalNameA;
         else {
-            globalNameB = b.global.name();
+            const char *nameB = b.global.name();
+            globalNameB = nameB != nullptr ? nameB : "";
             utf8tolower(globalNameB);
         }
         /// std::string::find(..) will return the largest positive value for
@@ -348,7 +356,7 @@ std::vector<struct TokenProcessor::LocalPlaceMatch> TokenProcessor::evaluateNear
 
 #ifdef DEBUG
     for (const TokenProcessor::LocalPlaceMatch &npm : result)
-        Error::debug("Found %s (%s) near place %s (%s) with distance %.1fkm", npm.local.operator std::string().c_str(), npm.local.name().c_str(), npm.global.operator std::string().c_str(), npm.global.name().c_str(), npm.distance / 1000.0);
+        Error::debug("Found %s (%s) near place %s (%s) with distance %.1fkm", npm.local.operator std::string().c_str(), npm.local.nameOrPlaceholder().c_str(), npm.global.operator std::string().c_str(), npm.global.nameOrPlaceholder().c_str(), npm.distance / 1000.0);
 #endif
 
     return result;
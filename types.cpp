@@ -18,25 +18,35 @@
 
 #include "idtree.h"
 #include "globalobjects.h"
+#include "config.h"
 
-std::string OSMElement::name() const {
-    WriteableString result;
-    switch (type) {
-    case Node:
-        if (nodeNames->retrieve(id, result)) return result;
-        break;
-    case Way:
-        if (wayNames->retrieve(id, result)) return result;
-        break;
-    case Relation:
-        if (relationNames->retrieve(id, result)) return result;
-        break;
-    case UnknownElementType:
+const char *OSMElement::name() const {
+    if (type == UnknownElementType) {
         Error::warn("Cannot retrieve name for an unknown element type (id=%llu)", id);
-        break;
+        return "";
     }
 
-    return result;
+    const NameTree *tree = nameTree(type);
+    if (tree == nullptr)
+        /// Name tree not loaded (yet), callers may show a placeholder instead
+        return lazy_name_trees == LazyNameTreesPlaceholder ? nullptr : "";
+    const char *result = tree->retrieve(id);
+    return result == nullptr ? "" : result;
+}
+
+std::string OSMElement::nameOrPlaceholder() const {
+    const char *result = name();
+    if (result != nullptr)
+        return std::string(result);
+
+    /// Refer to element by its id instead
+    switch (type) {
+    case Node: return "node " + std::to_string(id);
+    case Way: return "way " + std::to_string(id);
+    case Relation: return "relation " + std::to_string(id);
+    case UnknownElementType: break;
+    }
+    return std::string();
 }
 
 OSMElement::operator std::string() const {
@@ -38,7 +38,21 @@ struct OSMElement {
         /// nothing
     }
 
-    std::string name() const;
+    /**
+     * Look up this element's name without copying it. If the name
+     * trees are loaded in the background and configured not to be
+     * waited for (see configuration option 'lazy_name_trees'), no
+     * name is known until this element's name tree is ready.
+     * @return element's name as stored in the name trees, an empty string if it has no name, or nullptr if its name tree is not ready yet
+     */
+    const char *name() const;
+
+    /**
+     * Element's name for display, see name(). While its name tree
+     * is not ready yet, a placeholder like 'node 123' is returned.
+     * @return element's name, a placeholder, or an empty string if it has no name
+     */
+    std::string nameOrPlaceholder() const;
 
     operator std::string() const;
 